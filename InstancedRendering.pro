@@ -33,6 +33,13 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # Turn off warnings about C++17 extensions because MyCLKernel will generate a LOT of them.
 QMAKE_CXXFLAGS += -Wno-c++17-extensions
 
+# The CPU fluid backend uses SSE by default on x86-64. Its AVX path is only
+# compiled with -mavx, which `qmake CONFIG+=avx` adds (the binary then needs a
+# CPU with AVX).
+avx {
+    QMAKE_CXXFLAGS += -mavx
+}
+
 
 SOURCES += \
     src/grass.cpp \
@@ -46,7 +53,17 @@ SOURCES += \
     src/cl_interface/myclerrors.cpp \
     src/fluid2dsimulation.cpp \
     src/cl_interface/myclimage.cpp \
+    src/cl_interface/myclbuffer.cpp \
     src/fluid2dsimulationclprogram.cpp \
+    src/fluid2dsimulationbufferclprogram.cpp \
+    src/fluid2dpartitionedsolver.cpp \
+    src/fluid2dsimulationcpuprogram.cpp \
+    src/cputhreadpool.cpp \
+    src/fluid2densemble.cpp \
+    src/fluidstoragebenchmark.cpp \
+    src/fluid3dsimulation.cpp \
+    src/fluid3dsimulationclprogram.cpp \
+    src/cl_interface/myclimage3d.cpp \
     src/utilitiesclprogram.cpp \
     src/cl_interface/myclprogram.cpp \
     src/cl_interface/clniceties.cpp
@@ -62,8 +79,20 @@ HEADERS += \
     src/cl_interface/myclerrors.h \
     src/cl_interface/include_opencl.h \
     src/fluid2dsimulation.h \
+    src/fluid2dsimulationconfig.h \
     src/cl_interface/myclimage.h \
+    src/cl_interface/myclbuffer.h \
     src/fluid2dsimulationclprogram.h \
+    src/fluid2dsimulationbufferclprogram.h \
+    src/fluid2dpartitionedsolver.h \
+    src/fluid2dsimulationcpuprogram.h \
+    src/cputhreadpool.h \
+    src/fluid2densemble.h \
+    src/fluidstoragebenchmark.h \
+    src/fluid3dsimulation.h \
+    src/fluid3dsimulationconfig.h \
+    src/fluid3dsimulationclprogram.h \
+    src/cl_interface/myclimage3d.h \
     src/utilitiesclprogram.h \
     src/cl_interface/myclprogram.h \
     src/cl_interface/myclkernel.h \
@@ -19,6 +19,30 @@ void CLNiceties::ZeroImage(cl_command_queue queue, MyCLImage2D &zeroImage, MyCLW
         zeroImage.release(queue);
 }
 
+void CLNiceties::ZeroImage(cl_command_queue queue, MyCLImage3D &zeroImage)
+{
+    // Float images take a float4 fill color regardless of their channels.
+    const cl_float zero[4] = {0, 0, 0, 0};
+    const size_t origin[3] = {0, 0, 0};
+    const size_t region[3] = {zeroImage.width(), zeroImage.height(), zeroImage.depth()};
+
+    cl_int err = clEnqueueFillImage(queue, zeroImage.image(), zero, origin, region, 0, NULL, NULL);
+
+    if (err != CL_SUCCESS)
+        qDebug() << "Failed to zero a 3D image.";
+}
+
+void CLNiceties::ZeroBuffer(cl_command_queue queue, MyCLBuffer &zeroBuffer)
+{
+    const cl_float zero = 0;
+
+    cl_int err = clEnqueueFillBuffer(queue, zeroBuffer.buffer(), &zero, sizeof(zero),
+                                     0, zeroBuffer.size(), 0, NULL, NULL);
+
+    if (err != CL_SUCCESS)
+        qDebug() << "Failed to zero a buffer.";
+}
+
 void CLNiceties::ZeroMappedImage(MyCLImage2D &zeroImage)
 {
     Q_ASSERT(zeroImage.isMapped());
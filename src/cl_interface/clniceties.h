@@ -3,6 +3,8 @@
 
 #include "include_opencl.h"
 #include "myclimage.h"
+#include "myclimage3d.h"
+#include "myclbuffer.h"
 #include "myclwrapper.h"
 
 // TODO: Files should not depend on files higher up in the directory hierarchy.
@@ -43,6 +45,17 @@ public:
     /// \param wrapper      The device/context to use. If nullptr, uses the global context.
     static void ZeroImage(cl_command_queue queue, MyCLImage2D &zeroImage, MyCLWrapper *wrapper = nullptr);
 
+    /// \brief Fills the 3D image with zeros.
+    ///
+    /// Enqueues a fill of the whole image on the provided queue.
+    static void ZeroImage(cl_command_queue queue, MyCLImage3D &zeroImage);
+
+    /// \brief Fills the buffer with zeros.
+    ///
+    /// Enqueues a fill of the whole buffer on the provided queue. Unlike
+    /// ZeroImage(), this works on devices without image support.
+    static void ZeroBuffer(cl_command_queue queue, MyCLBuffer &zeroBuffer);
+
     /// \brief Fills the image with zeros, assuming it is mapped.
     static void ZeroMappedImage(MyCLImage2D &zeroImage);
 
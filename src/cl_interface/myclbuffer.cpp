@@ -0,0 +1,82 @@
+#include "myclbuffer.h"
+
+#include "myclerrors.h"
+
+#include <QDebug>
+
+MyCLBuffer::MyCLBuffer()
+    : mCreated(false),
+      mSize(0)
+{
+}
+
+MyCLBuffer::~MyCLBuffer()
+{
+    destroy();
+}
+
+bool MyCLBuffer::create(cl_context context, size_t sizeInBytes, cl_mem_flags flags)
+{
+    Q_ASSERT( !mCreated );
+
+    cl_int err;
+    mBuffer = clCreateBuffer(context, flags, sizeInBytes, NULL, &err);
+
+    if (err != CL_SUCCESS)
+    {
+        qDebug() << QString::fromStdString(parseCreateBufferError(err));
+        return false;
+    }
+
+    mSize = sizeInBytes;
+    mCreated = true;
+    return true;
+}
+
+void MyCLBuffer::destroy()
+{
+    if (mCreated)
+    {
+        clReleaseMemObject(mBuffer);
+        mCreated = false;
+    }
+}
+
+const cl_mem &MyCLBuffer::buffer() const
+{
+    Q_ASSERT( mCreated );
+    return mBuffer;
+}
+
+bool MyCLBuffer::read(cl_command_queue queue, void *dest, size_t bytes, bool blocking, cl_event *event)
+{
+    Q_ASSERT( mCreated );
+    Q_ASSERT( bytes <= mSize );
+    Q_ASSERT( blocking || event != nullptr );
+
+    cl_int err = clEnqueueReadBuffer(queue, mBuffer, blocking ? CL_TRUE : CL_FALSE, 0, bytes, dest, 0, NULL, event);
+
+    if (err != CL_SUCCESS)
+    {
+        qDebug() << QString::fromStdString(parseReadBufferError(err));
+        return false;
+    }
+
+    return true;
+}
+
+bool MyCLBuffer::write(cl_command_queue queue, const void *src, size_t bytes)
+{
+    Q_ASSERT( mCreated );
+    Q_ASSERT( bytes <= mSize );
+
+    cl_int err = clEnqueueWriteBuffer(queue, mBuffer, CL_TRUE, 0, bytes, src, 0, NULL, NULL);
+
+    if (err != CL_SUCCESS)
+    {
+        qDebug() << "Failed to write to buffer.";
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef MYCLBUFFER_H
+#define MYCLBUFFER_H
+
+#include "include_opencl.h"
+
+class MyCLBuffer
+{
+public:
+    MyCLBuffer();
+    ~MyCLBuffer();
+
+
+    /// Creates an uninitialized buffer of the given size in bytes.
+    bool create(cl_context context, size_t sizeInBytes, cl_mem_flags flags = CL_MEM_READ_WRITE);
+
+    /// Releases resources allocated in create().
+    void destroy();
+
+
+    /// Returns the associated cl_mem.
+    const cl_mem &buffer() const;
+
+    /// Returns the size of the buffer in bytes.
+    size_t size() const { return mSize; }
+
+    /// Returns true if the buffer has been created.
+    bool isCreated() const { return mCreated; }
+
+
+    /// Reads the first `bytes` bytes of the buffer into `dest`. If blocking is false,
+    /// `event` must be non-null and is set to an event that completes when the
+    /// read does; `dest` must stay valid until then.
+    bool read(cl_command_queue queue, void *dest, size_t bytes, bool blocking = true, cl_event *event = nullptr);
+
+    /// Writes `bytes` bytes from `src` to the start of the buffer. Blocks until
+    /// `src` may be reused.
+    bool write(cl_command_queue queue, const void *src, size_t bytes);
+
+private:
+    bool mCreated;
+
+    cl_mem mBuffer;
+    size_t mSize;
+};
+
+#endif // MYCLBUFFER_H
@@ -43,6 +43,42 @@ std::string parseCreateFromGLTextureError(cl_int err)
     }
 }
 
+std::string parseCreateBufferError(cl_int err)
+{
+    switch (err)
+    {
+    MYCLERRORS_ERROR_CASE(CL_SUCCESS);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_CONTEXT);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_VALUE);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_BUFFER_SIZE);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_HOST_PTR);
+    MYCLERRORS_ERROR_CASE(CL_MEM_OBJECT_ALLOCATION_FAILURE);
+    MYCLERRORS_ERROR_CASE(CL_OUT_OF_RESOURCES);
+    MYCLERRORS_ERROR_CASE(CL_OUT_OF_HOST_MEMORY);
+    default:
+        return "unknown";
+    }
+}
+
+std::string parseReadBufferError(cl_int err)
+{
+    switch (err)
+    {
+    MYCLERRORS_ERROR_CASE(CL_SUCCESS);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_COMMAND_QUEUE);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_CONTEXT);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_MEM_OBJECT);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_VALUE);
+    MYCLERRORS_ERROR_CASE(CL_INVALID_EVENT_WAIT_LIST);
+    MYCLERRORS_ERROR_CASE(CL_MISALIGNED_SUB_BUFFER_OFFSET);
+    MYCLERRORS_ERROR_CASE(CL_MEM_OBJECT_ALLOCATION_FAILURE);
+    MYCLERRORS_ERROR_CASE(CL_OUT_OF_RESOURCES);
+    MYCLERRORS_ERROR_CASE(CL_OUT_OF_HOST_MEMORY);
+    default:
+        return "unknown";
+    }
+}
+
 std::string parseAcquireError(cl_int err) { return "TODO: Parse acquire error."; }
 std::string parseReleaseError(cl_int err) { return "TODO: Parse release error."; }
 std::string parseMapImageError(cl_int err) { return "TODO: Parse map image error."; }
@@ -8,6 +8,8 @@
 
 std::string parseCreateImageError(cl_int err);
 std::string parseCreateFromGLTextureError(cl_int err);
+std::string parseCreateBufferError(cl_int err);
+std::string parseReadBufferError(cl_int err);
 std::string parseAcquireError(cl_int err);
 std::string parseReleaseError(cl_int err);
 std::string parseMapImageError(cl_int err);
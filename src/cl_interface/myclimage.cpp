@@ -4,6 +4,53 @@
 
 #include <QDebug>
 
+#include <cstring>
+#include <vector>
+
+/// Converts to the nearest half-precision float, rounding ties away from zero.
+static cl_half floatToHalf(float f)
+{
+    cl_uint bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+
+    const cl_uint sign = (bits >> 16) & 0x8000;
+    const cl_uint floatExponent = (bits >> 23) & 0xff;
+    cl_uint mantissa = bits & 0x7fffff;
+
+    // Infinity and NaN.
+    if (floatExponent == 0xff)
+        return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+
+    const int exponent = int(floatExponent) - 127 + 15;
+
+    // Too large: infinity.
+    if (exponent >= 0x1f)
+        return sign | 0x7c00;
+
+    // Too small for a normal half: a subnormal or zero.
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return sign;
+
+        mantissa |= 0x800000;
+        const int shift = 14 - exponent;
+
+        cl_uint half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            half += 1;
+
+        return sign | half;
+    }
+
+    // A carry out of the mantissa correctly bumps the exponent.
+    cl_uint half = sign | (cl_uint(exponent) << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half += 1;
+
+    return half;
+}
+
 MyCLImage2D::MyCLImage2D()
     : mCreated(false),
       mFromGLTexture(false),
@@ -98,6 +145,30 @@ bool MyCLImage2D::createShared(cl_context context, const QOpenGLTexture &texture
     return true;
 }
 
+bool MyCLImage2D::isFormatSupported(cl_context context, cl_image_format format)
+{
+    cl_uint numFormats;
+    cl_int err = clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D,
+                                            0, NULL, &numFormats);
+    if (err != CL_SUCCESS)
+        return false;
+
+    std::vector<cl_image_format> formats(numFormats);
+    err = clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D,
+                                     numFormats, formats.data(), NULL);
+    if (err != CL_SUCCESS)
+        return false;
+
+    for (const cl_image_format &supported : formats)
+    {
+        if (supported.image_channel_order == format.image_channel_order &&
+            supported.image_channel_data_type == format.image_channel_data_type)
+            return true;
+    }
+
+    return false;
+}
+
 void MyCLImage2D::destroy()
 {
     if (mCreated)
@@ -235,28 +306,30 @@ bool MyCLImage2D::unmap(cl_command_queue queue)
 void MyCLImage2D::setf(size_t x, size_t y, float v1, float v2, float v3, float v4)
 {
     Q_ASSERT( mIsMapped );
-    Q_ASSERT( mFormat.image_channel_data_type == CL_FLOAT );
+    Q_ASSERT( mFormat.image_channel_data_type == CL_FLOAT ||
+              mFormat.image_channel_data_type == CL_HALF_FLOAT );
 
-    Q_ASSERT( componentSize() == sizeof(float) );
+    const float values[4] = {v1, v2, v3, v4};
 
-    // Pixel size in floats.
+    // Pixel size in components.
     size_t pixelSize = numComponents();
+    size_t offset = y * mWidth * pixelSize + x * pixelSize;
 
-    float *ptr = (float *)mMapPtr;
+    if (mFormat.image_channel_data_type == CL_FLOAT)
+    {
+        Q_ASSERT( componentSize() == sizeof(cl_float) );
 
-    switch (numComponents())
+        cl_float *ptr = (cl_float *)mMapPtr;
+        for (size_t i = 0; i < pixelSize; ++i)
+            ptr[offset + i] = values[i];
+    }
+    else
     {
-    case 4:
-        ptr[y * mWidth * pixelSize + x * pixelSize + 3] = v4;
-    case 3:
-        ptr[y * mWidth * pixelSize + x * pixelSize + 2] = v3;
-    case 2:
-        ptr[y * mWidth * pixelSize + x * pixelSize + 1] = v2;
-    case 1:
-        ptr[y * mWidth * pixelSize + x * pixelSize + 0] = v1;
-        break;
-    default:
-        qFatal("Unhandled component number in setf()");
+        Q_ASSERT( componentSize() == sizeof(cl_half) );
+
+        cl_half *ptr = (cl_half *)mMapPtr;
+        for (size_t i = 0; i < pixelSize; ++i)
+            ptr[offset + i] = floatToHalf(values[i]);
     }
 }
 
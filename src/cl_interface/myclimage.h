@@ -18,12 +18,18 @@ public:
     /// Creates the image with the specified width, height and format.
     bool create(cl_context context, size_t width, size_t height, cl_channel_order channelOrder, cl_channel_type channelType = CL_FLOAT);
 
-    /// Creates the OpenCL image to share storage with the OpenGL texture.
+    /// Creates the OpenCL image to share storage with the OpenGL texture. The
+    /// image's format follows the texture's, e.g. an RG16F texture gives a
+    /// CL_RG / CL_HALF_FLOAT image.
     bool createShared(cl_context context, const QOpenGLTexture &texture);
 
     /// Releases resources allocated in the create functions.
     void destroy();
 
+    /// Returns true if read-write 2D images with the given format can be
+    /// created in the context. Only the CL_RGBA formats are guaranteed.
+    static bool isFormatSupported(cl_context context, cl_image_format format);
+
 
     /// Returns the associated cl_image.
     const cl_image &image() const;
@@ -59,8 +65,8 @@ public:
     /// Sets a value in the image. The image must be mapped by calling map().
     /// x and y must be within the range defined by map().
     ///
-    /// This function asserts that the format is CL_FLOAT. Extra floating point
-    /// values are ignored.
+    /// This function asserts that the format is CL_FLOAT or CL_HALF_FLOAT. Extra
+    /// floating point values are ignored.
     void setf(size_t x, size_t y, float v1, float v2 = 0, float v3 = 0, float v4 = 0);
 
 
@@ -0,0 +1,133 @@
+#include "myclimage3d.h"
+
+#include "myclerrors.h"
+
+#include <QDebug>
+
+#include <vector>
+
+MyCLImage3D::MyCLImage3D()
+    : mCreated(false),
+      mWidth(0),
+      mHeight(0),
+      mDepth(0)
+{
+
+}
+
+MyCLImage3D::~MyCLImage3D()
+{
+    destroy();
+}
+
+bool MyCLImage3D::create(cl_context context, size_t width, size_t height, size_t depth, cl_image_format format)
+{
+    cl_image_desc desc;
+    desc.image_type = CL_MEM_OBJECT_IMAGE3D;
+    desc.image_array_size = 1;
+    desc.image_row_pitch = 0;
+    desc.image_slice_pitch = 0;
+    desc.num_mip_levels = 0;
+    desc.num_samples = 0;
+    desc.buffer = NULL;
+
+    desc.image_width = width;
+    desc.image_height = height;
+    desc.image_depth = depth;
+
+    cl_int err;
+    mImage = clCreateImage(context,
+                           CL_MEM_READ_WRITE,
+                           &format,
+                           &desc,
+                           NULL,
+                           &err);
+
+    if (err != CL_SUCCESS)
+    {
+        qDebug() << QString::fromStdString(parseCreateImageError(err));
+        return false;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mDepth = depth;
+    mFormat = format;
+    mContext = context;
+    mCreated = true;
+
+    return true;
+}
+
+bool MyCLImage3D::create(cl_context context, size_t width, size_t height, size_t depth,
+                         cl_channel_order channelOrder, cl_channel_type channelType)
+{
+    cl_image_format format;
+    format.image_channel_data_type = channelType;
+    format.image_channel_order = channelOrder;
+
+    return create(context, width, height, depth, format);
+}
+
+void MyCLImage3D::destroy()
+{
+    if (mCreated)
+    {
+        clReleaseMemObject(mImage);
+        mCreated = false;
+    }
+}
+
+bool MyCLImage3D::isFormatSupported(cl_context context, cl_image_format format)
+{
+    cl_uint numFormats;
+    cl_int err = clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE3D,
+                                            0, NULL, &numFormats);
+    if (err != CL_SUCCESS)
+        return false;
+
+    std::vector<cl_image_format> formats(numFormats);
+    err = clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE3D,
+                                     numFormats, formats.data(), NULL);
+    if (err != CL_SUCCESS)
+        return false;
+
+    for (const cl_image_format &supported : formats)
+    {
+        if (supported.image_channel_order == format.image_channel_order &&
+            supported.image_channel_data_type == format.image_channel_data_type)
+            return true;
+    }
+
+    return false;
+}
+
+const cl_image &MyCLImage3D::image() const
+{
+    Q_ASSERT( mCreated );
+    return mImage;
+}
+
+cl_image_format MyCLImage3D::format() const
+{
+    Q_ASSERT( mCreated );
+    return mFormat;
+}
+
+bool MyCLImage3D::write(cl_command_queue queue, const void *data)
+{
+    Q_ASSERT( mCreated );
+
+    size_t origin[3] = {0, 0, 0};
+    size_t region[3] = {mWidth, mHeight, mDepth};
+
+    cl_int err = clEnqueueWriteImage(queue, mImage, CL_TRUE, origin, region, 0, 0, data, 0, NULL, NULL);
+
+    if (err != CL_SUCCESS)
+    {
+        qDebug() << "Failed to write a 3D image.";
+        return false;
+    }
+
+    return true;
+}
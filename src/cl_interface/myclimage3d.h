@@ -0,0 +1,61 @@
+#ifndef MYCLIMAGE3D_H
+#define MYCLIMAGE3D_H
+
+#include "include_opencl.h"
+
+/// The 3D counterpart of MyCLImage2D. 3D images can't be shared with OpenGL
+/// textures here, so there is nothing to acquire or release.
+class MyCLImage3D
+{
+public:
+    MyCLImage3D();
+    ~MyCLImage3D();
+
+
+    /// Creates the image with the specified size and format.
+    bool create(cl_context context, size_t width, size_t height, size_t depth, cl_image_format format);
+
+    /// Creates the image with the specified size and format.
+    bool create(cl_context context, size_t width, size_t height, size_t depth,
+                cl_channel_order channelOrder, cl_channel_type channelType = CL_FLOAT);
+
+    /// Releases resources allocated in the create functions.
+    void destroy();
+
+    /// Returns true if read-write 3D images with the given format can be
+    /// created in the context. Only the CL_RGBA formats are guaranteed.
+    static bool isFormatSupported(cl_context context, cl_image_format format);
+
+
+    /// Returns the associated cl_image.
+    const cl_image &image() const;
+
+    /// Returns the format of the image.
+    cl_image_format format() const;
+
+    /// Returns true if the image has been created.
+    bool isCreated() const { return mCreated; }
+
+
+    /// Overwrites the whole image with tightly packed pixels from data, which
+    /// must be in the image's format. Blocks until the data has been copied.
+    bool write(cl_command_queue queue, const void *data);
+
+
+    size_t width() const { return mWidth; }
+    size_t height() const { return mHeight; }
+    size_t depth() const { return mDepth; }
+private:
+    bool mCreated;
+
+    cl_context mContext;
+    cl_image mImage;
+
+    cl_image_format mFormat;
+
+    size_t mWidth;
+    size_t mHeight;
+    size_t mDepth;
+};
+
+#endif // MYCLIMAGE3D_H
@@ -3,6 +3,8 @@
 
 #include "include_opencl.h"
 #include "myclimage.h"
+#include "myclimage3d.h"
+#include "myclbuffer.h"
 #include "myclwrapper.h"
 #include "myclerrors.h"
 
@@ -11,9 +13,19 @@
 
 #include <QDebug>
 
+/// A kernel argument that allocates the given number of bytes of local memory
+/// for a __local pointer parameter.
+struct MyCLLocalMemory
+{
+    explicit MyCLLocalMemory(size_t bytes) : size(bytes) {}
+
+    size_t size;
+};
+
 /// A wrapper for an OpenCL kernel. The template arguments are the types
-/// of the kernel arguments, which may be any valid cl_* type or MyCLImage2D &.
-/// It is very important that MyCLImage2D is passed by reference!
+/// of the kernel arguments, which may be any valid cl_* type, MyCLImage2D &,
+/// MyCLImage3D &, MyCLBuffer & or MyCLLocalMemory. It is very important that images and
+/// buffers are passed by reference!
 ///
 /// The MyCLImage2D thing will be removed and MyCLImage2D will become
 /// implicitly convertible to cl_image.
@@ -163,6 +175,113 @@ public:
         return true;
     }
 
+
+    /// Invokes the kernel with the given arguments and a 3-dimensional layout.
+    bool operator() (size_t globalSize1, size_t globalSize2, size_t globalSize3, FirstType firstArg, OtherTypes ... restArgs)
+    {
+        Q_ASSERT(mCreated);
+
+        size_t idealWorkGroupSize = maxWorkGroupSize();
+        if (idealWorkGroupSize == 0)
+        {
+            qDebug() << "Couldn't get kernel work group size.";
+            return false;
+        }
+
+        size_t localSize1, localSize2, localSize3;
+        factorEvenly(idealWorkGroupSize, &localSize1, &localSize2, &localSize3);
+
+        return runWithLocalSize(globalSize1, globalSize2, globalSize3,
+                                localSize1, localSize2, localSize3,
+                                firstArg, restArgs...);
+    }
+
+
+    /// Invokes the kernel with the given arguments and a 2-dimensional layout,
+    /// using the given work group size instead of the ideal one. This is needed
+    /// by kernels that size their local memory for a particular work group.
+    ///
+    /// The global sizes are rounded up to multiples of the local sizes.
+    bool runWithLocalSize(size_t globalSize1, size_t globalSize2,
+                          size_t localSize1, size_t localSize2,
+                          FirstType firstArg, OtherTypes ... restArgs)
+    {
+        Q_ASSERT(mCreated);
+
+        if (!setKernelArg<FirstType, OtherTypes...>(0, firstArg, restArgs...))
+            return false;
+
+        size_t globals[2] = {nextMultiple(globalSize1, localSize1), nextMultiple(globalSize2, localSize2)};
+        size_t locals[2] = {localSize1, localSize2};
+
+        cl_int err = clEnqueueNDRangeKernel(mCLWrapper->queue(), mKernel, 2, NULL, globals, locals, 0, NULL, NULL);
+
+        if (err != CL_SUCCESS)
+        {
+            qDebug() << QString::fromStdString(parseEnqueueKernelReturnCode(err));
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Invokes the kernel with the given arguments and a 3-dimensional layout,
+    /// using the given work group size. See the 2-dimensional version.
+    bool runWithLocalSize(size_t globalSize1, size_t globalSize2, size_t globalSize3,
+                          size_t localSize1, size_t localSize2, size_t localSize3,
+                          FirstType firstArg, OtherTypes ... restArgs)
+    {
+        Q_ASSERT(mCreated);
+
+        if (!setKernelArg<FirstType, OtherTypes...>(0, firstArg, restArgs...))
+            return false;
+
+        size_t globals[3] = {nextMultiple(globalSize1, localSize1),
+                             nextMultiple(globalSize2, localSize2),
+                             nextMultiple(globalSize3, localSize3)};
+        size_t locals[3] = {localSize1, localSize2, localSize3};
+
+        cl_int err = clEnqueueNDRangeKernel(mCLWrapper->queue(), mKernel, 3, NULL, globals, locals, 0, NULL, NULL);
+
+        if (err != CL_SUCCESS)
+        {
+            qDebug() << QString::fromStdString(parseEnqueueKernelReturnCode(err));
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Returns the maximum work group size this kernel can be launched with
+    /// on the wrapper's device, or 0 on failure.
+    size_t maxWorkGroupSize() const
+    {
+        Q_ASSERT(mCreated);
+
+        size_t size;
+        cl_int err = clGetKernelWorkGroupInfo(mKernel, mCLWrapper->device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &size, NULL);
+
+        if (err != CL_SUCCESS)
+            return 0;
+
+        return size;
+    }
+
+    /// Returns the amount of local memory in bytes that the kernel uses on the
+    /// wrapper's device, not counting local memory arguments, or 0 on failure.
+    cl_ulong localMemorySize() const
+    {
+        Q_ASSERT(mCreated);
+
+        cl_ulong size;
+        cl_int err = clGetKernelWorkGroupInfo(mKernel, mCLWrapper->device(), CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &size, NULL);
+
+        if (err != CL_SUCCESS)
+            return 0;
+
+        return size;
+    }
+
 private:
     bool mCreated;
 
@@ -172,7 +291,7 @@ private:
 
 
     /// Sets the nth kernel argument to be arg1, and then sets the rest.
-    /// MyCLImage2D and cl_* types are valid here.
+    /// MyCLImage2D, MyCLImage3D, MyCLBuffer, MyCLLocalMemory and cl_* types are valid here.
     template< typename FirstArg, typename ... RestArgs >
     bool setKernelArg(int n, FirstArg arg1, RestArgs ... argsRest)
     {
@@ -183,6 +302,20 @@ private:
             static_assert(std::is_reference<FirstArg>::value, "MyCLImage2D arguments need to be passed by reference.");
             err = clSetKernelArg(mKernel, n, sizeof(cl_image), &arg1.image());
         }
+        else if constexpr (std::is_same<typename std::remove_reference<FirstArg>::type, MyCLImage3D>::value)
+        {
+            static_assert(std::is_reference<FirstArg>::value, "MyCLImage3D arguments need to be passed by reference.");
+            err = clSetKernelArg(mKernel, n, sizeof(cl_image), &arg1.image());
+        }
+        else if constexpr (std::is_same<typename std::remove_reference<FirstArg>::type, MyCLBuffer>::value)
+        {
+            static_assert(std::is_reference<FirstArg>::value, "MyCLBuffer arguments need to be passed by reference.");
+            err = clSetKernelArg(mKernel, n, sizeof(cl_mem), &arg1.buffer());
+        }
+        else if constexpr (std::is_same<typename std::remove_reference<FirstArg>::type, MyCLLocalMemory>::value)
+        {
+            err = clSetKernelArg(mKernel, n, arg1.size, NULL);
+        }
         else
         {
             err = clSetKernelArg(mKernel, n, sizeof(arg1), &arg1);
@@ -256,6 +389,41 @@ private:
 
         Q_ASSERT( (*f1) * (*f2) == initialNum);
     }
+
+    /// Factors num into f1 * f2 * f3 such that the factors are
+    /// close to each other.
+    static void factorEvenly(size_t num, size_t *f1, size_t *f2, size_t *f3)
+    {
+        /* Same strategy as the 2-factor version, with the prime factors
+            dealt out to f1, f2 and f3 in turn. */
+
+        const size_t initialNum = num;
+        *f1 = 1;
+        *f2 = 1;
+        *f3 = 1;
+
+        size_t *factors[3] = {f1, f2, f3};
+        int cur = 0;
+
+        size_t current_factor = 2;
+
+        while (num > 1)
+        {
+            if (num % current_factor == 0)
+            {
+                *factors[cur] *= current_factor;
+                cur = (cur + 1) % 3;
+
+                num /= current_factor;
+            }
+            else
+            {
+                ++current_factor;
+            }
+        }
+
+        Q_ASSERT( (*f1) * (*f2) * (*f3) == initialNum);
+    }
 };
 
 #endif // MYCLKERNEL_H
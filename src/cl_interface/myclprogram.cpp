@@ -13,7 +13,7 @@ MyCLProgram::MyCLProgram()
 }
 
 
-bool MyCLProgram::create(MyCLWrapper *wrapper, QString sourceFilePath)
+bool MyCLProgram::create(MyCLWrapper *wrapper, QString sourceFilePath, QString options)
 {
     mCLWrapper = wrapper;
 
@@ -46,7 +46,8 @@ bool MyCLProgram::create(MyCLWrapper *wrapper, QString sourceFilePath)
         return false;
     }
 
-    err = clBuildProgram(mProgram, 0, NULL, NULL, NULL, NULL);
+    QByteArray optionBytes = options.toLatin1();
+    err = clBuildProgram(mProgram, 0, NULL, optionBytes.isEmpty() ? NULL : optionBytes.constData(), NULL, NULL);
 
     if (err != CL_SUCCESS)
     {
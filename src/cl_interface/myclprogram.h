@@ -11,9 +11,10 @@ class MyCLProgram
 public:
     MyCLProgram();
 
-    /// Creates the program from the given sourceFile. Returns
-    /// true on success, false on failure.
-    bool create(MyCLWrapper *wrapper, QString sourceFile);
+    /// Creates the program from the given sourceFile, built with the given
+    /// compiler options (such as "-D NAME"). Returns true on success, false
+    /// on failure.
+    bool create(MyCLWrapper *wrapper, QString sourceFile, QString options = QString());
     void destroy();
 
     cl_program program() const { return mProgram; }
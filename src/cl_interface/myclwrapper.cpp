@@ -3,6 +3,9 @@
 #include <QDebug>
 #include <QOpenGLContext>
 
+#include <algorithm>
+#include <vector>
+
 MyCLWrapper *MyCLWrapper::currentGlobalContext = nullptr;
 
 MyCLWrapper &MyCLWrapper::current()
@@ -88,6 +91,111 @@ bool MyCLWrapper::createFromGLContext(cl_device_type deviceType)
     return true;
 }
 
+bool MyCLWrapper::createFromContext(cl_context context, cl_device_id device)
+{
+    cl_int err;
+
+    mCommandQueue = clCreateCommandQueue(context, device, 0, &err);
+
+    if (err != CL_SUCCESS)
+        return false;
+
+    clRetainContext(context);
+    clRetainDevice(device);
+
+    mContext = context;
+    mDevice = device;
+
+    mCreated = true;
+    return true;
+}
+
+
+int MyCLWrapper::createPartitioned(MyCLWrapper *wrappers, int count, cl_device_type deviceType)
+{
+    Q_ASSERT( count >= 1 );
+
+    cl_int err;
+
+
+    // Get up to `count` devices.
+    std::vector<cl_device_id> devices(count);
+    cl_uint numDevices = 0;
+
+    err = clGetDeviceIDs(NULL, deviceType, count, devices.data(), &numDevices);
+
+    if (err != CL_SUCCESS)
+        return 0;
+
+    numDevices = std::min<cl_uint>(numDevices, count);
+
+
+    // Split a lone device into sub-devices, if it supports that.
+    bool subDevices = false;
+
+    if (numDevices == 1 && count > 1)
+    {
+        cl_uint computeUnits = 0;
+        clGetDeviceInfo(devices[0], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, NULL);
+
+        const cl_device_partition_property properties[] = {
+            CL_DEVICE_PARTITION_EQUALLY,
+            (cl_device_partition_property) std::max<cl_uint>(computeUnits / count, 1),
+            0
+        };
+
+        cl_uint numSubDevices = 0;
+        if (clCreateSubDevices(devices[0], properties, 0, NULL, &numSubDevices) == CL_SUCCESS && numSubDevices > 1)
+        {
+            std::vector<cl_device_id> subDeviceIDs(numSubDevices);
+
+            if (clCreateSubDevices(devices[0], properties, numSubDevices, subDeviceIDs.data(), NULL) == CL_SUCCESS)
+            {
+                numDevices = std::min<cl_uint>(numSubDevices, count);
+
+                // Compute units that don't divide evenly make extra sub-devices.
+                for (cl_uint i = numDevices; i < numSubDevices; ++i)
+                    clReleaseDevice(subDeviceIDs[i]);
+
+                std::copy(subDeviceIDs.begin(), subDeviceIDs.begin() + numDevices, devices.begin());
+                subDevices = true;
+            }
+        }
+        else
+        {
+            qDebug() << "The device can't be split into sub-devices; using it whole.";
+        }
+    }
+
+
+    // Create the context and a wrapper for each device.
+    cl_context context = clCreateContext(NULL, numDevices, devices.data(), NULL, NULL, &err);
+
+    int created = 0;
+    if (err == CL_SUCCESS)
+    {
+        while (created < (int) numDevices && wrappers[created].createFromContext(context, devices[created]))
+            ++created;
+
+        if (created < (int) numDevices)
+        {
+            while (created > 0)
+                wrappers[--created].release();
+        }
+
+        // The wrappers hold their own references.
+        clReleaseContext(context);
+    }
+
+    if (subDevices)
+    {
+        for (cl_uint i = 0; i < numDevices; ++i)
+            clReleaseDevice(devices[i]);
+    }
+
+    return created;
+}
+
 
 void MyCLWrapper::release()
 {
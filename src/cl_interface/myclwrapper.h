@@ -32,6 +32,26 @@ public:
     /// Returns true on success, false on failure.
     bool createFromGLContext(cl_device_type deviceType = CL_DEVICE_TYPE_GPU);
 
+    /// Initializes this to use the given context and one of its devices, with
+    /// a command queue of its own. The context and device are retained, so the
+    /// caller may release its references to them.
+    ///
+    /// Returns true on success, false on failure.
+    bool createFromContext(cl_context context, cl_device_id device);
+
+    /// Initializes up to `count` of the given wrappers to share one context,
+    /// each with its own device and command queue, for splitting work between
+    /// devices. If there are several devices of the given type, each wrapper
+    /// gets one of them. Otherwise, the device is split into sub-devices with
+    /// equal numbers of compute units, which lets a CPU be partitioned. The
+    /// context doesn't share with OpenGL.
+    ///
+    /// Returns the number of wrappers initialized, which is 1 if there is
+    /// only one device and it can't be split, or 0 on failure.
+    static int createPartitioned(MyCLWrapper *wrappers,
+                                 int count,
+                                 cl_device_type deviceType = CL_DEVICE_TYPE_CPU);
+
     /// Releases the context, queue and device.
     void release();
 
@@ -0,0 +1,88 @@
+#include "cputhreadpool.h"
+
+#include <algorithm>
+
+
+CPUThreadPool::CPUThreadPool(int threadCount)
+    : mThreadCount(threadCount > 0 ? threadCount : std::max<int>(std::thread::hardware_concurrency(), 1)),
+      mBody(nullptr),
+      mRows(0),
+      mGeneration(0),
+      mPending(0),
+      mStopping(false)
+{
+    // The caller takes band 0.
+    for (int band = 1; band < mThreadCount; ++band)
+        mWorkers.emplace_back(&CPUThreadPool::workerLoop, this, band);
+}
+
+CPUThreadPool::~CPUThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWork.notify_all();
+
+    for (std::thread &worker : mWorkers)
+        worker.join();
+}
+
+void CPUThreadPool::parallelRows(int rows, const std::function<void(int, int)> &body)
+{
+    const int threads = threadCount();
+
+    // Bands of a few rows cost more to hand out than to do.
+    if (threads == 1 || rows < 2 * threads)
+    {
+        body(0, rows);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBody = &body;
+        mRows = rows;
+        mPending = mWorkers.size();
+        ++mGeneration;
+    }
+    mWork.notify_all();
+
+    body(0, rows / threads);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mPending == 0; });
+    mBody = nullptr;
+}
+
+void CPUThreadPool::workerLoop(int band)
+{
+    const int threads = mThreadCount;
+    int generation = 0;
+
+    for (;;)
+    {
+        const std::function<void(int, int)> *body;
+        int rows;
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWork.wait(lock, [&] { return mStopping || mGeneration != generation; });
+
+            if (mStopping)
+                return;
+
+            generation = mGeneration;
+            body = mBody;
+            rows = mRows;
+        }
+
+        (*body)(rows * band / threads, rows * (band + 1) / threads);
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (--mPending == 0)
+                mDone.notify_one();
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef CPUTHREADPOOL_H
+#define CPUTHREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A fixed set of worker threads that split loops over the rows of a grid into
+/// bands, for Fluid2DSimulationCPUProgram. The calling thread works on a band
+/// too, so a pool of one thread has no workers and runs everything inline.
+class CPUThreadPool
+{
+public:
+    /// Starts threadCount - 1 workers. 0 means one thread per hardware thread.
+    explicit CPUThreadPool(int threadCount = 0);
+
+    /// Stops and joins the workers.
+    ~CPUThreadPool();
+
+    CPUThreadPool(const CPUThreadPool &) = delete;
+    CPUThreadPool &operator=(const CPUThreadPool &) = delete;
+
+    /// The number of threads that share the work, including the caller's.
+    int threadCount() const { return mThreadCount; }
+
+    /// Calls body(firstRow, endRow) on one band of [0, rows) per thread, in
+    /// parallel, and returns once every band is done. The bands are disjoint
+    /// and contiguous. Must not be called from body.
+    void parallelRows(int rows, const std::function<void(int, int)> &body);
+
+private:
+    void workerLoop(int band);
+
+    int mThreadCount;
+    std::vector<std::thread> mWorkers;
+
+    /// Guards everything below. mWork wakes the workers when mGeneration
+    /// changes, and mDone wakes the caller when mPending reaches 0.
+    std::mutex mMutex;
+    std::condition_variable mWork;
+    std::condition_variable mDone;
+
+    const std::function<void(int, int)> *mBody;
+    int mRows;
+    int mGeneration;
+    int mPending;
+    bool mStopping;
+};
+
+#endif // CPUTHREADPOOL_H
@@ -0,0 +1,151 @@
+#include "fluid2densemble.h"
+#include "cl_interface/clniceties.h"
+
+#include <algorithm>
+
+
+Fluid2DEnsemble::Fluid2DEnsemble(Fluid2DSimulationConfig config, int fieldCount)
+    : mInitialized(false),
+      mConfig(config),
+      mFieldCount(std::max(fieldCount, 1)),
+      mParametersChanged(true),
+      mIndex(0)
+{
+    if (fieldCount < 1)
+        qWarning() << "An ensemble needs at least 1 field; using 1.";
+
+    FieldParameters defaults;
+    defaults.dt = config.fixedTimeStep;
+    defaults.density = config.density;
+    defaults.viscosity = config.hasViscosity ? config.viscosity : 0;
+    defaults.forceScale = 1;
+
+    mParameters.assign(mFieldCount, defaults);
+}
+
+Fluid2DEnsemble::~Fluid2DEnsemble()
+{
+    release(); // release() checks mInitialized
+}
+
+bool Fluid2DEnsemble::create(MyCLWrapper *wrapper)
+{
+    if (!mBufferProgram.create(wrapper, mConfig.periodicBoundary))
+        return false;
+
+    const size_t bytes = mFieldCount * mConfig.width * mConfig.height * sizeof(cl_float2);
+
+    for (MyCLBuffer *buf : {&mVelocityBuffers[0], &mVelocityBuffers[1],
+                            &mPressureBuffers[0], &mPressureBuffers[1],
+                            &mTempBuffers[0], &mTempBuffers[1]})
+    {
+        if (!buf->create(wrapper->context(), bytes))
+        {
+            qDebug() << "Failed to create an ensemble buffer.";
+            return false;
+        }
+
+        CLNiceties::ZeroBuffer(wrapper->queue(), *buf);
+    }
+
+    if (!mParameterBuffer.create(wrapper->context(), mFieldCount * sizeof(cl_float4), CL_MEM_READ_ONLY))
+    {
+        qDebug() << "Failed to create the ensemble parameter buffer.";
+        return false;
+    }
+
+    mIndex = 0;
+    mParametersChanged = true;
+
+    mCLWrapper = wrapper;
+    mInitialized = true;
+    return true;
+}
+
+void Fluid2DEnsemble::release()
+{
+    if (mInitialized)
+    {
+        mBufferProgram.release();
+
+        for (int i = 0; i < 2; ++i)
+        {
+            mVelocityBuffers[i].destroy();
+            mPressureBuffers[i].destroy();
+            mTempBuffers[i].destroy();
+        }
+        mParameterBuffer.destroy();
+
+        mInitialized = false;
+    }
+}
+
+void Fluid2DEnsemble::setFieldParameters(int field, const FieldParameters &params)
+{
+    Q_ASSERT( field >= 0 && field < mFieldCount );
+
+    if (params.dt <= 0 || params.density <= 0)
+    {
+        qWarning() << "Ignoring ensemble field parameters with a nonpositive time step or density.";
+        return;
+    }
+
+    mParameters[field] = params;
+    mParametersChanged = true;
+}
+
+bool Fluid2DEnsemble::update()
+{
+    return step(nullptr);
+}
+
+bool Fluid2DEnsemble::update(MyCLBuffer &forces)
+{
+    return step(&forces);
+}
+
+bool Fluid2DEnsemble::step(MyCLBuffer *forces)
+{
+    Q_ASSERT( mInitialized );
+
+    if (mParametersChanged)
+    {
+        std::vector<cl_float4> packed(mFieldCount);
+        for (int i = 0; i < mFieldCount; ++i)
+        {
+            const FieldParameters &p = mParameters[i];
+            packed[i] = {{ p.dt, p.density, p.viscosity, p.forceScale }};
+        }
+
+        if (!mParameterBuffer.write(mCLWrapper->queue(), packed.data(), mFieldCount * sizeof(cl_float4)))
+        {
+            qDebug() << "Failed to write the ensemble parameters.";
+            return false;
+        }
+
+        mParametersChanged = false;
+    }
+
+    // The diffusion sweeps are only worth launching if some field is viscous.
+    bool diffuse = std::any_of(mParameters.begin(), mParameters.end(),
+                               [] (const FieldParameters &p) { return p.viscosity > 0; });
+
+    if (!mBufferProgram.updateEnsemble(mConfig,
+                                       mFieldCount,
+                                       mParameterBuffer,
+                                       mVelocityBuffers[mIndex],
+                                       mVelocityBuffers[1 - mIndex],
+                                       forces,
+                                       mPressureBuffers[mIndex],
+                                       mPressureBuffers[1 - mIndex],
+                                       mTempBuffers[0],
+                                       mTempBuffers[1],
+                                       diffuse))
+    {
+        qDebug() << "Failed in ensemble wind update.";
+        return false;
+    }
+
+    mIndex = 1 - mIndex;
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef FLUID2DENSEMBLE_H
+#define FLUID2DENSEMBLE_H
+
+#include "fluid2dsimulationbufferclprogram.h"
+#include "fluid2dsimulationconfig.h"
+
+#include "cl_interface/myclwrapper.h"
+#include "cl_interface/myclbuffer.h"
+#include "cl_interface/include_opencl.h"
+
+#include <vector>
+
+/// Many small independent fluid fields of the same size, such as the wind of
+/// separate rooms, stepped together. Every field is a Fluid2DSimulation with
+/// BufferStorage of its own, except that the fields are stacked in the same
+/// buffers and every kernel is launched once for all of them, so the number of
+/// launches per step doesn't grow with the number of fields.
+///
+/// The config gives the size of each field, the grid square size, the number
+/// of pressure iterations and the boundary, which all fields share. Each field
+/// has its own time step, density, viscosity and force scale (see
+/// FieldParameters), which start out as the config's.
+class Fluid2DEnsemble
+{
+public:
+    /// The parameters of one field.
+    struct FieldParameters
+    {
+        /// The time step of every update(), in seconds.
+        float dt;
+
+        float density;
+
+        /// The viscosity, or 0 for an inviscid field.
+        float viscosity;
+
+        /// The factor by which the field's forces are multiplied. 0 ignores them.
+        float forceScale;
+    };
+
+    Fluid2DEnsemble(Fluid2DSimulationConfig config, int fieldCount);
+    ~Fluid2DEnsemble();
+
+    /// Creates the buffers of every field and zero-initializes them.
+    bool create(MyCLWrapper *wrapper);
+
+    /// Releases the OpenCL objects created in create().
+    void release();
+
+    /// Changes the parameters of a field, from the next step on.
+    void setFieldParameters(int field, const FieldParameters &params);
+    const FieldParameters &fieldParameters(int field) const { return mParameters[field]; }
+
+    /// Steps every field by its own dt without applying forces.
+    bool update();
+
+    /// Steps every field by its own dt, applying forces given as a buffer of
+    /// fieldCount() stacked vector fields, laid out like velocityBuffer().
+    bool update(MyCLBuffer &forces);
+
+    int fieldCount() const { return mFieldCount; }
+
+    size_t gridWidth() const { return mConfig.width; }
+    size_t gridHeight() const { return mConfig.height; }
+
+    /// The index of the first cell of a field in the buffers.
+    size_t fieldOffset(int field) const { return field * mConfig.width * mConfig.height; }
+
+    /// The buffers holding the current state of every field, stacked. These
+    /// change between steps. The velocities are cl_float2 per cell.
+    MyCLBuffer &velocityBuffer() { return mVelocityBuffers[mIndex]; }
+    MyCLBuffer &pressureBuffer() { return mPressureBuffers[mIndex]; }
+
+private:
+    /// Advances every field, swapping the current and next buffers afterward.
+    bool step(MyCLBuffer *forces);
+
+    bool mInitialized;
+
+    MyCLWrapper *mCLWrapper;
+
+    Fluid2DSimulationConfig mConfig;
+    Fluid2DSimulationBufferCLProgram mBufferProgram;
+
+    int mFieldCount;
+
+    /// The parameters of every field, and a copy on the device as a cl_float4
+    /// per field, which is rewritten before the next step if they changed.
+    std::vector<FieldParameters> mParameters;
+    MyCLBuffer mParameterBuffer;
+    bool mParametersChanged;
+
+    /// The current and next buffers, sized for fieldCount vector fields like
+    /// in Fluid2DSimulation.
+    MyCLBuffer mVelocityBuffers[2];
+    MyCLBuffer mPressureBuffers[2];
+    MyCLBuffer mTempBuffers[2];
+    int mIndex;
+};
+
+#endif // FLUID2DENSEMBLE_H
@@ -0,0 +1,436 @@
+#include "fluid2dpartitionedsolver.h"
+
+#include "cl_interface/clniceties.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+
+Fluid2DPartitionedSolver::Fluid2DPartitionedSolver()
+    : mWidth(0),
+      mHaloRows(0),
+      mWarnedClamping(false),
+      mIndex(0)
+{
+}
+
+Fluid2DPartitionedSolver::~Fluid2DPartitionedSolver()
+{
+    release();
+}
+
+bool Fluid2DPartitionedSolver::create(const Fluid2DSimulationConfig &config, MyCLWrapper *wrappers, int count)
+{
+    Q_ASSERT( count >= 1 );
+    Q_ASSERT( !config.periodicBoundary );
+
+    release();
+
+    const int height = config.height;
+
+    mWidth = config.width;
+    mHaloRows = std::max(config.partitionHaloRows, 1);
+    mWarnedClamping = false;
+    mIndex = 0;
+
+    // The halos are copied from the rows of the neighbors only.
+    int stripCount = std::min(count, std::max(height / mHaloRows, 1));
+    if (stripCount < count)
+        qWarning() << "The grid is too short for" << count << "strips with" << mHaloRows << "halo rows; using" << stripCount;
+
+    for (int i = 0; i < stripCount; ++i)
+    {
+        Strip *strip = new Strip;
+        mStrips.push_back(strip);
+
+        strip->wrapper = &wrappers[i];
+        strip->created = false;
+        strip->clampedReadback = 0;
+        strip->clampedEvent = NULL;
+        strip->firstRow = height * i / stripCount;
+        strip->rows = height * (i + 1) / stripCount - strip->firstRow;
+        strip->haloBefore = i > 0 ? mHaloRows : 0;
+        strip->haloAfter = i < stripCount - 1 ? mHaloRows : 0;
+
+        if (!strip->program.create(strip->wrapper))
+        {
+            release();
+            return false;
+        }
+        strip->created = true;
+        strip->program.setGridSize(mWidth, strip->localRows());
+
+        const size_t bytes = mWidth * strip->localRows() * sizeof(cl_float2);
+        cl_context context = strip->wrapper->context();
+
+        for (MyCLBuffer &buf : strip->buffers)
+        {
+            if (!buf.create(context, bytes))
+            {
+                qDebug() << "Failed to create a strip buffer.";
+                release();
+                return false;
+            }
+
+            CLNiceties::ZeroBuffer(strip->wrapper->queue(), buf);
+        }
+
+        if (!strip->forces.create(context, bytes) ||
+            !strip->clamped.create(context, sizeof(cl_int)))
+        {
+            qDebug() << "Failed to create a strip buffer.";
+            release();
+            return false;
+        }
+
+        CLNiceties::ZeroBuffer(strip->wrapper->queue(), strip->clamped);
+    }
+
+    return true;
+}
+
+void Fluid2DPartitionedSolver::release()
+{
+    for (Strip *strip : mStrips)
+    {
+        // The last readback may still be writing into the strip.
+        if (strip->clampedEvent != NULL)
+        {
+            clWaitForEvents(1, &strip->clampedEvent);
+            clReleaseEvent(strip->clampedEvent);
+        }
+
+        if (strip->created)
+            strip->program.release();
+
+        delete strip;
+    }
+
+    mStrips.clear();
+}
+
+bool Fluid2DPartitionedSolver::update(const Fluid2DSimulationConfig &config, MyCLBuffer *forces, cl_float dt)
+{
+    Q_ASSERT( !mStrips.empty() );
+
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float density = config.density;
+    const cl_float viscosity = config.hasViscosity ? config.viscosity : -1;
+
+    // The slots play the roles of the buffers in
+    // Fluid2DSimulationBufferCLProgram::update().
+    int velocity = mIndex;
+    int velocityOut = 1 - mIndex;
+    int pressure = 2 + mIndex;
+    int pressureOut = 3 - mIndex;
+    int free1 = 4;
+    int free2 = 5;
+
+#ifdef F2DPS_RUN
+    static_assert(false);
+#endif
+
+// Calls the program of every strip, returning false with the message if any call fails.
+#define F2DPS_RUN(message, call)\
+    for (Strip *strip : mStrips)\
+    {\
+        Fluid2DSimulationBufferCLProgram &program = strip->program;\
+        MyCLBuffer *buffers = strip->buffers;\
+        if (!(call))\
+        {\
+            qDebug() << message;\
+            return false;\
+        }\
+    }
+
+    if (!waitForFirstStrip())
+        return false;
+
+    if (forces != nullptr)
+    {
+        for (Strip *strip : mStrips)
+        {
+            const size_t rowBytes = mWidth * sizeof(cl_float2);
+
+            cl_int err = clEnqueueCopyBuffer(strip->wrapper->queue(), forces->buffer(), strip->forces.buffer(),
+                                             (strip->firstRow - strip->haloBefore) * rowBytes, 0,
+                                             strip->localRows() * rowBytes, 0, NULL, NULL);
+            if (err != CL_SUCCESS)
+            {
+                qDebug() << "Failure copying the forces into a strip.";
+                return false;
+            }
+        }
+    }
+
+
+    /* Step 1: Advection */
+    if (!exchangeHalos(velocity, sizeof(cl_float2)))
+        return false;
+
+    F2DPS_RUN("Failure in advection step.",
+              program.advectStrip(buffers[velocity], buffers[velocity], buffers[free1], strip->clamped,
+                                  dt, gridSize, strip->haloBefore, strip->haloAfter));
+    std::swap(velocity, free1);
+
+    if (!mWarnedClamping)
+        checkClamping();
+
+
+    /* Step 2: Diffusion (optional) */
+    if (viscosity > 0)
+    {
+        const cl_float hh_vdt = gridSize * gridSize / (viscosity * dt);
+
+        // The same 60 sweeps as the buffer pipeline, which ends in velocity.
+        int t1 = velocity;
+        int t2 = free1;
+
+        for (int sweep = 0; sweep < 60; ++sweep)
+        {
+            if (sweep % mHaloRows == 0 && !exchangeHalos(t1, sizeof(cl_float2)))
+                return false;
+
+            F2DPS_RUN("Failure in diffusion step.",
+                      program.jacobi2(buffers[t1], buffers[t1], buffers[t2], hh_vdt, 4 + hh_vdt));
+            std::swap(t1, t2);
+        }
+    }
+
+    /* Step 3: Add forces (optional) */
+    if (forces != nullptr)
+    {
+        F2DPS_RUN("Failure in add-forces step.",
+                  program.addScaled(buffers[velocity], strip->forces, dt, buffers[free1]));
+        std::swap(velocity, free1);
+    }
+
+    /* Step 4: Update pressure */
+    int divergence = free1;
+    int scratch = free2;
+
+    if (!exchangeHalos(velocity, sizeof(cl_float2)))
+        return false;
+
+    F2DPS_RUN("Failure in computing divergence.",
+              program.divergence(buffers[velocity], buffers[divergence], gridSize));
+
+    for (int iteration = 0; iteration < config.pressureIterations; ++iteration)
+    {
+        if (iteration % mHaloRows == 0 && !exchangeHalos(pressure, sizeof(cl_float)))
+            return false;
+
+        F2DPS_RUN("Failure in pressure computation.",
+                  program.jacobi1(buffers[pressure], buffers[divergence], buffers[scratch], -gridSize * gridSize, 4));
+        std::swap(pressure, scratch);
+    }
+
+    // The divergence isn't needed anymore.
+    int gradient = divergence;
+
+    /* Step 5: Subtract pressure gradient */
+    if (!exchangeHalos(pressure, sizeof(cl_float)))
+        return false;
+
+    F2DPS_RUN("Failure in pressure gradient computation.",
+              program.gradient(buffers[pressure], buffers[gradient], gridSize));
+
+    F2DPS_RUN("Failure in subtracting pressure gradient.",
+              program.addScaled(buffers[velocity], buffers[gradient], -1.0/density, buffers[scratch]));
+    std::swap(velocity, scratch);
+
+    /* Step 6: Enforce boundary conditions */
+    // These only read across the walls, which the strips share with the grid.
+    F2DPS_RUN("Failure enforcing velocity boundary.",
+              program.velocityBoundary(buffers[velocity], buffers[velocityOut]));
+
+    F2DPS_RUN("Failure enforcing pressure boundary.",
+              program.pressureBoundary(buffers[pressure], buffers[pressureOut]));
+
+#undef F2DPS_RUN
+
+    mIndex = 1 - mIndex;
+    return true;
+}
+
+bool Fluid2DPartitionedSolver::gather(MyCLBuffer &velocities, MyCLBuffer &pressure)
+{
+    Q_ASSERT( !mStrips.empty() );
+
+    if (!firstStripWaitsForAll())
+        return false;
+
+    cl_command_queue queue = mStrips[0]->wrapper->queue();
+
+    for (Strip *strip : mStrips)
+    {
+        const size_t vectorRow = mWidth * sizeof(cl_float2);
+        const size_t scalarRow = mWidth * sizeof(cl_float);
+
+        cl_int err = clEnqueueCopyBuffer(queue, strip->buffers[mIndex].buffer(), velocities.buffer(),
+                                         strip->haloBefore * vectorRow, strip->firstRow * vectorRow,
+                                         strip->rows * vectorRow, 0, NULL, NULL);
+        if (err == CL_SUCCESS)
+        {
+            err = clEnqueueCopyBuffer(queue, strip->buffers[2 + mIndex].buffer(), pressure.buffer(),
+                                      strip->haloBefore * scalarRow, strip->firstRow * scalarRow,
+                                      strip->rows * scalarRow, 0, NULL, NULL);
+        }
+
+        if (err != CL_SUCCESS)
+        {
+            qDebug() << "Failure gathering the strips.";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Fluid2DPartitionedSolver::exchangeHalos(int slot, size_t cellSize)
+{
+    const int count = mStrips.size();
+    if (count == 1)
+        return true;
+
+    const size_t rowBytes = mWidth * cellSize;
+
+    // ready[i] completes when strip i's queue has written the field.
+    std::vector<cl_event> ready(count, (cl_event) NULL);
+    // reads[i] are the copies out of strip i.
+    std::vector<std::vector<cl_event>> reads(count);
+
+    bool success = true;
+
+    for (int i = 0; i < count && success; ++i)
+        success = clEnqueueMarkerWithWaitList(mStrips[i]->wrapper->queue(), 0, NULL, &ready[i]) == CL_SUCCESS;
+
+    // Copies `rows` rows starting at grid row `row` from strip `from` into strip `to`.
+    auto copyRows = [&](int from, int to, int row, int rows)
+    {
+        Strip *source = mStrips[from];
+        Strip *destination = mStrips[to];
+
+        cl_event copied;
+        cl_int err = clEnqueueCopyBuffer(destination->wrapper->queue(),
+                                         source->buffers[slot].buffer(),
+                                         destination->buffers[slot].buffer(),
+                                         (row - source->firstRow + source->haloBefore) * rowBytes,
+                                         (row - destination->firstRow + destination->haloBefore) * rowBytes,
+                                         rows * rowBytes, 1, &ready[from], &copied);
+        if (err != CL_SUCCESS)
+            return false;
+
+        reads[from].push_back(copied);
+        return true;
+    };
+
+    for (int i = 0; i < count && success; ++i)
+    {
+        Strip *strip = mStrips[i];
+
+        if (i > 0)
+            success = copyRows(i - 1, i, strip->firstRow - strip->haloBefore, strip->haloBefore);
+
+        if (success && i < count - 1)
+            success = copyRows(i + 1, i, strip->firstRow + strip->rows, strip->haloAfter);
+    }
+
+    // The neighbors must not overwrite the field until it has been copied.
+    for (int i = 0; i < count && success; ++i)
+    {
+        success = clEnqueueBarrierWithWaitList(mStrips[i]->wrapper->queue(),
+                                               reads[i].size(), reads[i].data(), NULL) == CL_SUCCESS;
+    }
+
+    // The queues hold on to the events they wait for.
+    for (int i = 0; i < count; ++i)
+    {
+        if (ready[i] != NULL)
+            clReleaseEvent(ready[i]);
+
+        for (cl_event event : reads[i])
+            clReleaseEvent(event);
+    }
+
+    if (!success)
+        qDebug() << "Failure exchanging halos.";
+
+    return success;
+}
+
+void Fluid2DPartitionedSolver::checkClamping()
+{
+    for (Strip *strip : mStrips)
+    {
+        if (strip->clampedEvent != NULL)
+        {
+            cl_int status;
+            cl_int err = clGetEventInfo(strip->clampedEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+
+            // Still in flight; waiting for it would stall the queue.
+            if (err == CL_SUCCESS && status > CL_COMPLETE)
+                continue;
+
+            clReleaseEvent(strip->clampedEvent);
+            strip->clampedEvent = NULL;
+
+            if (err == CL_SUCCESS && status == CL_COMPLETE && strip->clampedReadback != 0 && !mWarnedClamping)
+            {
+                qWarning() << "Advection reached past the" << mHaloRows << "halo rows of a strip and was clamped;"
+                           << "increase partitionHaloRows (see Fluid2DSimulationConfig::setPartitionHaloForSpeed()).";
+                mWarnedClamping = true;
+            }
+        }
+
+        if (!mWarnedClamping &&
+            !strip->clamped.read(strip->wrapper->queue(), &strip->clampedReadback, sizeof(cl_int), false, &strip->clampedEvent))
+        {
+            strip->clampedEvent = NULL;
+        }
+    }
+}
+
+bool Fluid2DPartitionedSolver::waitForFirstStrip()
+{
+    if (mStrips.size() == 1)
+        return true;
+
+    cl_event event;
+    if (clEnqueueMarkerWithWaitList(mStrips[0]->wrapper->queue(), 0, NULL, &event) != CL_SUCCESS)
+        return false;
+
+    bool success = true;
+    for (size_t i = 1; i < mStrips.size() && success; ++i)
+        success = clEnqueueBarrierWithWaitList(mStrips[i]->wrapper->queue(), 1, &event, NULL) == CL_SUCCESS;
+
+    clReleaseEvent(event);
+    return success;
+}
+
+bool Fluid2DPartitionedSolver::firstStripWaitsForAll()
+{
+    if (mStrips.size() == 1)
+        return true;
+
+    std::vector<cl_event> events;
+    bool success = true;
+
+    for (size_t i = 1; i < mStrips.size() && success; ++i)
+    {
+        cl_event event;
+        success = clEnqueueMarkerWithWaitList(mStrips[i]->wrapper->queue(), 0, NULL, &event) == CL_SUCCESS;
+
+        if (success)
+            events.push_back(event);
+    }
+
+    if (success)
+        success = clEnqueueBarrierWithWaitList(mStrips[0]->wrapper->queue(), events.size(), events.data(), NULL) == CL_SUCCESS;
+
+    for (cl_event event : events)
+        clReleaseEvent(event);
+
+    return success;
+}
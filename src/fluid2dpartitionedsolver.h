@@ -0,0 +1,111 @@
+#ifndef FLUID2DPARTITIONEDSOLVER_H
+#define FLUID2DPARTITIONEDSOLVER_H
+
+#include "fluid2dsimulationbufferclprogram.h"
+#include "fluid2dsimulationconfig.h"
+
+#include "cl_interface/include_opencl.h"
+#include "cl_interface/myclwrapper.h"
+#include "cl_interface/myclbuffer.h"
+
+#include <vector>
+
+/// Runs the buffer pipeline of Fluid2DSimulationBufferCLProgram on horizontal
+/// strips of the grid, each on its own MyCLWrapper, for
+/// Fluid2DSimulation::createPartitioned().
+///
+/// Every strip keeps config.partitionHaloRows rows of each neighbor around its
+/// own rows, and runs the kernels on all of them with the strip as the grid.
+/// Each stencil step makes one more row at the edges of a strip wrong, so the
+/// halos are copied from the neighbors before every stencil step and every
+/// partitionHaloRows Jacobi sweeps, which keeps the strip's own rows exact.
+/// The queues only wait for each other around these copies. Advection that
+/// would reach past a halo is clamped to it, with a warning, since the rows
+/// beyond are unknown to the strip.
+class Fluid2DPartitionedSolver
+{
+public:
+    Fluid2DPartitionedSolver();
+    ~Fluid2DPartitionedSolver();
+
+    /// Splits a grid of the config's size into `count` strips of nearly equal
+    /// height, or fewer if the strips would be thinner than their halos, and
+    /// creates the program and zeroed buffers of each on its wrapper. The
+    /// wrappers must share one context (see MyCLWrapper::createPartitioned()).
+    /// The config must not be periodic.
+    bool create(const Fluid2DSimulationConfig &config, MyCLWrapper *wrappers, int count);
+
+    void release();
+
+    /// Does the same as Fluid2DSimulationBufferCLProgram::update() on the whole
+    /// grid. forces may be nullptr or a vector field buffer of the whole grid
+    /// in the shared context, which is read after everything enqueued on the
+    /// first wrapper's queue so far. Doesn't wait for the strips to finish.
+    bool update(const Fluid2DSimulationConfig &config, MyCLBuffer *forces, cl_float dt);
+
+    /// Copies the current velocities and pressure of every strip into buffers
+    /// of the whole grid (a vector and a scalar field) on the first wrapper's
+    /// queue, once the strips are done with them.
+    bool gather(MyCLBuffer &velocities, MyCLBuffer &pressure);
+
+    /// The number of strips, or 0 if not created.
+    int stripCount() const { return mStrips.size(); }
+
+private:
+    /// A horizontal strip of the grid and its storage. Every buffer holds a
+    /// vector field of haloBefore + rows + haloAfter rows, starting at grid
+    /// row firstRow - haloBefore. The strips at the top and bottom of the grid
+    /// have no halo on that side, so the edges of the strip are the walls.
+    struct Strip
+    {
+        MyCLWrapper *wrapper;
+        Fluid2DSimulationBufferCLProgram program;
+        bool created;
+
+        /// Indexed by the slots in update().
+        MyCLBuffer buffers[6];
+        MyCLBuffer forces;
+
+        /// A cl_int that advection sets once it clamps a backtrace to the
+        /// halos, and its asynchronous readback. See checkClamping().
+        MyCLBuffer clamped;
+        cl_int clampedReadback;
+        cl_event clampedEvent;
+
+        int firstRow;
+        int rows;
+        int haloBefore;
+        int haloAfter;
+
+        int localRows() const { return haloBefore + rows + haloAfter; }
+    };
+
+    /// Copies the halos of the field in `slot`, whose cells are cellSize bytes,
+    /// from the neighbors of every strip. Each copy waits for the neighbor's
+    /// queue to get to it, and the neighbor's queue waits for the copy.
+    bool exchangeHalos(int slot, size_t cellSize);
+
+    /// Warns, once, if advection in any strip has clamped a backtrace. The flags
+    /// are read back without waiting, like the residual checks of
+    /// Fluid2DSimulationCLProgram, so a clamp is reported a step or so late.
+    void checkClamping();
+
+    /// Makes every other strip's queue wait for everything enqueued on the first
+    /// strip's queue so far, or the other way around.
+    bool waitForFirstStrip();
+    bool firstStripWaitsForAll();
+
+    std::vector<Strip *> mStrips;
+
+    size_t mWidth;
+    int mHaloRows;
+
+    /// Whether checkClamping() has warned.
+    bool mWarnedClamping;
+
+    /// Which of the first two slots holds the current velocities, and which of
+    /// the next two the current pressure.
+    int mIndex;
+};
+
+#endif // FLUID2DPARTITIONEDSOLVER_H
@@ -1,10 +1,39 @@
 #include "fluid2dsimulation.h"
 #include "cl_interface/clniceties.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
 Fluid2DSimulation::Fluid2DSimulation(Fluid2DSimulationConfig config)
     : mInitialized(false),
-      mConfig(config)
+      mConfig(config),
+      mVelocityIndex(0),
+      mPressureIndex(0),
+      mRotateVelocities(true),
+      mRotatePressure(true),
+      mChannelType(CL_FLOAT),
+      mSeparateOutput(false),
+      mLowResolution(false),
+      mOutputIndex(0),
+      mRotateOutput(true),
+      mOutputWidth(config.width),
+      mOutputHeight(config.height),
+      mOriginX(0),
+      mOriginY(0),
+      mHasObstacles(false),
+      mAccumulatedSeconds(0),
+      mSlice(0),
+      mSliceVelocity(nullptr),
+      mSliceFree1(nullptr),
+      mSliceFree2(nullptr),
+      mSlicePressure(nullptr),
+      mSliceScratch(nullptr),
+      mBufferIndex(0),
+      mScalarCount(0)
 {
+    mVelocityTextures[0] = nullptr;
+    mVelocityTextures[1] = nullptr;
 }
 
 Fluid2DSimulation::~Fluid2DSimulation()
@@ -14,13 +43,89 @@ Fluid2DSimulation::~Fluid2DSimulation()
 
 bool Fluid2DSimulation::create(MyCLWrapper *wrapper,
                                const QOpenGLTexture *velocityTexture,
-                               const QOpenGLTexture *pressureTexture)
+                               const QOpenGLTexture *pressureTexture,
+                               const QOpenGLTexture *velocityTexture2,
+                               const QOpenGLTexture *pressureTexture2)
 {
+    if (mConfig.storage == Fluid2DSimulationConfig::CPUStorage)
+    {
+        if (usesUnsupportedOptions())
+            qWarning() << "CPU storage only supports the basic pipeline; ignoring the other solver options.";
+
+        if (velocityTexture != nullptr || pressureTexture != nullptr || velocityTexture2 != nullptr || pressureTexture2 != nullptr)
+            qWarning() << "CPU storage can't share OpenGL textures; ignoring them.";
+
+        if (!mCPUProgram.create(mConfig.periodicBoundary))
+            return false;
+
+        for (int i = 0; i < 2; ++i)
+        {
+            mCPUVelocities[i].reset(mConfig.width, mConfig.height);
+            mCPUPressure[i].reset(mConfig.width, mConfig.height);
+            mCPUTemp[i].reset(mConfig.width, mConfig.height);
+        }
+        mBufferIndex = 0;
+
+        mCLWrapper = wrapper;
+        mInitialized = true;
+        return true;
+    }
+
+    if (mConfig.storage == Fluid2DSimulationConfig::BufferStorage)
+    {
+        // The image transfers are for the display texture and for forces given
+        // as images; without image support, only buffer forces can be used.
+        if (!mBufferProgram.create(wrapper, mConfig.periodicBoundary, true))
+            return false;
+
+        if (!createBuffers(wrapper, velocityTexture))
+            return false;
+
+        mCLWrapper = wrapper;
+        mInitialized = true;
+        return true;
+    }
+
+    if (mConfig.resolutionDivisor > 1)
+    {
+        // From here on, mConfig describes the solver's grid.
+        const int divisor = mConfig.resolutionDivisor;
+
+        mLowResolution = true;
+        mConfig.width = (mOutputWidth + divisor - 1) / divisor;
+        mConfig.height = (mOutputHeight + divisor - 1) / divisor;
+        mConfig.gridSquareSize *= divisor;
+    }
 
-    if (!mFluidProgram.create(wrapper))
+    mSeparateOutput = mLowResolution || mConfig.interpolateSteps;
+
+    if (!mFluidProgram.create(wrapper, mConfig))
         return false;
 
-    if (!createImages(wrapper, velocityTexture, pressureTexture))
+    if (mConfig.jacobiSweepsPerLaunch > 1 && !mFluidProgram.tiledJacobiSupported())
+        qWarning() << "Tiled Jacobi is not supported on this device; using the plain kernel.";
+
+    if (mConfig.pressureSolver == Fluid2DSimulationConfig::ConjugateGradientSolver && !mFluidProgram.conjugateGradientSupported())
+        qWarning() << "Conjugate gradient is not supported on this device; using Jacobi instead.";
+
+    if (mConfig.pressureSolver == Fluid2DSimulationConfig::MultigridSolver && !mFluidProgram.multigridSupported())
+        qWarning() << "Multigrid is not supported on this device; using Jacobi instead.";
+
+    if (mConfig.adaptiveIterations && !mFluidProgram.reductionsSupported())
+        qWarning() << "Reductions are not supported on this device; using fixed iteration counts.";
+
+    if (mConfig.wholeStepForSmallGrids && !mFluidProgram.usesWholeStep(mConfig))
+        qWarning() << "The whole-step kernel can't be used for this grid, fluid, boundary or device; using separate kernels.";
+
+    if (mConfig.sparseTiles && (!mFluidProgram.usesSparseTiles(mConfig) || mConfig.timeSlices > 1))
+        qWarning() << "Sparse tiles can't be used for this fluid, boundary or device or with time slicing; simulating the whole grid.";
+
+    if (mConfig.spectralSolver && (!mFluidProgram.usesSpectralSolver(mConfig) || mConfig.timeSlices > 1))
+        qWarning() << "The spectral solver needs a periodic grid with power-of-two sides, its kernels and no time slicing; using the iterative solvers.";
+
+    chooseChannelType(wrapper);
+
+    if (!createImages(wrapper, velocityTexture, pressureTexture, velocityTexture2, pressureTexture2))
         return false;
 
 
@@ -29,64 +134,717 @@ bool Fluid2DSimulation::create(MyCLWrapper *wrapper,
     return true;
 }
 
+bool Fluid2DSimulation::createPartitioned(MyCLWrapper *wrappers, int count)
+{
+    if (mConfig.periodicBoundary)
+    {
+        qDebug() << "A partitioned simulation can't be periodic.";
+        return false;
+    }
+
+    if (mConfig.storage != Fluid2DSimulationConfig::BufferStorage)
+    {
+        qWarning() << "A partitioned simulation always uses buffer storage.";
+        mConfig.storage = Fluid2DSimulationConfig::BufferStorage;
+    }
+
+    // The whole grid is kept on the first wrapper for forces and for the result.
+    if (!mBufferProgram.create(&wrappers[0], false, true))
+        return false;
+
+    if (!createBuffers(&wrappers[0], nullptr))
+        return false;
+
+    if (!mPartitionedSolver.create(mConfig, wrappers, count))
+        return false;
+
+    mCLWrapper = &wrappers[0];
+    mInitialized = true;
+    return true;
+}
+
 void Fluid2DSimulation::release()
 {
     if (mInitialized)
     {
-        mVelocities.destroy();
-        mPressure.destroy();
+        mVelocities[0].destroy();
+        mVelocities[1].destroy();
+        mPressure[0].destroy();
+        mPressure[1].destroy();
         mTemp2F_2.destroy();
         mTemp2F_1.destroy();
+        mOutputVelocities[0].destroy();
+        mOutputVelocities[1].destroy();
+        mPreviousVelocities.destroy();
+        clearObstacles();
+        for (MyCLImage2D &img : mSliceImages)
+            img.destroy();
+        mSliceDivergence.destroy();
+        mSlicePressureScratch.destroy();
+        mSolverForces.destroy();
+
+        for (int i = 0; i < 2; ++i)
+        {
+            mVelocityBuffers[i].destroy();
+            mPressureBuffers[i].destroy();
+            mTempBuffers[i].destroy();
+        }
+        mForceBuffer.destroy();
+        mPartitionedSolver.release();
+
+        for (ScalarGroup *group : mScalarGroups)
+            delete group;
+        mScalarGroups.clear();
+        mScalarCount = 0;
+
+        mCPUProgram.release();
+        for (int i = 0; i < 2; ++i)
+        {
+            mCPUVelocities[i] = Fluid2DCPUField();
+            mCPUPressure[i] = Fluid2DCPUField();
+            mCPUTemp[i] = Fluid2DCPUField();
+        }
+
         mInitialized = false;
     }
 }
 
 bool Fluid2DSimulation::update(float dtSeconds)
 {
-    if (!mVelocities.acquire(mCLWrapper->queue())) return false;
-    if (!mPressure.acquire(mCLWrapper->queue())) return false;
+    if (mConfig.storage == Fluid2DSimulationConfig::BufferStorage)
+        return stepBuffers(dtSeconds, NULL);
 
-    if (!mFluidProgram.update(mVelocities,
-                              NULL,
-                              mPressure,
-                              mTemp2F_1,
-                              mTemp2F_2,
-                              mConfig.gridSquareSize,
-                              dtSeconds,
-                              mConfig.density,
-                              mConfig.hasViscosity ? mConfig.viscosity : -1))
+    if (mConfig.storage == Fluid2DSimulationConfig::CPUStorage)
+        return stepCPU(dtSeconds, NULL);
+
+    // The output only changes when a step is completed.
+    bool completes = completesStep();
+    return step(dtSeconds, NULL) && (!completes || writeOutput(false));
+}
+
+bool Fluid2DSimulation::update(float dtSeconds, MyCLImage2D &forces)
+{
+    if (mConfig.storage == Fluid2DSimulationConfig::CPUStorage)
+    {
+        qDebug() << "Forces must be given as a Fluid2DCPUField with CPU storage.";
+        return false;
+    }
+
+    if (mConfig.storage == Fluid2DSimulationConfig::BufferStorage)
+    {
+        if (!mBufferProgram.imageTransfersSupported())
+        {
+            qDebug() << "This device can't read forces from images; pass a MyCLBuffer instead.";
+            return false;
+        }
+
+        if (!forces.acquire(mCLWrapper->queue())) return false;
+        if (!mBufferProgram.imageToBuffer(forces, mForceBuffer)) return false;
+        if (!forces.release(mCLWrapper->queue())) return false;
+
+        return stepBuffers(dtSeconds, &mForceBuffer);
+    }
+
+    MyCLImage2D *solverForces = &forces;
+    if (!toSolverResolution(solverForces))
+        return false;
+
+    bool completes = completesStep();
+    return step(dtSeconds, solverForces) && (!completes || writeOutput(false));
+}
+
+bool Fluid2DSimulation::update(float dtSeconds, MyCLBuffer &forces)
+{
+    Q_ASSERT( mConfig.storage == Fluid2DSimulationConfig::BufferStorage );
+
+    return stepBuffers(dtSeconds, &forces);
+}
+
+bool Fluid2DSimulation::update(float dtSeconds, const Fluid2DCPUField &forces)
+{
+    Q_ASSERT( mConfig.storage == Fluid2DSimulationConfig::CPUStorage );
+
+    return stepCPU(dtSeconds, &forces);
+}
+
+bool Fluid2DSimulation::setObstacles(const QImage &mask)
+{
+    if (!mInitialized || mConfig.storage != Fluid2DSimulationConfig::ImageStorage || mConfig.periodicBoundary)
+    {
+        qDebug() << "Obstacles require a created simulation with image storage and walls.";
+        return false;
+    }
+
+    if (!mHasObstacles && usesOptionsIgnoredByObstacles())
+        qWarning() << "With obstacles, the pressure is solved with plain Jacobi sweeps; ignoring the other pressure solver options.";
+
+    // A shared mask can't be written from here.
+    clearObstacles();
+
+    if (!mObstacles.create(mCLWrapper->context(), mConfig.width, mConfig.height, CL_R, CL_FLOAT))
+    {
+        qDebug() << "Failed to create the obstacle mask.";
+        return false;
+    }
+
+    QImage scaled = mask.scaled(mConfig.width, mConfig.height);
+
+    if (!mObstacles.map(mCLWrapper->queue()))
+        return false;
+
+    for (size_t y = 0; y < mConfig.height; ++y)
+        for (size_t x = 0; x < mConfig.width; ++x)
+            mObstacles.setf(x, y, qGray(scaled.pixel(x, y)) > 127 ? 1 : 0);
+
+    if (!mObstacles.unmap(mCLWrapper->queue()))
+        return false;
+
+    mHasObstacles = true;
+    return true;
+}
+
+bool Fluid2DSimulation::setObstacleTexture(const QOpenGLTexture *texture)
+{
+    if (!mInitialized || mConfig.storage != Fluid2DSimulationConfig::ImageStorage || mConfig.periodicBoundary)
+    {
+        qDebug() << "Obstacles require a created simulation with image storage and walls.";
+        return false;
+    }
+
+    if (texture->width() != (int) mConfig.width || texture->height() != (int) mConfig.height)
+    {
+        qDebug() << "The obstacle texture must have the size of the solver's grid.";
+        return false;
+    }
+
+    if (!mHasObstacles && usesOptionsIgnoredByObstacles())
+        qWarning() << "With obstacles, the pressure is solved with plain Jacobi sweeps; ignoring the other pressure solver options.";
+
+    clearObstacles();
+
+    if (!mObstacles.createShared(mCLWrapper->context(), *texture))
+    {
+        qDebug() << "Failed to share the obstacle texture.";
+        return false;
+    }
+
+    mHasObstacles = true;
+    return true;
+}
+
+void Fluid2DSimulation::clearObstacles()
+{
+    mObstacles.destroy();
+    mHasObstacles = false;
+}
+
+int Fluid2DSimulation::addScalar(const QOpenGLTexture *texture, const QOpenGLTexture *texture2)
+{
+    if (!mInitialized || mConfig.storage != Fluid2DSimulationConfig::ImageStorage)
+    {
+        qDebug() << "Scalars require a created simulation with image storage.";
+        return -1;
+    }
+
+    if (scalarChannel(mScalarCount) == 0)
+    {
+        ScalarGroup *group = new ScalarGroup;
+        group->textures[0] = texture;
+        group->textures[1] = texture2;
+        group->index = 0;
+        group->rotate = (texture == nullptr) == (texture2 == nullptr);
+
+        // A single texture is shared with the first image, which stays current.
+        if (!createImage(mCLWrapper, group->images[0], texture, CL_RGBA, mConfig.width, mConfig.height) ||
+            !createImage(mCLWrapper, group->images[1], texture2, CL_RGBA, mConfig.width, mConfig.height))
+        {
+            delete group;
+            return -1;
+        }
+
+        mScalarGroups.push_back(group);
+    }
+    else if (texture != nullptr || texture2 != nullptr)
+    {
+        qWarning() << "Only the first scalar of every four can have textures; ignoring them.";
+    }
+
+    return mScalarCount++;
+}
+
+MyCLImage2D &Fluid2DSimulation::scalarImage(int scalar)
+{
+    Q_ASSERT( scalar >= 0 && scalar < mScalarCount );
+
+    ScalarGroup *group = mScalarGroups[scalar / 4];
+    return group->images[group->index];
+}
+
+const QOpenGLTexture *Fluid2DSimulation::scalarTexture(int scalar) const
+{
+    Q_ASSERT( scalar >= 0 && scalar < mScalarCount );
+
+    const ScalarGroup *group = mScalarGroups[scalar / 4];
+    return group->textures[group->index];
+}
+
+bool Fluid2DSimulation::addScalarSources(int scalar, MyCLImage2D &sources, float amount)
+{
+    Q_ASSERT( scalar >= 0 && scalar < mScalarCount );
+
+    ScalarGroup *group = mScalarGroups[scalar / 4];
+    MyCLImage2D &current = group->images[group->index];
+    MyCLImage2D &next = group->images[1 - group->index];
+
+    if (!current.acquire(mCLWrapper->queue())) return false;
+    if (!next.acquire(mCLWrapper->queue())) return false;
+
+    if (!mFluidProgram.addScaled(current, sources, amount, next))
+    {
+        qDebug() << "Failed to add scalar sources.";
+        return false;
+    }
+
+    if (group->rotate)
+        group->index = 1 - group->index;
+    else if (!mFluidProgram.copy(next, current))
+        return false;
+
+    if (!next.release(mCLWrapper->queue())) return false;
+    if (!current.release(mCLWrapper->queue())) return false;
+
+    return true;
+}
+
+bool Fluid2DSimulation::advectScalars(float dtSeconds)
+{
+    if (mScalarGroups.empty())
+        return true;
+
+    MyCLImage2D &velocities = mVelocities[mVelocityIndex];
+    if (!velocities.acquire(mCLWrapper->queue())) return false;
+
+    for (ScalarGroup *group : mScalarGroups)
+    {
+        MyCLImage2D &current = group->images[group->index];
+        MyCLImage2D &next = group->images[1 - group->index];
+
+        if (!current.acquire(mCLWrapper->queue())) return false;
+        if (!next.acquire(mCLWrapper->queue())) return false;
+
+        // All four channels are advected at once.
+        if (!mFluidProgram.advect(current, velocities, next, dtSeconds, mConfig.gridSquareSize))
+        {
+            qDebug() << "Failed to advect scalars.";
+            return false;
+        }
+
+        if (group->rotate)
+            group->index = 1 - group->index;
+        else if (!mFluidProgram.copy(next, current))
+            return false;
+
+        if (!next.release(mCLWrapper->queue())) return false;
+        if (!current.release(mCLWrapper->queue())) return false;
+    }
+
+    return velocities.release(mCLWrapper->queue());
+}
+
+bool Fluid2DSimulation::scrollTo(int originX, int originY)
+{
+    if (!mInitialized || mConfig.storage != Fluid2DSimulationConfig::ImageStorage || !mConfig.periodicBoundary)
+    {
+        qDebug() << "Scrolling requires a created simulation with image storage and a periodic boundary.";
+        return false;
+    }
+
+    const int width = mConfig.width;
+    const int height = mConfig.height;
+
+    const int dx = originX - mOriginX;
+    const int dy = originY - mOriginY;
+
+    mOriginX = originX;
+    mOriginY = originY;
+
+    if (std::abs(dx) >= width || std::abs(dy) >= height)
+        return clearCells(originX, originY, width, height);
+
+    // Moving right exposes the columns [old x + width, new x + width), and
+    // moving left exposes [new x, old x). Likewise for the rows.
+    if (dx != 0 && !clearCells(dx > 0 ? originX + width - dx : originX, originY, std::abs(dx), height))
+        return false;
+
+    if (dy != 0 && !clearCells(originX, dy > 0 ? originY + height - dy : originY, width, std::abs(dy)))
+        return false;
+
+    return true;
+}
+
+bool Fluid2DSimulation::clearCells(int x, int y, int countX, int countY)
+{
+    const int width = mConfig.width;
+    const int height = mConfig.height;
+
+    const int firstX = (x % width + width) % width;
+    const int firstY = (y % height + height) % height;
+
+    std::vector<MyCLImage2D *> images = { &mVelocities[0], &mVelocities[1], &mPressure[0], &mPressure[1] };
+
+    if (mConfig.interpolateSteps)
+        images.push_back(&mPreviousVelocities);
+
+    // A step in progress finishes from these.
+    if (mConfig.timeSlices > 1)
+    {
+        for (MyCLImage2D &img : mSliceImages)
+            images.push_back(&img);
+        images.push_back(&mSlicePressureScratch);
+    }
+
+    for (ScalarGroup *group : mScalarGroups)
+    {
+        images.push_back(&group->images[0]);
+        images.push_back(&group->images[1]);
+    }
+
+    for (MyCLImage2D *img : images)
+    {
+        if (!img->acquire(mCLWrapper->queue())) return false;
+
+        if (!mFluidProgram.clearWrapped(*img, firstX, firstY, countX, countY))
+        {
+            qDebug() << "Failed to clear the cells scrolled into view.";
+            return false;
+        }
+
+        if (!img->release(mCLWrapper->queue())) return false;
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulation::advance(float elapsedSeconds)
+{
+    return advanceFixed(elapsedSeconds, nullptr);
+}
+
+bool Fluid2DSimulation::advance(float elapsedSeconds, MyCLImage2D &forces)
+{
+    return advanceFixed(elapsedSeconds, &forces);
+}
+
+bool Fluid2DSimulation::advanceFixed(float elapsedSeconds, MyCLImage2D *forces)
+{
+    const float stepSeconds = mConfig.fixedTimeStep;
+
+    mAccumulatedSeconds += std::max(elapsedSeconds, 0.0f);
+
+    int steps = int(mAccumulatedSeconds / stepSeconds);
+    if (steps > mConfig.maxSubsteps)
+    {
+        // Forget the time that can't be caught up on rather than carrying it
+        // into the next frames.
+        steps = mConfig.maxSubsteps;
+        mAccumulatedSeconds = steps * stepSeconds;
+    }
+
+    if (mConfig.storage != Fluid2DSimulationConfig::ImageStorage)
+    {
+        for (int i = 0; i < steps; ++i)
+        {
+            if (!(forces != nullptr ? update(stepSeconds, *forces) : update(stepSeconds)))
+                return false;
+
+            mAccumulatedSeconds -= stepSeconds;
+        }
+
+        return true;
+    }
+
+    // Without interpolation, the output only changes when a step is completed.
+    if (steps == 0 && !mConfig.interpolateSteps)
+        return true;
+
+    // The forces are the same for every step, so they're downsampled once.
+    if (steps > 0 && !toSolverResolution(forces))
+        return false;
+
+    bool completed = false;
+
+    for (int i = 0; i < steps; ++i)
+    {
+        // Only the state before the last completed step is interpolated from.
+        bool completes = completesStep();
+        completed = completed || completes;
+
+        if (mConfig.interpolateSteps && completes && i + mConfig.timeSlices >= steps)
+        {
+            MyCLImage2D &velocities = mVelocities[mVelocityIndex];
+
+            if (!velocities.acquire(mCLWrapper->queue())) return false;
+            if (!mFluidProgram.copy(velocities, mPreviousVelocities)) return false;
+            if (!velocities.release(mCLWrapper->queue())) return false;
+        }
+
+        if (!step(stepSeconds, forces))
+            return false;
+
+        mAccumulatedSeconds -= stepSeconds;
+    }
+
+    if (!completed && !mConfig.interpolateSteps)
+        return true;
+
+    return writeOutput(mConfig.interpolateSteps);
+}
+
+bool Fluid2DSimulation::toSolverResolution(MyCLImage2D *&forces)
+{
+    if (mLowResolution && forces != nullptr && forces->width() != mConfig.width)
+    {
+        Q_ASSERT( forces->width() == mOutputWidth && forces->height() == mOutputHeight );
+
+        if (!forces->acquire(mCLWrapper->queue())) return false;
+        if (!mFluidProgram.downsampleAverage(*forces, mSolverForces, mConfig.resolutionDivisor)) return false;
+        if (!forces->release(mCLWrapper->queue())) return false;
+
+        forces = &mSolverForces;
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulation::writeOutput(bool interpolate)
+{
+    if (!mSeparateOutput)
+        return true;
+
+    int next = mRotateOutput ? 1 - mOutputIndex : mOutputIndex;
+    MyCLImage2D &output = mOutputVelocities[next];
+    MyCLImage2D *source = &mVelocities[mVelocityIndex];
+
+    if (!output.acquire(mCLWrapper->queue())) return false;
+
+    if (interpolate)
+    {
+        // With time slicing, the fraction of a whole step that has passed
+        // includes the slices done so far.
+        float alpha = (mAccumulatedSeconds + mSlice * mConfig.fixedTimeStep) /
+                      (mConfig.timeSlices * mConfig.fixedTimeStep);
+        alpha = std::min(std::max(alpha, 0.0f), 1.0f);
+
+        // At the output's resolution, the blend can go straight into it.
+        MyCLImage2D &blended = mLowResolution ? mTemp2F_1 : output;
+
+        if (!mFluidProgram.interpolateStates(mPreviousVelocities, *source, alpha, blended)) return false;
+        source = &blended;
+    }
+
+    if (mLowResolution)
+    {
+        if (!mFluidProgram.upsampleBicubic(*source, output)) return false;
+    }
+    else if (source != &output)
+    {
+        if (!mFluidProgram.copy(*source, output)) return false;
+    }
+
+    if (!output.release(mCLWrapper->queue())) return false;
+
+    mOutputIndex = next;
+    return true;
+}
+
+bool Fluid2DSimulation::stepBuffers(float dtSeconds, MyCLBuffer *forces)
+{
+    if (mPartitionedSolver.stripCount() > 0)
+    {
+        if (!mPartitionedSolver.update(mConfig, forces, dtSeconds) ||
+            !mPartitionedSolver.gather(mVelocityBuffers[1 - mBufferIndex], mPressureBuffers[1 - mBufferIndex]))
+        {
+            qDebug() << "Failed in partitioned wind update.";
+            return false;
+        }
+    }
+    else if (!mBufferProgram.update(mConfig,
+                                    mVelocityBuffers[mBufferIndex],
+                                    mVelocityBuffers[1 - mBufferIndex],
+                                    forces,
+                                    mPressureBuffers[mBufferIndex],
+                                    mPressureBuffers[1 - mBufferIndex],
+                                    mTempBuffers[0],
+                                    mTempBuffers[1],
+                                    dtSeconds))
     {
         qDebug() << "Failed in wind update.";
         return false;
     }
 
-    if (!mPressure.release(mCLWrapper->queue())) return false;
-    if (!mVelocities.release(mCLWrapper->queue())) return false;
+    mBufferIndex = 1 - mBufferIndex;
+
+    // Keep the display image (if any) up to date.
+    if (mVelocityTextures[0] != nullptr)
+    {
+        if (!mVelocities[0].acquire(mCLWrapper->queue())) return false;
+        if (!mBufferProgram.bufferToImage(mVelocityBuffers[mBufferIndex], mVelocities[0])) return false;
+        if (!mVelocities[0].release(mCLWrapper->queue())) return false;
+    }
 
     return true;
 }
 
-bool Fluid2DSimulation::update(float dtSeconds, MyCLImage2D &forces)
+bool Fluid2DSimulation::stepCPU(float dtSeconds, const Fluid2DCPUField *forces)
+{
+    if (!mCPUProgram.update(mConfig,
+                            mCPUVelocities[mBufferIndex],
+                            mCPUVelocities[1 - mBufferIndex],
+                            forces,
+                            mCPUPressure[mBufferIndex],
+                            mCPUPressure[1 - mBufferIndex],
+                            mCPUTemp[0],
+                            mCPUTemp[1],
+                            dtSeconds))
+    {
+        qDebug() << "Failed in CPU wind update.";
+        return false;
+    }
+
+    mBufferIndex = 1 - mBufferIndex;
+    return true;
+}
+
+bool Fluid2DSimulation::step(float dtSeconds, MyCLImage2D *forces)
 {
-    if (!mVelocities.acquire(mCLWrapper->queue())) return false;
-    if (!mPressure.acquire(mCLWrapper->queue())) return false;
+    // The scalars move along the velocities that the step starts from.
+    if (!advectScalars(dtSeconds))
+        return false;
+
+    if (mConfig.timeSlices > 1)
+        return stepSlice(dtSeconds, forces);
 
-    if (!mFluidProgram.update(mVelocities,
-                              &forces,
-                              mPressure,
+    MyCLImage2D &velocities = mVelocities[mVelocityIndex];
+    MyCLImage2D &nextVelocities = mVelocities[1 - mVelocityIndex];
+    MyCLImage2D &pressure = mPressure[mPressureIndex];
+    MyCLImage2D &nextPressure = mPressure[1 - mPressureIndex];
+
+    // acquire() and release() do nothing for images that aren't shared.
+    if (!velocities.acquire(mCLWrapper->queue())) return false;
+    if (!nextVelocities.acquire(mCLWrapper->queue())) return false;
+    if (!pressure.acquire(mCLWrapper->queue())) return false;
+    if (!nextPressure.acquire(mCLWrapper->queue())) return false;
+    if (mHasObstacles && !mObstacles.acquire(mCLWrapper->queue())) return false;
+
+    if (!mFluidProgram.update(mConfig,
+                              velocities,
+                              nextVelocities,
+                              forces,
+                              pressure,
+                              nextPressure,
                               mTemp2F_1,
                               mTemp2F_2,
-                              mConfig.gridSquareSize,
                               dtSeconds,
-                              mConfig.density,
-                              mConfig.hasViscosity ? mConfig.viscosity : -1))
+                              mHasObstacles ? &mObstacles : nullptr))
     {
         qDebug() << "Failed in wind update.";
         return false;
     }
 
-    if (!mPressure.release(mCLWrapper->queue())) return false;
-    if (!mVelocities.release(mCLWrapper->queue())) return false;
+    if (mHasObstacles && !mObstacles.release(mCLWrapper->queue())) return false;
+
+    if (!swapState())
+        return false;
+
+    if (!nextPressure.release(mCLWrapper->queue())) return false;
+    if (!pressure.release(mCLWrapper->queue())) return false;
+    if (!nextVelocities.release(mCLWrapper->queue())) return false;
+    if (!velocities.release(mCLWrapper->queue())) return false;
+
+    return true;
+}
+
+bool Fluid2DSimulation::stepSlice(float dtSeconds, MyCLImage2D *forces)
+{
+    const int slices = mConfig.timeSlices;
+
+    MyCLImage2D &velocities = mVelocities[mVelocityIndex];
+    MyCLImage2D &nextVelocities = mVelocities[1 - mVelocityIndex];
+    MyCLImage2D &pressure = mPressure[mPressureIndex];
+    MyCLImage2D &nextPressure = mPressure[1 - mPressureIndex];
+
+    if (!velocities.acquire(mCLWrapper->queue())) return false;
+    if (!nextVelocities.acquire(mCLWrapper->queue())) return false;
+    if (!pressure.acquire(mCLWrapper->queue())) return false;
+    if (!nextPressure.acquire(mCLWrapper->queue())) return false;
+
+    if (mSlice == 0)
+    {
+        mSliceVelocity = &mSliceImages[0];
+        mSliceFree1 = &mSliceImages[1];
+        mSliceFree2 = &mSliceImages[2];
+        mSlicePressure = &pressure;
+        mSliceScratch = &mSlicePressureScratch;
+
+        // The step covers the time of all of its slices.
+        if (!mFluidProgram.beginSlicedStep(mConfig, velocities, forces,
+                                           mSliceVelocity, mSliceFree1, mSliceFree2,
+                                           mSliceDivergence, dtSeconds * slices))
+        {
+            qDebug() << "Failed to begin a sliced wind update.";
+            return false;
+        }
+    }
+
+    // The conjugate gradient solver can't be resumed, so it runs in one slice.
+    const int iterations = mConfig.pressureIterations;
+    int sliceIterations;
+    if (mConfig.pressureSolver == Fluid2DSimulationConfig::ConjugateGradientSolver)
+        sliceIterations = mSlice == 0 ? iterations : 0;
+    else
+        sliceIterations = iterations * (mSlice + 1) / slices - iterations * mSlice / slices;
+
+    if (sliceIterations > 0 &&
+        !mFluidProgram.continuePressureSolve(mConfig, mSlicePressure, mSliceDivergence, mSliceScratch, sliceIterations))
+    {
+        qDebug() << "Failed in a sliced wind update.";
+        return false;
+    }
+
+    if (completesStep())
+    {
+        if (!mFluidProgram.finishSlicedStep(mConfig, *mSliceVelocity, *mSlicePressure, nextVelocities, nextPressure))
+        {
+            qDebug() << "Failed to finish a sliced wind update.";
+            return false;
+        }
+
+        if (!swapState())
+            return false;
+    }
+
+    if (!nextPressure.release(mCLWrapper->queue())) return false;
+    if (!pressure.release(mCLWrapper->queue())) return false;
+    if (!nextVelocities.release(mCLWrapper->queue())) return false;
+    if (!velocities.release(mCLWrapper->queue())) return false;
+
+    mSlice = (mSlice + 1) % slices;
+    return true;
+}
+
+bool Fluid2DSimulation::swapState()
+{
+    // Without rotation, the indices never change, so the next images are
+    // always the other ones.
+    if (mRotateVelocities)
+        mVelocityIndex = 1 - mVelocityIndex;
+    else if (!mFluidProgram.copy(mVelocities[1 - mVelocityIndex], mVelocities[mVelocityIndex]))
+        return false;
+
+    if (mRotatePressure)
+        mPressureIndex = 1 - mPressureIndex;
+    else if (!mFluidProgram.copy(mPressure[1 - mPressureIndex], mPressure[mPressureIndex]))
+        return false;
 
     return true;
 }
@@ -94,7 +852,9 @@ bool Fluid2DSimulation::update(float dtSeconds, MyCLImage2D &forces)
 
 bool Fluid2DSimulation::createImages(MyCLWrapper *wrapper,
                                      const QOpenGLTexture *velocityTexture,
-                                     const QOpenGLTexture *pressureTexture)
+                                     const QOpenGLTexture *pressureTexture,
+                                     const QOpenGLTexture *velocityTexture2,
+                                     const QOpenGLTexture *pressureTexture2)
 {
 // The macro should not have been defined anywhere else.
 #ifdef F2DS_CREATE_IMAGE
@@ -106,53 +866,75 @@ bool Fluid2DSimulation::createImages(MyCLWrapper *wrapper,
     if (!var.create(wrapper->context(),\
                     mConfig.width,\
                     mConfig.height,\
-                    order, CL_FLOAT))\
+                    order, mChannelType))\
     {\
         qDebug() << "Failed to instantiate " #var;\
         return false;\
     }
 
 #define F2DS_CREATE_IMAGE_2F(var) F2DS_CREATE_IMAGE(var, CL_RG)
-#define F2DS_CREATE_IMAGE_1F(var) F2DS_CREATE_IMAGE(var, CL_R)
 
-    if (velocityTexture != nullptr)
+    if (mSeparateOutput)
     {
-        if (!mVelocities.createShared(wrapper->context(), *velocityTexture))
-        {
-            qDebug() << "Failed to instantiate mVelocities from velocity texture.";
+        // The state stays in plain images and the textures receive the
+        // upsampled or interpolated velocities.
+        if (!createOutputImages(wrapper, velocityTexture, velocityTexture2))
             return false;
-        }
 
-        if (mConfig.zeroInitializeSharedTextures)
-            CLNiceties::ZeroImage(wrapper->queue(), mVelocities);
+        velocityTexture = velocityTexture2 = nullptr;
     }
-    else
+
+    if (mLowResolution)
     {
-        F2DS_CREATE_IMAGE_2F(mVelocities);
-        CLNiceties::ZeroImage(wrapper->queue(), mVelocities);
-    }
+        if (pressureTexture != nullptr || pressureTexture2 != nullptr)
+            qWarning() << "Pressure textures are not used when the solver runs at a lower resolution.";
 
+        pressureTexture = pressureTexture2 = nullptr;
 
-    if (pressureTexture != nullptr)
-    {
-        if (!mPressure.createShared(wrapper->context(), *pressureTexture))
-        {
-            qDebug() << "Failed to instantiate mPressure from pressure texture.";
-            return false;
-        }
+        F2DS_CREATE_IMAGE_2F(mSolverForces);
+    }
 
-        if (mConfig.zeroInitializeSharedTextures)
-            CLNiceties::ZeroImage(wrapper->queue(), mPressure);
+    if (mConfig.interpolateSteps)
+    {
+        F2DS_CREATE_IMAGE_2F(mPreviousVelocities);
+        CLNiceties::ZeroImage(wrapper->queue(), mPreviousVelocities);
     }
-    else
+
+    if (mConfig.timeSlices > 1)
     {
-        F2DS_CREATE_IMAGE_1F(mPressure);
-        CLNiceties::ZeroImage(wrapper->queue(), mPressure);
+        F2DS_CREATE_IMAGE_2F(mSliceImages[0]);
+        F2DS_CREATE_IMAGE_2F(mSliceImages[1]);
+        F2DS_CREATE_IMAGE_2F(mSliceImages[2]);
+        F2DS_CREATE_IMAGE(mSliceDivergence, CL_R);
+        F2DS_CREATE_IMAGE(mSlicePressureScratch, CL_R);
+        mSlice = 0;
     }
 
+    if (!createImage(wrapper, mVelocities[0], velocityTexture, CL_RG, mConfig.width, mConfig.height) ||
+        !createImage(wrapper, mVelocities[1], velocityTexture2, CL_RG, mConfig.width, mConfig.height))
+    {
+        qDebug() << "Failed to instantiate mVelocities.";
+        return false;
+    }
 
+    if (!createImage(wrapper, mPressure[0], pressureTexture, CL_R, mConfig.width, mConfig.height) ||
+        !createImage(wrapper, mPressure[1], pressureTexture2, CL_R, mConfig.width, mConfig.height))
+    {
+        qDebug() << "Failed to instantiate mPressure.";
+        return false;
+    }
 
+    // Whoever displays a texture expects the result to be in it after every step.
+    mRotateVelocities = (velocityTexture == nullptr) == (velocityTexture2 == nullptr);
+    mRotatePressure = (pressureTexture == nullptr) == (pressureTexture2 == nullptr);
 
+    if (!mSeparateOutput)
+    {
+        mVelocityTextures[0] = velocityTexture;
+        mVelocityTextures[1] = velocityTexture2;
+    }
+    mVelocityIndex = 0;
+    mPressureIndex = 0;
 
     F2DS_CREATE_IMAGE_2F(mTemp2F_1);
     F2DS_CREATE_IMAGE_2F(mTemp2F_2);
@@ -160,7 +942,141 @@ bool Fluid2DSimulation::createImages(MyCLWrapper *wrapper,
     CLNiceties::ZeroImage(wrapper->queue(), mTemp2F_1);
     CLNiceties::ZeroImage(wrapper->queue(), mTemp2F_2);
 
+#undef F2DS_CREATE_IMAGE_2F
 #undef F2DS_CREATE_IMAGE
 
     return true;
 }
+
+bool Fluid2DSimulation::usesUnsupportedOptions() const
+{
+    return mConfig.advectionScheme != Fluid2DSimulationConfig::SemiLagrangianAdvection ||
+           mConfig.pressureSolver != Fluid2DSimulationConfig::JacobiSolver ||
+           mConfig.jacobiSweepsPerLaunch > 1 || mConfig.adaptiveIterations ||
+           mConfig.fusedKernels || mConfig.wholeStepForSmallGrids || mConfig.vorticityStrength > 0 ||
+           mConfig.precision != Fluid2DSimulationConfig::SinglePrecision || mConfig.resolutionDivisor > 1 ||
+           mConfig.timeSlices > 1 || mConfig.sparseTiles || mConfig.spectralSolver;
+}
+
+bool Fluid2DSimulation::usesOptionsIgnoredByObstacles() const
+{
+    return mConfig.pressureSolver != Fluid2DSimulationConfig::JacobiSolver ||
+           mConfig.jacobiSweepsPerLaunch > 1 || mConfig.adaptiveIterations ||
+           mConfig.wholeStepForSmallGrids || mConfig.sparseTiles || mConfig.spectralSolver;
+}
+
+bool Fluid2DSimulation::createBuffers(MyCLWrapper *wrapper, const QOpenGLTexture *velocityTexture)
+{
+    if (usesUnsupportedOptions())
+        qWarning() << "Buffer storage only supports the basic pipeline; ignoring the other solver options.";
+
+    const size_t bytes = mConfig.width * mConfig.height * sizeof(cl_float2);
+
+    for (MyCLBuffer *buf : {&mVelocityBuffers[0], &mVelocityBuffers[1],
+                            &mPressureBuffers[0], &mPressureBuffers[1],
+                            &mTempBuffers[0], &mTempBuffers[1],
+                            &mForceBuffer})
+    {
+        if (!buf->create(wrapper->context(), bytes))
+        {
+            qDebug() << "Failed to create a fluid simulation buffer.";
+            return false;
+        }
+
+        CLNiceties::ZeroBuffer(wrapper->queue(), *buf);
+    }
+
+    mBufferIndex = 0;
+
+    if (velocityTexture != nullptr)
+    {
+        if (!mBufferProgram.imageTransfersSupported())
+        {
+            qDebug() << "This device can't share the velocity texture with buffer storage.";
+            return false;
+        }
+
+        if (!createImage(wrapper, mVelocities[0], velocityTexture, CL_RG, mConfig.width, mConfig.height))
+            return false;
+
+        mVelocityTextures[0] = velocityTexture;
+    }
+
+    mVelocityIndex = 0;
+    return true;
+}
+
+bool Fluid2DSimulation::createOutputImages(MyCLWrapper *wrapper,
+                                           const QOpenGLTexture *velocityTexture,
+                                           const QOpenGLTexture *velocityTexture2)
+{
+    if (!createImage(wrapper, mOutputVelocities[0], velocityTexture, CL_RG, mOutputWidth, mOutputHeight))
+    {
+        qDebug() << "Failed to instantiate mOutputVelocities.";
+        return false;
+    }
+
+    // With a single texture, every output is written into it.
+    mRotateOutput = velocityTexture2 != nullptr;
+
+    if (mRotateOutput && !createImage(wrapper, mOutputVelocities[1], velocityTexture2, CL_RG, mOutputWidth, mOutputHeight))
+    {
+        qDebug() << "Failed to instantiate mOutputVelocities.";
+        return false;
+    }
+
+    mVelocityTextures[0] = velocityTexture;
+    mVelocityTextures[1] = velocityTexture2;
+    mOutputIndex = 0;
+
+    return true;
+}
+
+bool Fluid2DSimulation::createImage(MyCLWrapper *wrapper,
+                                    MyCLImage2D &img,
+                                    const QOpenGLTexture *texture,
+                                    cl_channel_order order,
+                                    size_t width,
+                                    size_t height)
+{
+    if (texture != nullptr)
+    {
+        if (!img.createShared(wrapper->context(), *texture))
+        {
+            qDebug() << "Failed to instantiate an image from a texture.";
+            return false;
+        }
+
+        if (mConfig.zeroInitializeSharedTextures)
+            CLNiceties::ZeroImage(wrapper->queue(), img);
+    }
+    else
+    {
+        if (!img.create(wrapper->context(), width, height, order, mChannelType))
+        {
+            qDebug() << "Failed to instantiate an image.";
+            return false;
+        }
+
+        CLNiceties::ZeroImage(wrapper->queue(), img);
+    }
+
+    return true;
+}
+
+void Fluid2DSimulation::chooseChannelType(MyCLWrapper *wrapper)
+{
+    mChannelType = CL_FLOAT;
+
+    if (mConfig.precision == Fluid2DSimulationConfig::HalfPrecision)
+    {
+        cl_image_format rg = {CL_RG, CL_HALF_FLOAT};
+        cl_image_format r = {CL_R, CL_HALF_FLOAT};
+
+        if (MyCLImage2D::isFormatSupported(wrapper->context(), rg) &&
+            MyCLImage2D::isFormatSupported(wrapper->context(), r))
+            mChannelType = CL_HALF_FLOAT;
+        else
+            qWarning() << "Half-precision RG and R images are not supported on this device; using single precision.";
+    }
+}
@@ -2,62 +2,21 @@
 #define FLUID2DSIMULATION_H
 
 #include "fluid2dsimulationclprogram.h"
+#include "fluid2dsimulationbufferclprogram.h"
+#include "fluid2dpartitionedsolver.h"
+#include "fluid2dsimulationcpuprogram.h"
+#include "fluid2dsimulationconfig.h"
 
 #include "cl_interface/myclwrapper.h"
 #include "cl_interface/myclimage.h"
+#include "cl_interface/myclbuffer.h"
 #include "cl_interface/include_opencl.h"
 
 #include <QOpenGLTexture>
+#include <QImage>
 #include <QDebug>
 
-struct Fluid2DSimulationConfig
-{
-    /// Creates an inviscid (viscosity = 0) fluid with default density and grid coarseness.
-    Fluid2DSimulationConfig(size_t width, size_t height, float dens = 1, float gridSquare = 0.1f)
-        : width(width),
-          height(height),
-          hasViscosity(false),
-          viscosity(0),
-          density(dens),
-          gridSquareSize(gridSquare),
-          zeroInitializeSharedTextures(true)
-    {
-    }
-
-    /// Helper to enable and set the viscosity. The parameter should be > 0.
-    void setViscosity(float visc)
-    {
-        if (visc <= 0)
-        {
-            qWarning() << "Trying to set nonpositive viscosity disables viscosity.";
-            hasViscosity = false;
-            visc = 0;
-        }
-        else
-        {
-            hasViscosity = true;
-            viscosity = visc;
-        }
-    }
-
-    /// The width of the grid in grid-squares.
-    size_t width;
-
-    /// The height of the grid in grid-squares.
-    size_t height;
-
-    /// Whether this fluid has viscosity.
-    bool hasViscosity;
-    float viscosity;
-
-    float density;
-
-    /// The side-length of a single square in the grid.
-    float gridSquareSize;
-
-    /// Whether to zero-initialize the given OpenGL textures.
-    bool zeroInitializeSharedTextures;
-};
+#include <vector>
 
 class Fluid2DSimulation
 {
@@ -67,9 +26,35 @@ public:
 
     /// Creates the fluid simulation, optionally using the given OpenGL textures
     /// for some storage (so that the output may be visualized).
+    ///
+    /// The simulation keeps two images each for the velocities and pressure and
+    /// alternates between them every step. Each second texture, if given, is used
+    /// for the other image; otherwise the result is copied into the first texture
+    /// every step. See velocityTexture().
+    ///
+    /// With BufferStorage, the state is kept in buffers instead and only the
+    /// first velocity texture is used; the velocities are copied into it after
+    /// every step. The pressure textures are ignored.
+    ///
+    /// With CPUStorage, the state is kept in host memory and every texture is
+    /// ignored. The wrapper isn't used and may be nullptr.
     bool create(MyCLWrapper *wrapper,
                 const QOpenGLTexture *velocityTexture = nullptr,
-                const QOpenGLTexture *pressureTexture = nullptr);
+                const QOpenGLTexture *pressureTexture = nullptr,
+                const QOpenGLTexture *velocityTexture2 = nullptr,
+                const QOpenGLTexture *pressureTexture2 = nullptr);
+
+
+    /// Creates the simulation split into horizontal strips, one per wrapper in
+    /// wrappers[0..count), which must share one context, like the sub-devices
+    /// from MyCLWrapper::createPartitioned(). Each strip is solved on its own
+    /// queue with the buffer pipeline and exchanges halo rows with its
+    /// neighbors (see Fluid2DPartitionedSolver and partitionHaloRows). After
+    /// every step, the strips are gathered into velocityBuffer() and
+    /// pressureBuffer() on the first wrapper's queue, which is also the one
+    /// that forces are read on. Always uses BufferStorage without textures,
+    /// and the grid must not be periodic.
+    bool createPartitioned(MyCLWrapper *wrappers, int count);
 
 
     /// Releases the OpenCL objects created in create(). Releases nothing other than that
@@ -79,22 +64,199 @@ public:
     /// Updates the fluid without applying forces.
     bool update(float dtSeconds);
 
-    /// Updates the fluid, applying forces.
+    /// Updates the fluid, applying forces. With BufferStorage, the device must
+    /// support images.
     bool update(float dtSeconds, MyCLImage2D &forces);
 
+    /// Updates the fluid, applying forces given as a vector field buffer.
+    /// Only valid with BufferStorage.
+    bool update(float dtSeconds, MyCLBuffer &forces);
+
+    /// Updates the fluid, applying forces given as a field in host memory.
+    /// Only valid with CPUStorage.
+    bool update(float dtSeconds, const Fluid2DCPUField &forces);
+
+    /// Adds elapsedSeconds to the simulated time and takes as many steps of the
+    /// config's fixedTimeStep as are due, up to its maxSubsteps, interpolating
+    /// the output velocities between the last two steps if interpolateSteps is
+    /// set. Meant to be called once per frame with the frame's duration.
+    bool advance(float elapsedSeconds);
+
+    /// Like advance(float), applying the same forces in every step.
+    bool advance(float elapsedSeconds, MyCLImage2D &forces);
+
+    /// Sets the obstacles from an image, such as one rasterized with QPainter.
+    /// The image is scaled to the solver's grid, and cells whose pixel is
+    /// lighter than mid-gray become solid. May be called between any steps.
+    bool setObstacles(const QImage &mask);
+
+    /// Uses a single-channel OpenGL texture of the solver's grid size as the
+    /// obstacle mask, so that obstacles can be rendered into it. Texels above
+    /// 0.5 are solid. The texture is read at every step.
+    bool setObstacleTexture(const QOpenGLTexture *texture);
+
+    /// Removes the obstacles, going back to the boundary kernels.
+    void clearObstacles();
+
+    /// Whether the simulation has an obstacle mask. With obstacles, every
+    /// step uses the obstacle kernels (see Fluid2DSimulationCLProgram::update()),
+    /// which solve the pressure with plain Jacobi sweeps whatever the config's
+    /// solver options; setting the first obstacles warns if any are set.
+    /// Obstacles are ignored with BufferStorage and time slicing, and can't be
+    /// set on a periodic grid.
+    bool hasObstacles() const { return mHasObstacles; }
+
+    /// Moves the grid over a larger world so that its lower corner is at the
+    /// world cell (originX, originY), counted in cells of the solver's grid,
+    /// e.g. to keep it under the camera. Requires periodicBoundary: the world
+    /// cell (x, y) is stored at (x mod gridWidth(), y mod gridHeight()), so
+    /// nothing is copied and only the rows and columns that come into view are
+    /// cleared. Wind leaving the grid comes back in at the opposite edge until
+    /// the grid moves over it. The output velocities catch up at the next step.
+    bool scrollTo(int originX, int originY);
+
+    /// Registers a passive scalar field, such as smoke density or temperature,
+    /// which is carried along by the wind in every step and starts out as 0.
+    /// Returns its index, or -1 on failure. The scalars are packed four to an
+    /// RGBA image of the solver's grid size, in the channels 0 to 3 of
+    /// scalarImage(), and each image is advected in a single launch per step.
+    ///
+    /// A scalar that starts a new image (every fourth one) may share it with an
+    /// RGBA float texture of the solver's grid size, for rendering; like the
+    /// velocity textures, a second one lets the two trade places every step,
+    /// and otherwise the result is copied into the first. The textures are
+    /// ignored for the other scalars. Requires image storage.
+    int addScalar(const QOpenGLTexture *texture = nullptr, const QOpenGLTexture *texture2 = nullptr);
+
+    /// The number of scalars registered with addScalar().
+    int scalarCount() const { return mScalarCount; }
+
+    /// The channel of the scalar in its image.
+    static int scalarChannel(int scalar) { return scalar % 4; }
+
+    /// The image holding the current values of the scalar and of the others
+    /// in its group of four. This changes between steps.
+    MyCLImage2D &scalarImage(int scalar);
+
+    /// The OpenGL texture holding the current values of the scalar's group, or
+    /// nullptr if it doesn't have one. This changes between steps.
+    const QOpenGLTexture *scalarTexture(int scalar) const;
+
+    /// Adds amount times an RGBA image of the solver's grid size to the
+    /// scalar's image, one channel per scalar of its group, e.g. to emit smoke.
+    bool addScalarSources(int scalar, MyCLImage2D &sources, float amount = 1);
+
+    /// The world cell at the grid's lower corner. See scrollTo().
+    int originX() const { return mOriginX; }
+    int originY() const { return mOriginY; }
+
+    /// The size of the solver's grid. This is smaller than the configured size
+    /// if the config has a resolutionDivisor above 1.
     size_t gridWidth() const { return mConfig.width; }
     size_t gridHeight() const { return mConfig.height; }
 
-    const MyCLImage2D &velocities() const { return mVelocities; }
-    MyCLImage2D &velocities() { return mVelocities; }
+    /// The image holding the current velocities at the configured resolution,
+    /// which is the one shared with velocityTexture() if there is one. This is
+    /// velocities() unless the solver runs at a lower resolution or advance()
+    /// interpolates between steps. This changes between steps.
+    MyCLImage2D &outputVelocities() { return mSeparateOutput ? mOutputVelocities[mOutputIndex] : mVelocities[mVelocityIndex]; }
+
+    /// The images holding the current state. These change between steps.
+    const MyCLImage2D &velocities() const { return mVelocities[mVelocityIndex]; }
+    MyCLImage2D &velocities() { return mVelocities[mVelocityIndex]; }
 
-    const MyCLImage2D &pressure() const { return mPressure; }
-    MyCLImage2D &pressure() { return mPressure; }
+    const MyCLImage2D &pressure() const { return mPressure[mPressureIndex]; }
+    MyCLImage2D &pressure() { return mPressure[mPressureIndex]; }
+
+    /// The buffers holding the current state with BufferStorage. These change
+    /// between steps. The velocities are cl_float2 per cell.
+    MyCLBuffer &velocityBuffer() { return mVelocityBuffers[mBufferIndex]; }
+    MyCLBuffer &pressureBuffer() { return mPressureBuffers[mBufferIndex]; }
+
+    /// The fields holding the current state with CPUStorage. These change
+    /// between steps. The pressure is in the x plane.
+    const Fluid2DCPUField &cpuVelocities() const { return mCPUVelocities[mBufferIndex]; }
+    const Fluid2DCPUField &cpuPressure() const { return mCPUPressure[mBufferIndex]; }
+
+    /// The OpenGL texture holding the current velocities, or nullptr if
+    /// no velocity texture was given to create(). This changes between steps.
+    const QOpenGLTexture *velocityTexture() const { return mVelocityTextures[mSeparateOutput ? mOutputIndex : mVelocityIndex]; }
 
 private:
     bool createImages(MyCLWrapper *wrapper,
-                      const QOpenGLTexture *velocityTexture = nullptr,
-                      const QOpenGLTexture *pressureTexture = nullptr);
+                      const QOpenGLTexture *velocityTexture,
+                      const QOpenGLTexture *pressureTexture,
+                      const QOpenGLTexture *velocityTexture2,
+                      const QOpenGLTexture *pressureTexture2);
+
+    bool createBuffers(MyCLWrapper *wrapper, const QOpenGLTexture *velocityTexture);
+
+    /// Whether the config asks for anything beyond the basic pipeline, which
+    /// is all that BufferStorage and CPUStorage support.
+    bool usesUnsupportedOptions() const;
+
+    /// Whether the config asks for a pressure solve that the obstacle kernels,
+    /// which always do plain Jacobi sweeps, can't do.
+    bool usesOptionsIgnoredByObstacles() const;
+
+    /// Advances the simulation, swapping the current and next images afterward.
+    /// The forces must be at the solver's resolution.
+    bool step(float dtSeconds, MyCLImage2D *forces);
+
+    /// Does the next slice of a step spread over mConfig.timeSlices calls, and
+    /// swaps the current and next images after the last one.
+    bool stepSlice(float dtSeconds, MyCLImage2D *forces);
+
+    /// Whether the next call to step() completes a step.
+    bool completesStep() const { return mSlice == mConfig.timeSlices - 1; }
+
+    /// Makes the next images current, copying them into the current ones
+    /// for pairs that can't rotate.
+    bool swapState();
+
+    /// Zeroes the countX x countY block of world cells starting at (x, y) in
+    /// every image that holds state, for scrollTo().
+    bool clearCells(int x, int y, int countX, int countY);
+
+    /// The body of both advance() overloads. forces may be nullptr.
+    bool advanceFixed(float elapsedSeconds, MyCLImage2D *forces);
+
+    /// Points forces at mSolverForces, averaged down from the given forces,
+    /// if they are at the configured resolution of a low-resolution solver.
+    bool toSolverResolution(MyCLImage2D *&forces);
+
+    /// Writes the current velocities into the next of mOutputVelocities,
+    /// blending them with mPreviousVelocities by the fraction of a step left
+    /// in mAccumulatedSeconds if interpolate is set. Does nothing if the
+    /// textures share the state images.
+    bool writeOutput(bool interpolate);
+
+    /// Like step(), but with BufferStorage.
+    bool stepBuffers(float dtSeconds, MyCLBuffer *forces);
+
+    /// Advects every group of scalars along the current velocities.
+    bool advectScalars(float dtSeconds);
+
+    /// Like step(), but with CPUStorage.
+    bool stepCPU(float dtSeconds, const Fluid2DCPUField *forces);
+
+    /// Creates mOutputVelocities from the textures, for mSeparateOutput.
+    bool createOutputImages(MyCLWrapper *wrapper,
+                            const QOpenGLTexture *velocityTexture,
+                            const QOpenGLTexture *velocityTexture2);
+
+    /// Creates img from the texture, or as a plain image of the given size with
+    /// the given channel order and mChannelType if the texture is nullptr, and
+    /// zero-initializes it.
+    bool createImage(MyCLWrapper *wrapper,
+                     MyCLImage2D &img,
+                     const QOpenGLTexture *texture,
+                     cl_channel_order order,
+                     size_t width,
+                     size_t height);
+
+    /// Picks mChannelType from the configured precision and the device's support.
+    void chooseChannelType(MyCLWrapper *wrapper);
 
     bool mInitialized;
 
@@ -102,11 +264,109 @@ private:
 
     Fluid2DSimulationConfig mConfig;
     Fluid2DSimulationCLProgram mFluidProgram;
+    Fluid2DSimulationBufferCLProgram mBufferProgram;
+
+    /// The current and next images. update() writes into the next image and
+    /// then swaps the indices.
+    MyCLImage2D mVelocities[2];
+    MyCLImage2D mPressure[2];
+    int mVelocityIndex;
+    int mPressureIndex;
+
+    /// Whether the images in each pair can trade places. If only one of them is
+    /// shared with OpenGL, the result is copied into that one instead.
+    bool mRotateVelocities;
+    bool mRotatePressure;
+
+    const QOpenGLTexture *mVelocityTextures[2];
+
+    /// The data type of the images that aren't shared with OpenGL:
+    /// CL_FLOAT or CL_HALF_FLOAT.
+    cl_channel_type mChannelType;
+
+    /// Whether the textures are shared with mOutputVelocities instead of the
+    /// state. If so, every step is written from mVelocities into one of
+    /// mOutputVelocities, which rotate like mVelocities if two velocity
+    /// textures were given.
+    bool mSeparateOutput;
+
+    /// Whether the solver runs at a lower resolution than the configured one.
+    /// If so, mConfig describes the solver's grid and the output is upsampled.
+    bool mLowResolution;
+    MyCLImage2D mOutputVelocities[2];
+    int mOutputIndex;
+    bool mRotateOutput;
+    size_t mOutputWidth;
+    size_t mOutputHeight;
+
+    /// The world cell at the grid's lower corner. See scrollTo().
+    int mOriginX;
+    int mOriginY;
+
+    /// The obstacle mask, if mHasObstacles.
+    MyCLImage2D mObstacles;
+    bool mHasObstacles;
+
+    /// Forces given at the configured resolution, averaged down to the solver's.
+    MyCLImage2D mSolverForces;
+
+    /// The simulated time that advance() hasn't taken a step for yet.
+    float mAccumulatedSeconds;
+
+    /// The velocities before the last step taken by advance(), with
+    /// interpolateSteps.
+    MyCLImage2D mPreviousVelocities;
+
+    /// The slice that the next call to step() does, with timeSlices.
+    int mSlice;
+
+    /// The work images of a sliced step, which must keep their contents
+    /// between calls. The pointers track which of them hold what.
+    MyCLImage2D mSliceImages[3];
+    MyCLImage2D mSliceDivergence;
+    MyCLImage2D mSlicePressureScratch;
+    MyCLImage2D *mSliceVelocity;
+    MyCLImage2D *mSliceFree1;
+    MyCLImage2D *mSliceFree2;
+    MyCLImage2D *mSlicePressure;
+    MyCLImage2D *mSliceScratch;
 
-    MyCLImage2D mVelocities;
-    MyCLImage2D mPressure;
     MyCLImage2D mTemp2F_1;
     MyCLImage2D mTemp2F_2;
+
+    /// The storage used with BufferStorage, rotated like the images. Every
+    /// buffer is sized for a vector field (see Fluid2DSimulationBufferCLProgram).
+    MyCLBuffer mVelocityBuffers[2];
+    MyCLBuffer mPressureBuffers[2];
+    MyCLBuffer mTempBuffers[2];
+    int mBufferIndex;
+
+    /// Holds forces given as an image, with BufferStorage.
+    MyCLBuffer mForceBuffer;
+
+    /// Solves the strips of a simulation made with createPartitioned(). Has no
+    /// strips otherwise.
+    Fluid2DPartitionedSolver mPartitionedSolver;
+
+    /// The program and storage used with CPUStorage. The velocities and
+    /// pressure rotate with mBufferIndex.
+    Fluid2DSimulationCPUProgram mCPUProgram;
+    Fluid2DCPUField mCPUVelocities[2];
+    Fluid2DCPUField mCPUPressure[2];
+    Fluid2DCPUField mCPUTemp[2];
+
+    /// The images of up to four scalars, rotated like the velocities if both
+    /// or neither are shared with a texture.
+    struct ScalarGroup
+    {
+        MyCLImage2D images[2];
+        const QOpenGLTexture *textures[2];
+        int index;
+        bool rotate;
+    };
+
+    std::vector<ScalarGroup *> mScalarGroups;
+    int mScalarCount;
 };
 
 #endif // FLUID2DSIMULATION_H
@@ -0,0 +1,510 @@
+#include "fluid2dsimulationbufferclprogram.h"
+
+#include <algorithm>
+
+
+Fluid2DSimulationBufferCLProgram::Fluid2DSimulationBufferCLProgram()
+    : mCreated(false),
+      mPeriodicBoundary(false),
+      mImageTransfers(false),
+      mEnsembleLocalSize(0),
+      mWidth(0),
+      mHeight(0)
+{
+}
+
+bool Fluid2DSimulationBufferCLProgram::create(MyCLWrapper *wrapper, bool periodicBoundary, bool imageTransfers)
+{
+    mCLWrapper = wrapper;
+    mPeriodicBoundary = periodicBoundary;
+
+    if (imageTransfers)
+    {
+        // The image kernels don't compile on devices without image support.
+        cl_bool imageSupport = CL_FALSE;
+        clGetDeviceInfo(wrapper->device(), CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &imageSupport, NULL);
+        imageTransfers = imageSupport;
+    }
+
+    mImageTransfers = imageTransfers;
+
+    QString options;
+    if (periodicBoundary)
+        options += " -D PERIODIC_BOUNDARY";
+    if (imageTransfers)
+        options += " -D IMAGE_TRANSFERS";
+
+    if (!mProgram.create(wrapper, ":/compute/fluidSimulationBuffers.cl", options))
+    {
+        qDebug() << "Failed to create fluid simulation buffer program.";
+        return false;
+    }
+
+#ifndef MAKE_KERNEL
+#define MAKE_KERNEL(var, name)\
+    if (!var.createFromProgram(wrapper, mProgram.program(), name))\
+    {\
+        qDebug() << "Failed to create " name " kernel.";\
+        return false;\
+    }
+
+    MAKE_KERNEL(mJacobi2Kernel, "jacobi2");
+    MAKE_KERNEL(mJacobi1Kernel, "jacobi1");
+    MAKE_KERNEL(mAdvectKernel, "advect");
+    MAKE_KERNEL(mAdvectStripKernel, "advectStrip");
+    MAKE_KERNEL(mDivergenceKernel, "divergence");
+    MAKE_KERNEL(mGradientKernel, "gradient");
+    MAKE_KERNEL(mAddScaledKernel, "addScaled");
+    MAKE_KERNEL(mVelocityBoundaryKernel, "velocityBoundary");
+    MAKE_KERNEL(mPressureBoundaryKernel, "pressureBoundary");
+    MAKE_KERNEL(mEnsembleAdvectKernel, "ensembleAdvect");
+    MAKE_KERNEL(mEnsembleDiffuseKernel, "ensembleDiffuse");
+    MAKE_KERNEL(mEnsembleAddForcesKernel, "ensembleAddForces");
+    MAKE_KERNEL(mEnsembleDivergenceKernel, "ensembleDivergence");
+    MAKE_KERNEL(mEnsembleJacobi1Kernel, "ensembleJacobi1");
+    MAKE_KERNEL(mEnsembleProjectKernel, "ensembleProject");
+    MAKE_KERNEL(mEnsembleVelocityBoundaryKernel, "ensembleVelocityBoundary");
+    MAKE_KERNEL(mEnsemblePressureBoundaryKernel, "ensemblePressureBoundary");
+
+    if (imageTransfers)
+    {
+        MAKE_KERNEL(mBufferToImageKernel, "bufferToImage2");
+        MAKE_KERNEL(mImageToBufferKernel, "imageToBuffer2");
+    }
+#undef MAKE_KERNEL
+#else
+    static_assert(false);
+#endif
+
+    // The largest square power-of-two work group every ensemble kernel can be
+    // launched with, up to 16 x 16.
+    size_t ensembleLimit = std::min({mEnsembleAdvectKernel.maxWorkGroupSize(),
+                                     mEnsembleDiffuseKernel.maxWorkGroupSize(),
+                                     mEnsembleAddForcesKernel.maxWorkGroupSize(),
+                                     mEnsembleDivergenceKernel.maxWorkGroupSize(),
+                                     mEnsembleJacobi1Kernel.maxWorkGroupSize(),
+                                     mEnsembleProjectKernel.maxWorkGroupSize(),
+                                     mEnsembleVelocityBoundaryKernel.maxWorkGroupSize(),
+                                     mEnsemblePressureBoundaryKernel.maxWorkGroupSize()});
+
+    mEnsembleLocalSize = 16;
+    while (mEnsembleLocalSize > 1 && mEnsembleLocalSize * mEnsembleLocalSize > ensembleLimit)
+        mEnsembleLocalSize /= 2;
+
+    mCreated = true;
+    return true;
+}
+
+void Fluid2DSimulationBufferCLProgram::release()
+{
+    mJacobi2Kernel.destroy();
+    mJacobi1Kernel.destroy();
+    mAdvectKernel.destroy();
+    mAdvectStripKernel.destroy();
+    mDivergenceKernel.destroy();
+    mGradientKernel.destroy();
+    mAddScaledKernel.destroy();
+    mVelocityBoundaryKernel.destroy();
+    mPressureBoundaryKernel.destroy();
+    mBufferToImageKernel.destroy();
+    mImageToBufferKernel.destroy();
+    mEnsembleAdvectKernel.destroy();
+    mEnsembleDiffuseKernel.destroy();
+    mEnsembleAddForcesKernel.destroy();
+    mEnsembleDivergenceKernel.destroy();
+    mEnsembleJacobi1Kernel.destroy();
+    mEnsembleProjectKernel.destroy();
+    mEnsembleVelocityBoundaryKernel.destroy();
+    mEnsemblePressureBoundaryKernel.destroy();
+
+    mProgram.destroy();
+
+    mCreated = false;
+}
+
+bool Fluid2DSimulationBufferCLProgram::update(const Fluid2DSimulationConfig &config,
+                                              MyCLBuffer &velocities,
+                                              MyCLBuffer &velocitiesOut,
+                                              MyCLBuffer *forces,
+                                              MyCLBuffer &pressure,
+                                              MyCLBuffer &pressureOut,
+                                              MyCLBuffer &temp1,
+                                              MyCLBuffer &temp2,
+                                              cl_float dt)
+{
+    Q_ASSERT( mCreated );
+    Q_ASSERT( &velocitiesOut != &velocities && &velocitiesOut != &temp1 && &velocitiesOut != &temp2 );
+    Q_ASSERT( &pressureOut != &pressure && &pressureOut != &temp1 && &pressureOut != &temp2 );
+    Q_ASSERT( config.periodicBoundary == mPeriodicBoundary );
+
+    setGridSize(config.width, config.height);
+
+    const size_t vectorFieldSize = config.width * config.height * sizeof(cl_float2);
+    Q_ASSERT( pressure.size() >= vectorFieldSize && temp1.size() >= vectorFieldSize && temp2.size() >= vectorFieldSize );
+    Q_UNUSED( vectorFieldSize );
+
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float density = config.density;
+    const cl_float viscosity = config.hasViscosity ? config.viscosity : -1;
+
+    // The same bookkeeping as in Fluid2DSimulationCLProgram::update().
+    MyCLBuffer *velocityBuffer = &velocities;
+    MyCLBuffer *pressureBuffer = &pressure;
+
+    MyCLBuffer *freeBuffer1 = &temp1;
+    MyCLBuffer *freeBuffer2 = &temp2;
+
+
+    /* Step 1: Advection */
+    if (!advect(*velocityBuffer, *velocityBuffer, *freeBuffer1, dt, gridSize))
+    {
+        qDebug() << "Failure in advection step.";
+        return false;
+    }
+    std::swap(velocityBuffer, freeBuffer1);
+
+
+    /* Step 2: Diffusion (optional) */
+    if (viscosity > 0)
+    {
+        cl_float hh_vdt = gridSize * gridSize / (viscosity * dt);
+
+        for (int iteration = 0; iteration < 30; ++iteration)
+        {
+            MyCLBuffer *t1 = velocityBuffer;
+            MyCLBuffer *t2 = freeBuffer1;
+
+            for (int subIteration = 0; subIteration < 2; ++subIteration)
+            {
+                if (!jacobi2(*t1, *t1, *t2, hh_vdt, 4 + hh_vdt))
+                {
+                    qDebug() << "Failure in diffusion step.";
+                    return false;
+                }
+
+                std::swap(t1, t2);
+            }
+        }
+    }
+
+    /* Step 3: Add forces (optional) */
+    if (forces != nullptr)
+    {
+        if (!addScaled(*velocityBuffer, *forces, dt, *freeBuffer1))
+        {
+            qDebug() << "Failure in add-forces step.";
+            return false;
+        }
+
+        std::swap(velocityBuffer, freeBuffer1);
+    }
+
+    /* Step 4: Update pressure */
+    MyCLBuffer *divergenceBuffer = freeBuffer1;
+    MyCLBuffer *scratch = freeBuffer2;
+
+    if (!divergence(*velocityBuffer, *divergenceBuffer, gridSize))
+    {
+        qDebug() << "Failure in computing divergence.";
+        return false;
+    }
+
+    for (int iteration = 0; iteration < config.pressureIterations; ++iteration)
+    {
+        if (!jacobi1(*pressureBuffer, *divergenceBuffer, *scratch, -gridSize * gridSize, 4))
+        {
+            qDebug() << "Failure in pressure computation.";
+            return false;
+        }
+
+        std::swap(pressureBuffer, scratch);
+    }
+
+    // The divergence isn't needed anymore.
+    MyCLBuffer *gradientBuffer = divergenceBuffer;
+
+    /* Step 5: Subtract pressure gradient */
+    if (!gradient(*pressureBuffer, *gradientBuffer, gridSize))
+    {
+        qDebug() << "Failure in pressure gradient computation.";
+        return false;
+    }
+
+    // Without a boundary, the projected velocities are the result.
+    if (mPeriodicBoundary)
+        scratch = &velocitiesOut;
+
+    if (!addScaled(*velocityBuffer, *gradientBuffer, -1.0/density, *scratch))
+    {
+        qDebug() << "Failure in subtracting pressure gradient.";
+        return false;
+    }
+    std::swap(velocityBuffer, scratch);
+
+    if (mPeriodicBoundary)
+    {
+        cl_int err = clEnqueueCopyBuffer(mCLWrapper->queue(), pressureBuffer->buffer(), pressureOut.buffer(),
+                                         0, 0, config.width * config.height * sizeof(cl_float), 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            qDebug() << "Failure copying the pressure.";
+            return false;
+        }
+
+        return true;
+    }
+
+    /* Step 6: Enforce boundary conditions */
+    if (!velocityBoundary(*velocityBuffer, velocitiesOut))
+    {
+        qDebug() << "Failure enforcing velocity boundary.";
+        return false;
+    }
+
+    if (!pressureBoundary(*pressureBuffer, pressureOut))
+    {
+        qDebug() << "Failure enforcing pressure boundary.";
+        return false;
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulationBufferCLProgram::updateEnsemble(const Fluid2DSimulationConfig &config,
+                                                      cl_int count,
+                                                      MyCLBuffer &params,
+                                                      MyCLBuffer &velocities,
+                                                      MyCLBuffer &velocitiesOut,
+                                                      MyCLBuffer *forces,
+                                                      MyCLBuffer &pressure,
+                                                      MyCLBuffer &pressureOut,
+                                                      MyCLBuffer &temp1,
+                                                      MyCLBuffer &temp2,
+                                                      bool diffuse)
+{
+    Q_ASSERT( mCreated );
+    Q_ASSERT( &velocitiesOut != &velocities && &velocitiesOut != &temp1 && &velocitiesOut != &temp2 );
+    Q_ASSERT( &pressureOut != &pressure && &pressureOut != &temp1 && &pressureOut != &temp2 );
+    Q_ASSERT( config.periodicBoundary == mPeriodicBoundary );
+    Q_ASSERT( params.size() >= count * sizeof(cl_float4) );
+
+    setGridSize(config.width, config.height);
+
+    const size_t vectorFieldSize = count * config.width * config.height * sizeof(cl_float2);
+    Q_ASSERT( pressure.size() >= vectorFieldSize && temp1.size() >= vectorFieldSize && temp2.size() >= vectorFieldSize );
+    Q_UNUSED( vectorFieldSize );
+
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float hInv = 1.0 / gridSize;
+
+    // The same bookkeeping as in update().
+    MyCLBuffer *velocityBuffer = &velocities;
+    MyCLBuffer *pressureBuffer = &pressure;
+
+    MyCLBuffer *freeBuffer1 = &temp1;
+    MyCLBuffer *freeBuffer2 = &temp2;
+
+#ifdef F2DE_RUN
+    static_assert(false);
+#endif
+
+    // The work groups are one field deep, since the kernels don't check
+    // get_global_id(2) against count.
+#define F2DE_RUN(kernel, ...)\
+    kernel.runWithLocalSize(mWidth, mHeight, count, mEnsembleLocalSize, mEnsembleLocalSize, 1, __VA_ARGS__)
+
+
+    /* Step 1: Advection */
+    if (!F2DE_RUN(mEnsembleAdvectKernel, *velocityBuffer, *velocityBuffer, *freeBuffer1, params, hInv, mWidth, mHeight))
+    {
+        qDebug() << "Failure in ensemble advection step.";
+        return false;
+    }
+    std::swap(velocityBuffer, freeBuffer1);
+
+
+    /* Step 2: Diffusion (optional) */
+    if (diffuse)
+    {
+        // The same 60 sweeps as update(), which end in velocityBuffer.
+        for (int sweep = 0; sweep < 60; ++sweep)
+        {
+            if (!F2DE_RUN(mEnsembleDiffuseKernel, *velocityBuffer, *freeBuffer1, params, gridSize * gridSize, mWidth, mHeight))
+            {
+                qDebug() << "Failure in ensemble diffusion step.";
+                return false;
+            }
+
+            std::swap(velocityBuffer, freeBuffer1);
+        }
+    }
+
+    /* Step 3: Add forces (optional) */
+    if (forces != nullptr)
+    {
+        if (!F2DE_RUN(mEnsembleAddForcesKernel, *velocityBuffer, *forces, *freeBuffer1, params, mWidth, mHeight))
+        {
+            qDebug() << "Failure in ensemble add-forces step.";
+            return false;
+        }
+
+        std::swap(velocityBuffer, freeBuffer1);
+    }
+
+    /* Step 4: Update pressure */
+    MyCLBuffer *divergenceBuffer = freeBuffer1;
+    MyCLBuffer *scratch = freeBuffer2;
+
+    if (!F2DE_RUN(mEnsembleDivergenceKernel, *velocityBuffer, *divergenceBuffer, hInv, mWidth, mHeight))
+    {
+        qDebug() << "Failure in computing ensemble divergence.";
+        return false;
+    }
+
+    for (int iteration = 0; iteration < config.pressureIterations; ++iteration)
+    {
+        if (!F2DE_RUN(mEnsembleJacobi1Kernel, *pressureBuffer, *divergenceBuffer, *scratch,
+                      -gridSize * gridSize, 0.25f, mWidth, mHeight))
+        {
+            qDebug() << "Failure in ensemble pressure computation.";
+            return false;
+        }
+
+        std::swap(pressureBuffer, scratch);
+    }
+
+    /* Step 5: Subtract pressure gradient */
+    // The divergence isn't needed anymore.
+    MyCLBuffer *projected = mPeriodicBoundary ? &velocitiesOut : divergenceBuffer;
+
+    if (!F2DE_RUN(mEnsembleProjectKernel, *velocityBuffer, *pressureBuffer, *projected, params, hInv, mWidth, mHeight))
+    {
+        qDebug() << "Failure in subtracting ensemble pressure gradient.";
+        return false;
+    }
+    velocityBuffer = projected;
+
+    if (mPeriodicBoundary)
+    {
+        cl_int err = clEnqueueCopyBuffer(mCLWrapper->queue(), pressureBuffer->buffer(), pressureOut.buffer(),
+                                         0, 0, count * config.width * config.height * sizeof(cl_float), 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            qDebug() << "Failure copying the ensemble pressure.";
+            return false;
+        }
+
+        return true;
+    }
+
+    /* Step 6: Enforce boundary conditions */
+    if (!F2DE_RUN(mEnsembleVelocityBoundaryKernel, *velocityBuffer, velocitiesOut, mWidth, mHeight))
+    {
+        qDebug() << "Failure enforcing ensemble velocity boundary.";
+        return false;
+    }
+
+    if (!F2DE_RUN(mEnsemblePressureBoundaryKernel, *pressureBuffer, pressureOut, mWidth, mHeight))
+    {
+        qDebug() << "Failure enforcing ensemble pressure boundary.";
+        return false;
+    }
+
+#undef F2DE_RUN
+
+    return true;
+}
+
+void Fluid2DSimulationBufferCLProgram::setGridSize(cl_int width, cl_int height)
+{
+    mWidth = width;
+    mHeight = height;
+}
+
+bool Fluid2DSimulationBufferCLProgram::jacobi2(MyCLBuffer &input,
+                                               MyCLBuffer &b,
+                                               MyCLBuffer &output,
+                                               cl_float alpha,
+                                               cl_float beta)
+{
+    return mJacobi2Kernel(mWidth, mHeight, input, b, output, alpha, 1.0 / beta, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::jacobi1(MyCLBuffer &input,
+                                               MyCLBuffer &b,
+                                               MyCLBuffer &output,
+                                               cl_float alpha,
+                                               cl_float beta)
+{
+    return mJacobi1Kernel(mWidth, mHeight, input, b, output, alpha, 1.0 / beta, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::advect(MyCLBuffer &quantity,
+                                              MyCLBuffer &velocity,
+                                              MyCLBuffer &output,
+                                              cl_float dt,
+                                              cl_float gridSize)
+{
+    return mAdvectKernel(mWidth, mHeight, quantity, velocity, output, dt / gridSize, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::advectStrip(MyCLBuffer &quantity,
+                                                   MyCLBuffer &velocity,
+                                                   MyCLBuffer &output,
+                                                   MyCLBuffer &clamped,
+                                                   cl_float dt,
+                                                   cl_float gridSize,
+                                                   cl_int haloBefore,
+                                                   cl_int haloAfter)
+{
+    return mAdvectStripKernel(mWidth, mHeight, quantity, velocity, output, clamped, dt / gridSize,
+                              haloBefore, haloAfter, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::divergence(MyCLBuffer &vecField,
+                                                  MyCLBuffer &output,
+                                                  cl_float gridSize)
+{
+    return mDivergenceKernel(mWidth, mHeight, vecField, output, 1.0 / gridSize, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::gradient(MyCLBuffer &func,
+                                                MyCLBuffer &output,
+                                                cl_float gridSize)
+{
+    return mGradientKernel(mWidth, mHeight, func, output, 1.0 / gridSize, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::addScaled(MyCLBuffer &t1, MyCLBuffer &t2,
+                                                 cl_float multiplier,
+                                                 MyCLBuffer &sum)
+{
+    return mAddScaledKernel(mWidth, mHeight, t1, t2, multiplier, sum, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::velocityBoundary(MyCLBuffer &buf, MyCLBuffer &out)
+{
+    return mVelocityBoundaryKernel(mWidth, mHeight, buf, out, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::pressureBoundary(MyCLBuffer &buf, MyCLBuffer &out)
+{
+    return mPressureBoundaryKernel(mWidth, mHeight, buf, out, mWidth, mHeight);
+}
+
+bool Fluid2DSimulationBufferCLProgram::bufferToImage(MyCLBuffer &buf, MyCLImage2D &img)
+{
+    Q_ASSERT( mImageTransfers );
+    return mBufferToImageKernel(img.width(), img.height(), buf, img);
+}
+
+bool Fluid2DSimulationBufferCLProgram::imageToBuffer(MyCLImage2D &img, MyCLBuffer &buf)
+{
+    Q_ASSERT( mImageTransfers );
+    return mImageToBufferKernel(img.width(), img.height(), img, buf);
+}
+
+bool Fluid2DSimulationBufferCLProgram::imageTransfersSupported() const
+{
+    return mImageTransfers;
+}
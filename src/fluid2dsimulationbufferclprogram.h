@@ -0,0 +1,169 @@
+#ifndef FLUID2DSIMULATIONBUFFERCLPROGRAM_H
+#define FLUID2DSIMULATIONBUFFERCLPROGRAM_H
+
+#include "fluid2dsimulationconfig.h"
+
+#include "cl_interface/include_opencl.h"
+#include "cl_interface/myclwrapper.h"
+#include "cl_interface/myclimage.h"
+#include "cl_interface/myclbuffer.h"
+#include "cl_interface/myclprogram.h"
+#include "cl_interface/myclkernel.h"
+
+/// The buffer counterpart of Fluid2DSimulationCLProgram. Vector fields are
+/// row-major buffers of cl_float2 and scalar fields are row-major buffers of
+/// cl_float, so that the simulation runs on devices without image support.
+///
+/// Only the basic pipeline is available: semi-Lagrangian advection, Jacobi
+/// diffusion and pressure solves, and the boundary conditions.
+///
+/// The kernels that copy between buffers and images are only built on request
+/// and on devices with image support, so that the program builds everywhere.
+class Fluid2DSimulationBufferCLProgram
+{
+public:
+    Fluid2DSimulationBufferCLProgram();
+
+    /// Builds the kernels, for a grid that wraps around if periodicBoundary.
+    /// With imageTransfers, bufferToImage() and imageToBuffer() are built too
+    /// if the device supports images (see imageTransfersSupported()).
+    bool create(MyCLWrapper *wrapper, bool periodicBoundary = false, bool imageTransfers = false);
+
+    void release();
+
+    /// Does the same as Fluid2DSimulationCLProgram::update(), except that the
+    /// pressure solver options of the config are ignored. Every buffer, including
+    /// the pressure ones, must be large enough for a vector field, since the
+    /// buffers trade roles during the step.
+    bool update(const Fluid2DSimulationConfig &config,
+                MyCLBuffer &velocities,
+                MyCLBuffer &velocitiesOut,
+                MyCLBuffer *forces,
+                MyCLBuffer &pressure,
+                MyCLBuffer &pressureOut,
+                MyCLBuffer &temp1,
+                MyCLBuffer &temp2,
+                cl_float dt);
+
+    /// Does the same as update() on `count` independent fields stacked in
+    /// every buffer (see Fluid2DEnsemble), with one launch per kernel for all
+    /// of them. params holds a cl_float4 per field: its dt, density, viscosity
+    /// and force scale. The config gives the size of each field, the grid
+    /// square size and the number of pressure iterations; its other options
+    /// are ignored. The diffusion sweeps are skipped unless diffuse is set.
+    bool updateEnsemble(const Fluid2DSimulationConfig &config,
+                        cl_int count,
+                        MyCLBuffer &params,
+                        MyCLBuffer &velocities,
+                        MyCLBuffer &velocitiesOut,
+                        MyCLBuffer *forces,
+                        MyCLBuffer &pressure,
+                        MyCLBuffer &pressureOut,
+                        MyCLBuffer &temp1,
+                        MyCLBuffer &temp2,
+                        bool diffuse);
+
+
+    bool jacobi2(MyCLBuffer &input,
+                 MyCLBuffer &b,
+                 MyCLBuffer &output,
+                 cl_float alpha,
+                 cl_float beta);
+
+    bool jacobi1(MyCLBuffer &input,
+                 MyCLBuffer &b,
+                 MyCLBuffer &output,
+                 cl_float alpha,
+                 cl_float beta);
+
+    bool advect(MyCLBuffer &quantity,
+                MyCLBuffer &velocity,
+                MyCLBuffer &output,
+                cl_float dt,
+                cl_float gridSize);
+
+    /// Like advect(), for a strip whose first haloBefore and last haloAfter rows
+    /// are copies of its neighbors' rows. Backtraces from the strip's own rows
+    /// that would leave the halos are clamped to them, and the cl_int in
+    /// `clamped` is set to 1 if any were.
+    bool advectStrip(MyCLBuffer &quantity,
+                     MyCLBuffer &velocity,
+                     MyCLBuffer &output,
+                     MyCLBuffer &clamped,
+                     cl_float dt,
+                     cl_float gridSize,
+                     cl_int haloBefore,
+                     cl_int haloAfter);
+
+    bool divergence(MyCLBuffer &vecField,
+                    MyCLBuffer &output,
+                    cl_float gridSize);
+
+    bool gradient(MyCLBuffer &func,
+                  MyCLBuffer &output,
+                  cl_float gridSize);
+
+    bool addScaled(MyCLBuffer &t1, MyCLBuffer &t2,
+                   cl_float multiplier,
+                   MyCLBuffer &sum);
+
+    bool velocityBoundary(MyCLBuffer &buf, MyCLBuffer &out);
+    bool pressureBoundary(MyCLBuffer &buf, MyCLBuffer &out);
+
+    /// Copies a vector field into the first two channels of an image of the
+    /// grid's size. Requires imageTransfersSupported().
+    bool bufferToImage(MyCLBuffer &buf, MyCLImage2D &img);
+
+    /// Copies the first two channels of an image into a vector field.
+    /// Requires imageTransfersSupported().
+    bool imageToBuffer(MyCLImage2D &img, MyCLBuffer &buf);
+
+    /// Whether create() built the image transfer kernels.
+    bool imageTransfersSupported() const;
+
+    /// Sets the grid size used by the kernels. update() does this itself.
+    void setGridSize(cl_int width, cl_int height);
+
+private:
+    bool mCreated;
+
+    MyCLWrapper *mCLWrapper;
+
+    /// Whether the program was built with PERIODIC_BOUNDARY.
+    bool mPeriodicBoundary;
+
+    /// Whether the program was built with IMAGE_TRANSFERS.
+    bool mImageTransfers;
+
+    /// The side-length of the x-y work groups of the ensemble kernels. Their
+    /// work groups are one field deep, so that the range along z is exactly
+    /// the number of fields.
+    size_t mEnsembleLocalSize;
+
+    cl_int mWidth;
+    cl_int mHeight;
+
+    MyCLProgram mProgram;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_float, cl_int, cl_int> mJacobi2Kernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_float, cl_int, cl_int> mJacobi1Kernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int> mAdvectKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int, cl_int, cl_int> mAdvectStripKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int> mDivergenceKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int> mGradientKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_float, MyCLBuffer&, cl_int, cl_int> mAddScaledKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int, cl_int> mVelocityBoundaryKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int, cl_int> mPressureBoundaryKernel;
+    MyCLKernel<MyCLBuffer&, MyCLImage2D&> mBufferToImageKernel;
+    MyCLKernel<MyCLImage2D&, MyCLBuffer&> mImageToBufferKernel;
+
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int> mEnsembleAdvectKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int> mEnsembleDiffuseKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int, cl_int> mEnsembleAddForcesKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int> mEnsembleDivergenceKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_float, cl_int, cl_int> mEnsembleJacobi1Kernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_int, cl_int> mEnsembleProjectKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int, cl_int> mEnsembleVelocityBoundaryKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int, cl_int> mEnsemblePressureBoundaryKernel;
+};
+
+#endif // FLUID2DSIMULATIONBUFFERCLPROGRAM_H
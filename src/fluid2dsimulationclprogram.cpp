@@ -1,24 +1,52 @@
 #include "fluid2dsimulationclprogram.h"
 
 #include "cl_interface/myclerrors.h"
+#include "cl_interface/clniceties.h"
+
+#include <algorithm>
+#include <cmath>
 
 
 Fluid2DSimulationCLProgram::Fluid2DSimulationCLProgram()
-    : mCreated(false)
+    : mCreated(false),
+      mPeriodicBoundary(false),
+      mHasSparseKernels(false),
+      mHasConjugateGradientKernels(false),
+      mHasMultigridKernels(false),
+      mHasSpectralKernels(false),
+      mDeviceLocalMemSize(0),
+      mReductionGroupSize(0),
+      mMultigridWidth(0),
+      mMultigridHeight(0),
+      mResidualEvent(NULL)
 {
+    mPCG.count = 0;
+    mSparse.tilesX = 0;
+    mSparse.tilesY = 0;
+    mSpectral.width = 0;
+    mSpectral.height = 0;
 }
 
-bool Fluid2DSimulationCLProgram::create(MyCLWrapper *wrapper)
+bool Fluid2DSimulationCLProgram::create(MyCLWrapper *wrapper, const Fluid2DSimulationConfig &config)
 {
     mCLWrapper = wrapper;
+    mPeriodicBoundary = config.periodicBoundary;
 
 
-    if (!mProgram.create(wrapper, ":/compute/fluidSimulation.cl"))
+    if (!mProgram.create(wrapper, ":/compute/fluidSimulation.cl", mPeriodicBoundary ? "-D PERIODIC_BOUNDARY" : ""))
     {
         qDebug() << "Failed to create fluid simulation program.";
         return false;
     }
 
+    // The kernels of the optional solvers and pipelines are only created if the
+    // config selects them, and a failure to create them disables them instead
+    // of failing the whole program.
+    mHasSparseKernels = config.sparseTiles;
+    mHasConjugateGradientKernels = config.pressureSolver == Fluid2DSimulationConfig::ConjugateGradientSolver;
+    mHasMultigridKernels = config.pressureSolver == Fluid2DSimulationConfig::MultigridSolver;
+    mHasSpectralKernels = config.spectralSolver;
+
 #ifndef MAKE_KERNEL
 #define MAKE_KERNEL(var, name)\
     if (!var.createFromProgram(wrapper, mProgram.program(), name))\
@@ -26,19 +54,100 @@ bool Fluid2DSimulationCLProgram::create(MyCLWrapper *wrapper)
         qDebug() << "Failed to create " name " kernel.";\
         return false;\
     }
+#define MAKE_OPTIONAL_KERNEL(flag, var, name)\
+    if (flag && !var.createFromProgram(wrapper, mProgram.program(), name))\
+    {\
+        qWarning() << "Failed to create " name " kernel.";\
+        flag = false;\
+    }
 
     MAKE_KERNEL(mJacobiKernel, "jacobi");
+    MAKE_KERNEL(mJacobiTiledKernel, "jacobiTiled");
+    MAKE_KERNEL(mSORRedKernel, "sorRed");
+    MAKE_KERNEL(mSORBlackKernel, "sorBlack");
+    MAKE_KERNEL(mUpsampleBicubicKernel, "upsampleBicubic");
+    MAKE_KERNEL(mDownsampleAverageKernel, "downsampleAverage");
+    MAKE_KERNEL(mInterpolateStatesKernel, "interpolateStates");
+    MAKE_KERNEL(mClearWrappedKernel, "clearWrapped");
+    MAKE_KERNEL(mImageToBufferKernel, "imageToBuffer");
+    MAKE_KERNEL(mBufferToImageKernel, "bufferToImage");
+    MAKE_KERNEL(mPCGFinishDotKernel, "pcgFinishDot");
+    MAKE_KERNEL(mJacobiResidualNormKernel, "jacobiResidualNorm");
     MAKE_KERNEL(mAdvectKernel, "advect");
+    MAKE_KERNEL(mMacCormackCorrectKernel, "macCormackCorrect");
     MAKE_KERNEL(mDivergenceKernel, "divergence");
     MAKE_KERNEL(mGradientKernel, "gradient");
+    MAKE_KERNEL(mCurlKernel, "curl");
+    MAKE_KERNEL(mVorticityConfinementKernel, "vorticityConfinement");
     MAKE_KERNEL(mAddScaledKernel, "addScaled");
     MAKE_KERNEL(mVelocityBoundaryKernel, "velocityBoundary");
     MAKE_KERNEL(mPressureBoundaryKernel, "pressureBoundary");
+    MAKE_KERNEL(mAdvectAddForceKernel, "advectAddForce");
+    MAKE_KERNEL(mDivergenceJacobiKernel, "divergenceJacobi");
+    MAKE_KERNEL(mJacobiPressureBoundaryKernel, "jacobiPressureBoundary");
+    MAKE_KERNEL(mProjectBoundaryKernel, "projectBoundary");
+    MAKE_KERNEL(mWholeStepKernel, "wholeStep");
+    MAKE_KERNEL(mAdvectAddForceMaskedKernel, "advectAddForceMasked");
+    MAKE_KERNEL(mDivergenceJacobiMaskedKernel, "divergenceJacobiMasked");
+    MAKE_KERNEL(mJacobiMaskedKernel, "jacobiMasked");
+    MAKE_KERNEL(mProjectMaskedKernel, "projectMasked");
+
+    MAKE_OPTIONAL_KERNEL(mHasMultigridKernels, mResidualKernel, "residual");
+    MAKE_OPTIONAL_KERNEL(mHasMultigridKernels, mRestrictKernel, "restrictAverage");
+    MAKE_OPTIONAL_KERNEL(mHasMultigridKernels, mProlongAddKernel, "prolongAdd");
+
+    MAKE_OPTIONAL_KERNEL(mHasConjugateGradientKernels, mPCGResidualKernel, "pcgResidual");
+    MAKE_OPTIONAL_KERNEL(mHasConjugateGradientKernels, mPCGApplyMatrixKernel, "pcgApplyMatrix");
+    MAKE_OPTIONAL_KERNEL(mHasConjugateGradientKernels, mPCGDotKernel, "pcgDot");
+    MAKE_OPTIONAL_KERNEL(mHasConjugateGradientKernels, mPCGPreconditionDotKernel, "pcgPreconditionDot");
+    MAKE_OPTIONAL_KERNEL(mHasConjugateGradientKernels, mPCGUpdateSolutionKernel, "pcgUpdateSolution");
+    MAKE_OPTIONAL_KERNEL(mHasConjugateGradientKernels, mPCGUpdateDirectionKernel, "pcgUpdateDirection");
+
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mTileActivityKernel, "tileActivity");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mTileActivitySparseKernel, "tileActivitySparse");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mCompactTilesKernel, "compactTiles");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mClearTilesKernel, "clearTiles");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mSparseAdvectAddForceKernel, "sparseAdvectAddForce");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mSparseDivergenceJacobiKernel, "sparseDivergenceJacobi");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mSparseJacobiKernel, "sparseJacobi");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mSparseJacobiPressureBoundaryKernel, "sparseJacobiPressureBoundary");
+    MAKE_OPTIONAL_KERNEL(mHasSparseKernels, mSparseProjectBoundaryKernel, "sparseProjectBoundary");
+
+    MAKE_OPTIONAL_KERNEL(mHasSpectralKernels, mImageToComplexKernel, "imageToComplex");
+    MAKE_OPTIONAL_KERNEL(mHasSpectralKernels, mComplexToImageKernel, "complexToImage");
+    MAKE_OPTIONAL_KERNEL(mHasSpectralKernels, mFFTRadix2Kernel, "fftRadix2");
+    MAKE_OPTIONAL_KERNEL(mHasSpectralKernels, mSpectralProjectKernel, "spectralProject");
+#undef MAKE_OPTIONAL_KERNEL
 #undef MAKE_KERNEL
 #else
     static_assert(false);
 #endif
 
+    if (clGetDeviceInfo(wrapper->device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &mDeviceLocalMemSize, NULL) != CL_SUCCESS)
+        mDeviceLocalMemSize = 0;
+
+    // workGroupSum() works for any power-of-two group size, so halve the
+    // reduction group size until every reduction kernel can be launched with it.
+    size_t reductionLimit = mJacobiResidualNormKernel.maxWorkGroupSize();
+    if (mHasConjugateGradientKernels)
+        reductionLimit = std::min({reductionLimit,
+                                   mPCGDotKernel.maxWorkGroupSize(),
+                                   mPCGPreconditionDotKernel.maxWorkGroupSize()});
+
+    mReductionGroupSize = ReductionGroupSize;
+    while (mReductionGroupSize > reductionLimit)
+        mReductionGroupSize /= 2;
+
+    if (mPCGFinishDotKernel.maxWorkGroupSize() < ReductionNumGroups)
+        mReductionGroupSize = 0;
+
+    if (!mResidualPartialSums.create(wrapper->context(), ReductionNumGroups * sizeof(cl_float)) ||
+        !mResidualSum.create(wrapper->context(), sizeof(cl_float)))
+    {
+        qDebug() << "Failed to create residual buffers.";
+        return false;
+    }
+
     mCreated = true;
     return true;
 }
@@ -46,33 +155,121 @@ bool Fluid2DSimulationCLProgram::create(MyCLWrapper *wrapper)
 void Fluid2DSimulationCLProgram::release()
 {
     mJacobiKernel.destroy();
+    mJacobiTiledKernel.destroy();
+    mSORRedKernel.destroy();
+    mSORBlackKernel.destroy();
+    mResidualKernel.destroy();
+    mRestrictKernel.destroy();
+    mProlongAddKernel.destroy();
+    mUpsampleBicubicKernel.destroy();
+    mDownsampleAverageKernel.destroy();
+    mInterpolateStatesKernel.destroy();
+    mClearWrappedKernel.destroy();
+    mImageToBufferKernel.destroy();
+    mBufferToImageKernel.destroy();
+    mPCGResidualKernel.destroy();
+    mPCGApplyMatrixKernel.destroy();
+    mPCGDotKernel.destroy();
+    mPCGPreconditionDotKernel.destroy();
+    mPCGFinishDotKernel.destroy();
+    mPCGUpdateSolutionKernel.destroy();
+    mPCGUpdateDirectionKernel.destroy();
+    mJacobiResidualNormKernel.destroy();
+
+    // The last residual check may still be reading into mResidualReadback.
+    if (mResidualEvent != NULL)
+        clWaitForEvents(1, &mResidualEvent);
+
+    finishResidualChecks();
+    mResidualPartialSums.destroy();
+    mResidualSum.destroy();
+
+    destroyMultigridLevels();
+    destroyPCGBuffers();
     mAdvectKernel.destroy();
+    mMacCormackCorrectKernel.destroy();
     mDivergenceKernel.destroy();
     mGradientKernel.destroy();
+    mCurlKernel.destroy();
+    mVorticityConfinementKernel.destroy();
     mAddScaledKernel.destroy();
     mVelocityBoundaryKernel.destroy();
     mPressureBoundaryKernel.destroy();
+    mAdvectAddForceKernel.destroy();
+    mDivergenceJacobiKernel.destroy();
+    mJacobiPressureBoundaryKernel.destroy();
+    mProjectBoundaryKernel.destroy();
+    mWholeStepKernel.destroy();
+    mAdvectAddForceMaskedKernel.destroy();
+    mDivergenceJacobiMaskedKernel.destroy();
+    mJacobiMaskedKernel.destroy();
+    mProjectMaskedKernel.destroy();
+    mTileActivityKernel.destroy();
+    mTileActivitySparseKernel.destroy();
+    mCompactTilesKernel.destroy();
+    mClearTilesKernel.destroy();
+    mSparseAdvectAddForceKernel.destroy();
+    mSparseDivergenceJacobiKernel.destroy();
+    mSparseJacobiKernel.destroy();
+    mSparseJacobiPressureBoundaryKernel.destroy();
+    mSparseProjectBoundaryKernel.destroy();
+    mImageToComplexKernel.destroy();
+    mComplexToImageKernel.destroy();
+    mFFTRadix2Kernel.destroy();
+    mSpectralProjectKernel.destroy();
+
+    destroySparseBuffers();
+    destroySpectralBuffers();
 
     mProgram.destroy();
 
     mCreated = false;
 }
 
-bool Fluid2DSimulationCLProgram::update(MyCLImage2D &velocities,
+bool Fluid2DSimulationCLProgram::update(const Fluid2DSimulationConfig &config,
+                                        MyCLImage2D &velocities,
+                                        MyCLImage2D &velocitiesOut,
                                         MyCLImage2D *forces,
                                         MyCLImage2D &pressure,
+                                        MyCLImage2D &pressureOut,
                                         MyCLImage2D &temp1,
                                         MyCLImage2D &temp2,
-                                        cl_float gridSize,
                                         cl_float dt,
-                                        cl_float density,
-                                        cl_float viscosity)
+                                        MyCLImage2D *obstacles)
 {
     Q_ASSERT( mCreated );
+    Q_ASSERT( &velocitiesOut != &velocities && &velocitiesOut != &temp1 && &velocitiesOut != &temp2 );
+    Q_ASSERT( &pressureOut != &pressure && &pressureOut != &temp1 && &pressureOut != &temp2 );
+    Q_ASSERT( config.periodicBoundary == mPeriodicBoundary );
+
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float density = config.density;
+    const cl_float viscosity = config.hasViscosity ? config.viscosity : -1;
+
+    const int sweepsPerLaunch = effectiveSweepsPerLaunch(config);
+
+    if (obstacles != nullptr && !mPeriodicBoundary)
+        return updateMasked(config, velocities, velocitiesOut, forces, pressure, pressureOut, temp1, temp2, *obstacles, dt);
+
+    if (usesSpectralSolver(config))
+        return updateSpectral(config, velocities, velocitiesOut, forces, pressureOut, temp1, temp2, dt);
+
+    if (usesWholeStep(config))
+    {
+        cl_float omega = config.pressureSolver == Fluid2DSimulationConfig::RedBlackSORSolver ? config.sorOmega : 1;
+        return wholeStep(velocities, velocitiesOut, forces, pressure, pressureOut,
+                         dt, gridSize, density, omega, config.pressureIterations);
+    }
+
+    if (usesSparseTiles(config))
+        return updateSparse(config, velocities, velocitiesOut, forces, pressure, pressureOut, temp1, temp2, dt);
+
+    if (config.fusedKernels)
+        return updateFused(config, velocities, velocitiesOut, forces, pressure, pressureOut, temp1, temp2, dt, sweepsPerLaunch);
 
     // These help keep track of where the most updated
     // data is stored. At the end, the updated data
-    // must be stored in the original variables.
+    // is written into the output images.
     MyCLImage2D *velocityImage = &velocities;
     MyCLImage2D *pressureImage = &pressure;
 
@@ -87,6 +284,7 @@ bool Fluid2DSimulationCLProgram::update(MyCLImage2D &velocities,
         1) advect
         2) diffuse (optional)
         3) add forces (optional)
+        3.5) vorticity confinement (optional)
         4) update pressure
             i)   compute velocity field divergence
             ii)  solve Poisson equation (probably using Jacobi)
@@ -96,34 +294,20 @@ bool Fluid2DSimulationCLProgram::update(MyCLImage2D &velocities,
 
 
     /* Step 1: Advection */
-    if (!advect(*velocityImage, *velocityImage, *freeImage1, dt, gridSize))
+    if (!advectVelocity(config, velocityImage, freeImage1, freeImage2, dt))
     {
         qDebug() << "Failure in advection step.";
         return false;
     }
-    std::swap(velocityImage, freeImage1);
 
 
     /* Step 2: Diffusion (optional) */
     if (viscosity > 0)
     {
-        cl_float hh_vdt = gridSize * gridSize / (viscosity * dt);
-        for (int iteration = 0; iteration < 30; ++iteration)
+        if (!diffuse(config, velocityImage, freeImage1, freeImage2, dt, sweepsPerLaunch))
         {
-            MyCLImage2D *t1 = velocityImage;
-            MyCLImage2D *t2 = freeImage1;
-
-            for (int subIteration = 0; subIteration < 2; ++subIteration)
-            {
-                if (!jacobi(*t1, *t1, *t2, hh_vdt, 4 + hh_vdt))
-                {
-                    qDebug() << "Failure in diffusion step.";
-                    return false;
-                }
-
-                // Swap pointers.
-                std::swap(t1, t2);
-            }
+            qDebug() << "Failure in diffusion step.";
+            return false;
         }
     }
 
@@ -139,6 +323,13 @@ bool Fluid2DSimulationCLProgram::update(MyCLImage2D &velocities,
         std::swap(velocityImage, freeImage1);
     }
 
+    /* Step 3.5: Vorticity confinement (optional) */
+    if (!confineVorticity(config, velocityImage, freeImage1, freeImage2, dt))
+    {
+        qDebug() << "Failure in vorticity confinement step.";
+        return false;
+    }
+
     /* Step 4: Update pressure */
     if (!divergence(*velocityImage, *freeImage1, gridSize))
     {
@@ -152,22 +343,10 @@ bool Fluid2DSimulationCLProgram::update(MyCLImage2D &velocities,
     // freeImage1 should be free once again.
     // freeImage2 is now nullptr.
 
-    // NOTE: Doing too many of these breaks everything.
-    for (int iteration = 0; iteration < 4; ++iteration)
+    if (!solvePressure(config, pressureImage, *divergenceImage, freeImage1, sweepsPerLaunch))
     {
-        MyCLImage2D *t1 = pressureImage;
-        MyCLImage2D *t2 = freeImage1;
-
-        for (int subIteration = 0; subIteration < 2; ++subIteration)
-        {
-            if (!jacobi(*t1, *divergenceImage, *t2, -gridSize * gridSize, 4))
-            {
-                qDebug() << "Failure in pressure computation.";
-                return false;
-            }
-
-            std::swap(t1, t2);
-        }
+        qDebug() << "Failure in pressure computation.";
+        return false;
     }
 
     // We don't need divergence now.
@@ -175,18 +354,43 @@ bool Fluid2DSimulationCLProgram::update(MyCLImage2D &velocities,
     std::swap(freeImage2, divergenceImage);
 
     /* Step 5: Subtract pressure gradient */
-    if (!gradient(*pressureImage, *freeImage1, gridSize))
+    if (!gradient(*pressureImage, *freeImage2, gridSize))
     {
         qDebug() << "Failure in pressure gradient computation.";
         return false;
     }
 
     Q_ASSERT( gradientImage == nullptr );
-    std::swap(freeImage1, gradientImage);
-    std::swap(freeImage1, freeImage2);
-    // freeImage1 should be free once again.
+    std::swap(freeImage2, gradientImage);
     // freeImage2 is now nullptr.
 
+    // The pressure boundary is enforced here rather than in step 6 so that the
+    // pressure image can be reused below. A periodic grid has no boundary, so
+    // the pressure is only moved into the output.
+    if (mPeriodicBoundary)
+    {
+        if (pressureImage != &pressureOut && !copy(*pressureImage, pressureOut))
+        {
+            qDebug() << "Failure copying the pressure.";
+            return false;
+        }
+    }
+    else if (!pressureBoundary(*pressureImage, pressureOut))
+    {
+        qDebug() << "Failure enforcing pressure boundary.";
+        return false;
+    }
+
+    // The solvers may have left the pressure in a temporary image and the
+    // pressure input in freeImage1. The pressure input may have only one
+    // channel, so the velocity must go into whichever one is the temporary.
+    if (freeImage1 == &pressure)
+        std::swap(freeImage1, pressureImage);
+
+    // Without a boundary, the projected velocities are the result.
+    if (mPeriodicBoundary)
+        freeImage1 = &velocitiesOut;
+
     if (!addScaled(*velocityImage, *gradientImage, -1.0/density, *freeImage1))
     {
         qDebug() << "Failure in subtracting pressure gradient.";
@@ -194,82 +398,1545 @@ bool Fluid2DSimulationCLProgram::update(MyCLImage2D &velocities,
     }
     std::swap(freeImage1, velocityImage);
 
+    if (mPeriodicBoundary)
+        return true;
+
 
 
     /* Step 6: Enforce boundary conditions */
-    if (!velocityBoundary(*velocityImage, *freeImage1))
+    if (!velocityBoundary(*velocityImage, velocitiesOut))
     {
         qDebug() << "Failure enforcing velocity boundary.";
         return false;
     }
-    std::swap(velocityImage, freeImage1);
 
-    if (!pressureBoundary(*pressureImage, *freeImage1))
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::beginSlicedStep(const Fluid2DSimulationConfig &config,
+                                                 MyCLImage2D &velocities,
+                                                 MyCLImage2D *forces,
+                                                 MyCLImage2D *&velocity,
+                                                 MyCLImage2D *&free1,
+                                                 MyCLImage2D *&free2,
+                                                 MyCLImage2D &divergenceOut,
+                                                 cl_float dt)
+{
+    Q_ASSERT( mCreated );
+    Q_ASSERT( velocity != free1 && velocity != free2 && free1 != free2 );
+    Q_ASSERT( &velocities != velocity && &velocities != free1 && &velocities != free2 );
+
+    const cl_float gridSize = config.gridSquareSize;
+
+    /* Step 1: Advection */
+    // Unlike advectVelocity(), this never writes into the velocities, which
+    // stay on display until the step is finished.
+    if (config.advectionScheme == Fluid2DSimulationConfig::MacCormackAdvection)
     {
-        qDebug() << "Failure enforcing pressure boundary.";
+        if (!advect(velocities, velocities, *free1, dt, gridSize) ||
+            !macCormackCorrect(velocities, *free1, velocities, *velocity, dt, gridSize))
+        {
+            qDebug() << "Failure in advection step.";
+            return false;
+        }
+    }
+    else if (!advect(velocities, velocities, *velocity, dt, gridSize))
+    {
+        qDebug() << "Failure in advection step.";
         return false;
     }
-    std::swap(pressureImage, freeImage1);
 
-
-    if (velocityImage != &velocities)
+    /* Step 2: Diffusion (optional) */
+    if (config.hasViscosity && config.viscosity > 0)
     {
-        if (!copy(*velocityImage, velocities))
+        if (!diffuse(config, velocity, free1, free2, dt, effectiveSweepsPerLaunch(config)))
         {
-            qDebug() << "Failure in copy()";
+            qDebug() << "Failure in diffusion step.";
             return false;
         }
     }
 
-    if (pressureImage != &pressure)
+    /* Step 3: Add forces (optional) */
+    if (forces != nullptr)
     {
-        if (!copy(*pressureImage, pressure))
+        if (!addScaled(*velocity, *forces, dt, *free1))
         {
-            qDebug() << "Failure in copy()";
+            qDebug() << "Failure in add-forces step.";
             return false;
         }
+
+        std::swap(velocity, free1);
+    }
+
+    /* Step 3.5: Vorticity confinement (optional) */
+    if (!confineVorticity(config, velocity, free1, free2, dt))
+    {
+        qDebug() << "Failure in vorticity confinement step.";
+        return false;
+    }
+
+    /* Step 4i: Divergence */
+    if (!divergence(*velocity, divergenceOut, gridSize))
+    {
+        qDebug() << "Failure in computing divergence.";
+        return false;
     }
 
     return true;
 }
 
-bool Fluid2DSimulationCLProgram::copy(MyCLImage2D &from, MyCLImage2D &to)
+bool Fluid2DSimulationCLProgram::continuePressureSolve(const Fluid2DSimulationConfig &config,
+                                                       MyCLImage2D *&pressure,
+                                                       MyCLImage2D &divergence,
+                                                       MyCLImage2D *&scratch,
+                                                       int iterations)
 {
-    return addScaled(from, from, 0, to);
+    Q_ASSERT( mCreated );
+
+    Fluid2DSimulationConfig sliceConfig = config;
+    sliceConfig.pressureIterations = iterations;
+
+    if (!solvePressure(sliceConfig, pressure, divergence, scratch, effectiveSweepsPerLaunch(config)))
+    {
+        qDebug() << "Failure in pressure computation.";
+        return false;
+    }
+
+    return true;
 }
 
-bool Fluid2DSimulationCLProgram::jacobi(MyCLImage2D &input,
-                                        MyCLImage2D &b,
-                                        MyCLImage2D &output,
-                                        cl_float alpha,
-                                        cl_float beta)
+bool Fluid2DSimulationCLProgram::finishSlicedStep(const Fluid2DSimulationConfig &config,
+                                                  MyCLImage2D &velocity,
+                                                  MyCLImage2D &pressure,
+                                                  MyCLImage2D &velocitiesOut,
+                                                  MyCLImage2D &pressureOut)
 {
-    return mJacobiKernel(output.width(), output.height(), input, b, output, alpha, 1.0 / beta);
+    Q_ASSERT( mCreated );
+
+    if (!pressureBoundary(pressure, pressureOut))
+    {
+        qDebug() << "Failure enforcing pressure boundary.";
+        return false;
+    }
+
+    if (!projectBoundary(velocity, pressureOut, velocitiesOut, config.gridSquareSize, config.density))
+    {
+        qDebug() << "Failure in subtracting pressure gradient.";
+        return false;
+    }
+
+    return true;
 }
 
-bool Fluid2DSimulationCLProgram::advect(MyCLImage2D &quantity,
-                                        MyCLImage2D &velocity,
-                                        MyCLImage2D &output,
-                                        cl_float dt,
-                                        cl_float gridSize)
+int Fluid2DSimulationCLProgram::effectiveSweepsPerLaunch(const Fluid2DSimulationConfig &config) const
 {
+    // Falls back to the plain Jacobi kernel if the tiled one can't be launched.
+    if (config.jacobiSweepsPerLaunch > 1 && tiledJacobiSupported())
+        return std::min(config.jacobiSweepsPerLaunch, JacobiMaxSweepsPerLaunch);
 
-    return mAdvectKernel(output.width(), output.height(), quantity, velocity, output, dt / gridSize);
+    return 1;
 }
 
-bool Fluid2DSimulationCLProgram::divergence(MyCLImage2D &vecField,
-                                            MyCLImage2D &output,
-                                            cl_float gridSize)
+bool Fluid2DSimulationCLProgram::updateMasked(const Fluid2DSimulationConfig &config,
+                                              MyCLImage2D &velocities,
+                                              MyCLImage2D &velocitiesOut,
+                                              MyCLImage2D *forces,
+                                              MyCLImage2D &pressure,
+                                              MyCLImage2D &pressureOut,
+                                              MyCLImage2D &temp1,
+                                              MyCLImage2D &temp2,
+                                              MyCLImage2D &obstacles,
+                                              cl_float dt)
 {
-    return mDivergenceKernel(output.width(), output.height(), vecField, output, 1.0 / gridSize);
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float alpha = -gridSize * gridSize;
+    const size_t width = velocitiesOut.width();
+    const size_t height = velocitiesOut.height();
+
+    MyCLImage2D *velocityImage = &velocities;
+    MyCLImage2D *pressureImage = &pressure;
+
+    MyCLImage2D *freeImage1 = &temp1;
+    MyCLImage2D *freeImage2 = &temp2;
+
+
+    /* Algorithm: the fused pipeline, with the obstacle kernels.
+        1) advect and add forces, zeroing solid cells
+        2) diffuse (optional)
+        2.5) vorticity confinement (optional)
+        3) compute divergence and do the first pressure sweep
+        4) do the other pressure sweeps, the last one into pressureOut
+        5) subtract gradient of pressure and enforce the boundaries
+
+       Diffusion and vorticity confinement don't know about the obstacles and
+       may leave velocity in solid cells. The divergence reads solid neighbors
+       as zero and the projection zeroes them, so it never reaches the fluid.
+
+       The pressure is always solved with plain Jacobi sweeps, whatever the
+       config's pressureSolver, jacobiSweepsPerLaunch and adaptiveIterations.
+     * */
+
+
+    /* Step 1: Advection and forces */
+    // The forces image is only read if its scale is nonzero.
+    if (!mAdvectAddForceMaskedKernel(width, height, *velocityImage,
+                                     forces != nullptr ? *forces : *velocityImage,
+                                     obstacles, *freeImage1,
+                                     dt / gridSize, forces != nullptr ? dt : 0))
+    {
+        qDebug() << "Failure in advection step.";
+        return false;
+    }
+    std::swap(velocityImage, freeImage1);
+
+
+    /* Step 2: Diffusion (optional) */
+    if (config.hasViscosity && config.viscosity > 0)
+    {
+        if (!diffuse(config, velocityImage, freeImage1, freeImage2, dt, effectiveSweepsPerLaunch(config)))
+        {
+            qDebug() << "Failure in diffusion step.";
+            return false;
+        }
+    }
+
+
+    /* Step 2.5: Vorticity confinement (optional) */
+    if (!confineVorticity(config, velocityImage, freeImage1, freeImage2, dt))
+    {
+        qDebug() << "Failure in vorticity confinement step.";
+        return false;
+    }
+
+
+    /* Steps 3-4: Pressure */
+    MyCLImage2D *divergenceImage = freeImage1;
+    MyCLImage2D *scratch = freeImage2;
+
+    if (!mDivergenceJacobiMaskedKernel(width, height, *velocityImage, *pressureImage, obstacles,
+                                       *divergenceImage, *scratch, 1.0 / gridSize, alpha, 0.25))
+    {
+        qDebug() << "Failure in computing divergence.";
+        return false;
+    }
+    std::swap(pressureImage, scratch);
+
+    for (int iteration = 1; iteration < config.pressureIterations; ++iteration)
+    {
+        MyCLImage2D &output = iteration == config.pressureIterations - 1 ? pressureOut : *scratch;
+
+        if (!mJacobiMaskedKernel(width, height, *pressureImage, *divergenceImage, obstacles, output, alpha, 0.25))
+        {
+            qDebug() << "Failure in pressure computation.";
+            return false;
+        }
+
+        if (&output == scratch)
+            std::swap(pressureImage, scratch);
+        else
+            pressureImage = &pressureOut;
+    }
+
+    // With a single sweep, it went into the scratch image.
+    if (pressureImage != &pressureOut && !copy(*pressureImage, pressureOut))
+        return false;
+
+
+    /* Step 5: Projection */
+    if (!mProjectMaskedKernel(width, height, *velocityImage, pressureOut, obstacles, velocitiesOut,
+                              1.0 / (gridSize * config.density)))
+    {
+        qDebug() << "Failure in subtracting pressure gradient.";
+        return false;
+    }
+
+    return true;
 }
 
+bool Fluid2DSimulationCLProgram::updateSparse(const Fluid2DSimulationConfig &config,
+                                              MyCLImage2D &velocities,
+                                              MyCLImage2D &velocitiesOut,
+                                              MyCLImage2D *forces,
+                                              MyCLImage2D &pressure,
+                                              MyCLImage2D &pressureOut,
+                                              MyCLImage2D &temp1,
+                                              MyCLImage2D &temp2,
+                                              cl_float dt)
+{
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float alpha = -gridSize * gridSize;
 
-bool Fluid2DSimulationCLProgram::gradient(MyCLImage2D &func,
-                                          MyCLImage2D &output,
-                                          cl_float gridSize)
+    if (!createSparseBuffers(config.width, config.height))
+        return false;
+
+    MyCLImage2D *images[6] = { &velocities, &velocitiesOut, &pressure, &pressureOut, &temp1, &temp2 };
+    if (!updateActiveTiles(config, velocities, forces, dt, images))
+    {
+        qDebug() << "Failure in finding the active tiles.";
+        return false;
+    }
+
+    // Every launch has a work group for each tile of the grid, and those past
+    // the end of the active list return at once.
+    const size_t globalX = mSparse.tilesX * mSparse.tilesY * SparseTileSize;
+    const size_t globalY = SparseTileSize;
+    const cl_int tilesX = mSparse.tilesX;
+
+#ifdef F2DSP_RUN_SPARSE
+    static_assert(false);
+#endif
+
+#define F2DSP_RUN_SPARSE(kernel, ...)\
+    kernel.runWithLocalSize(globalX, globalY, SparseTileSize, SparseTileSize,\
+                            __VA_ARGS__, mSparse.tiles, mSparse.counts, tilesX)
+
+    /* Step 1: Advection and forces */
+    // The forces image is only read if its scale is nonzero.
+    if (!F2DSP_RUN_SPARSE(mSparseAdvectAddForceKernel,
+                          velocities, forces != nullptr ? *forces : velocities, temp1,
+                          dt / gridSize, forces != nullptr ? dt : 0))
+    {
+        qDebug() << "Failure in advection step.";
+        return false;
+    }
+
+    /* Step 2: Pressure */
+    // The pressure ping-pongs between pressure and pressureOut, so the number
+    // of middle sweeps is rounded up to an odd one for the last sweep to land
+    // in pressureOut. With the first and last sweeps, that makes an odd total
+    // of at least 3.
+    int middleSweeps = std::max(config.pressureIterations - 2, 1);
+    if (middleSweeps % 2 == 0)
+        ++middleSweeps;
+
+    if (!F2DSP_RUN_SPARSE(mSparseDivergenceJacobiKernel,
+                          temp1, pressure, temp2, pressureOut,
+                          1.0 / gridSize, alpha, 0.25))
+    {
+        qDebug() << "Failure in computing divergence.";
+        return false;
+    }
+
+    MyCLImage2D *pressureImage = &pressureOut;
+    MyCLImage2D *scratch = &pressure;
+
+    for (int sweep = 0; sweep < middleSweeps; ++sweep)
+    {
+        if (!F2DSP_RUN_SPARSE(mSparseJacobiKernel, *pressureImage, temp2, *scratch, alpha, 0.25))
+        {
+            qDebug() << "Failure in pressure computation.";
+            return false;
+        }
+
+        std::swap(pressureImage, scratch);
+    }
+
+    Q_ASSERT( pressureImage == &pressure );
+
+    if (!F2DSP_RUN_SPARSE(mSparseJacobiPressureBoundaryKernel, pressure, temp2, pressureOut, alpha, 0.25))
+    {
+        qDebug() << "Failure enforcing pressure boundary.";
+        return false;
+    }
+
+    /* Step 3: Projection */
+    if (!F2DSP_RUN_SPARSE(mSparseProjectBoundaryKernel,
+                          temp1, pressureOut, velocitiesOut, 1.0 / (gridSize * config.density)))
+    {
+        qDebug() << "Failure in subtracting pressure gradient.";
+        return false;
+    }
+
+#undef F2DSP_RUN_SPARSE
+
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::updateActiveTiles(const Fluid2DSimulationConfig &config,
+                                                   MyCLImage2D &velocities,
+                                                   MyCLImage2D *forces,
+                                                   cl_float dt,
+                                                   MyCLImage2D *images[6])
 {
-    return mGradientKernel(output.width(), output.height(), func, output, 1.0 / gridSize);
+    const cl_int tilesX = mSparse.tilesX;
+    const cl_int tilesY = mSparse.tilesY;
+
+    CLNiceties::ZeroBuffer(mCLWrapper->queue(), mSparse.flags);
+
+    // Forces can be anywhere, but without them, wind can only be where it
+    // was in the last step.
+    bool flagged = forces != nullptr
+            ? mTileActivityKernel.runWithLocalSize(tilesX * SparseTileSize, tilesY * SparseTileSize,
+                                                   SparseTileSize, SparseTileSize,
+                                                   velocities, *forces, dt, config.sparseThreshold, mSparse.flags)
+            : mTileActivitySparseKernel.runWithLocalSize(tilesX * tilesY * SparseTileSize, SparseTileSize,
+                                                         SparseTileSize, SparseTileSize,
+                                                         velocities, config.sparseThreshold, mSparse.flags,
+                                                         mSparse.tiles, mSparse.counts, tilesX);
+    if (!flagged)
+        return false;
+
+    CLNiceties::ZeroBuffer(mCLWrapper->queue(), mSparse.counts);
+
+    if (!mCompactTilesKernel(tilesX * tilesY, mSparse.flags, mSparse.wasActive, mSparse.tiles,
+                             mSparse.clearTiles, mSparse.counts, tilesX, tilesY, config.sparseDilation))
+        return false;
+
+    return mClearTilesKernel.runWithLocalSize(tilesX * tilesY * SparseTileSize, SparseTileSize,
+                                              SparseTileSize, SparseTileSize,
+                                              mSparse.clearTiles, mSparse.counts, tilesX,
+                                              *images[0], *images[1], *images[2],
+                                              *images[3], *images[4], *images[5]);
+}
+
+bool Fluid2DSimulationCLProgram::updateFused(const Fluid2DSimulationConfig &config,
+                                             MyCLImage2D &velocities,
+                                             MyCLImage2D &velocitiesOut,
+                                             MyCLImage2D *forces,
+                                             MyCLImage2D &pressure,
+                                             MyCLImage2D &pressureOut,
+                                             MyCLImage2D &temp1,
+                                             MyCLImage2D &temp2,
+                                             cl_float dt,
+                                             int sweepsPerLaunch)
+{
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float alpha = -gridSize * gridSize;
+
+    MyCLImage2D *velocityImage = &velocities;
+    MyCLImage2D *pressureImage = &pressure;
+
+    MyCLImage2D *freeImage1 = &temp1;
+    MyCLImage2D *freeImage2 = &temp2;
+
+
+    /* Algorithm:
+        1) advect and add forces (optional)
+        2) diffuse (optional)
+        2.5) vorticity confinement (optional)
+        3) compute divergence and do the first pressure sweep
+        4) do the middle pressure sweeps
+        5) do the last pressure sweep and enforce the pressure boundary
+        6) subtract gradient of pressure and enforce the velocity boundary
+
+       With a pressure solver other than Jacobi, steps 3-5 are the same as in
+       the unfused pipeline followed by pressureBoundary.
+     * */
+
+
+    /* Step 1: Advection and forces */
+    if (config.advectionScheme == Fluid2DSimulationConfig::SemiLagrangianAdvection)
+    {
+        bool advected = forces != nullptr
+                ? advectAddForce(*velocityImage, *forces, *freeImage1, dt, gridSize)
+                : advect(*velocityImage, *velocityImage, *freeImage1, dt, gridSize);
+
+        if (!advected)
+        {
+            qDebug() << "Failure in advection step.";
+            return false;
+        }
+        std::swap(velocityImage, freeImage1);
+    }
+    else
+    {
+        // The correction pass has no room for the forces, so add them separately.
+        if (!advectVelocity(config, velocityImage, freeImage1, freeImage2, dt))
+        {
+            qDebug() << "Failure in advection step.";
+            return false;
+        }
+
+        if (forces != nullptr)
+        {
+            if (!addScaled(*velocityImage, *forces, dt, *freeImage1))
+            {
+                qDebug() << "Failure in add-forces step.";
+                return false;
+            }
+            std::swap(velocityImage, freeImage1);
+        }
+    }
+
+
+    /* Step 2: Diffusion (optional) */
+    if (config.hasViscosity && config.viscosity > 0)
+    {
+        if (!diffuse(config, velocityImage, freeImage1, freeImage2, dt, sweepsPerLaunch))
+        {
+            qDebug() << "Failure in diffusion step.";
+            return false;
+        }
+    }
+
+
+    /* Step 2.5: Vorticity confinement (optional) */
+    if (!confineVorticity(config, velocityImage, freeImage1, freeImage2, dt))
+    {
+        qDebug() << "Failure in vorticity confinement step.";
+        return false;
+    }
+
+
+    /* Steps 3-5: Pressure */
+    MyCLImage2D *divergenceImage = freeImage1;
+    MyCLImage2D *scratch = freeImage2;
+
+    if (config.pressureSolver == Fluid2DSimulationConfig::JacobiSolver && config.pressureIterations >= 2)
+    {
+        if (!divergenceJacobi(*velocityImage, *pressureImage, *divergenceImage, *scratch, gridSize))
+        {
+            qDebug() << "Failure in computing divergence.";
+            return false;
+        }
+        std::swap(pressureImage, scratch);
+
+        if (!jacobiIterations(config, pressureImage, divergenceImage, scratch, alpha, 4,
+                              config.pressureIterations - 2, sweepsPerLaunch))
+        {
+            qDebug() << "Failure in pressure computation.";
+            return false;
+        }
+
+        if (!jacobiPressureBoundary(*pressureImage, *divergenceImage, pressureOut, alpha, 4))
+        {
+            qDebug() << "Failure enforcing pressure boundary.";
+            return false;
+        }
+    }
+    else
+    {
+        if (!divergence(*velocityImage, *divergenceImage, gridSize))
+        {
+            qDebug() << "Failure in computing divergence.";
+            return false;
+        }
+
+        if (!solvePressure(config, pressureImage, *divergenceImage, scratch, sweepsPerLaunch))
+        {
+            qDebug() << "Failure in pressure computation.";
+            return false;
+        }
+
+        if (!pressureBoundary(*pressureImage, pressureOut))
+        {
+            qDebug() << "Failure enforcing pressure boundary.";
+            return false;
+        }
+    }
+
+
+    /* Step 6: Projection */
+    // Unlike the unfused pipeline, this uses the pressure after its boundary
+    // condition has been enforced.
+    if (!projectBoundary(*velocityImage, pressureOut, velocitiesOut, gridSize, config.density))
+    {
+        qDebug() << "Failure in subtracting pressure gradient.";
+        return false;
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::updateSpectral(const Fluid2DSimulationConfig &config,
+                                                MyCLImage2D &velocities,
+                                                MyCLImage2D &velocitiesOut,
+                                                MyCLImage2D *forces,
+                                                MyCLImage2D &pressureOut,
+                                                MyCLImage2D &temp1,
+                                                MyCLImage2D &temp2,
+                                                cl_float dt)
+{
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float viscosity = config.hasViscosity ? config.viscosity : 0;
+    const size_t width = velocitiesOut.width();
+    const size_t height = velocitiesOut.height();
+
+    if (!createSpectralBuffers(width, height))
+        return false;
+
+    MyCLImage2D *velocityImage = &velocities;
+    MyCLImage2D *freeImage1 = &temp1;
+    MyCLImage2D *freeImage2 = &temp2;
+
+    MyCLBuffer *spectrum = &mSpectral.spectrum;
+    MyCLBuffer *scratch = &mSpectral.scratch;
+
+
+    /* Algorithm:
+        1) advect
+        2) add forces (optional)
+        2.5) vorticity confinement (optional)
+        3) transform the velocities
+        4) diffuse and project in frequency space, which also gives the
+           spectrum of the pressure
+        5) transform the velocities and the pressure back
+
+       The previous pressure isn't needed, since the solve is exact.
+     * */
+
+
+    /* Step 1: Advection */
+    if (!advectVelocity(config, velocityImage, freeImage1, freeImage2, dt))
+    {
+        qDebug() << "Failure in advection step.";
+        return false;
+    }
+
+    /* Step 2: Add forces (optional) */
+    if (forces != nullptr)
+    {
+        if (!addScaled(*velocityImage, *forces, dt, *freeImage1))
+        {
+            qDebug() << "Failure in add-forces step.";
+            return false;
+        }
+
+        std::swap(velocityImage, freeImage1);
+    }
+
+    /* Step 2.5: Vorticity confinement (optional) */
+    if (!confineVorticity(config, velocityImage, freeImage1, freeImage2, dt))
+    {
+        qDebug() << "Failure in vorticity confinement step.";
+        return false;
+    }
+
+    /* Step 3: Forward transform */
+    if (!mImageToComplexKernel(width, height, *velocityImage, *spectrum) ||
+        !fft2D(spectrum, scratch, -1))
+    {
+        qDebug() << "Failure in forward FFT.";
+        return false;
+    }
+
+    /* Step 4: Diffusion and projection */
+    if (!mSpectralProjectKernel(width, height, *spectrum, *scratch, mSpectral.pressure,
+                                viscosity * dt / (gridSize * gridSize), config.density, 1.0 / gridSize,
+                                mSpectral.width, mSpectral.height))
+    {
+        qDebug() << "Failure in spectral projection.";
+        return false;
+    }
+    std::swap(spectrum, scratch);
+
+    /* Step 5: Inverse transforms */
+    // The inverse FFT is unscaled, so the results are divided by the cell count.
+    const cl_float scale = 1.0 / (width * height);
+    const cl_float2 velocityScale = {{ scale, scale }};
+    const cl_float2 pressureScale = {{ scale, 0 }};
+
+    if (!fft2D(spectrum, scratch, 1) ||
+        !mComplexToImageKernel(width, height, *spectrum, velocitiesOut, velocityScale))
+    {
+        qDebug() << "Failure in inverse FFT of the velocities.";
+        return false;
+    }
+
+    // The pressure is real, so its imaginary part is only rounding error.
+    MyCLBuffer *pressure = &mSpectral.pressure;
+    if (!fft2D(pressure, spectrum, 1) ||
+        !mComplexToImageKernel(width, height, *pressure, pressureOut, pressureScale))
+    {
+        qDebug() << "Failure in inverse FFT of the pressure.";
+        return false;
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::fft2D(MyCLBuffer *&data, MyCLBuffer *&scratch, cl_int direction)
+{
+    const cl_int width = mSpectral.width;
+    const cl_int height = mSpectral.height;
+
+    // Rows, then columns. Each pass merges transforms of length p into ones of
+    // length 2p.
+    for (cl_int p = 1; p < width; p *= 2)
+    {
+        if (!mFFTRadix2Kernel(width / 2, height, *data, *scratch, width, p, 1, width, height, direction))
+            return false;
+
+        std::swap(data, scratch);
+    }
+
+    for (cl_int p = 1; p < height; p *= 2)
+    {
+        if (!mFFTRadix2Kernel(height / 2, width, *data, *scratch, height, p, width, 1, width, direction))
+            return false;
+
+        std::swap(data, scratch);
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::advectVelocity(const Fluid2DSimulationConfig &config,
+                                                MyCLImage2D *&velocity,
+                                                MyCLImage2D *&free1,
+                                                MyCLImage2D *&free2,
+                                                cl_float dt)
+{
+    const cl_float gridSize = config.gridSquareSize;
+
+    if (!advect(*velocity, *velocity, *free1, dt, gridSize))
+        return false;
+
+    switch (config.advectionScheme)
+    {
+    case Fluid2DSimulationConfig::SemiLagrangianAdvection:
+        std::swap(velocity, free1);
+        return true;
+
+    case Fluid2DSimulationConfig::MacCormackAdvection:
+        if (!macCormackCorrect(*velocity, *free1, *velocity, *free2, dt, gridSize))
+            return false;
+
+        std::swap(velocity, free2);
+        return true;
+    }
+
+    Q_UNREACHABLE();
+}
+
+bool Fluid2DSimulationCLProgram::confineVorticity(const Fluid2DSimulationConfig &config,
+                                                  MyCLImage2D *&velocity,
+                                                  MyCLImage2D *&free1,
+                                                  MyCLImage2D *&free2,
+                                                  cl_float dt)
+{
+    if (config.vorticityStrength <= 0)
+        return true;
+
+    if (!curl(*velocity, *free1, config.gridSquareSize))
+        return false;
+
+    if (!vorticityConfinement(*velocity, *free1, *free2, config.vorticityStrength, dt, config.gridSquareSize))
+        return false;
+
+    std::swap(velocity, free2);
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::diffuse(const Fluid2DSimulationConfig &config,
+                                         MyCLImage2D *&velocity,
+                                         MyCLImage2D *&free1,
+                                         MyCLImage2D *&free2,
+                                         cl_float dt,
+                                         int sweepsPerLaunch)
+{
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float hh_vdt = gridSize * gridSize / (config.viscosity * dt);
+
+    if (sweepsPerLaunch > 1 || config.adaptiveIterations)
+    {
+        // Like the loop below, each sweep uses its own input as b, and so does
+        // the residual check.
+        if (!jacobiIterations(config, velocity, nullptr, free1, hh_vdt, 4 + hh_vdt, 60, sweepsPerLaunch))
+            return false;
+    }
+    else for (int iteration = 0; iteration < 30; ++iteration)
+    {
+        MyCLImage2D *t1 = velocity;
+        MyCLImage2D *t2 = free1;
+
+        for (int subIteration = 0; subIteration < 2; ++subIteration)
+        {
+            if (!jacobi(*t1, *t1, *t2, hh_vdt, 4 + hh_vdt))
+                return false;
+
+            // Swap pointers.
+            std::swap(t1, t2);
+        }
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::solvePressure(const Fluid2DSimulationConfig &config,
+                                               MyCLImage2D *&pressure,
+                                               MyCLImage2D &divergence,
+                                               MyCLImage2D *&scratch,
+                                               int sweepsPerLaunch)
+{
+    const cl_float alpha = -config.gridSquareSize * config.gridSquareSize;
+
+    switch (config.pressureSolver)
+    {
+    case Fluid2DSimulationConfig::JacobiSolver:
+        return jacobiIterations(config, pressure, &divergence, scratch, alpha, 4, config.pressureIterations, sweepsPerLaunch);
+
+    case Fluid2DSimulationConfig::RedBlackSORSolver:
+        for (int iteration = 0; iteration < config.pressureIterations; ++iteration)
+        {
+            if (!redBlackSOR(*pressure, divergence, *scratch, alpha, 4, config.sorOmega))
+                return false;
+
+            // redBlackSOR() writes its result back into *pressure.
+
+            if (config.adaptiveIterations && (iteration + 1) % config.residualCheckInterval == 0)
+            {
+                bool converged;
+                if (!checkResidual(*pressure, divergence, alpha, 4, config.residualTolerance, &converged))
+                    return false;
+
+                if (converged)
+                    break;
+            }
+        }
+        finishResidualChecks();
+        return true;
+
+    case Fluid2DSimulationConfig::MultigridSolver:
+        if (!multigridSupported())
+            return jacobiIterations(config, pressure, &divergence, scratch, alpha, 4, config.pressureIterations, sweepsPerLaunch);
+
+        if (!createMultigridLevels(pressure->width(), pressure->height()))
+            return false;
+
+        for (int cycle = 0; cycle < config.pressureIterations; ++cycle)
+        {
+            if (!vCycle(0, pressure, divergence, scratch, config.gridSquareSize, config.multigridSmoothingSweeps))
+                return false;
+
+            // A V-cycle is worth many sweeps, so check after every one.
+            if (config.adaptiveIterations)
+            {
+                bool converged;
+                if (!checkResidual(*pressure, divergence, alpha, 4, config.residualTolerance, &converged))
+                    return false;
+
+                if (converged)
+                    break;
+            }
+        }
+        finishResidualChecks();
+        return true;
+
+    case Fluid2DSimulationConfig::ConjugateGradientSolver:
+        if (!conjugateGradientSupported())
+            return jacobiIterations(config, pressure, &divergence, scratch, alpha, 4, config.pressureIterations, sweepsPerLaunch);
+
+        return conjugateGradient(*pressure, divergence, config.gridSquareSize,
+                                 config.pcgTolerance, config.pressureIterations);
+    }
+
+    Q_UNREACHABLE();
+}
+
+bool Fluid2DSimulationCLProgram::vCycle(size_t level,
+                                        MyCLImage2D *&x,
+                                        MyCLImage2D &b,
+                                        MyCLImage2D *&temp,
+                                        cl_float gridSize,
+                                        int smoothingSweeps)
+{
+    const cl_float alpha = -gridSize * gridSize;
+
+    // On the coarsest grid, just smooth until the error is gone.
+    if (level == mMultigridLevels.size())
+    {
+        for (int sweep = 0; sweep < 16; ++sweep)
+        {
+            if (!redBlackSOR(*x, b, *temp, alpha, 4, 1))
+                return false;
+        }
+        return true;
+    }
+
+    for (int sweep = 0; sweep < smoothingSweeps; ++sweep)
+    {
+        if (!redBlackSOR(*x, b, *temp, alpha, 4, 1))
+            return false;
+    }
+
+    MultigridLevel *coarse = mMultigridLevels[level];
+
+    // Solve for the error on the coarse grid, starting from 0.
+    if (!residual(*x, b, *temp, gridSize))
+        return false;
+
+    if (!restrictAverage(*temp, coarse->rhs))
+        return false;
+
+    CLNiceties::ZeroImage(mCLWrapper->queue(), *coarse->x, mCLWrapper);
+
+    if (!vCycle(level + 1, coarse->x, coarse->rhs, coarse->temp, 2 * gridSize, smoothingSweeps))
+        return false;
+
+    if (!prolongAdd(*x, *coarse->x, *temp))
+        return false;
+    std::swap(x, temp);
+
+    for (int sweep = 0; sweep < smoothingSweeps; ++sweep)
+    {
+        if (!redBlackSOR(*x, b, *temp, alpha, 4, 1))
+            return false;
+    }
+
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::conjugateGradient(MyCLImage2D &pressure,
+                                                   MyCLImage2D &divergence,
+                                                   cl_float gridSize,
+                                                   cl_float tolerance,
+                                                   int maxIterations)
+{
+    const cl_int width = pressure.width();
+    const cl_int height = pressure.height();
+    const cl_int n = width * height;
+
+    if (!createPCGBuffers(n))
+        return false;
+
+    // Indices into mPCG.scalars. The two r.z slots alternate between iterations
+    // so that beta can be computed from the old and new values without a copy.
+    const cl_int pqIndex = 2;
+    const cl_int rz0Index = 3;
+
+    /* Initialize:
+        x = pressure,  r = f - A x,  z = M^-1 r,  p = z */
+    if (!mImageToBufferKernel(width, height, pressure, mPCG.x, 1)) return false;
+    if (!mImageToBufferKernel(width, height, divergence, mPCG.z, -gridSize * gridSize)) return false;   // z holds f for now
+    if (!mPCGResidualKernel(width, height, mPCG.x, mPCG.z, mPCG.r, width, height)) return false;
+    if (!preconditionDot(0)) return false;
+
+    cl_int err = clEnqueueCopyBuffer(mCLWrapper->queue(), mPCG.scalars.buffer(), mPCG.scalars.buffer(),
+                                     0, rz0Index * sizeof(cl_float), sizeof(cl_float), 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        qDebug() << "Failed to enqueue the PCG r.z copy:" << err;
+        return false;
+    }
+
+    err = clEnqueueCopyBuffer(mCLWrapper->queue(), mPCG.z.buffer(), mPCG.p.buffer(),
+                              0, 0, n * sizeof(cl_float), 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        qDebug() << "Failed to enqueue the PCG direction copy:" << err;
+        return false;
+    }
+
+    for (int iteration = 0; iteration < maxIterations; ++iteration)
+    {
+        const cl_int rzIndex = iteration % 2;
+        const cl_int rzNewIndex = 1 - rzIndex;
+
+        // alpha = r.z / p.Ap
+        if (!mPCGApplyMatrixKernel(width, height, mPCG.p, mPCG.q, width, height)) return false;
+        if (!dot(mPCG.p, mPCG.q, pqIndex)) return false;
+        if (!mPCGUpdateSolutionKernel(n, mPCG.x, mPCG.r, mPCG.p, mPCG.q, mPCG.scalars, rzIndex, pqIndex, n)) return false;
+
+        if (!preconditionDot(rzNewIndex)) return false;
+
+        // Reading the scalars back stalls the queue, so only check every few iterations.
+        if ((iteration + 1) % PCGCheckInterval == 0 && iteration + 1 < maxIterations)
+        {
+            cl_float scalars[4];
+            if (!mPCG.scalars.read(mCLWrapper->queue(), scalars, sizeof(scalars)))
+                return false;
+
+            // r.z is the squared residual in the preconditioner's norm.
+            if (scalars[rzNewIndex] <= tolerance * tolerance * scalars[rz0Index])
+                break;
+        }
+
+        // beta = r.z (new) / r.z (old)
+        if (!mPCGUpdateDirectionKernel(n, mPCG.p, mPCG.z, mPCG.scalars, rzNewIndex, rzIndex, n)) return false;
+    }
+
+    return mBufferToImageKernel(width, height, mPCG.x, pressure);
+}
+
+bool Fluid2DSimulationCLProgram::dot(MyCLBuffer &a, MyCLBuffer &b, cl_int scalarIndex)
+{
+    if (!mPCGDotKernel.runWithLocalSize(mReductionGroupSize * ReductionNumGroups, 1, mReductionGroupSize, 1,
+                                        a, b, mPCG.partialSums, mPCG.count))
+        return false;
+
+    return mPCGFinishDotKernel.runWithLocalSize(ReductionNumGroups, 1, ReductionNumGroups, 1,
+                                                mPCG.partialSums, mPCG.scalars, scalarIndex);
+}
+
+bool Fluid2DSimulationCLProgram::preconditionDot(cl_int scalarIndex)
+{
+    if (!mPCGPreconditionDotKernel.runWithLocalSize(mReductionGroupSize * ReductionNumGroups, 1, mReductionGroupSize, 1,
+                                                    mPCG.r, mPCG.z, mPCG.partialSums, mPCG.count))
+        return false;
+
+    return mPCGFinishDotKernel.runWithLocalSize(ReductionNumGroups, 1, ReductionNumGroups, 1,
+                                                mPCG.partialSums, mPCG.scalars, scalarIndex);
+}
+
+bool Fluid2DSimulationCLProgram::createPCGBuffers(cl_int count)
+{
+    if (mPCG.count == count)
+        return true;
+
+    destroyPCGBuffers();
+
+    cl_context context = mCLWrapper->context();
+    size_t bytes = count * sizeof(cl_float);
+
+    if (!mPCG.x.create(context, bytes) ||
+        !mPCG.r.create(context, bytes) ||
+        !mPCG.z.create(context, bytes) ||
+        !mPCG.p.create(context, bytes) ||
+        !mPCG.q.create(context, bytes) ||
+        !mPCG.partialSums.create(context, ReductionNumGroups * sizeof(cl_float)) ||
+        !mPCG.scalars.create(context, 4 * sizeof(cl_float)))
+    {
+        qDebug() << "Failed to create PCG buffers.";
+        destroyPCGBuffers();
+        return false;
+    }
+
+    mPCG.count = count;
+    return true;
+}
+
+void Fluid2DSimulationCLProgram::destroyPCGBuffers()
+{
+    mPCG.x.destroy();
+    mPCG.r.destroy();
+    mPCG.z.destroy();
+    mPCG.p.destroy();
+    mPCG.q.destroy();
+    mPCG.partialSums.destroy();
+    mPCG.scalars.destroy();
+    mPCG.count = 0;
+}
+
+bool Fluid2DSimulationCLProgram::createSparseBuffers(size_t width, size_t height)
+{
+    const cl_int tilesX = (width + SparseTileSize - 1) / SparseTileSize;
+    const cl_int tilesY = (height + SparseTileSize - 1) / SparseTileSize;
+
+    if (mSparse.tilesX == tilesX && mSparse.tilesY == tilesY)
+        return true;
+
+    destroySparseBuffers();
+
+    cl_context context = mCLWrapper->context();
+    size_t bytes = tilesX * tilesY * sizeof(cl_int);
+
+    if (!mSparse.flags.create(context, bytes) ||
+        !mSparse.wasActive.create(context, bytes) ||
+        !mSparse.tiles.create(context, bytes) ||
+        !mSparse.clearTiles.create(context, bytes) ||
+        !mSparse.counts.create(context, 2 * sizeof(cl_int)))
+    {
+        qDebug() << "Failed to create sparse tile buffers.";
+        destroySparseBuffers();
+        return false;
+    }
+
+    // No tile is active at first, which matches the zeroed images.
+    CLNiceties::ZeroBuffer(mCLWrapper->queue(), mSparse.wasActive);
+    CLNiceties::ZeroBuffer(mCLWrapper->queue(), mSparse.counts);
+
+    mSparse.tilesX = tilesX;
+    mSparse.tilesY = tilesY;
+    return true;
+}
+
+void Fluid2DSimulationCLProgram::destroySparseBuffers()
+{
+    mSparse.flags.destroy();
+    mSparse.wasActive.destroy();
+    mSparse.tiles.destroy();
+    mSparse.clearTiles.destroy();
+    mSparse.counts.destroy();
+    mSparse.tilesX = 0;
+    mSparse.tilesY = 0;
+}
+
+bool Fluid2DSimulationCLProgram::createSpectralBuffers(size_t width, size_t height)
+{
+    if (mSpectral.width == (cl_int) width && mSpectral.height == (cl_int) height)
+        return true;
+
+    destroySpectralBuffers();
+
+    cl_context context = mCLWrapper->context();
+    size_t bytes = width * height * sizeof(cl_float2);
+
+    if (!mSpectral.spectrum.create(context, bytes) ||
+        !mSpectral.scratch.create(context, bytes) ||
+        !mSpectral.pressure.create(context, bytes))
+    {
+        qDebug() << "Failed to create spectral solver buffers.";
+        destroySpectralBuffers();
+        return false;
+    }
+
+    mSpectral.width = width;
+    mSpectral.height = height;
+    return true;
+}
+
+void Fluid2DSimulationCLProgram::destroySpectralBuffers()
+{
+    mSpectral.spectrum.destroy();
+    mSpectral.scratch.destroy();
+    mSpectral.pressure.destroy();
+    mSpectral.width = 0;
+    mSpectral.height = 0;
+}
+
+bool Fluid2DSimulationCLProgram::createMultigridLevels(size_t width, size_t height)
+{
+    if (mMultigridWidth == width && mMultigridHeight == height)
+        return true;
+
+    destroyMultigridLevels();
+
+    const size_t fineWidth = width;
+    const size_t fineHeight = height;
+
+    // Coarsen until the grid is small enough to solve by smoothing alone.
+    while (width >= 8 && height >= 8)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+
+        MultigridLevel *level = new MultigridLevel();
+        mMultigridLevels.push_back(level);
+
+        for (MyCLImage2D *img : {&level->images[0], &level->images[1], &level->rhs})
+        {
+            if (!img->create(mCLWrapper->context(), width, height, CL_R, CL_FLOAT))
+            {
+                qDebug() << "Failed to create multigrid level.";
+                destroyMultigridLevels();
+                return false;
+            }
+        }
+
+        level->x = &level->images[0];
+        level->temp = &level->images[1];
+    }
+
+    mMultigridWidth = fineWidth;
+    mMultigridHeight = fineHeight;
+    return true;
+}
+
+void Fluid2DSimulationCLProgram::destroyMultigridLevels()
+{
+    for (MultigridLevel *level : mMultigridLevels)
+        delete level;   // the images release themselves
+
+    mMultigridLevels.clear();
+    mMultigridWidth = 0;
+    mMultigridHeight = 0;
+}
+
+bool Fluid2DSimulationCLProgram::copy(MyCLImage2D &from, MyCLImage2D &to)
+{
+    return addScaled(from, from, 0, to);
+}
+
+bool Fluid2DSimulationCLProgram::jacobi(MyCLImage2D &input,
+                                        MyCLImage2D &b,
+                                        MyCLImage2D &output,
+                                        cl_float alpha,
+                                        cl_float beta)
+{
+    return mJacobiKernel(output.width(), output.height(), input, b, output, alpha, 1.0 / beta);
+}
+
+bool Fluid2DSimulationCLProgram::jacobiTiled(MyCLImage2D &input,
+                                             MyCLImage2D *b,
+                                             MyCLImage2D &output,
+                                             cl_float alpha,
+                                             cl_float beta,
+                                             cl_int sweeps)
+{
+    Q_ASSERT( sweeps > 0 && sweeps <= JacobiMaxSweepsPerLaunch );
+
+    // Each work group writes a block of this side-length.
+    size_t blockSize = JacobiTileSize - 2 * sweeps;
+    size_t groupsX = (output.width() + blockSize - 1) / blockSize;
+    size_t groupsY = (output.height() + blockSize - 1) / blockSize;
+
+    return mJacobiTiledKernel.runWithLocalSize(groupsX * JacobiTileSize, groupsY * JacobiTileSize,
+                                               JacobiTileSize, JacobiTileSize,
+                                               input, b ? *b : input, output, alpha, 1.0 / beta,
+                                               sweeps, b ? 0 : 1);
+}
+
+bool Fluid2DSimulationCLProgram::redBlackSOR(MyCLImage2D &x,
+                                             MyCLImage2D &b,
+                                             MyCLImage2D &temp,
+                                             cl_float alpha,
+                                             cl_float beta,
+                                             cl_float omega)
+{
+    // Images can't be updated in place, so each half-sweep copies the cells
+    // of the other color through to its output.
+    if (!mSORRedKernel(x.width(), x.height(), x, b, temp, alpha, 1.0 / beta, omega))
+        return false;
+
+    return mSORBlackKernel(x.width(), x.height(), temp, b, x, alpha, 1.0 / beta, omega);
+}
+
+bool Fluid2DSimulationCLProgram::residual(MyCLImage2D &x,
+                                          MyCLImage2D &b,
+                                          MyCLImage2D &output,
+                                          cl_float gridSize)
+{
+    return mResidualKernel(output.width(), output.height(), x, b, output, 1.0 / (gridSize * gridSize));
+}
+
+bool Fluid2DSimulationCLProgram::restrictAverage(MyCLImage2D &fine, MyCLImage2D &coarse)
+{
+    return mRestrictKernel(coarse.width(), coarse.height(), fine, coarse);
+}
+
+bool Fluid2DSimulationCLProgram::prolongAdd(MyCLImage2D &x, MyCLImage2D &coarse, MyCLImage2D &output)
+{
+    return mProlongAddKernel(output.width(), output.height(), x, coarse, output);
+}
+
+bool Fluid2DSimulationCLProgram::interpolateStates(MyCLImage2D &previous,
+                                                   MyCLImage2D &current,
+                                                   cl_float alpha,
+                                                   MyCLImage2D &output)
+{
+    return mInterpolateStatesKernel(output.width(), output.height(), previous, current, alpha, output);
+}
+
+bool Fluid2DSimulationCLProgram::clearWrapped(MyCLImage2D &img,
+                                              cl_int firstX,
+                                              cl_int firstY,
+                                              cl_int countX,
+                                              cl_int countY)
+{
+    Q_ASSERT( firstX >= 0 && firstY >= 0 && (size_t) firstX < img.width() && (size_t) firstY < img.height() );
+
+    return mClearWrappedKernel(countX, countY, img, firstX, firstY, countX, countY);
+}
+
+bool Fluid2DSimulationCLProgram::upsampleBicubic(MyCLImage2D &coarse, MyCLImage2D &fine)
+{
+    return mUpsampleBicubicKernel(fine.width(), fine.height(), coarse, fine);
+}
+
+bool Fluid2DSimulationCLProgram::downsampleAverage(MyCLImage2D &fine, MyCLImage2D &coarse, cl_int factor)
+{
+    return mDownsampleAverageKernel(coarse.width(), coarse.height(), fine, coarse, factor);
+}
+
+bool Fluid2DSimulationCLProgram::tiledJacobiSupported() const
+{
+    return mJacobiTiledKernel.maxWorkGroupSize() >= JacobiTileSize * JacobiTileSize &&
+           mJacobiTiledKernel.localMemorySize() <= mDeviceLocalMemSize;
+}
+
+bool Fluid2DSimulationCLProgram::reductionsSupported() const
+{
+    return mReductionGroupSize > 0;
+}
+
+bool Fluid2DSimulationCLProgram::conjugateGradientSupported() const
+{
+    return mHasConjugateGradientKernels && reductionsSupported();
+}
+
+bool Fluid2DSimulationCLProgram::multigridSupported() const
+{
+    return mHasMultigridKernels;
+}
+
+bool Fluid2DSimulationCLProgram::jacobiResidualNorm(MyCLImage2D &x,
+                                                    MyCLImage2D &b,
+                                                    MyCLBuffer &partialSums,
+                                                    MyCLBuffer &sum,
+                                                    cl_float alpha,
+                                                    cl_float beta)
+{
+    if (!mJacobiResidualNormKernel.runWithLocalSize(mReductionGroupSize * ReductionNumGroups, 1, mReductionGroupSize, 1,
+                                                    x, b, partialSums, alpha, 1.0 / beta))
+        return false;
+
+    return mPCGFinishDotKernel.runWithLocalSize(ReductionNumGroups, 1, ReductionNumGroups, 1,
+                                                partialSums, sum, 0);
+}
+
+bool Fluid2DSimulationCLProgram::jacobiIterations(const Fluid2DSimulationConfig &config,
+                                                  MyCLImage2D *&x,
+                                                  MyCLImage2D *b,
+                                                  MyCLImage2D *&scratch,
+                                                  cl_float alpha,
+                                                  cl_float beta,
+                                                  int iterations,
+                                                  int sweepsPerLaunch)
+{
+    Q_ASSERT( x != b && scratch != b );
+
+    int sweepsDone = 0;
+    int nextCheck = config.residualCheckInterval;
+
+    while (sweepsDone < iterations)
+    {
+        int sweeps = std::min(iterations - sweepsDone, sweepsPerLaunch);
+
+        bool success = sweeps > 1
+                ? jacobiTiled(*x, b, *scratch, alpha, beta, sweeps)
+                : jacobi(*x, b ? *b : *x, *scratch, alpha, beta);
+
+        if (!success)
+            return false;
+
+        std::swap(x, scratch);
+        sweepsDone += sweeps;
+
+        if (config.adaptiveIterations && sweepsDone >= nextCheck && sweepsDone < iterations)
+        {
+            bool converged;
+            if (!checkResidual(*x, b ? *b : *x, alpha, beta, config.residualTolerance, &converged))
+                return false;
+
+            if (converged)
+                break;
+
+            nextCheck += config.residualCheckInterval;
+        }
+    }
+
+    finishResidualChecks();
+    return true;
+}
+
+bool Fluid2DSimulationCLProgram::checkResidual(MyCLImage2D &x,
+                                               MyCLImage2D &b,
+                                               cl_float alpha,
+                                               cl_float beta,
+                                               cl_float tolerance,
+                                               bool *converged)
+{
+    *converged = false;
+
+    // Without the reduction kernels, the solve simply never converges early.
+    if (!reductionsSupported())
+        return true;
+
+    if (mResidualEvent != NULL)
+    {
+        cl_int status;
+        cl_int err = clGetEventInfo(mResidualEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+
+        if (err != CL_SUCCESS || status < 0)
+        {
+            qDebug() << "Residual readback failed.";
+            finishResidualChecks();
+            return false;
+        }
+
+        // Still in flight; waiting for it would stall the queue.
+        if (status != CL_COMPLETE)
+            return true;
+
+        finishResidualChecks();
+
+        // The readback is the sum over the grid; compare its root mean square.
+        cl_float cells = x.width() * x.height();
+        if (std::sqrt(mResidualReadback / cells) <= tolerance)
+        {
+            *converged = true;
+            return true;
+        }
+    }
+
+    if (!jacobiResidualNorm(x, b, mResidualPartialSums, mResidualSum, alpha, beta))
+        return false;
+
+    if (!mResidualSum.read(mCLWrapper->queue(), &mResidualReadback, sizeof(cl_float), false, &mResidualEvent))
+    {
+        mResidualEvent = NULL;
+        return false;
+    }
+
+    // Make sure the check actually starts running while we enqueue more sweeps.
+    clFlush(mCLWrapper->queue());
+    return true;
+}
+
+void Fluid2DSimulationCLProgram::finishResidualChecks()
+{
+    // The queue is in order, so a read still in flight finishes before any later
+    // one writes to mResidualReadback. There is no need to wait for it here;
+    // release() waits before the readback target goes away.
+    if (mResidualEvent != NULL)
+    {
+        clReleaseEvent(mResidualEvent);
+        mResidualEvent = NULL;
+    }
+}
+
+bool Fluid2DSimulationCLProgram::advect(MyCLImage2D &quantity,
+                                        MyCLImage2D &velocity,
+                                        MyCLImage2D &output,
+                                        cl_float dt,
+                                        cl_float gridSize)
+{
+
+    return mAdvectKernel(output.width(), output.height(), quantity, velocity, output, dt / gridSize);
+}
+
+bool Fluid2DSimulationCLProgram::advectAddForce(MyCLImage2D &velocity,
+                                                MyCLImage2D &forces,
+                                                MyCLImage2D &output,
+                                                cl_float dt,
+                                                cl_float gridSize)
+{
+    return mAdvectAddForceKernel(output.width(), output.height(), velocity, forces, output, dt / gridSize, dt);
+}
+
+bool Fluid2DSimulationCLProgram::divergenceJacobi(MyCLImage2D &velocity,
+                                                  MyCLImage2D &pressure,
+                                                  MyCLImage2D &divOutput,
+                                                  MyCLImage2D &pressureOutput,
+                                                  cl_float gridSize)
+{
+    return mDivergenceJacobiKernel(divOutput.width(), divOutput.height(), velocity, pressure, divOutput, pressureOutput,
+                                   1.0 / gridSize, -gridSize * gridSize, 0.25);
+}
+
+bool Fluid2DSimulationCLProgram::jacobiPressureBoundary(MyCLImage2D &input,
+                                                        MyCLImage2D &b,
+                                                        MyCLImage2D &output,
+                                                        cl_float alpha,
+                                                        cl_float beta)
+{
+    return mJacobiPressureBoundaryKernel(output.width(), output.height(), input, b, output, alpha, 1.0 / beta);
+}
+
+bool Fluid2DSimulationCLProgram::projectBoundary(MyCLImage2D &velocity,
+                                                 MyCLImage2D &pressure,
+                                                 MyCLImage2D &output,
+                                                 cl_float gridSize,
+                                                 cl_float density)
+{
+    return mProjectBoundaryKernel(output.width(), output.height(), velocity, pressure, output, 1.0 / (gridSize * density));
+}
+
+bool Fluid2DSimulationCLProgram::wholeStep(MyCLImage2D &velocities,
+                                           MyCLImage2D &velocitiesOut,
+                                           MyCLImage2D *forces,
+                                           MyCLImage2D &pressure,
+                                           MyCLImage2D &pressureOut,
+                                           cl_float dt,
+                                           cl_float gridSize,
+                                           cl_float density,
+                                           cl_float omega,
+                                           cl_int iterations)
+{
+    Q_ASSERT( wholeStepSupported(velocitiesOut.width(), velocitiesOut.height()) );
+
+    const size_t cells = velocitiesOut.width() * velocitiesOut.height();
+    const size_t groupSize = mWholeStepKernel.maxWorkGroupSize();
+
+    // The forces image is only read if forceScale is nonzero.
+    MyCLImage2D &forcesImage = forces != nullptr ? *forces : velocities;
+    const cl_float forceScale = forces != nullptr ? dt : 0;
+
+    return mWholeStepKernel.runWithLocalSize(groupSize, 1, groupSize, 1,
+                                             velocities, forcesImage, pressure, velocitiesOut, pressureOut,
+                                             MyCLLocalMemory(cells * sizeof(cl_float2)),
+                                             MyCLLocalMemory(cells * sizeof(cl_float)),
+                                             MyCLLocalMemory(cells * sizeof(cl_float)),
+                                             dt / gridSize, forceScale, 1.0 / gridSize, -gridSize * gridSize,
+                                             omega, iterations, 1.0 / (gridSize * density));
+}
+
+bool Fluid2DSimulationCLProgram::wholeStepSupported(size_t width, size_t height) const
+{
+    // A velocity, divergence and pressure per cell.
+    cl_ulong bytes = width * height * (sizeof(cl_float2) + 2 * sizeof(cl_float));
+
+    return mWholeStepKernel.maxWorkGroupSize() > 0 &&
+            bytes + mWholeStepKernel.localMemorySize() <= mDeviceLocalMemSize;
+}
+
+bool Fluid2DSimulationCLProgram::usesWholeStep(const Fluid2DSimulationConfig &config) const
+{
+    return config.wholeStepForSmallGrids &&
+            !mPeriodicBoundary &&
+            config.advectionScheme == Fluid2DSimulationConfig::SemiLagrangianAdvection &&
+            config.vorticityStrength <= 0 &&
+            !(config.hasViscosity && config.viscosity > 0) &&
+            (config.pressureSolver == Fluid2DSimulationConfig::JacobiSolver ||
+             config.pressureSolver == Fluid2DSimulationConfig::RedBlackSORSolver) &&
+            wholeStepSupported(config.width, config.height);
+}
+
+bool Fluid2DSimulationCLProgram::usesSparseTiles(const Fluid2DSimulationConfig &config) const
+{
+    return config.sparseTiles &&
+            mHasSparseKernels &&
+            !mPeriodicBoundary &&
+            config.advectionScheme == Fluid2DSimulationConfig::SemiLagrangianAdvection &&
+            config.vorticityStrength <= 0 &&
+            !(config.hasViscosity && config.viscosity > 0) &&
+            config.pressureSolver == Fluid2DSimulationConfig::JacobiSolver;
+}
+
+bool Fluid2DSimulationCLProgram::usesSpectralSolver(const Fluid2DSimulationConfig &config) const
+{
+    // The radix-2 FFT needs sides that are powers of two.
+    auto isPowerOfTwo = [](size_t n) { return n >= 2 && (n & (n - 1)) == 0; };
+
+    return config.spectralSolver &&
+            mHasSpectralKernels &&
+            mPeriodicBoundary &&
+            isPowerOfTwo(config.width) &&
+            isPowerOfTwo(config.height);
+}
+
+bool Fluid2DSimulationCLProgram::macCormackCorrect(MyCLImage2D &quantity,
+                                                   MyCLImage2D &quantityHat,
+                                                   MyCLImage2D &velocity,
+                                                   MyCLImage2D &output,
+                                                   cl_float dt,
+                                                   cl_float gridSize)
+{
+    return mMacCormackCorrectKernel(output.width(), output.height(), quantity, quantityHat, velocity, output, dt / gridSize);
+}
+
+bool Fluid2DSimulationCLProgram::divergence(MyCLImage2D &vecField,
+                                            MyCLImage2D &output,
+                                            cl_float gridSize)
+{
+    return mDivergenceKernel(output.width(), output.height(), vecField, output, 1.0 / gridSize);
+}
+
+
+bool Fluid2DSimulationCLProgram::gradient(MyCLImage2D &func,
+                                          MyCLImage2D &output,
+                                          cl_float gridSize)
+{
+    return mGradientKernel(output.width(), output.height(), func, output, 1.0 / gridSize);
+}
+
+bool Fluid2DSimulationCLProgram::curl(MyCLImage2D &velocity,
+                                      MyCLImage2D &output,
+                                      cl_float gridSize)
+{
+    return mCurlKernel(output.width(), output.height(), velocity, output, 1.0 / gridSize);
+}
+
+bool Fluid2DSimulationCLProgram::vorticityConfinement(MyCLImage2D &velocity,
+                                                      MyCLImage2D &curlImage,
+                                                      MyCLImage2D &output,
+                                                      cl_float strength,
+                                                      cl_float dt,
+                                                      cl_float gridSize)
+{
+    return mVorticityConfinementKernel(output.width(), output.height(), velocity, curlImage, output,
+                                       1.0 / gridSize, strength * gridSize * dt);
 }
 
 bool Fluid2DSimulationCLProgram::addScaled(MyCLImage2D &t1, MyCLImage2D &t2,
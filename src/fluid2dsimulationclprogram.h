@@ -1,34 +1,113 @@
 #ifndef FLUID2DSIMULATIONCLPROGRAM_H
 #define FLUID2DSIMULATIONCLPROGRAM_H
 
+#include "fluid2dsimulationconfig.h"
+
 #include "cl_interface/include_opencl.h"
 #include "cl_interface/myclwrapper.h"
 #include "cl_interface/myclimage.h"
+#include "cl_interface/myclbuffer.h"
 #include "cl_interface/myclprogram.h"
 #include "cl_interface/myclkernel.h"
 
+#include <vector>
+
 class Fluid2DSimulationCLProgram
 {
 public:
     Fluid2DSimulationCLProgram();
 
-    bool create(MyCLWrapper *wrapper);
+    /// Builds the kernels. If the config is periodic, they are built for a grid
+    /// that wraps around (see Fluid2DSimulationConfig::periodicBoundary), and
+    /// update() must be given configs with periodicBoundary set. The kernels of
+    /// the sparse pipeline and of the conjugate gradient, multigrid and spectral
+    /// solvers are only built if the config selects them; if that fails, they
+    /// are disabled with a warning and update() falls back as it does when they
+    /// aren't supported.
+    bool create(MyCLWrapper *wrapper, const Fluid2DSimulationConfig &config);
 
     void release();
 
-    /// Updates the velocities and pressure images.
+    /// The side-length of the work group used by the tiled Jacobi kernel.
+    static const int JacobiTileSize = 16;
+
+    /// The most sweeps jacobiTiled() performs per launch. Each sweep shrinks the
+    /// block a work group writes by two cells, so this keeps at least half of
+    /// each tile's side useful.
+    static const int JacobiMaxSweepsPerLaunch = 4;
+
+    /// The largest work group size and the number of work groups of the dot
+    /// product and residual norm reduction kernels. Smaller power-of-two group
+    /// sizes are used on devices that can't launch this one.
+    static const int ReductionGroupSize = 256;
+    static const int ReductionNumGroups = 64;
+
+    /// The conjugate gradient solver reads its residual back every this many iterations.
+    static const int PCGCheckInterval = 4;
+
+    /// The side-length of the tiles of the sparse pipeline, which is also the
+    /// side-length of its work groups.
+    static const int SparseTileSize = 8;
+
+    /// Advances the velocities and pressure by one step, writing the results into
+    /// velocitiesOut and pressureOut. The input images are overwritten. The grid
+    /// size, density, viscosity and solver options are taken from the config.
+    ///
+    /// The last kernels of the step write straight into the output images, so
+    /// callers can swap input and output between steps instead of copying.
+    /// The output images must not alias any of the other images.
     ///
-    /// If the viscosity <= 0, the diffusion step is skipped.
+    /// If the config has no viscosity, the diffusion step is skipped.
     /// If forces == NULL, the force application step is skipped.
-    bool update(MyCLImage2D &velocities,
+    ///
+    /// If obstacles is given, it is a single-channel mask of the grid's size
+    /// that is above 0.5 in solid cells, and the step uses the obstacle kernels
+    /// of fluidSimulation.cl, which enforce the boundary conditions around the
+    /// obstacles and at the edges of the grid themselves. The pressure is then
+    /// always solved with Jacobi sweeps. Obstacles are ignored on a periodic grid.
+    bool update(const Fluid2DSimulationConfig &config,
+                MyCLImage2D &velocities,
+                MyCLImage2D &velocitiesOut,
                 MyCLImage2D *forces,
                 MyCLImage2D &pressure,
+                MyCLImage2D &pressureOut,
                 MyCLImage2D &temp1,
                 MyCLImage2D &temp2,
-                cl_float gridSize,
                 cl_float dt,
-                cl_float density,
-                cl_float viscosity);
+                MyCLImage2D *obstacles = nullptr);
+
+    /// The first part of a step spread over several calls (see
+    /// Fluid2DSimulationConfig::timeSlices): steps 1-4i of update(), without
+    /// the pressure solve. velocities is only read. *velocity, *free1 and *free2
+    /// must be three distinct vector field images; on return, *velocity holds
+    /// the velocity to be projected, divergence holds its divergence and the
+    /// other two are free.
+    bool beginSlicedStep(const Fluid2DSimulationConfig &config,
+                         MyCLImage2D &velocities,
+                         MyCLImage2D *forces,
+                         MyCLImage2D *&velocity,
+                         MyCLImage2D *&free1,
+                         MyCLImage2D *&free2,
+                         MyCLImage2D &divergence,
+                         cl_float dt);
+
+    /// Continues the pressure solve of a sliced step with `iterations` sweeps
+    /// (V-cycles, conjugate gradient iterations) of the config's solver. On
+    /// return, *pressure holds the result and *scratch is free.
+    bool continuePressureSolve(const Fluid2DSimulationConfig &config,
+                               MyCLImage2D *&pressure,
+                               MyCLImage2D &divergence,
+                               MyCLImage2D *&scratch,
+                               int iterations);
+
+    /// The last part of a sliced step: enforces the pressure boundary into
+    /// pressureOut and subtracts its gradient from velocity into velocitiesOut,
+    /// as the fused pipeline does.
+    bool finishSlicedStep(const Fluid2DSimulationConfig &config,
+                          MyCLImage2D &velocity,
+                          MyCLImage2D &pressure,
+                          MyCLImage2D &velocitiesOut,
+                          MyCLImage2D &pressureOut);
 
 
     bool copy(MyCLImage2D &from, MyCLImage2D &to);
@@ -39,12 +118,97 @@ public:
                 cl_float alpha,
                 cl_float beta);
 
+    /// Performs `sweeps` Jacobi iterations in one launch using local memory.
+    /// Unlike jacobi(), b is kept fixed across the sweeps; if b is null, each
+    /// sweep instead uses its own input as b, like jacobi(x, x, out). Requires
+    /// 0 < sweeps <= JacobiMaxSweepsPerLaunch and tiledJacobiSupported().
+    bool jacobiTiled(MyCLImage2D &input,
+                     MyCLImage2D *b,
+                     MyCLImage2D &output,
+                     cl_float alpha,
+                     cl_float beta,
+                     cl_int sweeps);
+
+    /// Performs one red-black successive over-relaxation sweep for the same
+    /// system that jacobi() iterates on. The result is written back into x;
+    /// temp is overwritten.
+    bool redBlackSOR(MyCLImage2D &x,
+                     MyCLImage2D &b,
+                     MyCLImage2D &temp,
+                     cl_float alpha,
+                     cl_float beta,
+                     cl_float omega);
+
+    /// Computes the residual b - laplacian(x) of the pressure Poisson equation.
+    bool residual(MyCLImage2D &x,
+                  MyCLImage2D &b,
+                  MyCLImage2D &output,
+                  cl_float gridSize);
+
+    /// Averages the fine image down into coarse, which must have half its size
+    /// (rounded up).
+    bool restrictAverage(MyCLImage2D &fine, MyCLImage2D &coarse);
+
+    /// Bilinearly interpolates coarse (half the size of x) onto x's grid and
+    /// writes the sum with x into output.
+    bool prolongAdd(MyCLImage2D &x, MyCLImage2D &coarse, MyCLImage2D &output);
+
+    /// Writes previous + (current - previous) * alpha into output.
+    bool interpolateStates(MyCLImage2D &previous, MyCLImage2D &current, cl_float alpha, MyCLImage2D &output);
+
+    /// Zeroes the countX x countY block of img whose first cell is
+    /// (firstX, firstY), wrapping around the edges of the image.
+    bool clearWrapped(MyCLImage2D &img, cl_int firstX, cl_int firstY, cl_int countX, cl_int countY);
+
+    /// Bicubically interpolates coarse onto fine, which covers the same area
+    /// at any higher resolution.
+    bool upsampleBicubic(MyCLImage2D &coarse, MyCLImage2D &fine);
+
+    /// Averages each factor x factor block of fine into a cell of coarse.
+    bool downsampleAverage(MyCLImage2D &fine, MyCLImage2D &coarse, cl_int factor);
+
+    /// Enqueues a reduction of the squared size of the next Jacobi update of x,
+    /// summed over the grid, into the first element of sum. partialSums must hold
+    /// ReductionNumGroups floats.
+    bool jacobiResidualNorm(MyCLImage2D &x,
+                            MyCLImage2D &b,
+                            MyCLBuffer &partialSums,
+                            MyCLBuffer &sum,
+                            cl_float alpha,
+                            cl_float beta);
+
+    /// Whether the device can launch jacobiTiled() with its required work group
+    /// size and local memory.
+    bool tiledJacobiSupported() const;
+
+    /// Whether the device can launch the reduction kernels. Without them, the
+    /// conjugate gradient solver falls back to Jacobi iterations and adaptive
+    /// solves always run their full number of iterations.
+    bool reductionsSupported() const;
+
+    /// Whether the conjugate gradient solver can be used. Without it, it falls
+    /// back to Jacobi iterations.
+    bool conjugateGradientSupported() const;
+
+    /// Whether the multigrid solver can be used. Without it, it falls back to
+    /// Jacobi iterations.
+    bool multigridSupported() const;
+
     bool advect(MyCLImage2D &quantity,
                 MyCLImage2D &velocity,
                 MyCLImage2D &output,
                 cl_float dt,
                 cl_float gridSize);
 
+    /// The correction pass of MacCormack advection, where quantityHat is the
+    /// result of advect() on quantity. See macCormackCorrect in fluidSimulation.cl.
+    bool macCormackCorrect(MyCLImage2D &quantity,
+                           MyCLImage2D &quantityHat,
+                           MyCLImage2D &velocity,
+                           MyCLImage2D &output,
+                           cl_float dt,
+                           cl_float gridSize);
+
     bool divergence(MyCLImage2D &vecField,
                     MyCLImage2D &output,
                     cl_float gridSize);
@@ -53,28 +217,396 @@ public:
                   MyCLImage2D &output,
                   cl_float gridSize);
 
+    /// Computes the curl of the velocity into the first channel of output.
+    bool curl(MyCLImage2D &velocity,
+              MyCLImage2D &output,
+              cl_float gridSize);
+
+    /// Adds the vorticity confinement force with the given strength, times dt,
+    /// to the velocity. curlImage must hold the curl of the velocity.
+    bool vorticityConfinement(MyCLImage2D &velocity,
+                              MyCLImage2D &curlImage,
+                              MyCLImage2D &output,
+                              cl_float strength,
+                              cl_float dt,
+                              cl_float gridSize);
+
     bool addScaled(MyCLImage2D &t1, MyCLImage2D &t2,
                    cl_float multiplier,
                    MyCLImage2D &sum);
 
+    /// advect() on the velocity itself, followed by adding forces * dt.
+    bool advectAddForce(MyCLImage2D &velocity,
+                        MyCLImage2D &forces,
+                        MyCLImage2D &output,
+                        cl_float dt,
+                        cl_float gridSize);
+
+    /// divergence() into divOutput, followed by the first Jacobi sweep of the
+    /// pressure solve from pressure into pressureOutput.
+    bool divergenceJacobi(MyCLImage2D &velocity,
+                          MyCLImage2D &pressure,
+                          MyCLImage2D &divOutput,
+                          MyCLImage2D &pressureOutput,
+                          cl_float gridSize);
+
+    /// jacobi() followed by pressureBoundary().
+    bool jacobiPressureBoundary(MyCLImage2D &input,
+                                MyCLImage2D &b,
+                                MyCLImage2D &output,
+                                cl_float alpha,
+                                cl_float beta);
+
+    /// Subtracts the pressure gradient divided by the density from the
+    /// velocity, followed by velocityBoundary().
+    bool projectBoundary(MyCLImage2D &velocity,
+                         MyCLImage2D &pressure,
+                         MyCLImage2D &output,
+                         cl_float gridSize,
+                         cl_float density);
+
+    /// Does a whole inviscid step with one launch of a single work group, keeping
+    /// the grid in local memory. Relaxes the pressure with `iterations` red-black
+    /// sweeps with factor omega. forces may be NULL. Requires wholeStepSupported().
+    bool wholeStep(MyCLImage2D &velocities,
+                   MyCLImage2D &velocitiesOut,
+                   MyCLImage2D *forces,
+                   MyCLImage2D &pressure,
+                   MyCLImage2D &pressureOut,
+                   cl_float dt,
+                   cl_float gridSize,
+                   cl_float density,
+                   cl_float omega,
+                   cl_int iterations);
+
+    /// Whether a grid of the given size fits in the local memory of one work group.
+    bool wholeStepSupported(size_t width, size_t height) const;
+
+    /// Whether update() will use wholeStep() for the given config.
+    bool usesWholeStep(const Fluid2DSimulationConfig &config) const;
+
+    /// Whether update() will use the sparse pipeline for the given config.
+    bool usesSparseTiles(const Fluid2DSimulationConfig &config) const;
+
+    /// Whether update() will use the spectral solver for the config.
+    bool usesSpectralSolver(const Fluid2DSimulationConfig &config) const;
+
     /* TODO: Instead of using OpenCL, I should draw lines on
             a given image by using OpenGL. */
     bool velocityBoundary(MyCLImage2D &img, MyCLImage2D &out);
     bool pressureBoundary(MyCLImage2D &img, MyCLImage2D &out);
 
 private:
+    /// The number of Jacobi sweeps to do per launch for the config, falling
+    /// back to 1 if the tiled kernel can't be launched.
+    int effectiveSweepsPerLaunch(const Fluid2DSimulationConfig &config) const;
+
+    /// The rest of update() when there are obstacles.
+    bool updateMasked(const Fluid2DSimulationConfig &config,
+                      MyCLImage2D &velocities,
+                      MyCLImage2D &velocitiesOut,
+                      MyCLImage2D *forces,
+                      MyCLImage2D &pressure,
+                      MyCLImage2D &pressureOut,
+                      MyCLImage2D &temp1,
+                      MyCLImage2D &temp2,
+                      MyCLImage2D &obstacles,
+                      cl_float dt);
+
+    /// The rest of update() when the config enables sparse tiles. Like the fused
+    /// pipeline, but only over the tiles with wind. Every image passed in must
+    /// be zero outside the active tiles, which holds as long as the same six
+    /// images are passed to every step (in any order) and start out zeroed.
+    bool updateSparse(const Fluid2DSimulationConfig &config,
+                      MyCLImage2D &velocities,
+                      MyCLImage2D &velocitiesOut,
+                      MyCLImage2D *forces,
+                      MyCLImage2D &pressure,
+                      MyCLImage2D &pressureOut,
+                      MyCLImage2D &temp1,
+                      MyCLImage2D &temp2,
+                      cl_float dt);
+
+    /// Recomputes the list of active tiles from the velocities and forces, and
+    /// zeroes the tiles that just became inactive in all of the images.
+    bool updateActiveTiles(const Fluid2DSimulationConfig &config,
+                           MyCLImage2D &velocities,
+                           MyCLImage2D *forces,
+                           cl_float dt,
+                           MyCLImage2D *images[6]);
+
+    /// The rest of update() when the config enables the spectral solver.
+    bool updateSpectral(const Fluid2DSimulationConfig &config,
+                        MyCLImage2D &velocities,
+                        MyCLImage2D &velocitiesOut,
+                        MyCLImage2D *forces,
+                        MyCLImage2D &pressureOut,
+                        MyCLImage2D &temp1,
+                        MyCLImage2D &temp2,
+                        cl_float dt);
+
+    /// Transforms the complex mSpectral.width x mSpectral.height field in *data
+    /// with the radix-2 FFT, ping-ponging between *data and *scratch. direction
+    /// is -1 for the forward transform and 1 for the unscaled inverse. On return,
+    /// *data holds the result and *scratch is free.
+    bool fft2D(MyCLBuffer *&data, MyCLBuffer *&scratch, cl_int direction);
+
+    /// The rest of update() when the config enables fused kernels.
+    bool updateFused(const Fluid2DSimulationConfig &config,
+                     MyCLImage2D &velocities,
+                     MyCLImage2D &velocitiesOut,
+                     MyCLImage2D *forces,
+                     MyCLImage2D &pressure,
+                     MyCLImage2D &pressureOut,
+                     MyCLImage2D &temp1,
+                     MyCLImage2D &temp2,
+                     cl_float dt,
+                     int sweepsPerLaunch);
+
+    /// Advects *velocity along itself with the config's advection scheme. Like
+    /// diffuse(), the three pointers may be permuted.
+    bool advectVelocity(const Fluid2DSimulationConfig &config,
+                        MyCLImage2D *&velocity,
+                        MyCLImage2D *&free1,
+                        MyCLImage2D *&free2,
+                        cl_float dt);
+
+    /// Applies vorticity confinement to *velocity if the config enables it. Like
+    /// diffuse(), the three pointers may be permuted.
+    bool confineVorticity(const Fluid2DSimulationConfig &config,
+                          MyCLImage2D *&velocity,
+                          MyCLImage2D *&free1,
+                          MyCLImage2D *&free2,
+                          cl_float dt);
+
+    /// Diffuses *velocity. Like solvePressure(), the three pointers may be
+    /// permuted; on return, *velocity holds the result and the others are free.
+    bool diffuse(const Fluid2DSimulationConfig &config,
+                 MyCLImage2D *&velocity,
+                 MyCLImage2D *&free1,
+                 MyCLImage2D *&free2,
+                 cl_float dt,
+                 int sweepsPerLaunch);
+
+    /// Solves for the pressure using the solver selected in the config, starting
+    /// from *pressure as the initial guess. On return, *pressure is the image
+    /// holding the result and *scratch is free.
+    bool solvePressure(const Fluid2DSimulationConfig &config,
+                       MyCLImage2D *&pressure,
+                       MyCLImage2D &divergence,
+                       MyCLImage2D *&scratch,
+                       int sweepsPerLaunch);
+
+    /// Performs up to `iterations` Jacobi sweeps on *x, `sweepsPerLaunch` at a time
+    /// (using the tiled kernel if that is above 1), ping-ponging between *x and
+    /// *scratch. b must not alias either; if it is null, each sweep uses its own
+    /// input as b, as the diffusion step does. If the config enables adaptive
+    /// iterations, stops early once the residual of that same iteration is below
+    /// its tolerance. On return, *x is the image holding the result and *scratch is free.
+    bool jacobiIterations(const Fluid2DSimulationConfig &config,
+                          MyCLImage2D *&x,
+                          MyCLImage2D *b,
+                          MyCLImage2D *&scratch,
+                          cl_float alpha,
+                          cl_float beta,
+                          int iterations,
+                          int sweepsPerLaunch);
+
+    /// Checks the result of the last residual check of an adaptive solve and sets
+    /// *converged if it was below tolerance. The check is asynchronous: if the last
+    /// one hasn't finished, this doesn't wait for it, and otherwise a new one of x
+    /// is enqueued. So convergence is detected one check late, but the queue never
+    /// stalls on a readback.
+    bool checkResidual(MyCLImage2D &x,
+                       MyCLImage2D &b,
+                       cl_float alpha,
+                       cl_float beta,
+                       cl_float tolerance,
+                       bool *converged);
+
+    /// Forgets about the residual check in flight, if any. Must be called at the
+    /// end of every adaptive solve.
+    void finishResidualChecks();
+
+    /// Storage for one level of the multigrid pyramid below the finest grid.
+    /// x and temp point into images and are swapped as the solve proceeds.
+    struct MultigridLevel
+    {
+        MyCLImage2D images[2];
+        MyCLImage2D rhs;
+
+        MyCLImage2D *x;
+        MyCLImage2D *temp;
+    };
+
+    /// Performs a multigrid V-cycle for laplacian(x) = b at the given level,
+    /// where level 0 is the finest grid and gridSize is the spacing at that level.
+    /// Like solvePressure(), *x and *temp may be swapped.
+    bool vCycle(size_t level,
+                MyCLImage2D *&x,
+                MyCLImage2D &b,
+                MyCLImage2D *&temp,
+                cl_float gridSize,
+                int smoothingSweeps);
+
+    /// Solves for the pressure with the Jacobi-preconditioned conjugate gradient
+    /// method on buffers, starting from the values in the pressure image. Stops
+    /// after maxIterations, or once the residual has shrunk by the factor tolerance.
+    bool conjugateGradient(MyCLImage2D &pressure,
+                           MyCLImage2D &divergence,
+                           cl_float gridSize,
+                           cl_float tolerance,
+                           int maxIterations);
+
+    /// Computes a . b into mPCG.scalars[scalarIndex].
+    bool dot(MyCLBuffer &a, MyCLBuffer &b, cl_int scalarIndex);
+
+    /// Computes z = M^-1 r and r . z into mPCG.scalars[scalarIndex].
+    bool preconditionDot(cl_int scalarIndex);
+
+    bool createPCGBuffers(cl_int count);
+    void destroyPCGBuffers();
+
+    /// Creates the tile buffers of the sparse pipeline for a grid of the given
+    /// size, unless they already exist.
+    bool createSparseBuffers(size_t width, size_t height);
+    void destroySparseBuffers();
+
+    /// Creates the complex buffers of the spectral solver for a grid of the
+    /// given size, unless they already exist.
+    bool createSpectralBuffers(size_t width, size_t height);
+    void destroySpectralBuffers();
+
+    /// Creates the multigrid pyramid for a finest grid of the given size, unless
+    /// it already exists.
+    bool createMultigridLevels(size_t width, size_t height);
+    void destroyMultigridLevels();
+
     bool mCreated;
 
     MyCLWrapper *mCLWrapper;
 
+    /// Whether the program was built with PERIODIC_BOUNDARY.
+    bool mPeriodicBoundary;
+
+    /// Whether the kernels of each optional pipeline or solver were created.
+    bool mHasSparseKernels;
+    bool mHasConjugateGradientKernels;
+    bool mHasMultigridKernels;
+    bool mHasSpectralKernels;
+
+    /// CL_DEVICE_LOCAL_MEM_SIZE of the wrapper's device.
+    cl_ulong mDeviceLocalMemSize;
+
+    /// The work group size the reduction kernels are launched with, or 0 if
+    /// they can't be launched on this device.
+    size_t mReductionGroupSize;
+
+    /// The coarser levels of the multigrid pyramid. Created on the first
+    /// multigrid solve.
+    std::vector<MultigridLevel *> mMultigridLevels;
+    size_t mMultigridWidth;
+    size_t mMultigridHeight;
+
+    /// Buffers for the conjugate gradient solver. Created on the first PCG solve.
+    struct
+    {
+        MyCLBuffer x, r, z, p, q;
+        MyCLBuffer partialSums;
+        MyCLBuffer scalars;
+        cl_int count;
+    } mPCG;
+
+    /// Buffers for the sparse pipeline. Created on the first sparse step.
+    /// flags holds each tile's activity, wasActive whether it was in the last
+    /// active list, tiles and clearTiles the lists of active tiles and of tiles
+    /// to zero, and counts their lengths.
+    struct
+    {
+        MyCLBuffer flags, wasActive;
+        MyCLBuffer tiles, clearTiles;
+        MyCLBuffer counts;
+        cl_int tilesX, tilesY;
+    } mSparse;
+
+    /// Complex (float2) buffers for the spectral solver. Created on the first
+    /// spectral step.
+    struct
+    {
+        MyCLBuffer spectrum, scratch, pressure;
+        cl_int width, height;
+    } mSpectral;
+
+    /// Storage for the residual checks of adaptive solves. mResidualEvent is
+    /// the event of the readback into mResidualReadback, or NULL if none is
+    /// in flight.
+    MyCLBuffer mResidualPartialSums;
+    MyCLBuffer mResidualSum;
+    cl_float mResidualReadback;
+    cl_event mResidualEvent;
+
     MyCLProgram mProgram;
     MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float> mJacobiKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float, cl_int, cl_int> mJacobiTiledKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float, cl_float> mSORRedKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float, cl_float> mSORBlackKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float> mResidualKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&> mRestrictKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&> mProlongAddKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&> mUpsampleBicubicKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, cl_int> mDownsampleAverageKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, cl_float, MyCLImage2D&> mInterpolateStatesKernel;
+    MyCLKernel<MyCLImage2D&, cl_int, cl_int, cl_int, cl_int> mClearWrappedKernel;
+    MyCLKernel<MyCLImage2D&, MyCLBuffer&, cl_float> mImageToBufferKernel;
+    MyCLKernel<MyCLBuffer&, MyCLImage2D&> mBufferToImageKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int, cl_int> mPCGResidualKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int, cl_int> mPCGApplyMatrixKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int> mPCGDotKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int> mPCGPreconditionDotKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int> mPCGFinishDotKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLBuffer&, cl_float, cl_float> mJacobiResidualNormKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int, cl_int, cl_int> mPCGUpdateSolutionKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int, cl_int, cl_int> mPCGUpdateDirectionKernel;
     MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float> mAdvectKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float> mMacCormackCorrectKernel;
     MyCLKernel<MyCLImage2D&, MyCLImage2D&, cl_float> mDivergenceKernel;
     MyCLKernel<MyCLImage2D&, MyCLImage2D&, cl_float> mGradientKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, cl_float> mCurlKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float> mVorticityConfinementKernel;
     MyCLKernel<MyCLImage2D&, MyCLImage2D&, cl_float, MyCLImage2D&> mAddScaledKernel;
     MyCLKernel<MyCLImage2D&, MyCLImage2D&> mVelocityBoundaryKernel;
     MyCLKernel<MyCLImage2D&, MyCLImage2D&> mPressureBoundaryKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float> mAdvectAddForceKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float, cl_float> mDivergenceJacobiKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float> mJacobiPressureBoundaryKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float> mProjectBoundaryKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&,
+               MyCLLocalMemory, MyCLLocalMemory, MyCLLocalMemory,
+               cl_float, cl_float, cl_float, cl_float, cl_float, cl_int, cl_float> mWholeStepKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float> mAdvectAddForceMaskedKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&,
+               cl_float, cl_float, cl_float> mDivergenceJacobiMaskedKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float> mJacobiMaskedKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float> mProjectMaskedKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, cl_float, cl_float, MyCLBuffer&> mTileActivityKernel;
+    MyCLKernel<MyCLImage2D&, cl_float, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int> mTileActivitySparseKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_int, cl_int, cl_int> mCompactTilesKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int,
+               MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&> mClearTilesKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float,
+               MyCLBuffer&, MyCLBuffer&, cl_int> mSparseAdvectAddForceKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float, cl_float,
+               MyCLBuffer&, MyCLBuffer&, cl_int> mSparseDivergenceJacobiKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float,
+               MyCLBuffer&, MyCLBuffer&, cl_int> mSparseJacobiKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float, cl_float,
+               MyCLBuffer&, MyCLBuffer&, cl_int> mSparseJacobiPressureBoundaryKernel;
+    MyCLKernel<MyCLImage2D&, MyCLImage2D&, MyCLImage2D&, cl_float,
+               MyCLBuffer&, MyCLBuffer&, cl_int> mSparseProjectBoundaryKernel;
+    MyCLKernel<MyCLImage2D&, MyCLBuffer&> mImageToComplexKernel;
+    MyCLKernel<MyCLBuffer&, MyCLImage2D&, cl_float2> mComplexToImageKernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, cl_int, cl_int, cl_int, cl_int, cl_int, cl_int> mFFTRadix2Kernel;
+    MyCLKernel<MyCLBuffer&, MyCLBuffer&, MyCLBuffer&, cl_float, cl_float, cl_float, cl_int, cl_int> mSpectralProjectKernel;
 };
 
 #endif // FLUID2DSIMULATIONCLPROGRAM_H
@@ -0,0 +1,425 @@
+#ifndef FLUID2DSIMULATIONCONFIG_H
+#define FLUID2DSIMULATIONCONFIG_H
+
+#include <cmath>
+#include <cstddef>
+
+#include <QDebug>
+
+struct Fluid2DSimulationConfig
+{
+    /// The method used to solve the Poisson equation for the pressure.
+    enum PressureSolver
+    {
+        /// Jacobi iteration. Uses the tiled kernel if jacobiSweepsPerLaunch > 1.
+        JacobiSolver,
+
+        /// Red-black successive over-relaxation with factor sorOmega.
+        RedBlackSORSolver,
+
+        /// Geometric multigrid V-cycles with red-black Gauss-Seidel smoothing.
+        MultigridSolver,
+
+        /// Jacobi-preconditioned conjugate gradient, stopping at pcgTolerance.
+        ConjugateGradientSolver
+    };
+
+    /// The method used to advect the velocity along itself.
+    enum AdvectionScheme
+    {
+        /// First-order semi-Lagrangian advection with bilinear interpolation.
+        SemiLagrangianAdvection,
+
+        /// MacCormack advection: a semi-Lagrangian pass, then a correction
+        /// estimated by advecting backward, limited to stay within the values
+        /// that were interpolated. Much less diffusive, at twice the cost.
+        MacCormackAdvection
+    };
+
+    /// Where the simulation keeps its fields.
+    enum StorageBackend
+    {
+        /// OpenCL images, sampled with read_imagef. Supports every option.
+        ImageStorage,
+
+        /// Plain row-major buffers with explicit interpolation, for devices
+        /// without image support or with slow image sampling (CPU runtimes).
+        /// Supports only the basic pipeline: semi-Lagrangian advection and
+        /// Jacobi solves, without the tiled, fused, adaptive, whole-step or
+        /// vorticity options.
+        BufferStorage,
+
+        /// Row-major planes in host memory, solved by
+        /// Fluid2DSimulationCPUProgram with SIMD instructions on a thread pool,
+        /// for machines without a usable OpenCL device. Supports the same
+        /// options as BufferStorage, and can't share OpenGL textures.
+        CPUStorage
+    };
+
+    /// The precision in which the images store the fields. The kernels always
+    /// compute with floats.
+    enum FieldPrecision
+    {
+        /// 32-bit floats: RG32F velocities and R32F pressure.
+        SinglePrecision,
+
+        /// 16-bit floats: RG16F velocities and R16F pressure. Halves the memory
+        /// traffic of every step, which dominates its cost, but the pressure is
+        /// only accurate to about 3 decimal digits. Falls back to single
+        /// precision if the device can't create such images.
+        HalfPrecision
+    };
+
+    /// Creates an inviscid (viscosity = 0) fluid with default density and grid coarseness.
+    Fluid2DSimulationConfig(size_t width, size_t height, float dens = 1, float gridSquare = 0.1f)
+        : width(width),
+          height(height),
+          hasViscosity(false),
+          viscosity(0),
+          density(dens),
+          gridSquareSize(gridSquare),
+          zeroInitializeSharedTextures(true),
+          jacobiSweepsPerLaunch(1),
+          pressureSolver(JacobiSolver),
+          pressureIterations(8),
+          sorOmega(1.7f),
+          multigridSmoothingSweeps(2),
+          pcgTolerance(1e-3f),
+          adaptiveIterations(false),
+          residualTolerance(1e-4f),
+          residualCheckInterval(4),
+          fusedKernels(false),
+          wholeStepForSmallGrids(false),
+          advectionScheme(SemiLagrangianAdvection),
+          vorticityStrength(0),
+          storage(ImageStorage),
+          precision(SinglePrecision),
+          resolutionDivisor(1),
+          fixedTimeStep(1 / 60.0f),
+          maxSubsteps(4),
+          interpolateSteps(false),
+          timeSlices(1),
+          sparseTiles(false),
+          sparseThreshold(1e-3f),
+          sparseDilation(1),
+          periodicBoundary(false),
+          spectralSolver(false),
+          partitionHaloRows(4)
+    {
+    }
+
+    /// Helper to enable and set the viscosity. The parameter should be > 0.
+    void setViscosity(float visc)
+    {
+        if (visc <= 0)
+        {
+            qWarning() << "Trying to set nonpositive viscosity disables viscosity.";
+            hasViscosity = false;
+            visc = 0;
+        }
+        else
+        {
+            hasViscosity = true;
+            viscosity = visc;
+        }
+    }
+
+    /// Helper to make the Jacobi solves use the local-memory tiled kernel, which
+    /// performs several sweeps per launch. A value of 1 uses the plain kernel.
+    void setTiledJacobi(int sweepsPerLaunch)
+    {
+        if (sweepsPerLaunch < 1)
+        {
+            qWarning() << "Jacobi sweeps per launch must be at least 1; using 1.";
+            sweepsPerLaunch = 1;
+        }
+
+        jacobiSweepsPerLaunch = sweepsPerLaunch;
+    }
+
+    /// Helper to select the red-black SOR pressure solver. The relaxation factor
+    /// must be in (0, 2); 1 is plain Gauss-Seidel.
+    void setRedBlackSOR(float omega, int iterations)
+    {
+        if (omega <= 0 || omega >= 2)
+        {
+            qWarning() << "SOR relaxation factor must be in (0, 2); using 1.";
+            omega = 1;
+        }
+
+        pressureSolver = RedBlackSORSolver;
+        sorOmega = omega;
+        pressureIterations = iterations;
+    }
+
+    /// Helper to select the multigrid pressure solver. Each V-cycle costs a small
+    /// constant number of sweeps over the grid, independent of its size.
+    void setMultigrid(int vCycles, int smoothingSweeps = 2)
+    {
+        pressureSolver = MultigridSolver;
+        pressureIterations = vCycles;
+        multigridSmoothingSweeps = smoothingSweeps;
+    }
+
+    /// Helper to select the preconditioned conjugate gradient pressure solver.
+    /// The solve stops once the residual has shrunk by the factor `tolerance`,
+    /// or after maxIterations.
+    void setConjugateGradient(float tolerance, int maxIterations)
+    {
+        pressureSolver = ConjugateGradientSolver;
+        pcgTolerance = tolerance;
+        pressureIterations = maxIterations;
+    }
+
+    /// Helper to run the solver on a grid `divisor` times coarser along each axis
+    /// than width x height. See resolutionDivisor.
+    void setLowResolution(int divisor)
+    {
+        if (divisor < 1)
+        {
+            qWarning() << "Resolution divisor must be at least 1; using 1.";
+            divisor = 1;
+        }
+
+        resolutionDivisor = divisor;
+    }
+
+    /// Helper to configure Fluid2DSimulation::advance(). See fixedTimeStep.
+    void setFixedTimeStep(float stepSeconds, int substepLimit, bool interpolate = true)
+    {
+        if (stepSeconds <= 0)
+        {
+            qWarning() << "Fixed time step must be positive; using 1/60 s.";
+            stepSeconds = 1 / 60.0f;
+        }
+
+        if (substepLimit < 1)
+        {
+            qWarning() << "Substep limit must be at least 1; using 1.";
+            substepLimit = 1;
+        }
+
+        fixedTimeStep = stepSeconds;
+        maxSubsteps = substepLimit;
+        interpolateSteps = interpolate;
+    }
+
+    /// Helper to spread every step over `slices` calls. See timeSlices.
+    void setTimeSlices(int slices)
+    {
+        if (slices < 1)
+        {
+            qWarning() << "Time slices must be at least 1; using 1.";
+            slices = 1;
+        }
+
+        timeSlices = slices;
+    }
+
+    /// Helper to enable the sparse pipeline. See sparseTiles.
+    void setSparseTiles(float threshold, int dilation = 1)
+    {
+        if (dilation < 1)
+        {
+            qWarning() << "Sparse tile dilation must be at least 1; using 1.";
+            dilation = 1;
+        }
+
+        sparseTiles = true;
+        sparseThreshold = threshold;
+        sparseDilation = dilation;
+    }
+
+    /// Helper to make the diffusion and pressure solves stop early once converged.
+    /// The residual is checked every checkInterval sweeps (every V-cycle for the
+    /// multigrid solver), and the iteration counts become upper limits.
+    void setAdaptiveIterations(float tolerance, int checkInterval = 4)
+    {
+        if (checkInterval < 1)
+        {
+            qWarning() << "Residual check interval must be at least 1; using 1.";
+            checkInterval = 1;
+        }
+
+        adaptiveIterations = true;
+        residualTolerance = tolerance;
+        residualCheckInterval = checkInterval;
+    }
+
+    /// Helper to give a partitioned simulation halos deep enough that advection
+    /// at up to maxSpeed over a step of dt seconds never reaches past them. See
+    /// partitionHaloRows.
+    void setPartitionHaloForSpeed(float maxSpeed, float dt)
+    {
+        int rows = (int) std::ceil(std::abs(maxSpeed) * dt / gridSquareSize);
+        partitionHaloRows = rows > 1 ? rows : 1;
+    }
+
+    /// The width of the grid in grid-squares.
+    size_t width;
+
+    /// The height of the grid in grid-squares.
+    size_t height;
+
+    /// Whether this fluid has viscosity.
+    bool hasViscosity;
+    float viscosity;
+
+    float density;
+
+    /// The side-length of a single square in the grid.
+    float gridSquareSize;
+
+    /// Whether to zero-initialize the given OpenGL textures.
+    bool zeroInitializeSharedTextures;
+
+    /// The number of Jacobi sweeps done per kernel launch in the diffusion
+    /// and pressure solves. Values above 1 select the tiled kernel, which
+    /// keeps a tile of the grid in local memory between sweeps. Values above
+    /// Fluid2DSimulationCLProgram::JacobiMaxSweepsPerLaunch are clamped to it.
+    int jacobiSweepsPerLaunch;
+
+    PressureSolver pressureSolver;
+
+    /// The number of sweeps of the iterative pressure solvers, the number
+    /// of V-cycles of the multigrid solver, or the maximum number of
+    /// conjugate gradient iterations.
+    /// NOTE: Doing too many Jacobi sweeps breaks everything.
+    int pressureIterations;
+
+    /// The over-relaxation factor of the red-black SOR solver.
+    float sorOmega;
+
+    /// The number of Gauss-Seidel sweeps before and after each coarse-grid
+    /// correction of the multigrid solver.
+    int multigridSmoothingSweeps;
+
+    /// The relative residual at which the conjugate gradient solver stops.
+    float pcgTolerance;
+
+    /// Whether the Jacobi, SOR and multigrid solves, and the diffusion sweeps, stop
+    /// early once the residual is below residualTolerance. The conjugate gradient
+    /// solver always does.
+    bool adaptiveIterations;
+
+    /// The root mean square size of the next Jacobi update at which an adaptive
+    /// solve counts as converged. It is in the units of the solved quantity.
+    float residualTolerance;
+
+    /// The number of sweeps between residual checks. The checks don't stall the
+    /// queue, but each one costs about as much as a sweep.
+    int residualCheckInterval;
+
+    /// Whether update() uses fused kernels that each do the work of two steps,
+    /// which roughly halves the number of launches outside the solves. Forces are
+    /// added before diffusion rather than after, and the pressure gradient is taken
+    /// after the pressure boundary condition is enforced rather than before.
+    bool fusedKernels;
+
+    /// Whether update() does the whole step in a single launch when the grid fits
+    /// in one work group's local memory (about 48x48 with 48KB). Only inviscid
+    /// fluids with semi-Lagrangian advection, no vorticity confinement and the
+    /// Jacobi or SOR solver qualify; the pressure is then relaxed
+    /// in place with pressureIterations red-black sweeps, using sorOmega for SOR
+    /// and plain Gauss-Seidel for Jacobi. Adaptive iterations are ignored.
+    bool wholeStepForSmallGrids;
+
+    /// How the velocity is advected. MacCormack advects forward, then a
+    /// correction launch advects the result backward to estimate the first
+    /// pass's error and corrects for half of it, clamped to the texels the first
+    /// pass sampled so it can't overshoot. It keeps small swirls alive much
+    /// longer, at the cost of the correction launch (about one more advection)
+    /// and a temporary image.
+    /// With fusedKernels, forces can't be folded into the correction pass and
+    /// are added in a separate launch. The whole-step kernel and sparse tiles
+    /// only do semi-Lagrangian advection and aren't used with MacCormack; buffer
+    /// and CPU storage ignore it.
+    AdvectionScheme advectionScheme;
+
+    /// The strength of the vorticity confinement force, which is added after the
+    /// forces to keep small swirls alive on coarse grids. 0 disables it.
+    float vorticityStrength;
+
+    StorageBackend storage;
+
+    /// The precision of the images created by the simulation. Images shared with
+    /// OpenGL textures take the precision of their texture instead. Ignored with
+    /// BufferStorage.
+    FieldPrecision precision;
+
+    /// How many times coarser than width x height the solver grid is along each
+    /// axis. Above 1, the simulation solves on the coarse grid (with
+    /// proportionally larger grid squares, so that it covers the same area) and
+    /// bicubically upsamples the velocities into the output images after every
+    /// step. Forces may be given at either resolution. Ignored with BufferStorage.
+    int resolutionDivisor;
+
+    /// The time step taken by Fluid2DSimulation::advance(), which accumulates
+    /// the elapsed time and takes as many steps of this size as fit in it, so
+    /// that the cost of the simulation depends on the simulated time rather
+    /// than on the frame rate. Ignored by update().
+    float fixedTimeStep;
+
+    /// The most steps advance() takes per call. Time beyond that is dropped,
+    /// so that a long frame slows the fluid down instead of making the next
+    /// frames even longer.
+    int maxSubsteps;
+
+    /// Whether advance() interpolates the output velocities between the last
+    /// two steps by the fraction of a step left in the accumulator. The output
+    /// then lags by up to one step but moves smoothly at any frame rate.
+    /// Ignored with BufferStorage.
+    bool interpolateSteps;
+
+    /// The number of update() or advance() steps that each step of the solver
+    /// is spread over, to cap the work done per frame. The first slice advects,
+    /// diffuses, adds the forces and computes the divergence, the pressure
+    /// iterations are split evenly between the slices (all conjugate gradient
+    /// iterations happen in the first), and the last slice projects, as the
+    /// fused pipeline does. The velocities keep the last completed step in the
+    /// meantime, and each completed step advances the fluid by timeSlices
+    /// times the dt given to its first slice. The whole-step kernel is not used.
+    /// Ignored with BufferStorage.
+    int timeSlices;
+
+    /// Whether update() only simulates the tiles of the grid with wind. Before
+    /// every step, the tiles where the speed or forces * dt exceed
+    /// sparseThreshold are found, and the fused pipeline runs on them and on
+    /// the tiles within sparseDilation tiles of them. Everything elsewhere is
+    /// zero, including the pressure, so the cost scales with the area of the
+    /// wind rather than of the grid. Only inviscid fluids with semi-Lagrangian
+    /// advection, no vorticity confinement and the Jacobi solver qualify;
+    /// the pressure sweeps always land in the output image, so their number is
+    /// rounded up to an odd one of at least 3, and adaptive iterations are
+    /// ignored. Not used by the whole-step kernel or with timeSlices.
+    bool sparseTiles;
+    float sparseThreshold;
+    int sparseDilation;
+
+    /// Whether the grid wraps around at its edges, like a torus, instead of
+    /// having walls. The kernels are then built to read across the edges, and
+    /// the boundary conditions are skipped, so the wind tiles seamlessly and
+    /// one small simulation can cover a large world. Obstacles, the whole-step
+    /// kernel and sparse tiles are not used with it. Must be set before
+    /// Fluid2DSimulation::create().
+    bool periodicBoundary;
+
+    /// Whether update() diffuses and projects the velocities in frequency
+    /// space, with FFTs, instead of with the iterative solves. Both are then
+    /// exact for any viscosity and cost O(N log N); pressureSolver and
+    /// pressureIterations are ignored. Forces are added before diffusion, like
+    /// in the fused pipeline. Needs periodicBoundary and a grid whose sides are
+    /// powers of two, and is not used with timeSlices.
+    bool spectralSolver;
+
+    /// The number of rows of its neighbors that each strip of a partitioned
+    /// simulation keeps (see Fluid2DSimulation::createPartitioned()). The strips
+    /// exchange these halos before every stencil step and once per block of
+    /// this many Jacobi sweeps, so more rows mean fewer exchanges but more
+    /// repeated work at the seams. Advection that would reach further than this
+    /// across a seam in one step is clamped to the halo, with a warning; to
+    /// avoid that, size it with setPartitionHaloForSpeed().
+    int partitionHaloRows;
+};
+
+#endif // FLUID2DSIMULATIONCONFIG_H
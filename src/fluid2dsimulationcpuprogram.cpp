@@ -0,0 +1,502 @@
+#include "fluid2dsimulationcpuprogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+
+namespace {
+
+// A few floats of a row, operated on at once. The loads and stores are
+// unaligned, since the stencils read every row at offsets of one cell.
+#if defined(__AVX__)
+typedef __m256 Vec;
+const int VecWidth = 8;
+
+inline Vec load(const float *p) { return _mm256_loadu_ps(p); }
+inline void store(float *p, Vec v) { _mm256_storeu_ps(p, v); }
+inline Vec splat(float f) { return _mm256_set1_ps(f); }
+inline Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+inline Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+#elif defined(__SSE__)
+typedef __m128 Vec;
+const int VecWidth = 4;
+
+inline Vec load(const float *p) { return _mm_loadu_ps(p); }
+inline void store(float *p, Vec v) { _mm_storeu_ps(p, v); }
+inline Vec splat(float f) { return _mm_set1_ps(f); }
+inline Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+inline Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+#else
+typedef float Vec;
+const int VecWidth = 1;
+
+inline Vec load(const float *p) { return *p; }
+inline void store(float *p, Vec v) { *p = v; }
+inline Vec splat(float f) { return f; }
+inline Vec add(Vec a, Vec b) { return a + b; }
+inline Vec sub(Vec a, Vec b) { return a - b; }
+inline Vec mul(Vec a, Vec b) { return a * b; }
+#endif
+
+inline float mix(float a, float b, float t)
+{
+    return a + (b - a) * t;
+}
+
+} // namespace
+
+
+Fluid2DSimulationCPUProgram::Fluid2DSimulationCPUProgram()
+    : mCreated(false),
+      mPeriodicBoundary(false),
+      mWidth(0),
+      mHeight(0),
+      mThreadPool(nullptr)
+{
+}
+
+Fluid2DSimulationCPUProgram::~Fluid2DSimulationCPUProgram()
+{
+    release();
+}
+
+bool Fluid2DSimulationCPUProgram::create(bool periodicBoundary, int threadCount)
+{
+    release();
+
+    mPeriodicBoundary = periodicBoundary;
+    mThreadPool = new CPUThreadPool(threadCount);
+
+    mCreated = true;
+    return true;
+}
+
+void Fluid2DSimulationCPUProgram::release()
+{
+    delete mThreadPool;
+    mThreadPool = nullptr;
+
+    mCreated = false;
+}
+
+bool Fluid2DSimulationCPUProgram::update(const Fluid2DSimulationConfig &config,
+                                         Fluid2DCPUField &velocities,
+                                         Fluid2DCPUField &velocitiesOut,
+                                         const Fluid2DCPUField *forces,
+                                         Fluid2DCPUField &pressure,
+                                         Fluid2DCPUField &pressureOut,
+                                         Fluid2DCPUField &temp1,
+                                         Fluid2DCPUField &temp2,
+                                         float dt)
+{
+    Q_ASSERT( mCreated );
+    Q_ASSERT( &velocitiesOut != &velocities && &velocitiesOut != &temp1 && &velocitiesOut != &temp2 );
+    Q_ASSERT( &pressureOut != &pressure && &pressureOut != &temp1 && &pressureOut != &temp2 );
+    Q_ASSERT( config.periodicBoundary == mPeriodicBoundary );
+
+    setGridSize(config.width, config.height);
+
+    const size_t cells = config.width * config.height;
+    Q_ASSERT( velocities.x.size() == cells && pressure.x.size() == cells && temp1.x.size() == cells && temp2.x.size() == cells );
+    Q_ASSERT( velocitiesOut.x.size() == cells && pressureOut.x.size() == cells );
+    Q_ASSERT( forces == nullptr || forces->x.size() == cells );
+    Q_UNUSED( cells );
+
+    const float gridSize = config.gridSquareSize;
+    const float density = config.density;
+    const float viscosity = config.hasViscosity ? config.viscosity : -1;
+
+    // The same bookkeeping as in Fluid2DSimulationBufferCLProgram::update().
+    Fluid2DCPUField *velocityField = &velocities;
+    Fluid2DCPUField *pressureField = &pressure;
+
+    Fluid2DCPUField *freeField1 = &temp1;
+    Fluid2DCPUField *freeField2 = &temp2;
+
+
+    /* Step 1: Advection */
+    advect(*velocityField, *velocityField, *freeField1, dt, gridSize);
+    std::swap(velocityField, freeField1);
+
+
+    /* Step 2: Diffusion (optional) */
+    if (viscosity > 0)
+    {
+        float hh_vdt = gridSize * gridSize / (viscosity * dt);
+
+        for (int iteration = 0; iteration < 30; ++iteration)
+        {
+            Fluid2DCPUField *t1 = velocityField;
+            Fluid2DCPUField *t2 = freeField1;
+
+            for (int subIteration = 0; subIteration < 2; ++subIteration)
+            {
+                jacobi2(*t1, *t1, *t2, hh_vdt, 4 + hh_vdt);
+                std::swap(t1, t2);
+            }
+        }
+    }
+
+    /* Step 3: Add forces (optional) */
+    if (forces != nullptr)
+    {
+        addScaled(*velocityField, *forces, dt, *freeField1);
+        std::swap(velocityField, freeField1);
+    }
+
+    /* Step 4: Update pressure */
+    Fluid2DCPUField *divergenceField = freeField1;
+    Fluid2DCPUField *scratch = freeField2;
+
+    divergence(*velocityField, *divergenceField, gridSize);
+
+    for (int iteration = 0; iteration < config.pressureIterations; ++iteration)
+    {
+        jacobi1(*pressureField, *divergenceField, *scratch, -gridSize * gridSize, 4);
+        std::swap(pressureField, scratch);
+    }
+
+    // The divergence isn't needed anymore.
+    Fluid2DCPUField *gradientField = divergenceField;
+
+    /* Step 5: Subtract pressure gradient */
+    gradient(*pressureField, *gradientField, gridSize);
+
+    // Without a boundary, the projected velocities are the result.
+    if (mPeriodicBoundary)
+        scratch = &velocitiesOut;
+
+    addScaled(*velocityField, *gradientField, -1.0 / density, *scratch);
+    std::swap(velocityField, scratch);
+
+    if (mPeriodicBoundary)
+    {
+        pressureOut.x = pressureField->x;
+        return true;
+    }
+
+    /* Step 6: Enforce boundary conditions */
+    velocityBoundary(*velocityField, velocitiesOut);
+    pressureBoundary(*pressureField, pressureOut);
+
+    return true;
+}
+
+void Fluid2DSimulationCPUProgram::setGridSize(int width, int height)
+{
+    mWidth = width;
+    mHeight = height;
+
+    mZeroRow.assign(width, 0);
+}
+
+const float *Fluid2DSimulationCPUProgram::previousRow(const std::vector<float> &plane, int y) const
+{
+    if (y > 0)
+        return &plane[(y - 1) * mWidth];
+
+    return mPeriodicBoundary ? &plane[(mHeight - 1) * mWidth] : mZeroRow.data();
+}
+
+const float *Fluid2DSimulationCPUProgram::nextRow(const std::vector<float> &plane, int y) const
+{
+    if (y < mHeight - 1)
+        return &plane[(y + 1) * mWidth];
+
+    return mPeriodicBoundary ? plane.data() : mZeroRow.data();
+}
+
+float Fluid2DSimulationCPUProgram::at(const std::vector<float> &plane, int x, int y) const
+{
+    if (mPeriodicBoundary)
+    {
+        x = (x % mWidth + mWidth) % mWidth;
+        y = (y % mHeight + mHeight) % mHeight;
+    }
+    else if (x < 0 || y < 0 || x >= mWidth || y >= mHeight)
+    {
+        return 0;
+    }
+
+    return plane[y * mWidth + x];
+}
+
+void Fluid2DSimulationCPUProgram::jacobiRow(const float *before,
+                                           const float *row,
+                                           const float *after,
+                                           const float *b,
+                                           float *out,
+                                           float alpha,
+                                           float betaInverse) const
+{
+    // The cells at either end have a neighbor outside of the row.
+    auto cell = [&](int x)
+    {
+        float left = x > 0 ? row[x - 1] : (mPeriodicBoundary ? row[mWidth - 1] : 0);
+        float right = x < mWidth - 1 ? row[x + 1] : (mPeriodicBoundary ? row[0] : 0);
+
+        out[x] = (left + right + before[x] + after[x] + alpha * b[x]) * betaInverse;
+    };
+
+    cell(0);
+
+    const Vec alphaVec = splat(alpha);
+    const Vec betaInverseVec = splat(betaInverse);
+
+    int x = 1;
+    for (; x + VecWidth <= mWidth - 1; x += VecWidth)
+    {
+        // In the same order as the kernel, for the same rounding.
+        Vec sum = add(load(row + x - 1), load(row + x + 1));
+        sum = add(sum, load(before + x));
+        sum = add(sum, load(after + x));
+        sum = add(sum, mul(alphaVec, load(b + x)));
+
+        store(out + x, mul(sum, betaInverseVec));
+    }
+
+    for (; x < mWidth; ++x)
+        cell(x);
+}
+
+void Fluid2DSimulationCPUProgram::jacobi2(const Fluid2DCPUField &input,
+                                         const Fluid2DCPUField &b,
+                                         Fluid2DCPUField &output,
+                                         float alpha,
+                                         float beta)
+{
+    const float betaInverse = 1.0 / beta;
+
+    mThreadPool->parallelRows(mHeight, [&](int firstRow, int endRow)
+    {
+        for (int y = firstRow; y < endRow; ++y)
+        {
+            const size_t offset = y * mWidth;
+
+            jacobiRow(previousRow(input.x, y), &input.x[offset], nextRow(input.x, y),
+                      &b.x[offset], &output.x[offset], alpha, betaInverse);
+            jacobiRow(previousRow(input.y, y), &input.y[offset], nextRow(input.y, y),
+                      &b.y[offset], &output.y[offset], alpha, betaInverse);
+        }
+    });
+}
+
+void Fluid2DSimulationCPUProgram::jacobi1(const Fluid2DCPUField &input,
+                                         const Fluid2DCPUField &b,
+                                         Fluid2DCPUField &output,
+                                         float alpha,
+                                         float beta)
+{
+    const float betaInverse = 1.0 / beta;
+
+    mThreadPool->parallelRows(mHeight, [&](int firstRow, int endRow)
+    {
+        for (int y = firstRow; y < endRow; ++y)
+        {
+            const size_t offset = y * mWidth;
+
+            jacobiRow(previousRow(input.x, y), &input.x[offset], nextRow(input.x, y),
+                      &b.x[offset], &output.x[offset], alpha, betaInverse);
+        }
+    });
+}
+
+void Fluid2DSimulationCPUProgram::sampleBilinear(const Fluid2DCPUField &field,
+                                                float posX, float posY,
+                                                float *outX, float *outY) const
+{
+    float px = posX - 0.5f;
+    float py = posY - 0.5f;
+    float baseX = std::floor(px);
+    float baseY = std::floor(py);
+    float tx = px - baseX;
+    float ty = py - baseY;
+
+    int i = baseX;
+    int j = baseY;
+
+    *outX = mix(mix(at(field.x, i, j), at(field.x, i + 1, j), tx),
+                mix(at(field.x, i, j + 1), at(field.x, i + 1, j + 1), tx), ty);
+    *outY = mix(mix(at(field.y, i, j), at(field.y, i + 1, j), tx),
+                mix(at(field.y, i, j + 1), at(field.y, i + 1, j + 1), tx), ty);
+}
+
+void Fluid2DSimulationCPUProgram::advect(const Fluid2DCPUField &quantity,
+                                        const Fluid2DCPUField &velocity,
+                                        Fluid2DCPUField &output,
+                                        float dt,
+                                        float gridSize)
+{
+    const float dt_h = dt / gridSize;
+
+    // The samples land anywhere, so this is left to the compiler.
+    mThreadPool->parallelRows(mHeight, [&](int firstRow, int endRow)
+    {
+        for (int y = firstRow; y < endRow; ++y)
+        {
+            for (int x = 0; x < mWidth; ++x)
+            {
+                float velX, velY;
+                sampleBilinear(velocity, x, y, &velX, &velY);
+
+                const size_t index = y * mWidth + x;
+                sampleBilinear(quantity, x + 0.5f - velX * dt_h, y + 0.5f - velY * dt_h,
+                               &output.x[index], &output.y[index]);
+            }
+        }
+    });
+}
+
+void Fluid2DSimulationCPUProgram::divergence(const Fluid2DCPUField &vecField,
+                                            Fluid2DCPUField &output,
+                                            float gridSize)
+{
+    const float hInv = 1.0 / gridSize;
+
+    mThreadPool->parallelRows(mHeight, [&](int firstRow, int endRow)
+    {
+        for (int y = firstRow; y < endRow; ++y)
+        {
+            const float *row = &vecField.x[y * mWidth];
+            const float *before = previousRow(vecField.y, y);
+            const float *after = nextRow(vecField.y, y);
+            float *out = &output.x[y * mWidth];
+
+            auto cell = [&](int x)
+            {
+                out[x] = ((at(vecField.x, x + 1, y) - at(vecField.x, x - 1, y)) + (after[x] - before[x])) * hInv;
+            };
+
+            cell(0);
+
+            const Vec hInvVec = splat(hInv);
+
+            int x = 1;
+            for (; x + VecWidth <= mWidth - 1; x += VecWidth)
+            {
+                Vec dx = sub(load(row + x + 1), load(row + x - 1));
+                Vec dy = sub(load(after + x), load(before + x));
+
+                store(out + x, mul(add(dx, dy), hInvVec));
+            }
+
+            for (; x < mWidth; ++x)
+                cell(x);
+        }
+    });
+}
+
+void Fluid2DSimulationCPUProgram::gradient(const Fluid2DCPUField &func,
+                                          Fluid2DCPUField &output,
+                                          float gridSize)
+{
+    const float hInv = 1.0 / gridSize;
+
+    mThreadPool->parallelRows(mHeight, [&](int firstRow, int endRow)
+    {
+        for (int y = firstRow; y < endRow; ++y)
+        {
+            const float *row = &func.x[y * mWidth];
+            const float *before = previousRow(func.x, y);
+            const float *after = nextRow(func.x, y);
+            float *outX = &output.x[y * mWidth];
+            float *outY = &output.y[y * mWidth];
+
+            auto cell = [&](int x)
+            {
+                outX[x] = (at(func.x, x + 1, y) - at(func.x, x - 1, y)) * hInv;
+                outY[x] = (after[x] - before[x]) * hInv;
+            };
+
+            cell(0);
+
+            const Vec hInvVec = splat(hInv);
+
+            int x = 1;
+            for (; x + VecWidth <= mWidth - 1; x += VecWidth)
+            {
+                store(outX + x, mul(sub(load(row + x + 1), load(row + x - 1)), hInvVec));
+                store(outY + x, mul(sub(load(after + x), load(before + x)), hInvVec));
+            }
+
+            for (; x < mWidth; ++x)
+                cell(x);
+        }
+    });
+}
+
+void Fluid2DSimulationCPUProgram::addScaled(const Fluid2DCPUField &t1,
+                                           const Fluid2DCPUField &t2,
+                                           float multiplier,
+                                           Fluid2DCPUField &sum)
+{
+    mThreadPool->parallelRows(mHeight, [&](int firstRow, int endRow)
+    {
+        const int begin = firstRow * mWidth;
+        const int end = endRow * mWidth;
+        const Vec multiplierVec = splat(multiplier);
+
+        for (std::vector<float> Fluid2DCPUField::*plane : { &Fluid2DCPUField::x, &Fluid2DCPUField::y })
+        {
+            const float *a = (t1.*plane).data();
+            const float *b = (t2.*plane).data();
+            float *out = (sum.*plane).data();
+
+            int i = begin;
+            for (; i + VecWidth <= end; i += VecWidth)
+                store(out + i, add(load(a + i), mul(load(b + i), multiplierVec)));
+
+            for (; i < end; ++i)
+                out[i] = a[i] + b[i] * multiplier;
+        }
+    });
+}
+
+void Fluid2DSimulationCPUProgram::boundary(const std::vector<float> &in, std::vector<float> &out, float sign)
+{
+    mThreadPool->parallelRows(mHeight, [&](int firstRow, int endRow)
+    {
+        for (int y = firstRow; y < endRow; ++y)
+        {
+            const float *row = &in[y * mWidth];
+            float *outRow = &out[y * mWidth];
+
+            std::copy(row, row + mWidth, outRow);
+
+            if (mPeriodicBoundary)
+                continue;
+
+            // The same precedence as boundarySource: the left and right walls
+            // win over the top and bottom ones at the corners.
+            if (y == 0 || y == mHeight - 1)
+            {
+                const float *inner = &in[(y == 0 ? 1 : mHeight - 2) * mWidth];
+
+                for (int x = 1; x < mWidth - 1; ++x)
+                    outRow[x] = sign * inner[x];
+            }
+
+            outRow[0] = sign * row[1];
+            outRow[mWidth - 1] = sign * row[mWidth - 2];
+        }
+    });
+}
+
+void Fluid2DSimulationCPUProgram::velocityBoundary(const Fluid2DCPUField &in, Fluid2DCPUField &out)
+{
+    boundary(in.x, out.x, -1);
+    boundary(in.y, out.y, -1);
+}
+
+void Fluid2DSimulationCPUProgram::pressureBoundary(const Fluid2DCPUField &in, Fluid2DCPUField &out)
+{
+    boundary(in.x, out.x, 1);
+}
@@ -0,0 +1,143 @@
+#ifndef FLUID2DSIMULATIONCPUPROGRAM_H
+#define FLUID2DSIMULATIONCPUPROGRAM_H
+
+#include "fluid2dsimulationconfig.h"
+#include "cputhreadpool.h"
+
+#include <vector>
+
+/// A field in host memory for Fluid2DSimulationCPUProgram, stored as a
+/// structure of arrays: one row-major plane of floats per component, so that
+/// neighboring cells of a component are adjacent for SIMD loads. Scalar fields
+/// only use x, but every field has both planes so that fields can trade roles.
+struct Fluid2DCPUField
+{
+    std::vector<float> x;
+    std::vector<float> y;
+
+    /// Sizes both planes for width x height cells and zeroes them.
+    void reset(size_t width, size_t height)
+    {
+        x.assign(width * height, 0);
+        y.assign(width * height, 0);
+    }
+};
+
+/// The host counterpart of Fluid2DSimulationBufferCLProgram, for machines
+/// without an OpenCL device and as a reference to check the kernels against.
+/// Each operation computes the same thing as the kernel of the same name in
+/// fluidSimulationBuffers.cl, up to rounding, with the rows of the grid split
+/// into bands between the threads of a CPUThreadPool.
+///
+/// The stencil operations work on several cells at once with AVX (8 floats)
+/// or SSE (4 floats) when the compiler targets them, and one at a time
+/// otherwise. Advection samples arbitrary positions, so it is scalar.
+class Fluid2DSimulationCPUProgram
+{
+public:
+    Fluid2DSimulationCPUProgram();
+    ~Fluid2DSimulationCPUProgram();
+
+    /// Starts the thread pool, with one thread per hardware thread if
+    /// threadCount is 0, for a grid that wraps around if periodicBoundary.
+    bool create(bool periodicBoundary = false, int threadCount = 0);
+
+    void release();
+
+    /// Does the same as Fluid2DSimulationBufferCLProgram::update(). Every field
+    /// must have the config's size.
+    bool update(const Fluid2DSimulationConfig &config,
+                Fluid2DCPUField &velocities,
+                Fluid2DCPUField &velocitiesOut,
+                const Fluid2DCPUField *forces,
+                Fluid2DCPUField &pressure,
+                Fluid2DCPUField &pressureOut,
+                Fluid2DCPUField &temp1,
+                Fluid2DCPUField &temp2,
+                float dt);
+
+
+    /// The output of these must not alias any input.
+    void jacobi2(const Fluid2DCPUField &input,
+                 const Fluid2DCPUField &b,
+                 Fluid2DCPUField &output,
+                 float alpha,
+                 float beta);
+
+    void jacobi1(const Fluid2DCPUField &input,
+                 const Fluid2DCPUField &b,
+                 Fluid2DCPUField &output,
+                 float alpha,
+                 float beta);
+
+    void advect(const Fluid2DCPUField &quantity,
+                const Fluid2DCPUField &velocity,
+                Fluid2DCPUField &output,
+                float dt,
+                float gridSize);
+
+    void divergence(const Fluid2DCPUField &vecField,
+                    Fluid2DCPUField &output,
+                    float gridSize);
+
+    void gradient(const Fluid2DCPUField &func,
+                  Fluid2DCPUField &output,
+                  float gridSize);
+
+    void addScaled(const Fluid2DCPUField &t1,
+                   const Fluid2DCPUField &t2,
+                   float multiplier,
+                   Fluid2DCPUField &sum);
+
+    void velocityBoundary(const Fluid2DCPUField &in, Fluid2DCPUField &out);
+    void pressureBoundary(const Fluid2DCPUField &in, Fluid2DCPUField &out);
+
+    /// Sets the grid size used by the operations. update() does this itself.
+    void setGridSize(int width, int height);
+
+    /// The number of threads that the work is split between.
+    int threadCount() const { return mThreadPool != nullptr ? mThreadPool->threadCount() : 0; }
+
+private:
+    /// out = (input[x-1] + input[x+1] + before[x] + after[x] + alpha * b[x]) * betaInverse
+    /// for one row of one plane, where before and after are the rows around it.
+    void jacobiRow(const float *before,
+                   const float *row,
+                   const float *after,
+                   const float *b,
+                   float *out,
+                   float alpha,
+                   float betaInverse) const;
+
+    /// The row before or after row y of the plane, which is a row of zeros
+    /// outside of the grid unless it is periodic.
+    const float *previousRow(const std::vector<float> &plane, int y) const;
+    const float *nextRow(const std::vector<float> &plane, int y) const;
+
+    /// The value of the plane at (x, y), with the same treatment of cells
+    /// outside of the grid.
+    float at(const std::vector<float> &plane, int x, int y) const;
+
+    /// Bilinearly interpolates the field at pos, where cell centers are at
+    /// half-integer coordinates, like sampleBilinear2 in fluidSimulationBuffers.cl.
+    void sampleBilinear(const Fluid2DCPUField &field, float posX, float posY, float *outX, float *outY) const;
+
+    /// Copies the plane, replacing each cell on the walls with its inner
+    /// neighbor times sign, like boundarySource in fluidSimulationBuffers.cl.
+    void boundary(const std::vector<float> &in, std::vector<float> &out, float sign);
+
+    bool mCreated;
+
+    /// Whether the grid wraps around.
+    bool mPeriodicBoundary;
+
+    int mWidth;
+    int mHeight;
+
+    /// width zeros, read as the rows outside of a grid with walls.
+    std::vector<float> mZeroRow;
+
+    CPUThreadPool *mThreadPool;
+};
+
+#endif // FLUID2DSIMULATIONCPUPROGRAM_H
@@ -0,0 +1,113 @@
+#include "fluid3dsimulation.h"
+#include "cl_interface/clniceties.h"
+
+Fluid3DSimulation::Fluid3DSimulation(Fluid3DSimulationConfig config)
+    : mInitialized(false),
+      mConfig(config),
+      mIndex(0)
+{
+}
+
+Fluid3DSimulation::~Fluid3DSimulation()
+{
+    release(); // release() checks mInitialized
+}
+
+bool Fluid3DSimulation::create(MyCLWrapper *wrapper)
+{
+    if (!mFluidProgram.create(wrapper))
+        return false;
+
+    if (mConfig.jacobiSweepsPerLaunch > 1 && !mFluidProgram.tiledJacobiSupported())
+        qWarning() << "Tiled Jacobi is not supported on this device; using the plain kernel.";
+
+    // Vector fields need RGBA, since RGB images don't exist. The pressure only
+    // needs one channel, but single-channel 3D images are optional.
+    cl_image_format vectorFormat = {CL_RGBA, CL_FLOAT};
+    cl_image_format scalarFormat = {CL_R, CL_FLOAT};
+
+    if (!MyCLImage3D::isFormatSupported(wrapper->context(), scalarFormat))
+        scalarFormat = vectorFormat;
+
+    const size_t w = mConfig.width;
+    const size_t h = mConfig.height;
+    const size_t d = mConfig.depth;
+
+    // The temporary images hold both vector and scalar fields during a step.
+    for (MyCLImage3D *img : {&mVelocities[0], &mVelocities[1], &mTemp1, &mTemp2})
+    {
+        if (!img->create(wrapper->context(), w, h, d, vectorFormat))
+        {
+            qDebug() << "Failed to instantiate a 3D fluid image.";
+            return false;
+        }
+
+        CLNiceties::ZeroImage(wrapper->queue(), *img);
+    }
+
+    for (MyCLImage3D *img : {&mPressure[0], &mPressure[1]})
+    {
+        if (!img->create(wrapper->context(), w, h, d, scalarFormat))
+        {
+            qDebug() << "Failed to instantiate a 3D pressure image.";
+            return false;
+        }
+
+        CLNiceties::ZeroImage(wrapper->queue(), *img);
+    }
+
+    mIndex = 0;
+
+    mCLWrapper = wrapper;
+    mInitialized = true;
+    return true;
+}
+
+void Fluid3DSimulation::release()
+{
+    if (mInitialized)
+    {
+        mVelocities[0].destroy();
+        mVelocities[1].destroy();
+        mPressure[0].destroy();
+        mPressure[1].destroy();
+        mTemp2.destroy();
+        mTemp1.destroy();
+
+        mFluidProgram.release();
+
+        mInitialized = false;
+    }
+}
+
+bool Fluid3DSimulation::update(float dtSeconds)
+{
+    return step(dtSeconds, NULL);
+}
+
+bool Fluid3DSimulation::update(float dtSeconds, MyCLImage3D &forces)
+{
+    return step(dtSeconds, &forces);
+}
+
+bool Fluid3DSimulation::step(float dtSeconds, MyCLImage3D *forces)
+{
+    Q_ASSERT( mInitialized );
+
+    if (!mFluidProgram.update(mConfig,
+                              mVelocities[mIndex],
+                              mVelocities[1 - mIndex],
+                              forces,
+                              mPressure[mIndex],
+                              mPressure[1 - mIndex],
+                              mTemp1,
+                              mTemp2,
+                              dtSeconds))
+    {
+        qDebug() << "Failed in 3D fluid update.";
+        return false;
+    }
+
+    mIndex = 1 - mIndex;
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef FLUID3DSIMULATION_H
+#define FLUID3DSIMULATION_H
+
+#include "fluid3dsimulationclprogram.h"
+#include "fluid3dsimulationconfig.h"
+
+#include "cl_interface/myclwrapper.h"
+#include "cl_interface/myclimage3d.h"
+#include "cl_interface/include_opencl.h"
+
+#include <QDebug>
+
+/// The 3D counterpart of Fluid2DSimulation, for volumetric wind. The state is
+/// kept in 3D images, which can't be shared with OpenGL; kernels that need the
+/// velocities can read velocities() directly.
+class Fluid3DSimulation
+{
+public:
+    Fluid3DSimulation(Fluid3DSimulationConfig config);
+    ~Fluid3DSimulation();
+
+    /// Creates the fluid simulation. Fails if the device can't write to 3D images.
+    bool create(MyCLWrapper *wrapper);
+
+    /// Releases the OpenCL objects created in create().
+    void release();
+
+    /// Updates the fluid without applying forces.
+    bool update(float dtSeconds);
+
+    /// Updates the fluid, applying forces stored in the first three channels of
+    /// an image of the grid's size.
+    bool update(float dtSeconds, MyCLImage3D &forces);
+
+    size_t gridWidth() const { return mConfig.width; }
+    size_t gridHeight() const { return mConfig.height; }
+    size_t gridDepth() const { return mConfig.depth; }
+
+    /// The images holding the current state. These change between steps.
+    /// The velocities are in the first three channels of a CL_RGBA image.
+    const MyCLImage3D &velocities() const { return mVelocities[mIndex]; }
+    MyCLImage3D &velocities() { return mVelocities[mIndex]; }
+
+    const MyCLImage3D &pressure() const { return mPressure[mIndex]; }
+    MyCLImage3D &pressure() { return mPressure[mIndex]; }
+
+private:
+    /// Advances the simulation, swapping the current and next images afterward.
+    bool step(float dtSeconds, MyCLImage3D *forces);
+
+    bool mInitialized;
+
+    MyCLWrapper *mCLWrapper;
+
+    Fluid3DSimulationConfig mConfig;
+    Fluid3DSimulationCLProgram mFluidProgram;
+
+    /// The current and next images. update() writes into the next images and
+    /// then swaps them with the current ones.
+    MyCLImage3D mVelocities[2];
+    MyCLImage3D mPressure[2];
+    int mIndex;
+
+    MyCLImage3D mTemp1;
+    MyCLImage3D mTemp2;
+};
+
+#endif // FLUID3DSIMULATION_H
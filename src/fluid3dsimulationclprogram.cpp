@@ -0,0 +1,489 @@
+#include "fluid3dsimulationclprogram.h"
+
+#include <algorithm>
+#include <string>
+
+
+Fluid3DSimulationCLProgram::Fluid3DSimulationCLProgram()
+    : mCreated(false),
+      mDeviceLocalMemSize(0)
+{
+}
+
+bool Fluid3DSimulationCLProgram::create(MyCLWrapper *wrapper)
+{
+    mCLWrapper = wrapper;
+
+    // The program doesn't compile without the extension, so give a clearer
+    // message than the build log would.
+    size_t extensionsSize = 0;
+    clGetDeviceInfo(wrapper->device(), CL_DEVICE_EXTENSIONS, 0, NULL, &extensionsSize);
+
+    std::string extensions(extensionsSize, '\0');
+    clGetDeviceInfo(wrapper->device(), CL_DEVICE_EXTENSIONS, extensionsSize, &extensions[0], NULL);
+
+    if (extensions.find("cl_khr_3d_image_writes") == std::string::npos)
+    {
+        qDebug() << "The 3D fluid simulation needs cl_khr_3d_image_writes, which this device doesn't support.";
+        return false;
+    }
+
+
+    if (!mProgram.create(wrapper, ":/compute/fluidSimulation3D.cl"))
+    {
+        qDebug() << "Failed to create 3D fluid simulation program.";
+        return false;
+    }
+
+#ifndef MAKE_KERNEL
+#define MAKE_KERNEL(var, name)\
+    if (!var.createFromProgram(wrapper, mProgram.program(), name))\
+    {\
+        qDebug() << "Failed to create " name " kernel.";\
+        return false;\
+    }
+
+    MAKE_KERNEL(mJacobiKernel, "jacobi");
+    MAKE_KERNEL(mJacobiTiledKernel, "jacobiTiled");
+    MAKE_KERNEL(mAdvectKernel, "advect");
+    MAKE_KERNEL(mDivergenceKernel, "divergence");
+    MAKE_KERNEL(mGradientKernel, "gradient");
+    MAKE_KERNEL(mAddScaledKernel, "addScaled");
+    MAKE_KERNEL(mVelocityBoundaryKernel, "velocityBoundary");
+    MAKE_KERNEL(mPressureBoundaryKernel, "pressureBoundary");
+    MAKE_KERNEL(mAdvectAddForceKernel, "advectAddForce");
+    MAKE_KERNEL(mDivergenceJacobiKernel, "divergenceJacobi");
+    MAKE_KERNEL(mJacobiPressureBoundaryKernel, "jacobiPressureBoundary");
+    MAKE_KERNEL(mProjectBoundaryKernel, "projectBoundary");
+#undef MAKE_KERNEL
+#else
+    static_assert(false);
+#endif
+
+    if (clGetDeviceInfo(wrapper->device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &mDeviceLocalMemSize, NULL) != CL_SUCCESS)
+        mDeviceLocalMemSize = 0;
+
+    mCreated = true;
+    return true;
+}
+
+void Fluid3DSimulationCLProgram::release()
+{
+    mJacobiKernel.destroy();
+    mJacobiTiledKernel.destroy();
+    mAdvectKernel.destroy();
+    mDivergenceKernel.destroy();
+    mGradientKernel.destroy();
+    mAddScaledKernel.destroy();
+    mVelocityBoundaryKernel.destroy();
+    mPressureBoundaryKernel.destroy();
+    mAdvectAddForceKernel.destroy();
+    mDivergenceJacobiKernel.destroy();
+    mJacobiPressureBoundaryKernel.destroy();
+    mProjectBoundaryKernel.destroy();
+
+    mProgram.destroy();
+
+    mCreated = false;
+}
+
+bool Fluid3DSimulationCLProgram::update(const Fluid3DSimulationConfig &config,
+                                        MyCLImage3D &velocities,
+                                        MyCLImage3D &velocitiesOut,
+                                        MyCLImage3D *forces,
+                                        MyCLImage3D &pressure,
+                                        MyCLImage3D &pressureOut,
+                                        MyCLImage3D &temp1,
+                                        MyCLImage3D &temp2,
+                                        cl_float dt)
+{
+    Q_ASSERT( mCreated );
+    Q_ASSERT( &velocitiesOut != &velocities && &velocitiesOut != &temp1 && &velocitiesOut != &temp2 );
+    Q_ASSERT( &pressureOut != &pressure && &pressureOut != &temp1 && &pressureOut != &temp2 );
+
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float density = config.density;
+
+    // Falls back to the plain Jacobi kernel if the tiled one can't be launched.
+    int sweepsPerLaunch = 1;
+    if (config.jacobiSweepsPerLaunch > 1 && tiledJacobiSupported())
+        sweepsPerLaunch = std::min(config.jacobiSweepsPerLaunch, JacobiMaxSweepsPerLaunch);
+
+    if (config.fusedKernels)
+        return updateFused(config, velocities, velocitiesOut, forces, pressure, pressureOut, temp1, temp2, dt, sweepsPerLaunch);
+
+    // The same bookkeeping as in Fluid2DSimulationCLProgram::update().
+    MyCLImage3D *velocityImage = &velocities;
+    MyCLImage3D *pressureImage = &pressure;
+
+    MyCLImage3D *freeImage1 = &temp1;
+    MyCLImage3D *freeImage2 = &temp2;
+
+
+    /* Step 1: Advection */
+    if (!advect(*velocityImage, *velocityImage, *freeImage1, dt, gridSize))
+    {
+        qDebug() << "Failure in advection step.";
+        return false;
+    }
+    std::swap(velocityImage, freeImage1);
+
+
+    /* Step 2: Diffusion (optional) */
+    if (config.hasViscosity && config.viscosity > 0)
+    {
+        if (!diffuse(config, velocityImage, freeImage1, freeImage2, dt, sweepsPerLaunch))
+        {
+            qDebug() << "Failure in diffusion step.";
+            return false;
+        }
+    }
+
+
+    /* Step 3: Add forces (optional) */
+    if (forces != nullptr)
+    {
+        if (!addScaled(*velocityImage, *forces, dt, *freeImage1))
+        {
+            qDebug() << "Failure in add-forces step.";
+            return false;
+        }
+
+        std::swap(velocityImage, freeImage1);
+    }
+
+
+    /* Step 4: Update pressure */
+    MyCLImage3D *divergenceImage = freeImage1;
+    MyCLImage3D *scratch = freeImage2;
+
+    if (!divergence(*velocityImage, *divergenceImage, gridSize))
+    {
+        qDebug() << "Failure in computing divergence.";
+        return false;
+    }
+
+    if (!jacobiIterations(pressureImage, *divergenceImage, scratch, -gridSize * gridSize, 6,
+                          config.pressureIterations, sweepsPerLaunch))
+    {
+        qDebug() << "Failure in pressure computation.";
+        return false;
+    }
+
+    // The divergence isn't needed anymore.
+    MyCLImage3D *gradientImage = divergenceImage;
+
+
+    /* Step 5: Subtract pressure gradient */
+    if (!gradient(*pressureImage, *gradientImage, gridSize))
+    {
+        qDebug() << "Failure in pressure gradient computation.";
+        return false;
+    }
+
+    // As in 2D, the pressure boundary is enforced early so that the velocity
+    // can go into whichever of the two pressure-solve images is a temporary.
+    if (!pressureBoundary(*pressureImage, pressureOut))
+    {
+        qDebug() << "Failure enforcing pressure boundary.";
+        return false;
+    }
+
+    if (scratch == &pressure)
+        std::swap(scratch, pressureImage);
+
+    if (!addScaled(*velocityImage, *gradientImage, -1.0/density, *scratch))
+    {
+        qDebug() << "Failure in subtracting pressure gradient.";
+        return false;
+    }
+    std::swap(velocityImage, scratch);
+
+
+    /* Step 6: Enforce boundary conditions */
+    if (!velocityBoundary(*velocityImage, velocitiesOut))
+    {
+        qDebug() << "Failure enforcing velocity boundary.";
+        return false;
+    }
+
+    return true;
+}
+
+bool Fluid3DSimulationCLProgram::updateFused(const Fluid3DSimulationConfig &config,
+                                             MyCLImage3D &velocities,
+                                             MyCLImage3D &velocitiesOut,
+                                             MyCLImage3D *forces,
+                                             MyCLImage3D &pressure,
+                                             MyCLImage3D &pressureOut,
+                                             MyCLImage3D &temp1,
+                                             MyCLImage3D &temp2,
+                                             cl_float dt,
+                                             int sweepsPerLaunch)
+{
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float alpha = -gridSize * gridSize;
+
+    MyCLImage3D *velocityImage = &velocities;
+    MyCLImage3D *pressureImage = &pressure;
+
+    MyCLImage3D *freeImage1 = &temp1;
+    MyCLImage3D *freeImage2 = &temp2;
+
+
+    /* The same steps as Fluid2DSimulationCLProgram::updateFused(). */
+
+
+    /* Step 1: Advection and forces */
+    bool advected = forces != nullptr
+            ? advectAddForce(*velocityImage, *forces, *freeImage1, dt, gridSize)
+            : advect(*velocityImage, *velocityImage, *freeImage1, dt, gridSize);
+
+    if (!advected)
+    {
+        qDebug() << "Failure in advection step.";
+        return false;
+    }
+    std::swap(velocityImage, freeImage1);
+
+
+    /* Step 2: Diffusion (optional) */
+    if (config.hasViscosity && config.viscosity > 0)
+    {
+        if (!diffuse(config, velocityImage, freeImage1, freeImage2, dt, sweepsPerLaunch))
+        {
+            qDebug() << "Failure in diffusion step.";
+            return false;
+        }
+    }
+
+
+    /* Steps 3-5: Pressure */
+    MyCLImage3D *divergenceImage = freeImage1;
+    MyCLImage3D *scratch = freeImage2;
+
+    if (config.pressureIterations >= 2)
+    {
+        if (!divergenceJacobi(*velocityImage, *pressureImage, *divergenceImage, *scratch, gridSize))
+        {
+            qDebug() << "Failure in computing divergence.";
+            return false;
+        }
+        std::swap(pressureImage, scratch);
+
+        if (!jacobiIterations(pressureImage, *divergenceImage, scratch, alpha, 6,
+                              config.pressureIterations - 2, sweepsPerLaunch))
+        {
+            qDebug() << "Failure in pressure computation.";
+            return false;
+        }
+
+        if (!jacobiPressureBoundary(*pressureImage, *divergenceImage, pressureOut, alpha, 6))
+        {
+            qDebug() << "Failure enforcing pressure boundary.";
+            return false;
+        }
+    }
+    else
+    {
+        if (!divergence(*velocityImage, *divergenceImage, gridSize))
+        {
+            qDebug() << "Failure in computing divergence.";
+            return false;
+        }
+
+        if (!jacobiIterations(pressureImage, *divergenceImage, scratch, alpha, 6,
+                              config.pressureIterations, sweepsPerLaunch))
+        {
+            qDebug() << "Failure in pressure computation.";
+            return false;
+        }
+
+        if (!pressureBoundary(*pressureImage, pressureOut))
+        {
+            qDebug() << "Failure enforcing pressure boundary.";
+            return false;
+        }
+    }
+
+
+    /* Step 6: Projection */
+    if (!projectBoundary(*velocityImage, pressureOut, velocitiesOut, gridSize, config.density))
+    {
+        qDebug() << "Failure in subtracting pressure gradient.";
+        return false;
+    }
+
+    return true;
+}
+
+bool Fluid3DSimulationCLProgram::diffuse(const Fluid3DSimulationConfig &config,
+                                         MyCLImage3D *&velocity,
+                                         MyCLImage3D *&free1,
+                                         MyCLImage3D *&free2,
+                                         cl_float dt,
+                                         int sweepsPerLaunch)
+{
+    const cl_float gridSize = config.gridSquareSize;
+    const cl_float hh_vdt = gridSize * gridSize / (config.viscosity * dt);
+
+    // b is the velocity from before diffusion, and the iteration ping-pongs
+    // between the two free images.
+    MyCLImage3D *diffused = free1;
+    MyCLImage3D *scratch = free2;
+
+    if (!jacobi(*velocity, *velocity, *diffused, hh_vdt, 6 + hh_vdt))
+        return false;
+
+    if (!jacobiIterations(diffused, *velocity, scratch, hh_vdt, 6 + hh_vdt, DiffusionIterations - 1, sweepsPerLaunch))
+        return false;
+
+    free1 = velocity;
+    free2 = scratch;
+    velocity = diffused;
+
+    return true;
+}
+
+bool Fluid3DSimulationCLProgram::jacobiIterations(MyCLImage3D *&x,
+                                                  MyCLImage3D &b,
+                                                  MyCLImage3D *&scratch,
+                                                  cl_float alpha,
+                                                  cl_float beta,
+                                                  int iterations,
+                                                  int sweepsPerLaunch)
+{
+    Q_ASSERT( x != &b && scratch != &b );
+
+    int sweepsDone = 0;
+    while (sweepsDone < iterations)
+    {
+        int sweeps = std::min(iterations - sweepsDone, sweepsPerLaunch);
+
+        bool success = sweeps > 1
+                ? jacobiTiled(*x, b, *scratch, alpha, beta, sweeps)
+                : jacobi(*x, b, *scratch, alpha, beta);
+
+        if (!success)
+            return false;
+
+        std::swap(x, scratch);
+        sweepsDone += sweeps;
+    }
+
+    return true;
+}
+
+bool Fluid3DSimulationCLProgram::jacobi(MyCLImage3D &input,
+                                        MyCLImage3D &b,
+                                        MyCLImage3D &output,
+                                        cl_float alpha,
+                                        cl_float beta)
+{
+    return mJacobiKernel(output.width(), output.height(), output.depth(), input, b, output, alpha, 1.0 / beta);
+}
+
+bool Fluid3DSimulationCLProgram::jacobiTiled(MyCLImage3D &input,
+                                             MyCLImage3D &b,
+                                             MyCLImage3D &output,
+                                             cl_float alpha,
+                                             cl_float beta,
+                                             cl_int sweeps)
+{
+    Q_ASSERT( sweeps > 0 && sweeps <= JacobiMaxSweepsPerLaunch );
+
+    // Each work group writes a column of this side-length and JacobiColumnDepth planes.
+    size_t blockSize = JacobiTileSize - 2 * sweeps;
+    size_t groupsX = (output.width() + blockSize - 1) / blockSize;
+    size_t groupsY = (output.height() + blockSize - 1) / blockSize;
+    size_t groupsZ = (output.depth() + JacobiColumnDepth - 1) / JacobiColumnDepth;
+
+    return mJacobiTiledKernel.runWithLocalSize(groupsX * JacobiTileSize, groupsY * JacobiTileSize, groupsZ,
+                                               JacobiTileSize, JacobiTileSize, 1,
+                                               input, b, output, alpha, 1.0 / beta, sweeps);
+}
+
+bool Fluid3DSimulationCLProgram::tiledJacobiSupported() const
+{
+    return mJacobiTiledKernel.maxWorkGroupSize() >= JacobiTileSize * JacobiTileSize &&
+           mJacobiTiledKernel.localMemorySize() <= mDeviceLocalMemSize;
+}
+
+bool Fluid3DSimulationCLProgram::advect(MyCLImage3D &quantity,
+                                        MyCLImage3D &velocity,
+                                        MyCLImage3D &output,
+                                        cl_float dt,
+                                        cl_float gridSize)
+{
+    return mAdvectKernel(output.width(), output.height(), output.depth(), quantity, velocity, output, dt / gridSize);
+}
+
+bool Fluid3DSimulationCLProgram::divergence(MyCLImage3D &vecField,
+                                            MyCLImage3D &output,
+                                            cl_float gridSize)
+{
+    return mDivergenceKernel(output.width(), output.height(), output.depth(), vecField, output, 1.0 / gridSize);
+}
+
+bool Fluid3DSimulationCLProgram::gradient(MyCLImage3D &func,
+                                          MyCLImage3D &output,
+                                          cl_float gridSize)
+{
+    return mGradientKernel(output.width(), output.height(), output.depth(), func, output, 1.0 / gridSize);
+}
+
+bool Fluid3DSimulationCLProgram::addScaled(MyCLImage3D &t1, MyCLImage3D &t2,
+                                           cl_float multiplier,
+                                           MyCLImage3D &sum)
+{
+    return mAddScaledKernel(sum.width(), sum.height(), sum.depth(), t1, t2, multiplier, sum);
+}
+
+bool Fluid3DSimulationCLProgram::velocityBoundary(MyCLImage3D &img, MyCLImage3D &out)
+{
+    return mVelocityBoundaryKernel(out.width(), out.height(), out.depth(), img, out);
+}
+
+bool Fluid3DSimulationCLProgram::pressureBoundary(MyCLImage3D &img, MyCLImage3D &out)
+{
+    return mPressureBoundaryKernel(out.width(), out.height(), out.depth(), img, out);
+}
+
+bool Fluid3DSimulationCLProgram::advectAddForce(MyCLImage3D &velocity,
+                                                MyCLImage3D &forces,
+                                                MyCLImage3D &output,
+                                                cl_float dt,
+                                                cl_float gridSize)
+{
+    return mAdvectAddForceKernel(output.width(), output.height(), output.depth(), velocity, forces, output, dt / gridSize, dt);
+}
+
+bool Fluid3DSimulationCLProgram::divergenceJacobi(MyCLImage3D &velocity,
+                                                  MyCLImage3D &pressure,
+                                                  MyCLImage3D &divOutput,
+                                                  MyCLImage3D &pressureOutput,
+                                                  cl_float gridSize)
+{
+    return mDivergenceJacobiKernel(divOutput.width(), divOutput.height(), divOutput.depth(),
+                                   velocity, pressure, divOutput, pressureOutput,
+                                   1.0 / gridSize, -gridSize * gridSize, 1.0 / 6);
+}
+
+bool Fluid3DSimulationCLProgram::jacobiPressureBoundary(MyCLImage3D &input,
+                                                        MyCLImage3D &b,
+                                                        MyCLImage3D &output,
+                                                        cl_float alpha,
+                                                        cl_float beta)
+{
+    return mJacobiPressureBoundaryKernel(output.width(), output.height(), output.depth(), input, b, output, alpha, 1.0 / beta);
+}
+
+bool Fluid3DSimulationCLProgram::projectBoundary(MyCLImage3D &velocity,
+                                                 MyCLImage3D &pressure,
+                                                 MyCLImage3D &output,
+                                                 cl_float gridSize,
+                                                 cl_float density)
+{
+    return mProjectBoundaryKernel(output.width(), output.height(), output.depth(),
+                                  velocity, pressure, output, 1.0 / (gridSize * density));
+}
@@ -0,0 +1,178 @@
+#ifndef FLUID3DSIMULATIONCLPROGRAM_H
+#define FLUID3DSIMULATIONCLPROGRAM_H
+
+#include "fluid3dsimulationconfig.h"
+
+#include "cl_interface/include_opencl.h"
+#include "cl_interface/myclwrapper.h"
+#include "cl_interface/myclimage3d.h"
+#include "cl_interface/myclprogram.h"
+#include "cl_interface/myclkernel.h"
+
+/// The 3D counterpart of Fluid2DSimulationCLProgram, with the kernels of
+/// fluidSimulation3D.cl. Requires the cl_khr_3d_image_writes extension.
+class Fluid3DSimulationCLProgram
+{
+public:
+    Fluid3DSimulationCLProgram();
+
+    /// Fails if the device can't write to 3D images.
+    bool create(MyCLWrapper *wrapper);
+
+    void release();
+
+    /// The side-length of the x-y tile of the tiled Jacobi kernel, which is also
+    /// its work group.
+    static const int JacobiTileSize = 16;
+
+    /// The number of planes of output each work group of the tiled Jacobi kernel
+    /// marches through. The longer the march, the smaller the share of planes
+    /// loaded only to start it.
+    static const int JacobiColumnDepth = 16;
+
+    /// The most sweeps jacobiTiled() performs per launch. Each sweep but the last
+    /// keeps three planes of the tile in local memory, so two sweeps take 24 KB.
+    static const int JacobiMaxSweepsPerLaunch = 2;
+
+    /// The number of Jacobi sweeps of the diffusion solve.
+    static const int DiffusionIterations = 20;
+
+    /// Does the same as Fluid2DSimulationCLProgram::update() on a 3D grid.
+    /// Vector fields are in the first three channels of the images.
+    bool update(const Fluid3DSimulationConfig &config,
+                MyCLImage3D &velocities,
+                MyCLImage3D &velocitiesOut,
+                MyCLImage3D *forces,
+                MyCLImage3D &pressure,
+                MyCLImage3D &pressureOut,
+                MyCLImage3D &temp1,
+                MyCLImage3D &temp2,
+                cl_float dt);
+
+
+    bool jacobi(MyCLImage3D &input,
+                MyCLImage3D &b,
+                MyCLImage3D &output,
+                cl_float alpha,
+                cl_float beta);
+
+    /// Performs `sweeps` Jacobi iterations in one launch, marching an x-y tile
+    /// along z in local memory. Like the 2D jacobiTiled(), b is kept fixed.
+    /// Requires 0 < sweeps <= JacobiMaxSweepsPerLaunch and tiledJacobiSupported().
+    bool jacobiTiled(MyCLImage3D &input,
+                     MyCLImage3D &b,
+                     MyCLImage3D &output,
+                     cl_float alpha,
+                     cl_float beta,
+                     cl_int sweeps);
+
+    /// Whether the device can launch jacobiTiled() with its required work group
+    /// size and local memory.
+    bool tiledJacobiSupported() const;
+
+    bool advect(MyCLImage3D &quantity,
+                MyCLImage3D &velocity,
+                MyCLImage3D &output,
+                cl_float dt,
+                cl_float gridSize);
+
+    bool divergence(MyCLImage3D &vecField,
+                    MyCLImage3D &output,
+                    cl_float gridSize);
+
+    bool gradient(MyCLImage3D &func,
+                  MyCLImage3D &output,
+                  cl_float gridSize);
+
+    bool addScaled(MyCLImage3D &t1, MyCLImage3D &t2,
+                   cl_float multiplier,
+                   MyCLImage3D &sum);
+
+    bool velocityBoundary(MyCLImage3D &img, MyCLImage3D &out);
+    bool pressureBoundary(MyCLImage3D &img, MyCLImage3D &out);
+
+    /// advect() of the velocity along itself followed by adding forces * dt.
+    bool advectAddForce(MyCLImage3D &velocity,
+                        MyCLImage3D &forces,
+                        MyCLImage3D &output,
+                        cl_float dt,
+                        cl_float gridSize);
+
+    /// divergence() into divOutput and the first pressure Jacobi sweep into
+    /// pressureOutput.
+    bool divergenceJacobi(MyCLImage3D &velocity,
+                          MyCLImage3D &pressure,
+                          MyCLImage3D &divOutput,
+                          MyCLImage3D &pressureOutput,
+                          cl_float gridSize);
+
+    /// A Jacobi sweep followed by pressureBoundary().
+    bool jacobiPressureBoundary(MyCLImage3D &input,
+                                MyCLImage3D &b,
+                                MyCLImage3D &output,
+                                cl_float alpha,
+                                cl_float beta);
+
+    /// Subtracts the pressure gradient from the velocity and enforces the
+    /// velocity boundary.
+    bool projectBoundary(MyCLImage3D &velocity,
+                         MyCLImage3D &pressure,
+                         MyCLImage3D &output,
+                         cl_float gridSize,
+                         cl_float density);
+
+private:
+    /// The fused pipeline, used by update() if config.fusedKernels is set.
+    bool updateFused(const Fluid3DSimulationConfig &config,
+                     MyCLImage3D &velocities,
+                     MyCLImage3D &velocitiesOut,
+                     MyCLImage3D *forces,
+                     MyCLImage3D &pressure,
+                     MyCLImage3D &pressureOut,
+                     MyCLImage3D &temp1,
+                     MyCLImage3D &temp2,
+                     cl_float dt,
+                     int sweepsPerLaunch);
+
+    /// Diffuses the velocity, keeping the velocity from before diffusion as b.
+    /// The pointers trade places like in the 2D version.
+    bool diffuse(const Fluid3DSimulationConfig &config,
+                 MyCLImage3D *&velocity,
+                 MyCLImage3D *&free1,
+                 MyCLImage3D *&free2,
+                 cl_float dt,
+                 int sweepsPerLaunch);
+
+    /// Performs `iterations` Jacobi sweeps on *x, ping-ponging with *scratch,
+    /// sweepsPerLaunch at a time where possible. *x holds the result.
+    bool jacobiIterations(MyCLImage3D *&x,
+                          MyCLImage3D &b,
+                          MyCLImage3D *&scratch,
+                          cl_float alpha,
+                          cl_float beta,
+                          int iterations,
+                          int sweepsPerLaunch);
+
+    bool mCreated;
+
+    MyCLWrapper *mCLWrapper;
+
+    /// CL_DEVICE_LOCAL_MEM_SIZE of the wrapper's device.
+    cl_ulong mDeviceLocalMemSize;
+
+    MyCLProgram mProgram;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, cl_float, cl_float> mJacobiKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, cl_float, cl_float, cl_int> mJacobiTiledKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, cl_float> mAdvectKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, cl_float> mDivergenceKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, cl_float> mGradientKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, cl_float, MyCLImage3D&> mAddScaledKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&> mVelocityBoundaryKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&> mPressureBoundaryKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, cl_float, cl_float> mAdvectAddForceKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, cl_float, cl_float, cl_float> mDivergenceJacobiKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, cl_float, cl_float> mJacobiPressureBoundaryKernel;
+    MyCLKernel<MyCLImage3D&, MyCLImage3D&, MyCLImage3D&, cl_float> mProjectBoundaryKernel;
+};
+
+#endif // FLUID3DSIMULATIONCLPROGRAM_H
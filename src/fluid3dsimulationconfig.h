@@ -0,0 +1,83 @@
+#ifndef FLUID3DSIMULATIONCONFIG_H
+#define FLUID3DSIMULATIONCONFIG_H
+
+#include <cstddef>
+
+#include <QDebug>
+
+/// The 3D counterpart of Fluid2DSimulationConfig. Only the options that the 3D
+/// pipeline supports are here: Jacobi solves, optionally tiled, and the fused
+/// kernels.
+struct Fluid3DSimulationConfig
+{
+    /// Creates an inviscid (viscosity = 0) fluid with default density and grid coarseness.
+    Fluid3DSimulationConfig(size_t width, size_t height, size_t depth, float dens = 1, float gridSquare = 0.1f)
+        : width(width),
+          height(height),
+          depth(depth),
+          hasViscosity(false),
+          viscosity(0),
+          density(dens),
+          gridSquareSize(gridSquare),
+          jacobiSweepsPerLaunch(1),
+          pressureIterations(8),
+          fusedKernels(false)
+    {
+    }
+
+    /// Helper to enable and set the viscosity. The parameter should be > 0.
+    void setViscosity(float visc)
+    {
+        if (visc <= 0)
+        {
+            qWarning() << "Trying to set nonpositive viscosity disables viscosity.";
+            hasViscosity = false;
+            visc = 0;
+        }
+        else
+        {
+            hasViscosity = true;
+            viscosity = visc;
+        }
+    }
+
+    /// Helper to make the Jacobi solves use the local-memory tiled kernel, which
+    /// performs several sweeps per launch. A value of 1 uses the plain kernel.
+    void setTiledJacobi(int sweepsPerLaunch)
+    {
+        if (sweepsPerLaunch < 1)
+        {
+            qWarning() << "Jacobi sweeps per launch must be at least 1; using 1.";
+            sweepsPerLaunch = 1;
+        }
+
+        jacobiSweepsPerLaunch = sweepsPerLaunch;
+    }
+
+    /// The size of the grid in grid-cubes.
+    size_t width;
+    size_t height;
+    size_t depth;
+
+    /// Whether this fluid has viscosity.
+    bool hasViscosity;
+    float viscosity;
+
+    float density;
+
+    /// The side-length of a single cube in the grid.
+    float gridSquareSize;
+
+    /// The number of Jacobi sweeps done per kernel launch. Values above 1 select
+    /// the tiled kernel, which marches an x-y tile along z. Values above
+    /// Fluid3DSimulationCLProgram::JacobiMaxSweepsPerLaunch (2) are clamped to it.
+    int jacobiSweepsPerLaunch;
+
+    /// The number of Jacobi sweeps of the pressure solve.
+    int pressureIterations;
+
+    /// Whether update() uses fused kernels. See Fluid2DSimulationConfig::fusedKernels.
+    bool fusedKernels;
+};
+
+#endif // FLUID3DSIMULATIONCONFIG_H
@@ -1,3 +1,70 @@
+/* ---------------------------------------------------------------------------
+   Grid reads.
+
+   The solver kernels read their fields through these. Cells outside the grid
+   read as 0, unless the program is built with PERIODIC_BOUNDARY defined (see
+   Fluid2DSimulationConfig::periodicBoundary), in which case the grid wraps
+   around: reads use CLK_ADDRESS_REPEAT, which needs normalized coordinates,
+   and the boundary conditions are compiled out.
+   --------------------------------------------------------------------------- */
+
+/* Reads the cell at coords. */
+float4 readGrid(__read_only image2d_t img, int2 coords)
+{
+#ifdef PERIODIC_BOUNDARY
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE |
+                              CLK_ADDRESS_REPEAT         |
+                              CLK_FILTER_NEAREST;
+
+    float2 size = (float2) (get_image_width(img), get_image_height(img));
+    return read_imagef(img, sampler, (convert_float2(coords) + (float2) (0.5f, 0.5f)) / size);
+#else
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    return read_imagef(img, sampler, coords);
+#endif
+}
+
+/* Bilinearly interpolates img at coords, where cell centers are at
+   half-integer coordinates. */
+float4 readGridLinear(__read_only image2d_t img, float2 coords)
+{
+#ifdef PERIODIC_BOUNDARY
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE |
+                              CLK_ADDRESS_REPEAT         |
+                              CLK_FILTER_LINEAR;
+
+    float2 size = (float2) (get_image_width(img), get_image_height(img));
+    return read_imagef(img, sampler, coords / size);
+#else
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_LINEAR;
+
+    return read_imagef(img, sampler, coords);
+#endif
+}
+
+
+
+/* Computes a Jacobi iteration at one cell:
+    [input(i-1,j) + input(i+1,j) + input(i,j-1) + input(i,j+1) + alpha*b(i,j)] * betaInverse
+*/
+float4 jacobiAt(__read_only image2d_t input,
+                __read_only image2d_t b,
+                int2 coords,
+                const float alpha,
+                const float betaInverse)
+{
+    return (readGrid(input, (int2)(coords.x-1, coords.y))
+           +readGrid(input, (int2)(coords.x+1, coords.y))
+           +readGrid(input, (int2)(coords.x, coords.y-1))
+           +readGrid(input, (int2)(coords.x, coords.y+1))
+           +alpha * readGrid(b, coords)) * betaInverse;
+}
+
 /* Performs a Jacobi iteration:
     output(i,j) = [input(i-1,j) + input(i+1,j) + input(i,j-1) + input(i,j+1) + alpha*b(i,j)] * betaInverse
 */
@@ -8,20 +75,234 @@ __kernel void jacobi(__read_only image2d_t input,
                      const float alpha,
                      const float betaInverse)
 {
-    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
-                              CLK_ADDRESS_CLAMP           |
-                              CLK_FILTER_NEAREST;
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+        write_imagef(output, coords, jacobiAt(input, b, coords, alpha, betaInverse));
+}
+
+
+
+/* The side-length of the work group used by jacobiTiled. This must match
+   Fluid2DSimulationCLProgram::JacobiTileSize. */
+#define JACOBI_TILE_SIZE 16
+
+/* Performs `sweeps` Jacobi iterations (see jacobi above) in a single launch.
+
+   Each work group loads a JACOBI_TILE_SIZE x JACOBI_TILE_SIZE tile of the input
+   into local memory. After every sweep, the outermost ring of the tile no longer
+   holds correct values (its neighbors weren't loaded), so the valid region
+   shrinks by one cell per side. Only the center block of side
+   JACOBI_TILE_SIZE - 2*sweeps is written out, and work groups are spaced so
+   that those blocks cover the image.
+
+   If bFollowsInput is 0, b is read once and kept fixed for all sweeps. Otherwise
+   b is ignored and every sweep uses its own input as b, so that the launch
+   matches `sweeps` launches of jacobi(x, x, out) as the diffusion step does.
+
+   Must be launched with a JACOBI_TILE_SIZE x JACOBI_TILE_SIZE work group,
+   and sweeps must be less than JACOBI_TILE_SIZE / 2.
+*/
+__kernel void jacobiTiled(__read_only image2d_t input,
+                          __read_only image2d_t b,
+                          __write_only image2d_t output,
+                          const float alpha,
+                          const float betaInverse,
+                          const int sweeps,
+                          const int bFollowsInput)
+{
+    __local float4 tile[2][JACOBI_TILE_SIZE][JACOBI_TILE_SIZE];
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+
+    int blockSize = JACOBI_TILE_SIZE - 2 * sweeps;
+    int2 coords = (int2) (get_group_id(0) * blockSize + lx - sweeps,
+                          get_group_id(1) * blockSize + ly - sweeps);
+
+    bool inImage = coords.x >= 0 && coords.y >= 0 &&
+                   coords.x < get_image_width(output) && coords.y < get_image_height(output);
+
+#ifdef PERIODIC_BOUNDARY
+    // Cells outside the image read the cells they wrap around to, and are
+    // updated like them, so the halo stays in step with the interior.
+    bool inGrid = true;
+#else
+    // Cells outside the image read as 0 and stay 0, matching the clamp-to-border
+    // behavior of the plain jacobi kernel.
+    bool inGrid = inImage;
+#endif
+
+    tile[0][ly][lx] = readGrid(input, coords);
+    float4 alphaB = alpha * readGrid(b, coords);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int src = 0;
+    for (int sweep = 0; sweep < sweeps; ++sweep)
+    {
+        int margin = sweep + 1;
+        bool updatable = inGrid &&
+                         lx >= margin && lx < JACOBI_TILE_SIZE - margin &&
+                         ly >= margin && ly < JACOBI_TILE_SIZE - margin;
+
+        float4 value = tile[src][ly][lx];
+        if (updatable)
+        {
+            if (bFollowsInput)
+                alphaB = alpha * value;
+
+            value = (tile[src][ly][lx - 1]
+                    +tile[src][ly][lx + 1]
+                    +tile[src][ly - 1][lx]
+                    +tile[src][ly + 1][lx]
+                    +alphaB) * betaInverse;
+        }
+
+        tile[1 - src][ly][lx] = value;
+        src = 1 - src;
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    bool inBlock = lx >= sweeps && lx < JACOBI_TILE_SIZE - sweeps &&
+                   ly >= sweeps && ly < JACOBI_TILE_SIZE - sweeps;
+
+    if (inImage && inBlock)
+        write_imagef(output, coords, tile[src][ly][lx]);
+}
+
+
+
+/* Performs half of a red-black successive over-relaxation sweep for the system
+   that jacobi iterates on. Cells whose color matches `parity` ((x + y) % 2) are
+   relaxed toward their Gauss-Seidel value by the factor omega:
+
+    gs(i,j)     = [input(i-1,j) + input(i+1,j) + input(i,j-1) + input(i,j+1) + alpha*b(i,j)] * betaInverse
+    output(i,j) = input(i,j) + omega * (gs(i,j) - input(i,j))
+
+   Cells of the other color are copied through unchanged, since images can't be
+   updated in place.
+*/
+void sorHalfSweep(__read_only image2d_t input,
+                  __read_only image2d_t b,
+                  __write_only image2d_t output,
+                  const float alpha,
+                  const float betaInverse,
+                  const float omega,
+                  const int parity)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+    {
+        float4 current = readGrid(input, coords);
+
+        if (((coords.x + coords.y) & 1) == parity)
+        {
+            float4 gaussSeidel = (readGrid(input, (int2)(coords.x-1, coords.y))
+                                 +readGrid(input, (int2)(coords.x+1, coords.y))
+                                 +readGrid(input, (int2)(coords.x, coords.y-1))
+                                 +readGrid(input, (int2)(coords.x, coords.y+1))
+                                 +alpha * readGrid(b, coords)) * betaInverse;
+
+            current += omega * (gaussSeidel - current);
+        }
+
+        write_imagef(output, coords, current);
+    }
+}
+
+/* Relaxes the red cells ((x + y) even). See sorHalfSweep. */
+__kernel void sorRed(__read_only image2d_t input,
+                     __read_only image2d_t b,
+                     __write_only image2d_t output,
+                     const float alpha,
+                     const float betaInverse,
+                     const float omega)
+{
+    sorHalfSweep(input, b, output, alpha, betaInverse, omega, 0);
+}
+
+/* Relaxes the black cells ((x + y) odd). See sorHalfSweep. */
+__kernel void sorBlack(__read_only image2d_t input,
+                       __read_only image2d_t b,
+                       __write_only image2d_t output,
+                       const float alpha,
+                       const float betaInverse,
+                       const float omega)
+{
+    sorHalfSweep(input, b, output, alpha, betaInverse, omega, 1);
+}
+
+
+
+/* Computes the residual of the Poisson equation laplacian(x) = b:
+
+    output(i,j) = b(i,j) - [x(i-1,j) + x(i+1,j) + x(i,j-1) + x(i,j+1) - 4*x(i,j)] * hInvSq
+
+   Like jacobi, values outside of the image are treated as 0.
+*/
+__kernel void residual(__read_only image2d_t x,
+                       __read_only image2d_t b,
+                       __write_only image2d_t output,
+                       const float hInvSq)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+    {
+        float4 laplacian = (readGrid(x, (int2)(coords.x-1, coords.y))
+                           +readGrid(x, (int2)(coords.x+1, coords.y))
+                           +readGrid(x, (int2)(coords.x, coords.y-1))
+                           +readGrid(x, (int2)(coords.x, coords.y+1))
+                           -4 * readGrid(x, coords)) * hInvSq;
 
+        write_imagef(output, coords, readGrid(b, coords) - laplacian);
+    }
+}
+
+
+/* Restricts a fine grid to a grid of half the resolution by averaging each
+   2x2 block of fine cells into the coarse cell that covers it.
+*/
+__kernel void restrictAverage(__read_only image2d_t fine,
+                              __write_only image2d_t coarse)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(coarse) && coords.y < get_image_height(coarse))
+    {
+        int2 fineCoords = 2 * coords;
+
+        float4 sum = readGrid(fine, fineCoords)
+                   + readGrid(fine, (int2)(fineCoords.x+1, fineCoords.y))
+                   + readGrid(fine, (int2)(fineCoords.x, fineCoords.y+1))
+                   + readGrid(fine, (int2)(fineCoords.x+1, fineCoords.y+1));
+
+        write_imagef(coarse, coords, sum * 0.25f);
+    }
+}
+
+
+/* Interpolates a coarse grid of half the resolution onto the fine grid and
+   adds it to x:
+
+    output(i,j) = x(i,j) + bilinear(coarse, (i,j) / 2)
+*/
+__kernel void prolongAdd(__read_only image2d_t x,
+                         __read_only image2d_t coarse,
+                         __write_only image2d_t output)
+{
     int2 coords = (int2) (get_global_id(0), get_global_id(1));
 
     if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
     {
-        float4 outVal = (read_imagef(input, sampler, (int2)(coords.x-1, coords.y))
-                        +read_imagef(input, sampler, (int2)(coords.x+1, coords.y))
-                        +read_imagef(input, sampler, (int2)(coords.x, coords.y-1))
-                        +read_imagef(input, sampler, (int2)(coords.x, coords.y+1))
-                        +alpha * read_imagef(b, sampler, coords)) * betaInverse;
-        write_imagef(output, coords, outVal);
+        // Cell centers are at half-integer coordinates on both grids.
+        float2 coarseCoords = (convert_float2(coords) + (float2)(0.5, 0.5)) * 0.5f;
+
+        write_imagef(output, coords, readGrid(x, coords)
+                                   + readGridLinear(coarse, coarseCoords));
     }
 }
 
@@ -35,51 +316,94 @@ __kernel void jacobi(__read_only image2d_t input,
     dt := time increment
     h  := grid size
 */
+/* Computes the advected quantity at the cell at coords. See advect. */
+float4 advectedAt(__read_only image2d_t quantity,
+                  __read_only image2d_t velocity,
+                  int2 icoords,
+                  const float dt_h)
+{
+    // NOTE: It is unclear whether linear interpolation is a good idea.
+    // Try experimenting.
+
+    float2 coords = convert_float2(icoords);
+
+    float2 vel = readGridLinear(velocity, coords).xy;
+    float2 offset = -vel * dt_h;
+
+    return readGridLinear(quantity, coords + (float2)(0.5, 0.5) + offset);
+}
+
 __kernel void advect(__read_only image2d_t quantity,
                      __read_only image2d_t velocity,
                      __write_only image2d_t output,
                      const float dt_h)
 {
-    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
-                              CLK_ADDRESS_CLAMP           |
-                              CLK_FILTER_LINEAR;
-    // NOTE: It is unclear whether linear interpolation is a good idea.
-    // Try experimenting.
-
-    float2 coords = (float2) (get_global_id(0), get_global_id(1));
     int2 icoords = (int2) (get_global_id(0), get_global_id(1));
 
+    if (icoords.x < get_image_width(output) && icoords.y < get_image_height(output))
+        write_imagef(output, icoords, advectedAt(quantity, velocity, icoords, dt_h));
+}
+
+
+/* Second pass of MacCormack advection. quantityHat is the result of advect on
+   quantity. This traces quantityHat back along the velocity to estimate the
+   error of the first pass and corrects it:
+
+    output(x) = quantityHat(x) + (quantity(x) - advect(quantityHat, -dt)(x)) / 2
+
+   The result is clamped to the range of the quantity values that advect
+   interpolated between, which keeps the scheme stable near sharp features.
+*/
+__kernel void macCormackCorrect(__read_only image2d_t quantity,
+                                __read_only image2d_t quantityHat,
+                                __read_only image2d_t velocity,
+                                __write_only image2d_t output,
+                                const float dt_h)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
     if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
     {
-        float2 vel = read_imagef(velocity, sampler, coords).xy;
-        float2 offset = -vel * dt_h;
+        float4 hat = readGrid(quantityHat, coords);
+        float4 bar = advectedAt(quantityHat, velocity, coords, -dt_h);
+        float4 corrected = hat + 0.5f * (readGrid(quantity, coords) - bar);
+
+        // The texels that advectedAt(quantity, velocity, coords, dt_h) interpolated.
+        float2 vel = readGridLinear(velocity, convert_float2(coords)).xy;
+        int2 base = convert_int2(floor(convert_float2(coords) - vel * dt_h));
+
+        float4 q00 = readGrid(quantity, base);
+        float4 q10 = readGrid(quantity, base + (int2)(1, 0));
+        float4 q01 = readGrid(quantity, base + (int2)(0, 1));
+        float4 q11 = readGrid(quantity, base + (int2)(1, 1));
 
-        float4 prev_quant = read_imagef(quantity, sampler, coords + (float2)(0.5, 0.5) + offset);
+        float4 lo = fmin(fmin(q00, q10), fmin(q01, q11));
+        float4 hi = fmax(fmax(q00, q10), fmax(q01, q11));
 
-        write_imagef(output, icoords, prev_quant);
+        write_imagef(output, coords, clamp(corrected, lo, hi));
     }
 }
 
 
+/* Computes the divergence of the first two channels of field at coords. */
+float divergenceAt(__read_only image2d_t field, int2 coords, const float hInv)
+{
+    float4 field_xp = readGrid(field, (int2) (coords.x + 1, coords.y));
+    float4 field_xm = readGrid(field, (int2) (coords.x - 1, coords.y));
+    float4 field_yp = readGrid(field, (int2) (coords.x, coords.y + 1));
+    float4 field_ym = readGrid(field, (int2) (coords.x, coords.y - 1));
+
+    return ((field_xp.x - field_xm.x) + (field_yp.y - field_ym.y)) * hInv;
+}
+
 __kernel void divergence(__read_only image2d_t field,
                          __write_only image2d_t output,
                          const float hInv)
 {
-    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
-                              CLK_ADDRESS_CLAMP           |
-                              CLK_FILTER_NEAREST;
-
     int2 coords = (int2) (get_global_id(0), get_global_id(1));
 
     if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
-    {
-        float4 field_xp = read_imagef(field, sampler, (int2) (coords.x + 1, coords.y));
-        float4 field_xm = read_imagef(field, sampler, (int2) (coords.x - 1, coords.y));
-        float4 field_yp = read_imagef(field, sampler, (int2) (coords.x, coords.y + 1));
-        float4 field_ym = read_imagef(field, sampler, (int2) (coords.x, coords.y - 1));
-
-        write_imagef(output, coords, (float4) (((field_xp.x - field_xm.x) + (field_yp.y - field_ym.y)) * hInv, 0, 0, 0));
-    }
+        write_imagef(output, coords, (float4) (divergenceAt(field, coords, hInv), 0, 0, 0));
 }
 
 
@@ -87,18 +411,14 @@ __kernel void gradient(__read_only image2d_t field,
                        __write_only image2d_t output,
                        const float hInv)
 {
-    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
-                              CLK_ADDRESS_CLAMP           |
-                              CLK_FILTER_NEAREST;
-
     int2 coords = (int2) (get_global_id(0), get_global_id(1));
 
     if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
     {
-        float field_xp = read_imagef(field, sampler, (int2) (coords.x + 1, coords.y)).x;
-        float field_xm = read_imagef(field, sampler, (int2) (coords.x - 1, coords.y)).x;
-        float field_yp = read_imagef(field, sampler, (int2) (coords.x, coords.y + 1)).x;
-        float field_ym = read_imagef(field, sampler, (int2) (coords.x, coords.y - 1)).x;
+        float field_xp = readGrid(field, (int2) (coords.x + 1, coords.y)).x;
+        float field_xm = readGrid(field, (int2) (coords.x - 1, coords.y)).x;
+        float field_yp = readGrid(field, (int2) (coords.x, coords.y + 1)).x;
+        float field_ym = readGrid(field, (int2) (coords.x, coords.y - 1)).x;
 
         float dx = (field_xp - field_xm) * hInv;
         float dy = (field_yp - field_ym) * hInv;
@@ -108,6 +428,64 @@ __kernel void gradient(__read_only image2d_t field,
 }
 
 
+/* Computes the curl (vorticity) of a 2D velocity field, a scalar:
+
+    output(i,j) = d(vel.y)/dx - d(vel.x)/dy
+*/
+__kernel void curl(__read_only image2d_t velocity,
+                   __write_only image2d_t output,
+                   const float hInv)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+    {
+        float vy_xp = readGrid(velocity, (int2) (coords.x + 1, coords.y)).y;
+        float vy_xm = readGrid(velocity, (int2) (coords.x - 1, coords.y)).y;
+        float vx_yp = readGrid(velocity, (int2) (coords.x, coords.y + 1)).x;
+        float vx_ym = readGrid(velocity, (int2) (coords.x, coords.y - 1)).x;
+
+        float w = ((vy_xp - vy_xm) - (vx_yp - vx_ym)) * 0.5f * hInv;
+
+        write_imagef(output, coords, (float4) (w, 0, 0, 0));
+    }
+}
+
+
+/* Adds the vorticity confinement force, which pushes velocity around the
+   local maxima of |curl| to restore small swirls lost to numerical diffusion:
+
+    N = normalize(gradient(|curl|))
+    output = velocity + scale * (N.y * curl, -N.x * curl)
+
+   scale is strength * h * dt.
+*/
+__kernel void vorticityConfinement(__read_only image2d_t velocity,
+                                   __read_only image2d_t curl,
+                                   __write_only image2d_t output,
+                                   const float hInv,
+                                   const float scale)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+    {
+        float w_xp = fabs(readGrid(curl, (int2) (coords.x + 1, coords.y)).x);
+        float w_xm = fabs(readGrid(curl, (int2) (coords.x - 1, coords.y)).x);
+        float w_yp = fabs(readGrid(curl, (int2) (coords.x, coords.y + 1)).x);
+        float w_ym = fabs(readGrid(curl, (int2) (coords.x, coords.y - 1)).x);
+        float w = readGrid(curl, coords).x;
+
+        float2 gradW = (float2) (w_xp - w_xm, w_yp - w_ym) * 0.5f * hInv;
+        float2 N = gradW / (length(gradW) + 1e-5f);
+
+        float4 force = (float4) (N.y * w, -N.x * w, 0, 0);
+
+        write_imagef(output, coords, readGrid(velocity, coords) + force * scale);
+    }
+}
+
+
 __kernel void addScaled(__read_only image2d_t term1,
                         __read_only image2d_t term2,
                         const float multiplier,
@@ -125,11 +503,32 @@ __kernel void addScaled(__read_only image2d_t term1,
 }
 
 
+/* Linearly interpolates between two states: previous + (current - previous) * alpha. */
+__kernel void interpolateStates(__read_only image2d_t previous,
+                                __read_only image2d_t current,
+                                const float alpha,
+                                __write_only image2d_t output)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+        write_imagef(output, coords, mix(read_imagef(previous, sampler, coords),
+                                         read_imagef(current, sampler, coords),
+                                         alpha));
+}
+
+
 /* Sets the boundary value to the negation of its inner neighbor.
 
     | p1 | p2 ...
 
     p1 <- -p2
+
+   With PERIODIC_BOUNDARY there is no boundary and this only copies.
 */
 __kernel void velocityBoundary(__read_only image2d_t img,
                                __write_only image2d_t out)
@@ -140,6 +539,7 @@ __kernel void velocityBoundary(__read_only image2d_t img,
 
     int2 coords = (int2) (get_global_id(0), get_global_id(1));
 
+#ifndef PERIODIC_BOUNDARY
     if (coords.x == 0)
         write_imagef(out, coords, -read_imagef(img, sampler, (int2) (1, coords.y)));
     else if (coords.x == get_image_width(out) - 1)
@@ -148,7 +548,9 @@ __kernel void velocityBoundary(__read_only image2d_t img,
         write_imagef(out, coords, -read_imagef(img, sampler, (int2) (coords.x, 1)));
     else if (coords.y == get_image_height(out) - 1)
         write_imagef(out, coords, -read_imagef(img, sampler, (int2) (coords.x, coords.y - 1)));
-    else if (coords.x < get_image_width(out) && coords.y < get_image_height(out))
+    else
+#endif
+    if (coords.x < get_image_width(out) && coords.y < get_image_height(out))
         write_imagef(out, coords, read_imagef(img, sampler, coords));
 }
 
@@ -157,6 +559,8 @@ __kernel void velocityBoundary(__read_only image2d_t img,
     | p1 | p2 ...
 
     p1 <- p2
+
+   With PERIODIC_BOUNDARY there is no boundary and this only copies.
 */
 __kernel void pressureBoundary(__read_only image2d_t img,
                                __write_only image2d_t out)
@@ -167,6 +571,7 @@ __kernel void pressureBoundary(__read_only image2d_t img,
 
    int2 coords = (int2) (get_global_id(0), get_global_id(1));
 
+#ifndef PERIODIC_BOUNDARY
    if (coords.x == 0)
        write_imagef(out, coords, read_imagef(img, sampler, (int2) (/*coords.x + */1, coords.y)));
    else if (coords.x == get_image_width(out) - 1)
@@ -175,6 +580,1293 @@ __kernel void pressureBoundary(__read_only image2d_t img,
        write_imagef(out, coords, read_imagef(img, sampler, (int2) (coords.x, /*coords.y + */1)));
    else if (coords.y == get_image_height(out) - 1)
        write_imagef(out, coords, read_imagef(img, sampler, (int2) (coords.x, coords.y - 1)));
-   else if (coords.x < get_image_width(out) && coords.y < get_image_height(out))
+   else
+#endif
+   if (coords.x < get_image_width(out) && coords.y < get_image_height(out))
        write_imagef(out, coords, read_imagef(img, sampler, coords));
 }
+
+
+
+
+/* ---------------------------------------------------------------------------
+   Resampling between the solver grid and the output resolution, for
+   Fluid2DSimulationConfig::resolutionDivisor.
+   --------------------------------------------------------------------------- */
+
+/* Computes the Catmull-Rom weights of the samples at -1, 0, 1 and 2 for a
+   point at t in [0, 1) between samples 0 and 1. */
+void catmullRomWeights(float t, float w[4])
+{
+    float t2 = t * t;
+    float t3 = t2 * t;
+
+    w[0] = -0.5f * t3 +        t2 - 0.5f * t;
+    w[1] =  1.5f * t3 - 2.5f * t2 + 1;
+    w[2] = -1.5f * t3 + 2.0f * t2 + 0.5f * t;
+    w[3] =  0.5f * t3 - 0.5f * t2;
+}
+
+/* Reads coarse for upsampleBicubic. Clamping to the edge keeps the filter from
+   pulling in zeros at the border; a periodic grid wraps instead, so that the
+   upsampled field still tiles. */
+float4 readCoarse(__read_only image2d_t coarse, int2 coords)
+{
+#ifdef PERIODIC_BOUNDARY
+    return readGrid(coarse, coords);
+#else
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP_TO_EDGE   |
+                              CLK_FILTER_NEAREST;
+
+    return read_imagef(coarse, sampler, coords);
+#endif
+}
+
+/* Bicubically (Catmull-Rom) interpolates coarse onto fine, which covers the
+   same area at a higher resolution. */
+__kernel void upsampleBicubic(__read_only image2d_t coarse,
+                              __write_only image2d_t fine)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(fine) && coords.y < get_image_height(fine))
+    {
+        float2 scale = (float2) (get_image_width(coarse), get_image_height(coarse))
+                     / (float2) (get_image_width(fine), get_image_height(fine));
+
+        // The fine cell's center in the coarse grid, where coarse cell centers
+        // are at integer coordinates.
+        float2 p = (convert_float2(coords) + (float2) (0.5f, 0.5f)) * scale - (float2) (0.5f, 0.5f);
+        float2 base = floor(p);
+        int2 b = convert_int2(base);
+
+        float wx[4], wy[4];
+        catmullRomWeights(p.x - base.x, wx);
+        catmullRomWeights(p.y - base.y, wy);
+
+        float4 sum = (float4) (0, 0, 0, 0);
+        for (int j = 0; j < 4; ++j)
+        {
+            int y = b.y + j - 1;
+
+            float4 row = wx[0] * readCoarse(coarse, (int2) (b.x - 1, y))
+                       + wx[1] * readCoarse(coarse, (int2) (b.x,     y))
+                       + wx[2] * readCoarse(coarse, (int2) (b.x + 1, y))
+                       + wx[3] * readCoarse(coarse, (int2) (b.x + 2, y));
+
+            sum += wy[j] * row;
+        }
+
+        write_imagef(fine, coords, sum);
+    }
+}
+
+/* Averages each factor x factor block of fine cells into the coarse cell that
+   covers it. Cells past the edge of fine count as 0. */
+__kernel void downsampleAverage(__read_only image2d_t fine,
+                                __write_only image2d_t coarse,
+                                const int factor)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(coarse) && coords.y < get_image_height(coarse))
+    {
+        float4 sum = (float4) (0, 0, 0, 0);
+
+        for (int j = 0; j < factor; ++j)
+            for (int i = 0; i < factor; ++i)
+                sum += read_imagef(fine, sampler, (int2) (coords.x * factor + i, coords.y * factor + j));
+
+        write_imagef(coarse, coords, sum / (float) (factor * factor));
+    }
+}
+
+
+/* Zeroes a countX x countY block of img starting at (firstX, firstY) and
+   wrapping around its edges, for Fluid2DSimulation::scrollTo(), which stores
+   the grid toroidally. firstX and firstY must be inside the image. */
+__kernel void clearWrapped(__write_only image2d_t img,
+                           const int firstX,
+                           const int firstY,
+                           const int countX,
+                           const int countY)
+{
+    int2 offset = (int2) (get_global_id(0), get_global_id(1));
+
+    if (offset.x < countX && offset.y < countY)
+    {
+        int2 coords = (int2) ((firstX + offset.x) % get_image_width(img),
+                              (firstY + offset.y) % get_image_height(img));
+
+        write_imagef(img, coords, (float4) (0, 0, 0, 0));
+    }
+}
+
+
+
+
+/* ---------------------------------------------------------------------------
+   Fused kernels.
+
+   Each of these does the work of two of the kernels above in one launch, for
+   the fused pipeline of Fluid2DSimulationCLProgram::update().
+   --------------------------------------------------------------------------- */
+
+/* The value of advectAddForce at coords. */
+float4 advectAddForceAt(__read_only image2d_t velocity,
+                        __read_only image2d_t forces,
+                        int2 coords,
+                        const float dt_h,
+                        const float dt)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    return advectedAt(velocity, velocity, coords, dt_h) + read_imagef(forces, sampler, coords) * dt;
+}
+
+/* advect on the velocity itself followed by addScaled(result, forces, dt). */
+__kernel void advectAddForce(__read_only image2d_t velocity,
+                             __read_only image2d_t forces,
+                             __write_only image2d_t output,
+                             const float dt_h,
+                             const float dt)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+        write_imagef(output, coords, advectAddForceAt(velocity, forces, coords, dt_h, dt));
+}
+
+/* divergence of velocity into divOutput, followed by the first Jacobi sweep of
+   the pressure solve with b = the divergence. A Jacobi sweep only needs b at its
+   own cell, so the divergence image isn't read back. */
+void divergenceJacobiAt(__read_only image2d_t velocity,
+                        __read_only image2d_t pressure,
+                        __write_only image2d_t divOutput,
+                        __write_only image2d_t pressureOutput,
+                        int2 coords,
+                        const float hInv,
+                        const float alpha,
+                        const float betaInverse)
+{
+    float4 div = (float4) (divergenceAt(velocity, coords, hInv), 0, 0, 0);
+    write_imagef(divOutput, coords, div);
+
+    float4 p = (readGrid(pressure, (int2)(coords.x-1, coords.y))
+               +readGrid(pressure, (int2)(coords.x+1, coords.y))
+               +readGrid(pressure, (int2)(coords.x, coords.y-1))
+               +readGrid(pressure, (int2)(coords.x, coords.y+1))
+               +alpha * div) * betaInverse;
+    write_imagef(pressureOutput, coords, p);
+}
+
+__kernel void divergenceJacobi(__read_only image2d_t velocity,
+                               __read_only image2d_t pressure,
+                               __write_only image2d_t divOutput,
+                               __write_only image2d_t pressureOutput,
+                               const float hInv,
+                               const float alpha,
+                               const float betaInverse)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(divOutput) && coords.y < get_image_height(divOutput))
+        divergenceJacobiAt(velocity, pressure, divOutput, pressureOutput, coords, hInv, alpha, betaInverse);
+}
+
+/* The value of jacobiPressureBoundary at coords, in an image of the given size. */
+float4 jacobiPressureBoundaryAt(__read_only image2d_t input,
+                                __read_only image2d_t b,
+                                int2 coords,
+                                int width,
+                                int height,
+                                const float alpha,
+                                const float betaInverse)
+{
+    int2 source = coords;
+#ifndef PERIODIC_BOUNDARY
+    if (coords.x == 0)               source = (int2) (1, coords.y);
+    else if (coords.x == width - 1)  source = (int2) (coords.x - 1, coords.y);
+    else if (coords.y == 0)          source = (int2) (coords.x, 1);
+    else if (coords.y == height - 1) source = (int2) (coords.x, coords.y - 1);
+#endif
+
+    return jacobiAt(input, b, source, alpha, betaInverse);
+}
+
+/* The last Jacobi sweep of the pressure solve followed by pressureBoundary.
+   Boundary cells take the Jacobi value of their inner neighbor. */
+__kernel void jacobiPressureBoundary(__read_only image2d_t input,
+                                     __read_only image2d_t b,
+                                     __write_only image2d_t output,
+                                     const float alpha,
+                                     const float betaInverse)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(output);
+    int height = get_image_height(output);
+
+    if (coords.x < width && coords.y < height)
+        write_imagef(output, coords, jacobiPressureBoundaryAt(input, b, coords, width, height, alpha, betaInverse));
+}
+
+/* Computes velocity - gradient(pressure) * scale at coords. */
+float4 projectedAt(__read_only image2d_t velocity,
+                   __read_only image2d_t pressure,
+                   int2 coords,
+                   const float scale)
+{
+    float p_xp = readGrid(pressure, (int2) (coords.x + 1, coords.y)).x;
+    float p_xm = readGrid(pressure, (int2) (coords.x - 1, coords.y)).x;
+    float p_yp = readGrid(pressure, (int2) (coords.x, coords.y + 1)).x;
+    float p_ym = readGrid(pressure, (int2) (coords.x, coords.y - 1)).x;
+
+    return readGrid(velocity, coords) - (float4) (p_xp - p_xm, p_yp - p_ym, 0, 0) * scale;
+}
+
+/* The value of projectBoundary at coords, in an image of the given size. */
+float4 projectBoundaryAt(__read_only image2d_t velocity,
+                         __read_only image2d_t pressure,
+                         int2 coords,
+                         int width,
+                         int height,
+                         const float scale)
+{
+#ifndef PERIODIC_BOUNDARY
+    if (coords.x == 0)
+        return -projectedAt(velocity, pressure, (int2) (1, coords.y), scale);
+    else if (coords.x == width - 1)
+        return -projectedAt(velocity, pressure, (int2) (coords.x - 1, coords.y), scale);
+    else if (coords.y == 0)
+        return -projectedAt(velocity, pressure, (int2) (coords.x, 1), scale);
+    else if (coords.y == height - 1)
+        return -projectedAt(velocity, pressure, (int2) (coords.x, coords.y - 1), scale);
+#endif
+    return projectedAt(velocity, pressure, coords, scale);
+}
+
+/* gradient of pressure, addScaled to subtract it from velocity, and then
+   velocityBoundary, in one launch. scale is hInv / density. Boundary cells
+   take the negated projected value of their inner neighbor. */
+__kernel void projectBoundary(__read_only image2d_t velocity,
+                              __read_only image2d_t pressure,
+                              __write_only image2d_t output,
+                              const float scale)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(output);
+    int height = get_image_height(output);
+
+    if (coords.x < width && coords.y < height)
+        write_imagef(output, coords, projectBoundaryAt(velocity, pressure, coords, width, height, scale));
+}
+
+
+
+/* ---------------------------------------------------------------------------
+   Obstacle kernels.
+
+   These replace the fused kernels when the simulation has an obstacle mask,
+   a single-channel image that is above 0.5 in solid cells. Everything outside
+   the grid counts as solid, so the walls of the grid need no separate boundary
+   kernels. The velocity is zero in solid cells, the pressure has zero normal
+   derivative at solid faces, and fluid cells next to a solid lose their
+   velocity component normal to it.
+   --------------------------------------------------------------------------- */
+
+bool solidAt(__read_only image2d_t obstacles, int2 coords)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP_TO_EDGE   |
+                              CLK_FILTER_NEAREST;
+
+    if (coords.x < 0 || coords.y < 0 ||
+        coords.x >= get_image_width(obstacles) || coords.y >= get_image_height(obstacles))
+        return true;
+
+    return read_imagef(obstacles, sampler, coords).x > 0.5f;
+}
+
+/* The pressure at a neighbor of a fluid cell whose own pressure is center,
+   mirroring the center across solid faces. */
+float pressureNeighbor(__read_only image2d_t pressure,
+                       __read_only image2d_t obstacles,
+                       int2 coords,
+                       float center)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    return solidAt(obstacles, coords) ? center : read_imagef(pressure, sampler, coords).x;
+}
+
+/* advectAddForce, with zero velocity in solid cells. */
+__kernel void advectAddForceMasked(__read_only image2d_t velocity,
+                                   __read_only image2d_t forces,
+                                   __read_only image2d_t obstacles,
+                                   __write_only image2d_t output,
+                                   const float dt_h,
+                                   const float dt)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+    {
+        float4 value = solidAt(obstacles, coords)
+                ? (float4) (0, 0, 0, 0)
+                : advectAddForceAt(velocity, forces, coords, dt_h, dt);
+
+        write_imagef(output, coords, value);
+    }
+}
+
+/* A Jacobi sweep of the pressure solve at a fluid cell, where solid neighbors
+   take the cell's own pressure. */
+float jacobiMaskedAt(__read_only image2d_t input,
+                     float b,
+                     __read_only image2d_t obstacles,
+                     int2 coords,
+                     const float alpha,
+                     const float betaInverse)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    float center = read_imagef(input, sampler, coords).x;
+
+    return (pressureNeighbor(input, obstacles, (int2) (coords.x - 1, coords.y), center)
+           +pressureNeighbor(input, obstacles, (int2) (coords.x + 1, coords.y), center)
+           +pressureNeighbor(input, obstacles, (int2) (coords.x, coords.y - 1), center)
+           +pressureNeighbor(input, obstacles, (int2) (coords.x, coords.y + 1), center)
+           +alpha * b) * betaInverse;
+}
+
+/* divergenceAt, reading the velocity of solid neighbors as zero. Diffusion and
+   vorticity confinement don't know about the obstacles, so they may leave some
+   velocity in solid cells. */
+float divergenceMaskedAt(__read_only image2d_t velocity,
+                         __read_only image2d_t obstacles,
+                         int2 coords,
+                         const float hInv)
+{
+    int2 xp = (int2) (coords.x + 1, coords.y);
+    int2 xm = (int2) (coords.x - 1, coords.y);
+    int2 yp = (int2) (coords.x, coords.y + 1);
+    int2 ym = (int2) (coords.x, coords.y - 1);
+
+    float u_xp = solidAt(obstacles, xp) ? 0 : readGrid(velocity, xp).x;
+    float u_xm = solidAt(obstacles, xm) ? 0 : readGrid(velocity, xm).x;
+    float v_yp = solidAt(obstacles, yp) ? 0 : readGrid(velocity, yp).y;
+    float v_ym = solidAt(obstacles, ym) ? 0 : readGrid(velocity, ym).y;
+
+    return ((u_xp - u_xm) + (v_yp - v_ym)) * hInv;
+}
+
+/* divergenceJacobi with obstacles. The pressure in solid cells is zero. */
+__kernel void divergenceJacobiMasked(__read_only image2d_t velocity,
+                                     __read_only image2d_t pressure,
+                                     __read_only image2d_t obstacles,
+                                     __write_only image2d_t divOutput,
+                                     __write_only image2d_t pressureOutput,
+                                     const float hInv,
+                                     const float alpha,
+                                     const float betaInverse)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x >= get_image_width(divOutput) || coords.y >= get_image_height(divOutput))
+        return;
+
+    if (solidAt(obstacles, coords))
+    {
+        write_imagef(divOutput, coords, (float4) (0, 0, 0, 0));
+        write_imagef(pressureOutput, coords, (float4) (0, 0, 0, 0));
+        return;
+    }
+
+    float div = divergenceMaskedAt(velocity, obstacles, coords, hInv);
+    write_imagef(divOutput, coords, (float4) (div, 0, 0, 0));
+    write_imagef(pressureOutput, coords, (float4) (jacobiMaskedAt(pressure, div, obstacles, coords, alpha, betaInverse), 0, 0, 0));
+}
+
+/* jacobi on the pressure with obstacles. The pressure in solid cells is zero. */
+__kernel void jacobiMasked(__read_only image2d_t input,
+                           __read_only image2d_t b,
+                           __read_only image2d_t obstacles,
+                           __write_only image2d_t output,
+                           const float alpha,
+                           const float betaInverse)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < get_image_width(output) && coords.y < get_image_height(output))
+    {
+        float p = solidAt(obstacles, coords)
+                ? 0
+                : jacobiMaskedAt(input, read_imagef(b, sampler, coords).x, obstacles, coords, alpha, betaInverse);
+
+        write_imagef(output, coords, (float4) (p, 0, 0, 0));
+    }
+}
+
+/* projectBoundary with obstacles: subtracts the pressure gradient, mirrored
+   across solid faces, divided by the density. scale is hInv / density. */
+__kernel void projectMasked(__read_only image2d_t velocity,
+                            __read_only image2d_t pressure,
+                            __read_only image2d_t obstacles,
+                            __write_only image2d_t output,
+                            const float scale)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x >= get_image_width(output) || coords.y >= get_image_height(output))
+        return;
+
+    if (solidAt(obstacles, coords))
+    {
+        write_imagef(output, coords, (float4) (0, 0, 0, 0));
+        return;
+    }
+
+    int2 xp = (int2) (coords.x + 1, coords.y);
+    int2 xm = (int2) (coords.x - 1, coords.y);
+    int2 yp = (int2) (coords.x, coords.y + 1);
+    int2 ym = (int2) (coords.x, coords.y - 1);
+
+    float center = read_imagef(pressure, sampler, coords).x;
+    float p_xp = pressureNeighbor(pressure, obstacles, xp, center);
+    float p_xm = pressureNeighbor(pressure, obstacles, xm, center);
+    float p_yp = pressureNeighbor(pressure, obstacles, yp, center);
+    float p_ym = pressureNeighbor(pressure, obstacles, ym, center);
+
+    float4 v = read_imagef(velocity, sampler, coords) - (float4) (p_xp - p_xm, p_yp - p_ym, 0, 0) * scale;
+
+    if (solidAt(obstacles, xp) || solidAt(obstacles, xm))
+        v.x = 0;
+    if (solidAt(obstacles, yp) || solidAt(obstacles, ym))
+        v.y = 0;
+
+    write_imagef(output, coords, v);
+}
+
+
+
+/* ---------------------------------------------------------------------------
+   Sparse (active tile) kernels.
+
+   With Fluid2DSimulationConfig::sparseTiles, the grid is divided into
+   SPARSE_TILE_SIZE x SPARSE_TILE_SIZE tiles and the fused pipeline runs only
+   on the tiles where there is wind, plus a band around them. Every field is
+   kept at zero in the other tiles, so reading across into them is exact.
+
+   The sparse kernels are launched with one SPARSE_TILE_SIZE x SPARSE_TILE_SIZE
+   work group per tile of the grid, and work group g handles the tile
+   tiles[g]. The number of active tiles is only known on the device, so the
+   work groups past it return immediately.
+   --------------------------------------------------------------------------- */
+
+/* The side-length of a tile. This must match
+   Fluid2DSimulationCLProgram::SparseTileSize. */
+#define SPARSE_TILE_SIZE 8
+
+/* Finds the cell that this work item handles in a launch over the first
+   tileCount tiles of the list. Returns false if there is none. */
+bool sparseCoords(__global const int *tiles,
+                  const int tileCount,
+                  const int tilesX,
+                  int width,
+                  int height,
+                  int2 *coords)
+{
+    int group = get_group_id(0);
+
+    if (group >= tileCount)
+        return false;
+
+    int tile = tiles[group];
+    *coords = (int2) ((tile % tilesX) * SPARSE_TILE_SIZE + get_local_id(0),
+                      (tile / tilesX) * SPARSE_TILE_SIZE + get_local_id(1));
+
+    return coords->x < width && coords->y < height;
+}
+
+/* Marks the tile of this work group as active in flags if the speed of the
+   velocity or of forces * forceScale exceeds threshold anywhere in it.
+   Launched over the whole grid with one work group per tile. */
+__kernel void tileActivity(__read_only image2d_t velocity,
+                           __read_only image2d_t forces,
+                           const float forceScale,
+                           const float threshold,
+                           __global int *flags)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    __local int active;
+
+    if (get_local_id(0) == 0 && get_local_id(1) == 0)
+        active = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    float2 v = read_imagef(velocity, sampler, coords).xy;
+    float2 f = read_imagef(forces, sampler, coords).xy * forceScale;
+
+    float threshold2 = threshold * threshold;
+    if (dot(v, v) > threshold2 || dot(f, f) > threshold2)
+        atomic_or(&active, 1);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (get_local_id(0) == 0 && get_local_id(1) == 0)
+        flags[get_group_id(1) * get_num_groups(0) + get_group_id(0)] = active;
+}
+
+/* Like tileActivity without forces, but only over the tiles in the list. The
+   velocity is zero everywhere else, so the other tiles stay inactive. */
+__kernel void tileActivitySparse(__read_only image2d_t velocity,
+                                 const float threshold,
+                                 __global int *flags,
+                                 __global const int *tiles,
+                                 __global const int *counts,
+                                 const int tilesX)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    __local int active;
+
+    if (get_group_id(0) >= counts[0])
+        return;
+
+    if (get_local_id(0) == 0 && get_local_id(1) == 0)
+        active = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int tile = tiles[get_group_id(0)];
+    int2 coords = (int2) ((tile % tilesX) * SPARSE_TILE_SIZE + get_local_id(0),
+                          (tile / tilesX) * SPARSE_TILE_SIZE + get_local_id(1));
+
+    float2 v = read_imagef(velocity, sampler, coords).xy;
+    if (dot(v, v) > threshold * threshold)
+        atomic_or(&active, 1);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (get_local_id(0) == 0 && get_local_id(1) == 0)
+        flags[tile] = active;
+}
+
+/* Builds the list of active tiles: those within `dilation` tiles of one that
+   is flagged. Tiles that were active in the last step but no longer are go in
+   the clear list. counts[0] and counts[1] must be zero beforehand and receive
+   the lengths of the two lists. One work item per tile. */
+__kernel void compactTiles(__global const int *flags,
+                           __global int *wasActive,
+                           __global int *tiles,
+                           __global int *clearTiles,
+                           __global int *counts,
+                           const int tilesX,
+                           const int tilesY,
+                           const int dilation)
+{
+    int tile = get_global_id(0);
+
+    if (tile >= tilesX * tilesY)
+        return;
+
+    int tx = tile % tilesX;
+    int ty = tile / tilesX;
+
+    int active = 0;
+    for (int y = max(ty - dilation, 0); y <= min(ty + dilation, tilesY - 1); ++y)
+        for (int x = max(tx - dilation, 0); x <= min(tx + dilation, tilesX - 1); ++x)
+            active |= flags[y * tilesX + x];
+
+    if (active)
+        tiles[atomic_inc(&counts[0])] = tile;
+    else if (wasActive[tile])
+        clearTiles[atomic_inc(&counts[1])] = tile;
+
+    wasActive[tile] = active;
+}
+
+/* Zeroes the tiles of the clear list in every image of the simulation. */
+__kernel void clearTiles(__global const int *tiles,
+                         __global const int *counts,
+                         const int tilesX,
+                         __write_only image2d_t img1,
+                         __write_only image2d_t img2,
+                         __write_only image2d_t img3,
+                         __write_only image2d_t img4,
+                         __write_only image2d_t img5,
+                         __write_only image2d_t img6)
+{
+    int2 coords;
+    if (!sparseCoords(tiles, counts[1], tilesX, get_image_width(img1), get_image_height(img1), &coords))
+        return;
+
+    const float4 zero = (float4) (0, 0, 0, 0);
+
+    write_imagef(img1, coords, zero);
+    write_imagef(img2, coords, zero);
+    write_imagef(img3, coords, zero);
+    write_imagef(img4, coords, zero);
+    write_imagef(img5, coords, zero);
+    write_imagef(img6, coords, zero);
+}
+
+/* advectAddForce over the active tiles. */
+__kernel void sparseAdvectAddForce(__read_only image2d_t velocity,
+                                   __read_only image2d_t forces,
+                                   __write_only image2d_t output,
+                                   const float dt_h,
+                                   const float dt,
+                                   __global const int *tiles,
+                                   __global const int *counts,
+                                   const int tilesX)
+{
+    int2 coords;
+    if (sparseCoords(tiles, counts[0], tilesX, get_image_width(output), get_image_height(output), &coords))
+        write_imagef(output, coords, advectAddForceAt(velocity, forces, coords, dt_h, dt));
+}
+
+/* divergenceJacobi over the active tiles. */
+__kernel void sparseDivergenceJacobi(__read_only image2d_t velocity,
+                                     __read_only image2d_t pressure,
+                                     __write_only image2d_t divOutput,
+                                     __write_only image2d_t pressureOutput,
+                                     const float hInv,
+                                     const float alpha,
+                                     const float betaInverse,
+                                     __global const int *tiles,
+                                     __global const int *counts,
+                                     const int tilesX)
+{
+    int2 coords;
+    if (sparseCoords(tiles, counts[0], tilesX, get_image_width(divOutput), get_image_height(divOutput), &coords))
+        divergenceJacobiAt(velocity, pressure, divOutput, pressureOutput, coords, hInv, alpha, betaInverse);
+}
+
+/* jacobi over the active tiles. */
+__kernel void sparseJacobi(__read_only image2d_t input,
+                           __read_only image2d_t b,
+                           __write_only image2d_t output,
+                           const float alpha,
+                           const float betaInverse,
+                           __global const int *tiles,
+                           __global const int *counts,
+                           const int tilesX)
+{
+    int2 coords;
+    if (sparseCoords(tiles, counts[0], tilesX, get_image_width(output), get_image_height(output), &coords))
+        write_imagef(output, coords, jacobiAt(input, b, coords, alpha, betaInverse));
+}
+
+/* jacobiPressureBoundary over the active tiles. */
+__kernel void sparseJacobiPressureBoundary(__read_only image2d_t input,
+                                           __read_only image2d_t b,
+                                           __write_only image2d_t output,
+                                           const float alpha,
+                                           const float betaInverse,
+                                           __global const int *tiles,
+                                           __global const int *counts,
+                                           const int tilesX)
+{
+    int width = get_image_width(output);
+    int height = get_image_height(output);
+
+    int2 coords;
+    if (sparseCoords(tiles, counts[0], tilesX, width, height, &coords))
+        write_imagef(output, coords, jacobiPressureBoundaryAt(input, b, coords, width, height, alpha, betaInverse));
+}
+
+/* projectBoundary over the active tiles. */
+__kernel void sparseProjectBoundary(__read_only image2d_t velocity,
+                                    __read_only image2d_t pressure,
+                                    __write_only image2d_t output,
+                                    const float scale,
+                                    __global const int *tiles,
+                                    __global const int *counts,
+                                    const int tilesX)
+{
+    int width = get_image_width(output);
+    int height = get_image_height(output);
+
+    int2 coords;
+    if (sparseCoords(tiles, counts[0], tilesX, width, height, &coords))
+        write_imagef(output, coords, projectBoundaryAt(velocity, pressure, coords, width, height, scale));
+}
+
+
+
+/* ---------------------------------------------------------------------------
+   Whole-step kernel.
+
+   Does an entire inviscid step (advect, add forces, divergence, pressure solve,
+   gradient subtraction and both boundary conditions) in a single launch of a
+   single work group, for grids small enough that the velocity, divergence and
+   pressure all fit in local memory. Phases are separated by barriers.
+
+   The pressure is relaxed in place with red-black Gauss-Seidel (over-relaxed
+   if omega > 1), since Jacobi would need a second pressure array.
+   --------------------------------------------------------------------------- */
+
+/* One red-black relaxation half-sweep over the cells of the given color, on
+   the pressure system that jacobi iterates on. Cells outside the grid are 0. */
+void localRelaxColor(__local float *p,
+                     __local const float *div,
+                     const int width,
+                     const int height,
+                     const float alpha,
+                     const float omega,
+                     const int color)
+{
+    int n = width * height;
+
+    for (int i = get_local_id(0); i < n; i += get_local_size(0))
+    {
+        int x = i % width;
+        int y = i / width;
+
+        if ((x + y) % 2 != color)
+            continue;
+
+        float neighbors = 0;
+        if (x > 0)          neighbors += p[i - 1];
+        if (x < width - 1)  neighbors += p[i + 1];
+        if (y > 0)          neighbors += p[i - width];
+        if (y < height - 1) neighbors += p[i + width];
+
+        float jacobiValue = (neighbors + alpha * div[i]) * 0.25f;
+        p[i] = mix(p[i], jacobiValue, omega);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+/* vel, div and p must each have one element per grid cell. forceScale is dt,
+   or 0 to skip the forces. projectScale is hInv / density. */
+__kernel void wholeStep(__read_only image2d_t velocity,
+                        __read_only image2d_t forces,
+                        __read_only image2d_t pressure,
+                        __write_only image2d_t velocityOut,
+                        __write_only image2d_t pressureOut,
+                        __local float2 *vel,
+                        __local float *div,
+                        __local float *p,
+                        const float dt_h,
+                        const float forceScale,
+                        const float hInv,
+                        const float alpha,
+                        const float omega,
+                        const int iterations,
+                        const float projectScale)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int width = get_image_width(velocityOut);
+    int height = get_image_height(velocityOut);
+    int n = width * height;
+
+    /* Advect, add forces and load the initial pressure. */
+    for (int i = get_local_id(0); i < n; i += get_local_size(0))
+    {
+        int2 coords = (int2) (i % width, i / width);
+
+        float4 v = advectedAt(velocity, velocity, coords, dt_h);
+        if (forceScale != 0)
+            v += read_imagef(forces, sampler, coords) * forceScale;
+
+        vel[i] = v.xy;
+        p[i] = read_imagef(pressure, sampler, coords).x;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /* Divergence, with velocities outside the grid treated as 0. */
+    for (int i = get_local_id(0); i < n; i += get_local_size(0))
+    {
+        int x = i % width;
+        int y = i / width;
+
+        float v_xp = x < width - 1  ? vel[i + 1].x     : 0;
+        float v_xm = x > 0          ? vel[i - 1].x     : 0;
+        float v_yp = y < height - 1 ? vel[i + width].y : 0;
+        float v_ym = y > 0          ? vel[i - width].y : 0;
+
+        div[i] = ((v_xp - v_xm) + (v_yp - v_ym)) * hInv;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /* Pressure solve. */
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        localRelaxColor(p, div, width, height, alpha, omega, 0);
+        localRelaxColor(p, div, width, height, alpha, omega, 1);
+    }
+
+    /* Subtract the pressure gradient. Each cell only writes its own velocity. */
+    for (int i = get_local_id(0); i < n; i += get_local_size(0))
+    {
+        int x = i % width;
+        int y = i / width;
+
+        float p_xp = x < width - 1  ? p[i + 1]     : 0;
+        float p_xm = x > 0          ? p[i - 1]     : 0;
+        float p_yp = y < height - 1 ? p[i + width] : 0;
+        float p_ym = y > 0          ? p[i - width] : 0;
+
+        vel[i] -= (float2) (p_xp - p_xm, p_yp - p_ym) * projectScale;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /* Enforce the boundary conditions while writing out. See velocityBoundary
+       and pressureBoundary. */
+    for (int i = get_local_id(0); i < n; i += get_local_size(0))
+    {
+        int x = i % width;
+        int y = i / width;
+
+        int source = i;
+        float sign = -1;
+
+        if (x == 0)               source = i + 1;
+        else if (x == width - 1)  source = i - 1;
+        else if (y == 0)          source = i + width;
+        else if (y == height - 1) source = i - width;
+        else                      sign = 1;
+
+        write_imagef(velocityOut, (int2) (x, y), (float4) (sign * vel[source], 0, 0));
+        write_imagef(pressureOut, (int2) (x, y), (float4) (p[source], 0, 0, 0));
+    }
+}
+
+
+/* ---------------------------------------------------------------------------
+   Preconditioned conjugate gradient (PCG) kernels.
+
+   These solve the same pressure system as jacobi, written as A x = f with
+
+    (A x)(i,j) = 4*x(i,j) - x(i-1,j) - x(i+1,j) - x(i,j-1) - x(i,j+1)
+    f(i,j)     = -h^2 * divergence(i,j)
+
+   on row-major float buffers, with values outside the grid treated as 0.
+   Scalars that the iteration needs (r.z, p.q) stay on the device in a small
+   buffer so that the host only has to read them to check convergence.
+   --------------------------------------------------------------------------- */
+
+/* These must match Fluid2DSimulationCLProgram::ReductionGroupSize and
+   ReductionNumGroups. The group size is an upper bound; the reductions may be
+   launched with any smaller power of two. */
+#define REDUCTION_GROUP_SIZE 256
+#define REDUCTION_NUM_GROUPS 64
+
+/* Copies the first channel of an image, multiplied by scale, into a buffer. */
+__kernel void imageToBuffer(__read_only image2d_t img,
+                            __global float *buf,
+                            const float scale)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(img);
+
+    if (coords.x < width && coords.y < get_image_height(img))
+        buf[coords.y * width + coords.x] = scale * read_imagef(img, sampler, coords).x;
+}
+
+/* Writes a buffer into the first channel of an image. */
+__kernel void bufferToImage(__global const float *buf,
+                            __write_only image2d_t img)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(img);
+
+    if (coords.x < width && coords.y < get_image_height(img))
+        write_imagef(img, coords, (float4) (buf[coords.y * width + coords.x], 0, 0, 0));
+}
+
+/* Computes (A x)(i,j) for the cell at (i,j). */
+float applyPoissonMatrix(__global const float *x, int2 coords, const int width, const int height)
+{
+    int index = coords.y * width + coords.x;
+
+    float neighbors = 0;
+#ifdef PERIODIC_BOUNDARY
+    neighbors += x[coords.y * width + (coords.x + width - 1) % width];
+    neighbors += x[coords.y * width + (coords.x + 1) % width];
+    neighbors += x[((coords.y + height - 1) % height) * width + coords.x];
+    neighbors += x[((coords.y + 1) % height) * width + coords.x];
+#else
+    if (coords.x > 0)          neighbors += x[index - 1];
+    if (coords.x < width - 1)  neighbors += x[index + 1];
+    if (coords.y > 0)          neighbors += x[index - width];
+    if (coords.y < height - 1) neighbors += x[index + width];
+#endif
+
+    return 4 * x[index] - neighbors;
+}
+
+/* r = f - A x */
+__kernel void pcgResidual(__global const float *x,
+                          __global const float *f,
+                          __global float *r,
+                          const int width,
+                          const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int index = coords.y * width + coords.x;
+        r[index] = f[index] - applyPoissonMatrix(x, coords, width, height);
+    }
+}
+
+/* q = A p */
+__kernel void pcgApplyMatrix(__global const float *p,
+                             __global float *q,
+                             const int width,
+                             const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+        q[coords.y * width + coords.x] = applyPoissonMatrix(p, coords, width, height);
+}
+
+/* Sums `value` over the work group. The result is only valid in work item 0.
+   `sums` must have one element per work item, and the work group size must be
+   a power of two. */
+float workGroupSum(float value, __local float *sums)
+{
+    int lid = get_local_id(0);
+
+    sums[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int stride = get_local_size(0) / 2; stride > 0; stride /= 2)
+    {
+        if (lid < stride)
+            sums[lid] += sums[lid + stride];
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    return sums[0];
+}
+
+/* Writes one partial sum of a . b per work group into partialSums.
+   Must be launched with REDUCTION_NUM_GROUPS groups of at most
+   REDUCTION_GROUP_SIZE items, a power of two. */
+__kernel void pcgDot(__global const float *a,
+                     __global const float *b,
+                     __global float *partialSums,
+                     const int n)
+{
+    __local float sums[REDUCTION_GROUP_SIZE];
+
+    float sum = 0;
+    for (int i = get_global_id(0); i < n; i += get_global_size(0))
+        sum += a[i] * b[i];
+
+    sum = workGroupSum(sum, sums);
+
+    if (get_local_id(0) == 0)
+        partialSums[get_group_id(0)] = sum;
+}
+
+/* Applies the Jacobi (diagonal) preconditioner, z = r / diag(A), and writes one
+   partial sum of r . z per work group. Launched like pcgDot. */
+__kernel void pcgPreconditionDot(__global const float *r,
+                                 __global float *z,
+                                 __global float *partialSums,
+                                 const int n)
+{
+    __local float sums[REDUCTION_GROUP_SIZE];
+
+    float sum = 0;
+    for (int i = get_global_id(0); i < n; i += get_global_size(0))
+    {
+        // Every diagonal entry of A is 4.
+        float zi = r[i] * 0.25f;
+        z[i] = zi;
+        sum += r[i] * zi;
+    }
+
+    sum = workGroupSum(sum, sums);
+
+    if (get_local_id(0) == 0)
+        partialSums[get_group_id(0)] = sum;
+}
+
+/* Adds up the partial sums from pcgDot into scalars[index].
+   Must be launched as a single work group of REDUCTION_NUM_GROUPS items. */
+__kernel void pcgFinishDot(__global const float *partialSums,
+                           __global float *scalars,
+                           const int index)
+{
+    __local float sums[REDUCTION_NUM_GROUPS];
+
+    float sum = workGroupSum(partialSums[get_local_id(0)], sums);
+
+    if (get_local_id(0) == 0)
+        scalars[index] = sum;
+}
+
+/* x += alpha p, r -= alpha q, where alpha = scalars[rzIndex] / scalars[pqIndex]. */
+__kernel void pcgUpdateSolution(__global float *x,
+                                __global float *r,
+                                __global const float *p,
+                                __global const float *q,
+                                __global const float *scalars,
+                                const int rzIndex,
+                                const int pqIndex,
+                                const int n)
+{
+    int i = get_global_id(0);
+
+    if (i < n)
+    {
+        float pq = scalars[pqIndex];
+        float alpha = pq > 0 ? scalars[rzIndex] / pq : 0;
+
+        x[i] += alpha * p[i];
+        r[i] -= alpha * q[i];
+    }
+}
+
+/* p = z + beta p, where beta = scalars[rzNewIndex] / scalars[rzOldIndex]. */
+__kernel void pcgUpdateDirection(__global float *p,
+                                 __global const float *z,
+                                 __global const float *scalars,
+                                 const int rzNewIndex,
+                                 const int rzOldIndex,
+                                 const int n)
+{
+    int i = get_global_id(0);
+
+    if (i < n)
+    {
+        float rzOld = scalars[rzOldIndex];
+        float beta = rzOld > 0 ? scalars[rzNewIndex] / rzOld : 0;
+
+        p[i] = z[i] + beta * p[i];
+    }
+}
+
+
+
+/* Writes one partial sum per work group of the squared size of the next Jacobi
+   update of x, |(x(i-1,j) + x(i+1,j) + x(i,j-1) + x(i,j+1) + alpha*b(i,j)) * betaInverse - x(i,j)|^2,
+   over the first two channels. This is the residual of the system that jacobi
+   iterates on, scaled by betaInverse, and is zero exactly when x solves it.
+   Launched like pcgDot; the partial sums are added up with pcgFinishDot. */
+__kernel void jacobiResidualNorm(__read_only image2d_t x,
+                                 __read_only image2d_t b,
+                                 __global float *partialSums,
+                                 const float alpha,
+                                 const float betaInverse)
+{
+    __local float sums[REDUCTION_GROUP_SIZE];
+
+    int width = get_image_width(x);
+    int n = width * get_image_height(x);
+
+    float sum = 0;
+    for (int i = get_global_id(0); i < n; i += get_global_size(0))
+    {
+        int2 coords = (int2) (i % width, i / width);
+
+        float4 update = (readGrid(x, (int2)(coords.x-1, coords.y))
+                        +readGrid(x, (int2)(coords.x+1, coords.y))
+                        +readGrid(x, (int2)(coords.x, coords.y-1))
+                        +readGrid(x, (int2)(coords.x, coords.y+1))
+                        +alpha * readGrid(b, coords)) * betaInverse
+                        - readGrid(x, coords);
+
+        // Single-channel images read 1 in the last channel, so only .xy is meaningful.
+        sum += dot(update.xy, update.xy);
+    }
+
+    sum = workGroupSum(sum, sums);
+
+    if (get_local_id(0) == 0)
+        partialSums[get_group_id(0)] = sum;
+}
+
+
+
+/* ---------------------------------------------------------------------------
+   Spectral solver kernels.
+
+   With Fluid2DSimulationConfig::spectralSolver on a periodic grid whose sides
+   are powers of two, diffusion and projection are done in frequency space,
+   where both are a multiply per wave number. The velocity field is packed
+   into one complex row-major float2 buffer as u + i v, transformed with the
+   radix-2 FFT below, multiplied by spectralProject, and transformed back.
+   --------------------------------------------------------------------------- */
+
+/* Packs the first two channels of an image into a complex buffer. */
+__kernel void imageToComplex(__read_only image2d_t img,
+                             __global float2 *buf)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(img);
+
+    if (coords.x < width && coords.y < get_image_height(img))
+        buf[coords.y * width + coords.x] = read_imagef(img, sampler, coords).xy;
+}
+
+/* Writes a complex buffer, multiplied componentwise by scale, into the first
+   two channels of an image. A scale of (s, 0) keeps only the real part. */
+__kernel void complexToImage(__global const float2 *buf,
+                             __write_only image2d_t img,
+                             const float2 scale)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(img);
+
+    if (coords.x < width && coords.y < get_image_height(img))
+        write_imagef(img, coords, (float4) (buf[coords.y * width + coords.x] * scale, 0, 0));
+}
+
+/* One pass of a radix-2 Stockham FFT along `lines` lines of n complex values,
+   where element e of line l is at l * lineStride + e * elementStride. Rows have
+   an element stride of 1 and columns one of the width.
+
+   Pass p (p = 1, 2, 4, ..., n/2) merges the transforms of length p into ones of
+   length 2p; after log2(n) passes, output holds the transform in natural order.
+   direction is -1 for the forward transform and +1 for the (unscaled) inverse.
+
+   Launched on an n/2 x lines range. input and output must not alias. */
+__kernel void fftRadix2(__global const float2 *input,
+                        __global float2 *output,
+                        const int n,
+                        const int p,
+                        const int elementStride,
+                        const int lineStride,
+                        const int lines,
+                        const int direction)
+{
+    int i = get_global_id(0);
+    int line = get_global_id(1);
+
+    if (i < n / 2 && line < lines)
+    {
+        int base = line * lineStride;
+        int k = i & (p - 1);
+
+        float2 u0 = input[base + i * elementStride];
+        float2 u1 = input[base + (i + n / 2) * elementStride];
+
+        // u1 *= exp(direction * i * pi * k / p)
+        float c;
+        float s = sincos(direction * M_PI_F * k / p, &c);
+        u1 = (float2) (u1.x * c - u1.y * s, u1.x * s + u1.y * c);
+
+        int j = (i << 1) - k;
+        output[base + j * elementStride] = u0 + u1;
+        output[base + (j + p) * elementStride] = u0 - u1;
+    }
+}
+
+/* Diffuses and projects the velocity spectrum, and computes the spectrum of
+   the pressure that the projection subtracts.
+
+   The spectrum C of u + i v holds both components: U(k) = (C(k) + C*(-k)) / 2
+   and V(k) = (C(k) - C*(-k)) / 2i. Diffusion is the implicit step of the
+   five-point Laplacian, which divides each mode by
+
+    1 + viscosity * dt * (4 - 2 cos(tx) - 2 cos(ty)) / h^2
+
+   for the mode's angular frequencies tx and ty. The divergence and gradient
+   kernels take central differences, which multiply a mode by i g for
+   g = (2 sin(tx), 2 sin(ty)) / h, so the projection removes the component of
+   (U, V) along g exactly, and the pressure is density * -i (g . (U, V)) / |g|^2.
+   Modes with g = 0 have no divergence and are left alone.
+
+   Launched on a width x height range. spectrum must not alias the outputs. */
+__kernel void spectralProject(__global const float2 *spectrum,
+                              __global float2 *velocityOut,
+                              __global float2 *pressureOut,
+                              const float viscosity_dt_hh,
+                              const float density,
+                              const float hInv,
+                              const int width,
+                              const int height)
+{
+    int2 k = (int2) (get_global_id(0), get_global_id(1));
+
+    if (k.x < width && k.y < height)
+    {
+        int2 kNeg = (int2) ((width - k.x) & (width - 1), (height - k.y) & (height - 1));
+
+        float2 c = spectrum[k.y * width + k.x];
+        float2 cNeg = spectrum[kNeg.y * width + kNeg.x];
+        float2 cNegConj = (float2) (cNeg.x, -cNeg.y);
+
+        // U = (c + conj(cNeg)) / 2, V = (c - conj(cNeg)) * -i / 2
+        float2 U = (c + cNegConj) * 0.5f;
+        float2 d = (c - cNegConj) * 0.5f;
+        float2 V = (float2) (d.y, -d.x);
+
+        float2 theta = 2 * M_PI_F * convert_float2(k) / (float2) (width, height);
+
+        float decay = 1 + viscosity_dt_hh * (4 - 2 * cos(theta.x) - 2 * cos(theta.y));
+        U /= decay;
+        V /= decay;
+
+        float2 g = 2 * sin(theta) * hInv;
+        float gg = dot(g, g);
+
+        float2 pressure = (float2) (0, 0);
+        if (gg > 1e-12f * hInv * hInv)
+        {
+            // The complex number g . (U, V), divided by |g|^2.
+            float2 gu = (g.x * U + g.y * V) / gg;
+
+            U -= g.x * gu;
+            V -= g.y * gu;
+
+            // density * -i * gu
+            pressure = density * (float2) (gu.y, -gu.x);
+        }
+
+        // U + i V
+        velocityOut[k.y * width + k.x] = (float2) (U.x - V.y, U.y + V.x);
+        pressureOut[k.y * width + k.x] = pressure;
+    }
+}
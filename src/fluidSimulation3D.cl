@@ -0,0 +1,412 @@
+/* 3D versions of the kernels in fluidSimulation.cl, used by
+   Fluid3DSimulationCLProgram.
+
+   Vector fields are stored in the first three channels of CL_RGBA images and
+   scalar fields in the first channel. Coordinates are (x, y, z, 0), and values
+   outside the grid read as 0 because of CLK_ADDRESS_CLAMP, as in 2D.
+
+   All kernels are launched on a 3D range covering the grid. Writing to 3D
+   images needs cl_khr_3d_image_writes.
+*/
+
+#pragma OPENCL EXTENSION cl_khr_3d_image_writes : enable
+
+
+/* Returns true if coords is inside img. */
+bool inGrid(__write_only image3d_t img, int4 coords)
+{
+    return coords.x < get_image_width(img) &&
+           coords.y < get_image_height(img) &&
+           coords.z < get_image_depth(img);
+}
+
+/* Returns the inner neighbor of a cell on the boundary of a grid of the given
+   size, or the cell itself if it isn't on the boundary. */
+int4 boundarySource(int4 coords, int4 size)
+{
+    if (coords.x == 0)                coords.x = 1;
+    else if (coords.x == size.x - 1)  coords.x -= 1;
+    else if (coords.y == 0)           coords.y = 1;
+    else if (coords.y == size.y - 1)  coords.y -= 1;
+    else if (coords.z == 0)           coords.z = 1;
+    else if (coords.z == size.z - 1)  coords.z -= 1;
+
+    return coords;
+}
+
+
+/* Computes a Jacobi iteration at one cell:
+    [sum of input at the 6 neighbors + alpha*b(i,j,k)] * betaInverse
+*/
+float4 jacobiAt(__read_only image3d_t input,
+                __read_only image3d_t b,
+                int4 coords,
+                const float alpha,
+                const float betaInverse)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    return (read_imagef(input, sampler, coords + (int4) (-1, 0, 0, 0))
+           +read_imagef(input, sampler, coords + (int4) ( 1, 0, 0, 0))
+           +read_imagef(input, sampler, coords + (int4) (0, -1, 0, 0))
+           +read_imagef(input, sampler, coords + (int4) (0,  1, 0, 0))
+           +read_imagef(input, sampler, coords + (int4) (0, 0, -1, 0))
+           +read_imagef(input, sampler, coords + (int4) (0, 0,  1, 0))
+           +alpha * read_imagef(b, sampler, coords)) * betaInverse;
+}
+
+__kernel void jacobi(__read_only image3d_t input,
+                     __read_only image3d_t b,
+                     __write_only image3d_t output,
+                     const float alpha,
+                     const float betaInverse)
+{
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+    if (inGrid(output, coords))
+        write_imagef(output, coords, jacobiAt(input, b, coords, alpha, betaInverse));
+}
+
+
+
+/* The side-length of the x-y tile of jacobiTiled, the number of planes of output
+   each of its work groups marches through, and the most sweeps it performs. These
+   must match the constants of the same names in Fluid3DSimulationCLProgram. */
+#define JACOBI_TILE_SIZE 16
+#define JACOBI_COLUMN_DEPTH 16
+#define JACOBI_MAX_SWEEPS 2
+
+/* Performs `sweeps` Jacobi iterations in a single launch using 2.5D tiling.
+
+   Each work group holds a JACOBI_TILE_SIZE x JACOBI_TILE_SIZE tile in the x-y
+   plane and marches it along z, through JACOBI_COLUMN_DEPTH planes of output plus
+   `sweeps` planes on either side. At every step it loads the next input plane,
+   and each sweep computes one plane behind the sweep before it from that sweep's
+   last three planes, which are kept in local memory. So every input cell is read
+   about once per launch, and only the x-y valid region shrinks, by one cell per
+   side per sweep: only the center of side JACOBI_TILE_SIZE - 2*sweeps is
+   written out.
+
+   b is kept fixed for all sweeps.
+
+   Must be launched with a JACOBI_TILE_SIZE x JACOBI_TILE_SIZE x 1 work group,
+   and sweeps must be at most JACOBI_MAX_SWEEPS.
+*/
+__kernel void jacobiTiled(__read_only image3d_t input,
+                          __read_only image3d_t b,
+                          __write_only image3d_t output,
+                          const float alpha,
+                          const float betaInverse,
+                          const int sweeps)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    // planes[s][step % 3] is the plane that s sweeps reached at that step. The
+    // last sweep is written straight to the output, so it isn't kept.
+    __local float4 planes[JACOBI_MAX_SWEEPS][3][JACOBI_TILE_SIZE][JACOBI_TILE_SIZE];
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+
+    int blockSize = JACOBI_TILE_SIZE - 2 * sweeps;
+    int x = get_group_id(0) * blockSize + lx - sweeps;
+    int y = get_group_id(1) * blockSize + ly - sweeps;
+    int firstZ = get_group_id(2) * JACOBI_COLUMN_DEPTH;
+
+    bool inColumn = x >= 0 && y >= 0 &&
+                    x < get_image_width(output) && y < get_image_height(output);
+
+    bool inBlock = lx >= sweeps && lx < JACOBI_TILE_SIZE - sweeps &&
+                   ly >= sweeps && ly < JACOBI_TILE_SIZE - sweeps;
+
+    for (int step = 0; step < JACOBI_COLUMN_DEPTH + 2 * sweeps; ++step)
+    {
+        // The input plane loaded at this step. Sweep s reaches plane z - s.
+        int z = firstZ - sweeps + step;
+
+        planes[0][step % 3][ly][lx] = read_imagef(input, sampler, (int4) (x, y, z, 0));
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        int below = (step + 1) % 3;
+        int center = (step + 2) % 3;
+        int above = step % 3;
+
+        for (int sweep = 1; sweep <= sweeps; ++sweep)
+        {
+            int planeZ = z - sweep;
+
+            // Sweep s has all three planes it needs from step 2*s on. Cells
+            // outside the image keep the border value they were read as,
+            // matching the plain jacobi kernel.
+            bool updatable = step >= 2 * sweep &&
+                             inColumn && planeZ >= 0 && planeZ < get_image_depth(output) &&
+                             lx >= sweep && lx < JACOBI_TILE_SIZE - sweep &&
+                             ly >= sweep && ly < JACOBI_TILE_SIZE - sweep;
+
+            float4 value = planes[sweep - 1][center][ly][lx];
+            if (updatable)
+            {
+                value = (planes[sweep - 1][center][ly][lx - 1]
+                        +planes[sweep - 1][center][ly][lx + 1]
+                        +planes[sweep - 1][center][ly - 1][lx]
+                        +planes[sweep - 1][center][ly + 1][lx]
+                        +planes[sweep - 1][below][ly][lx]
+                        +planes[sweep - 1][above][ly][lx]
+                        +alpha * read_imagef(b, sampler, (int4) (x, y, planeZ, 0))) * betaInverse;
+            }
+
+            if (sweep < sweeps)
+                planes[sweep][step % 3][ly][lx] = value;
+            else if (updatable && inBlock && planeZ >= firstZ && planeZ < firstZ + JACOBI_COLUMN_DEPTH)
+                write_imagef(output, (int4) (x, y, planeZ, 0), value);
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+    }
+}
+
+
+
+/* Performs advection:
+    output(x) = quantity(x - velocity * dt_h)
+   with trilinear interpolation. See advect in fluidSimulation.cl. */
+float4 advectedAt(__read_only image3d_t quantity,
+                  __read_only image3d_t velocity,
+                  int4 icoords,
+                  const float dt_h)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_LINEAR;
+
+    float4 coords = convert_float4(icoords) + (float4) (0.5f, 0.5f, 0.5f, 0);
+
+    float4 vel = read_imagef(velocity, sampler, coords);
+    float4 offset = (float4) (-vel.xyz * dt_h, 0);
+
+    return read_imagef(quantity, sampler, coords + offset);
+}
+
+__kernel void advect(__read_only image3d_t quantity,
+                     __read_only image3d_t velocity,
+                     __write_only image3d_t output,
+                     const float dt_h)
+{
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+    if (inGrid(output, coords))
+        write_imagef(output, coords, advectedAt(quantity, velocity, coords, dt_h));
+}
+
+
+
+/* Computes the divergence of the first three channels of field at coords. */
+float divergenceAt(__read_only image3d_t field, int4 coords, const float hInv)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    float field_xp = read_imagef(field, sampler, coords + (int4) ( 1, 0, 0, 0)).x;
+    float field_xm = read_imagef(field, sampler, coords + (int4) (-1, 0, 0, 0)).x;
+    float field_yp = read_imagef(field, sampler, coords + (int4) (0,  1, 0, 0)).y;
+    float field_ym = read_imagef(field, sampler, coords + (int4) (0, -1, 0, 0)).y;
+    float field_zp = read_imagef(field, sampler, coords + (int4) (0, 0,  1, 0)).z;
+    float field_zm = read_imagef(field, sampler, coords + (int4) (0, 0, -1, 0)).z;
+
+    return ((field_xp - field_xm) + (field_yp - field_ym) + (field_zp - field_zm)) * hInv;
+}
+
+__kernel void divergence(__read_only image3d_t field,
+                         __write_only image3d_t output,
+                         const float hInv)
+{
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+    if (inGrid(output, coords))
+        write_imagef(output, coords, (float4) (divergenceAt(field, coords, hInv), 0, 0, 0));
+}
+
+/* Computes the gradient of the first channel of field at coords. */
+float4 gradientAt(__read_only image3d_t field, int4 coords, const float hInv)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    float field_xp = read_imagef(field, sampler, coords + (int4) ( 1, 0, 0, 0)).x;
+    float field_xm = read_imagef(field, sampler, coords + (int4) (-1, 0, 0, 0)).x;
+    float field_yp = read_imagef(field, sampler, coords + (int4) (0,  1, 0, 0)).x;
+    float field_ym = read_imagef(field, sampler, coords + (int4) (0, -1, 0, 0)).x;
+    float field_zp = read_imagef(field, sampler, coords + (int4) (0, 0,  1, 0)).x;
+    float field_zm = read_imagef(field, sampler, coords + (int4) (0, 0, -1, 0)).x;
+
+    return (float4) (field_xp - field_xm, field_yp - field_ym, field_zp - field_zm, 0) * hInv;
+}
+
+__kernel void gradient(__read_only image3d_t field,
+                       __write_only image3d_t output,
+                       const float hInv)
+{
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+    if (inGrid(output, coords))
+        write_imagef(output, coords, gradientAt(field, coords, hInv));
+}
+
+
+__kernel void addScaled(__read_only image3d_t term1,
+                        __read_only image3d_t term2,
+                        const float multiplier,
+                        __write_only image3d_t sum)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+    if (inGrid(sum, coords))
+        write_imagef(sum, coords, read_imagef(term1, sampler, coords)
+                                + read_imagef(term2, sampler, coords) * multiplier);
+}
+
+
+/* Sets the boundary value to the negation of its inner neighbor. */
+__kernel void velocityBoundary(__read_only image3d_t img,
+                               __write_only image3d_t out)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+    int4 size = (int4) (get_image_width(out), get_image_height(out), get_image_depth(out), 0);
+
+    if (inGrid(out, coords))
+    {
+        int4 source = boundarySource(coords, size);
+        float4 value = read_imagef(img, sampler, source);
+
+        write_imagef(out, coords, all(source == coords) ? value : -value);
+    }
+}
+
+/* Sets the boundary value to the value of its inner neighbor. */
+__kernel void pressureBoundary(__read_only image3d_t img,
+                               __write_only image3d_t out)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+    int4 size = (int4) (get_image_width(out), get_image_height(out), get_image_depth(out), 0);
+
+    if (inGrid(out, coords))
+        write_imagef(out, coords, read_imagef(img, sampler, boundarySource(coords, size)));
+}
+
+
+
+
+/* ---------------------------------------------------------------------------
+   Fused kernels.
+
+   The 3D counterparts of the fused kernels in fluidSimulation.cl, for the
+   fused pipeline of Fluid3DSimulationCLProgram::update().
+   --------------------------------------------------------------------------- */
+
+/* advect on the velocity itself followed by addScaled(result, forces, dt). */
+__kernel void advectAddForce(__read_only image3d_t velocity,
+                             __read_only image3d_t forces,
+                             __write_only image3d_t output,
+                             const float dt_h,
+                             const float dt)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+    if (inGrid(output, coords))
+        write_imagef(output, coords, advectedAt(velocity, velocity, coords, dt_h)
+                                   + read_imagef(forces, sampler, coords) * dt);
+}
+
+/* divergence of velocity into divOutput, followed by the first Jacobi sweep of
+   the pressure solve with b = the divergence. */
+__kernel void divergenceJacobi(__read_only image3d_t velocity,
+                               __read_only image3d_t pressure,
+                               __write_only image3d_t divOutput,
+                               __write_only image3d_t pressureOutput,
+                               const float hInv,
+                               const float alpha,
+                               const float betaInverse)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+    if (inGrid(divOutput, coords))
+    {
+        float4 div = (float4) (divergenceAt(velocity, coords, hInv), 0, 0, 0);
+        write_imagef(divOutput, coords, div);
+
+        float4 p = (read_imagef(pressure, sampler, coords + (int4) (-1, 0, 0, 0))
+                   +read_imagef(pressure, sampler, coords + (int4) ( 1, 0, 0, 0))
+                   +read_imagef(pressure, sampler, coords + (int4) (0, -1, 0, 0))
+                   +read_imagef(pressure, sampler, coords + (int4) (0,  1, 0, 0))
+                   +read_imagef(pressure, sampler, coords + (int4) (0, 0, -1, 0))
+                   +read_imagef(pressure, sampler, coords + (int4) (0, 0,  1, 0))
+                   +alpha * div) * betaInverse;
+        write_imagef(pressureOutput, coords, p);
+    }
+}
+
+/* The last Jacobi sweep of the pressure solve followed by pressureBoundary.
+   Boundary cells take the Jacobi value of their inner neighbor. */
+__kernel void jacobiPressureBoundary(__read_only image3d_t input,
+                                     __read_only image3d_t b,
+                                     __write_only image3d_t output,
+                                     const float alpha,
+                                     const float betaInverse)
+{
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+    int4 size = (int4) (get_image_width(output), get_image_height(output), get_image_depth(output), 0);
+
+    if (inGrid(output, coords))
+        write_imagef(output, coords, jacobiAt(input, b, boundarySource(coords, size), alpha, betaInverse));
+}
+
+/* gradient of pressure, addScaled to subtract it from velocity, and then
+   velocityBoundary, in one launch. hInv_density is hInv / density. Boundary
+   cells take the negated projected value of their inner neighbor. */
+__kernel void projectBoundary(__read_only image3d_t velocity,
+                              __read_only image3d_t pressure,
+                              __write_only image3d_t output,
+                              const float hInv_density)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int4 coords = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+    int4 size = (int4) (get_image_width(output), get_image_height(output), get_image_depth(output), 0);
+
+    if (inGrid(output, coords))
+    {
+        int4 source = boundarySource(coords, size);
+        float4 value = read_imagef(velocity, sampler, source) - gradientAt(pressure, source, hInv_density);
+
+        write_imagef(output, coords, all(source == coords) ? value : -value);
+    }
+}
@@ -0,0 +1,514 @@
+/* Buffer versions of the kernels in fluidSimulation.cl.
+
+   Every field is a row-major __global buffer of width x height cells: float2
+   for vector fields and float for scalar fields. Values outside the grid are
+   treated as 0, like the CLK_ADDRESS_CLAMP samplers of the image kernels, so
+   both versions compute the same thing. With PERIODIC_BOUNDARY defined, the
+   grid wraps around instead, and the boundary kernels only copy. The kernels
+   that touch images are only compiled with IMAGE_TRANSFERS defined, so that the
+   rest builds on devices without image support.
+
+   All kernels are launched on a 2D range covering the grid.
+*/
+
+
+/* Wraps coords into the grid, for PERIODIC_BOUNDARY. */
+int2 wrapCoords(int2 coords, const int width, const int height)
+{
+    return (int2) ((coords.x % width + width) % width,
+                   (coords.y % height + height) % height);
+}
+
+/* Returns buf(coords), or 0 outside of the grid. */
+float2 load2(__global const float2 *buf, int2 coords, const int width, const int height)
+{
+#ifdef PERIODIC_BOUNDARY
+    coords = wrapCoords(coords, width, height);
+#else
+    if (coords.x < 0 || coords.y < 0 || coords.x >= width || coords.y >= height)
+        return (float2) (0, 0);
+#endif
+
+    return buf[coords.y * width + coords.x];
+}
+
+float load1(__global const float *buf, int2 coords, const int width, const int height)
+{
+#ifdef PERIODIC_BOUNDARY
+    coords = wrapCoords(coords, width, height);
+#else
+    if (coords.x < 0 || coords.y < 0 || coords.x >= width || coords.y >= height)
+        return 0;
+#endif
+
+    return buf[coords.y * width + coords.x];
+}
+
+/* Bilinearly interpolates buf at pos, where cell centers are at half-integer
+   coordinates. This is what read_imagef does with CLK_FILTER_LINEAR and
+   unnormalized coordinates. */
+float2 sampleBilinear2(__global const float2 *buf, float2 pos, const int width, const int height)
+{
+    float2 p = pos - (float2) (0.5f, 0.5f);
+    float2 base = floor(p);
+    float2 t = p - base;
+
+    int2 i = convert_int2(base);
+
+    float2 v00 = load2(buf, i, width, height);
+    float2 v10 = load2(buf, i + (int2) (1, 0), width, height);
+    float2 v01 = load2(buf, i + (int2) (0, 1), width, height);
+    float2 v11 = load2(buf, i + (int2) (1, 1), width, height);
+
+    return mix(mix(v00, v10, t.x), mix(v01, v11, t.x), t.y);
+}
+
+
+/* See jacobi in fluidSimulation.cl. */
+__kernel void jacobi2(__global const float2 *input,
+                      __global const float2 *b,
+                      __global float2 *output,
+                      const float alpha,
+                      const float betaInverse,
+                      const int width,
+                      const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        output[coords.y * width + coords.x] =
+                (load2(input, (int2) (coords.x-1, coords.y), width, height)
+                +load2(input, (int2) (coords.x+1, coords.y), width, height)
+                +load2(input, (int2) (coords.x, coords.y-1), width, height)
+                +load2(input, (int2) (coords.x, coords.y+1), width, height)
+                +alpha * b[coords.y * width + coords.x]) * betaInverse;
+    }
+}
+
+/* jacobi2 for scalar fields. */
+__kernel void jacobi1(__global const float *input,
+                      __global const float *b,
+                      __global float *output,
+                      const float alpha,
+                      const float betaInverse,
+                      const int width,
+                      const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        output[coords.y * width + coords.x] =
+                (load1(input, (int2) (coords.x-1, coords.y), width, height)
+                +load1(input, (int2) (coords.x+1, coords.y), width, height)
+                +load1(input, (int2) (coords.x, coords.y-1), width, height)
+                +load1(input, (int2) (coords.x, coords.y+1), width, height)
+                +alpha * b[coords.y * width + coords.x]) * betaInverse;
+    }
+}
+
+
+/* See advect in fluidSimulation.cl. */
+__kernel void advect(__global const float2 *quantity,
+                     __global const float2 *velocity,
+                     __global float2 *output,
+                     const float dt_h,
+                     const int width,
+                     const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        float2 pos = convert_float2(coords);
+
+        float2 vel = sampleBilinear2(velocity, pos, width, height);
+        float2 offset = -vel * dt_h;
+
+        output[coords.y * width + coords.x] = sampleBilinear2(quantity, pos + (float2) (0.5f, 0.5f) + offset, width, height);
+    }
+}
+
+
+/* advect for a strip of a partitioned simulation (see Fluid2DPartitionedSolver),
+   whose first haloBefore and last haloAfter rows are copies of its neighbors'
+   rows. Past a wall the velocity is zero, but past a halo it is unknown, so a
+   backtrace from the strip's own rows that would leave the halo is clamped to
+   its edge, and *clamped is set so that the host can warn about it. */
+__kernel void advectStrip(__global const float2 *quantity,
+                          __global const float2 *velocity,
+                          __global float2 *output,
+                          __global int *clamped,
+                          const float dt_h,
+                          const int haloBefore,
+                          const int haloAfter,
+                          const int width,
+                          const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        float2 pos = convert_float2(coords);
+
+        float2 vel = sampleBilinear2(velocity, pos, width, height);
+        float2 source = pos + (float2) (0.5f, 0.5f) - vel * dt_h;
+
+        // sampleBilinear2 reads the rows on either side of source.y - 0.5.
+        bool ownRow = coords.y >= haloBefore && coords.y < height - haloAfter;
+        if (haloBefore > 0 && source.y < 0.5f)
+        {
+            source.y = 0.5f;
+            if (ownRow)
+                *clamped = 1;
+        }
+        else if (haloAfter > 0 && source.y > height - 0.5f)
+        {
+            source.y = height - 0.5f;
+            if (ownRow)
+                *clamped = 1;
+        }
+
+        output[coords.y * width + coords.x] = sampleBilinear2(quantity, source, width, height);
+    }
+}
+
+
+__kernel void divergence(__global const float2 *field,
+                         __global float *output,
+                         const float hInv,
+                         const int width,
+                         const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        float2 field_xp = load2(field, (int2) (coords.x + 1, coords.y), width, height);
+        float2 field_xm = load2(field, (int2) (coords.x - 1, coords.y), width, height);
+        float2 field_yp = load2(field, (int2) (coords.x, coords.y + 1), width, height);
+        float2 field_ym = load2(field, (int2) (coords.x, coords.y - 1), width, height);
+
+        output[coords.y * width + coords.x] = ((field_xp.x - field_xm.x) + (field_yp.y - field_ym.y)) * hInv;
+    }
+}
+
+
+__kernel void gradient(__global const float *field,
+                       __global float2 *output,
+                       const float hInv,
+                       const int width,
+                       const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        float field_xp = load1(field, (int2) (coords.x + 1, coords.y), width, height);
+        float field_xm = load1(field, (int2) (coords.x - 1, coords.y), width, height);
+        float field_yp = load1(field, (int2) (coords.x, coords.y + 1), width, height);
+        float field_ym = load1(field, (int2) (coords.x, coords.y - 1), width, height);
+
+        output[coords.y * width + coords.x] = (float2) (field_xp - field_xm, field_yp - field_ym) * hInv;
+    }
+}
+
+
+__kernel void addScaled(__global const float2 *term1,
+                        __global const float2 *term2,
+                        const float multiplier,
+                        __global float2 *sum,
+                        const int width,
+                        const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int index = coords.y * width + coords.x;
+        sum[index] = term1[index] + term2[index] * multiplier;
+    }
+}
+
+
+/* Returns the index of the inner neighbor of a boundary cell, or of the cell
+   itself if it is not on the boundary. */
+int boundarySource(int2 coords, const int width, const int height)
+{
+#ifndef PERIODIC_BOUNDARY
+    if (coords.x == 0)               coords.x = 1;
+    else if (coords.x == width - 1)  coords.x -= 1;
+    else if (coords.y == 0)          coords.y = 1;
+    else if (coords.y == height - 1) coords.y -= 1;
+#endif
+
+    return coords.y * width + coords.x;
+}
+
+/* See velocityBoundary in fluidSimulation.cl. */
+__kernel void velocityBoundary(__global const float2 *img,
+                               __global float2 *out,
+                               const int width,
+                               const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int index = coords.y * width + coords.x;
+        int source = boundarySource(coords, width, height);
+
+        out[index] = source == index ? img[index] : -img[source];
+    }
+}
+
+/* See pressureBoundary in fluidSimulation.cl. */
+__kernel void pressureBoundary(__global const float *img,
+                               __global float *out,
+                               const int width,
+                               const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+        out[coords.y * width + coords.x] = img[boundarySource(coords, width, height)];
+}
+
+
+#ifdef IMAGE_TRANSFERS
+/* Copies a vector field into the first two channels of an image, for display
+   or for kernels that sample the velocities as an image. */
+__kernel void bufferToImage2(__global const float2 *buf,
+                             __write_only image2d_t img)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(img);
+
+    if (coords.x < width && coords.y < get_image_height(img))
+        write_imagef(img, coords, (float4) (buf[coords.y * width + coords.x], 0, 0));
+}
+
+/* Copies the first two channels of an image into a vector field. */
+__kernel void imageToBuffer2(__read_only image2d_t img,
+                             __global float2 *buf)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP           |
+                              CLK_FILTER_NEAREST;
+
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+    int width = get_image_width(img);
+
+    if (coords.x < width && coords.y < get_image_height(img))
+        buf[coords.y * width + coords.x] = read_imagef(img, sampler, coords).xy;
+}
+#endif
+
+
+/* ---------------------------------------------------------------------------
+   Ensemble kernels.
+
+   A Fluid2DEnsemble stacks `count` independent fields of width x height cells
+   in each buffer, field f starting at cell f * width * height, and launches
+   every kernel below once on a 3D range of width x height x count, with work
+   groups one field deep so that get_global_id(2) is always a field. Each field
+   has its own parameters in a float4: (dt, density, viscosity, forceScale).
+   A field with a viscosity of 0 or less isn't diffused.
+   --------------------------------------------------------------------------- */
+
+/* The offset of the current field's first cell in every buffer. */
+int fieldOffset(const int width, const int height)
+{
+    return get_global_id(2) * width * height;
+}
+
+/* See advect. */
+__kernel void ensembleAdvect(__global const float2 *quantity,
+                             __global const float2 *velocity,
+                             __global float2 *output,
+                             __global const float4 *params,
+                             const float hInv,
+                             const int width,
+                             const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int offset = fieldOffset(width, height);
+        float dt_h = params[get_global_id(2)].x * hInv;
+
+        float2 pos = convert_float2(coords);
+
+        float2 vel = sampleBilinear2(velocity + offset, pos, width, height);
+        float2 newPos = pos + (float2) (0.5f, 0.5f) - vel * dt_h;
+
+        output[offset + coords.y * width + coords.x] = sampleBilinear2(quantity + offset, newPos, width, height);
+    }
+}
+
+/* One sweep of the diffusion solve, which is jacobi2 with the field as its own
+   right-hand side and alpha = h^2 / (viscosity * dt). */
+__kernel void ensembleDiffuse(__global const float2 *input,
+                              __global float2 *output,
+                              __global const float4 *params,
+                              const float hh,
+                              const int width,
+                              const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int offset = fieldOffset(width, height);
+        int index = offset + coords.y * width + coords.x;
+        float4 p = params[get_global_id(2)];
+
+        if (p.z <= 0)
+        {
+            output[index] = input[index];
+            return;
+        }
+
+        float alpha = hh / (p.z * p.x);
+        input += offset;
+
+        output[index] =
+                (load2(input, (int2) (coords.x-1, coords.y), width, height)
+                +load2(input, (int2) (coords.x+1, coords.y), width, height)
+                +load2(input, (int2) (coords.x, coords.y-1), width, height)
+                +load2(input, (int2) (coords.x, coords.y+1), width, height)
+                +alpha * input[coords.y * width + coords.x]) / (4 + alpha);
+    }
+}
+
+/* sum = velocity + forces * dt * forceScale. */
+__kernel void ensembleAddForces(__global const float2 *velocity,
+                                __global const float2 *forces,
+                                __global float2 *sum,
+                                __global const float4 *params,
+                                const int width,
+                                const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int index = fieldOffset(width, height) + coords.y * width + coords.x;
+        float4 p = params[get_global_id(2)];
+
+        sum[index] = velocity[index] + forces[index] * (p.x * p.w);
+    }
+}
+
+/* See divergence. */
+__kernel void ensembleDivergence(__global const float2 *field,
+                                 __global float *output,
+                                 const float hInv,
+                                 const int width,
+                                 const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int offset = fieldOffset(width, height);
+        field += offset;
+
+        float2 field_xp = load2(field, (int2) (coords.x + 1, coords.y), width, height);
+        float2 field_xm = load2(field, (int2) (coords.x - 1, coords.y), width, height);
+        float2 field_yp = load2(field, (int2) (coords.x, coords.y + 1), width, height);
+        float2 field_ym = load2(field, (int2) (coords.x, coords.y - 1), width, height);
+
+        output[offset + coords.y * width + coords.x] = ((field_xp.x - field_xm.x) + (field_yp.y - field_ym.y)) * hInv;
+    }
+}
+
+/* See jacobi1. */
+__kernel void ensembleJacobi1(__global const float *input,
+                              __global const float *b,
+                              __global float *output,
+                              const float alpha,
+                              const float betaInverse,
+                              const int width,
+                              const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int offset = fieldOffset(width, height);
+        int index = offset + coords.y * width + coords.x;
+        input += offset;
+
+        output[index] =
+                (load1(input, (int2) (coords.x-1, coords.y), width, height)
+                +load1(input, (int2) (coords.x+1, coords.y), width, height)
+                +load1(input, (int2) (coords.x, coords.y-1), width, height)
+                +load1(input, (int2) (coords.x, coords.y+1), width, height)
+                +alpha * b[index]) * betaInverse;
+    }
+}
+
+/* output = velocity - gradient(pressure) / density, which is gradient and
+   addScaled in one launch. */
+__kernel void ensembleProject(__global const float2 *velocity,
+                              __global const float *pressure,
+                              __global float2 *output,
+                              __global const float4 *params,
+                              const float hInv,
+                              const int width,
+                              const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int offset = fieldOffset(width, height);
+        int index = offset + coords.y * width + coords.x;
+        pressure += offset;
+
+        float field_xp = load1(pressure, (int2) (coords.x + 1, coords.y), width, height);
+        float field_xm = load1(pressure, (int2) (coords.x - 1, coords.y), width, height);
+        float field_yp = load1(pressure, (int2) (coords.x, coords.y + 1), width, height);
+        float field_ym = load1(pressure, (int2) (coords.x, coords.y - 1), width, height);
+
+        float2 gradient = (float2) (field_xp - field_xm, field_yp - field_ym) * hInv;
+
+        output[index] = velocity[index] + gradient * (-1.0f / params[get_global_id(2)].y);
+    }
+}
+
+/* See velocityBoundary. */
+__kernel void ensembleVelocityBoundary(__global const float2 *img,
+                                       __global float2 *out,
+                                       const int width,
+                                       const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int offset = fieldOffset(width, height);
+        int index = coords.y * width + coords.x;
+        int source = boundarySource(coords, width, height);
+
+        out[offset + index] = source == index ? img[offset + index] : -img[offset + source];
+    }
+}
+
+/* See pressureBoundary. */
+__kernel void ensemblePressureBoundary(__global const float *img,
+                                       __global float *out,
+                                       const int width,
+                                       const int height)
+{
+    int2 coords = (int2) (get_global_id(0), get_global_id(1));
+
+    if (coords.x < width && coords.y < height)
+    {
+        int offset = fieldOffset(width, height);
+        out[offset + coords.y * width + coords.x] = img[offset + boundarySource(coords, width, height)];
+    }
+}
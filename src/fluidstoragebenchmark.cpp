@@ -0,0 +1,380 @@
+#include "fluidstoragebenchmark.h"
+
+#include "fluid2dsimulation.h"
+#include "fluid2densemble.h"
+
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+bool FluidStorageBenchmark::run(MyCLWrapper *wrapper, size_t width, size_t height, int steps)
+{
+    char deviceName[256] = "";
+    clGetDeviceInfo(wrapper->device(), CL_DEVICE_NAME, sizeof(deviceName) - 1, deviceName, NULL);
+
+    cl_bool imageSupport = CL_FALSE;
+    clGetDeviceInfo(wrapper->device(), CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &imageSupport, NULL);
+
+    qDebug() << "Fluid storage benchmark on" << deviceName << ":" << width << "x" << height << "," << steps << "steps";
+
+    // The same fluid as the wind simulation.
+    Fluid2DSimulationConfig config(width, height, 3, 0.03f);
+
+    if (imageSupport)
+    {
+        config.storage = Fluid2DSimulationConfig::ImageStorage;
+
+        double msPerStep;
+        if (!timeSimulation(wrapper, config, steps, &msPerStep))
+            return false;
+
+        qDebug() << "   images: " << msPerStep << "ms per step";
+    }
+    else
+    {
+        qDebug() << "   images:  not supported by this device";
+    }
+
+    config.storage = Fluid2DSimulationConfig::BufferStorage;
+
+    double msPerStep;
+    if (!timeSimulation(wrapper, config, steps, &msPerStep))
+        return false;
+
+    qDebug() << "   buffers:" << msPerStep << "ms per step";
+
+    config.storage = Fluid2DSimulationConfig::CPUStorage;
+
+    if (!timeSimulation(wrapper, config, steps, &msPerStep))
+        return false;
+
+    qDebug() << "   CPU:    " << msPerStep << "ms per step";
+
+    return true;
+}
+
+bool FluidStorageBenchmark::runPartitioned(size_t width,
+                                           size_t height,
+                                           int partitions,
+                                           int steps,
+                                           cl_device_type deviceType)
+{
+    MyCLWrapper whole;
+    if (MyCLWrapper::createPartitioned(&whole, 1, deviceType) != 1)
+    {
+        qDebug() << "Failed to get a device for the partitioned benchmark.";
+        return false;
+    }
+
+    std::vector<MyCLWrapper> strips(partitions);
+    int count = MyCLWrapper::createPartitioned(strips.data(), partitions, deviceType);
+    if (count == 0)
+    {
+        qDebug() << "Failed to partition the device.";
+        whole.release();
+        return false;
+    }
+
+    char deviceName[256] = "";
+    clGetDeviceInfo(whole.device(), CL_DEVICE_NAME, sizeof(deviceName) - 1, deviceName, NULL);
+
+    qDebug() << "Partitioned benchmark on" << deviceName << ":" << width << "x" << height << "," << count << "devices," << steps << "steps";
+
+    Fluid2DSimulationConfig config(width, height, 3, 0.03f);
+    config.storage = Fluid2DSimulationConfig::BufferStorage;
+
+    // The forces push for every step, so the halos must reach as far as the
+    // fastest wind they could make, or the strips would clamp their advection
+    // and the difference below would measure that instead of rounding error.
+    config.setPartitionHaloForSpeed(StirringForce * PartitionedDt * steps, PartitionedDt);
+
+    double wholeMsPerStep, stripMsPerStep;
+    std::vector<cl_float2> wholeVelocities, stripVelocities;
+
+    // The baseline is the ordinary buffer pipeline, not a single strip.
+    bool success = timePartitioned(&whole, 0, config, steps, &wholeMsPerStep, &wholeVelocities) &&
+                   timePartitioned(strips.data(), count, config, steps, &stripMsPerStep, &stripVelocities);
+
+    if (success)
+    {
+        qDebug() << "   whole device:" << wholeMsPerStep << "ms per step";
+        qDebug() << "   partitioned: " << stripMsPerStep << "ms per step";
+        qDebug() << "   largest velocity difference:" << largestDifference(wholeVelocities, stripVelocities);
+    }
+
+    for (int i = 0; i < count; ++i)
+        strips[i].release();
+    whole.release();
+
+    return success;
+}
+
+bool FluidStorageBenchmark::compareWithCPU(MyCLWrapper *wrapper, size_t width, size_t height, int steps)
+{
+    const float dt = 1 / 60.0f;
+    const size_t cells = width * height;
+
+    char deviceName[256] = "";
+    clGetDeviceInfo(wrapper->device(), CL_DEVICE_NAME, sizeof(deviceName) - 1, deviceName, NULL);
+
+    qDebug() << "CPU comparison with" << deviceName << ":" << width << "x" << height << "," << steps << "steps";
+
+    Fluid2DSimulationConfig config(width, height, 3, 0.03f);
+    std::vector<cl_float2> forceData = stirringForces(config);
+
+    // The device simulation.
+    config.storage = Fluid2DSimulationConfig::BufferStorage;
+    Fluid2DSimulation device(config);
+
+    MyCLBuffer forces;
+    if (!device.create(wrapper) ||
+        !forces.create(wrapper->context(), cells * sizeof(cl_float2)) ||
+        !forces.write(wrapper->queue(), forceData.data(), cells * sizeof(cl_float2)))
+    {
+        qDebug() << "Failed to create the device simulation.";
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < steps; ++i)
+    {
+        if (!(i < 10 ? device.update(dt, forces) : device.update(dt)))
+            return false;
+    }
+    clFinish(wrapper->queue());
+
+    const double deviceMsPerStep = timer.nsecsElapsed() / 1e6 / steps;
+
+    std::vector<cl_float2> deviceVelocities(cells);
+    if (!device.velocityBuffer().read(wrapper->queue(), deviceVelocities.data(), cells * sizeof(cl_float2)))
+        return false;
+
+    // The CPU simulation.
+    config.storage = Fluid2DSimulationConfig::CPUStorage;
+    Fluid2DSimulation cpu(config);
+
+    if (!cpu.create(nullptr))
+    {
+        qDebug() << "Failed to create the CPU simulation.";
+        return false;
+    }
+
+    Fluid2DCPUField cpuForces;
+    cpuForces.reset(width, height);
+    for (size_t i = 0; i < cells; ++i)
+    {
+        cpuForces.x[i] = forceData[i].s[0];
+        cpuForces.y[i] = forceData[i].s[1];
+    }
+
+    timer.start();
+
+    for (int i = 0; i < steps; ++i)
+    {
+        if (!(i < 10 ? cpu.update(dt, cpuForces) : cpu.update(dt)))
+            return false;
+    }
+
+    const double cpuMsPerStep = timer.nsecsElapsed() / 1e6 / steps;
+
+    std::vector<cl_float2> cpuVelocities(cells);
+    for (size_t i = 0; i < cells; ++i)
+        cpuVelocities[i] = {{ cpu.cpuVelocities().x[i], cpu.cpuVelocities().y[i] }};
+
+    qDebug() << "   device:" << deviceMsPerStep << "ms per step";
+    qDebug() << "   CPU:   " << cpuMsPerStep << "ms per step";
+    qDebug() << "   largest velocity difference:" << largestDifference(deviceVelocities, cpuVelocities);
+
+    return true;
+}
+
+bool FluidStorageBenchmark::runEnsemble(MyCLWrapper *wrapper, size_t width, size_t height, int fields, int steps)
+{
+    const float dt = 1 / 60.0f;
+
+    char deviceName[256] = "";
+    clGetDeviceInfo(wrapper->device(), CL_DEVICE_NAME, sizeof(deviceName) - 1, deviceName, NULL);
+
+    qDebug() << "Ensemble benchmark on" << deviceName << ":" << fields << "fields of" << width << "x" << height << "," << steps << "steps";
+
+    Fluid2DSimulationConfig config(width, height, 3, 0.03f);
+    config.storage = Fluid2DSimulationConfig::BufferStorage;
+    config.fixedTimeStep = dt;
+
+    // Separate simulations, each with its own launches.
+    std::vector<Fluid2DSimulation *> simulations;
+    bool success = true;
+
+    for (int i = 0; i < fields && success; ++i)
+    {
+        simulations.push_back(new Fluid2DSimulation(config));
+        success = simulations.back()->create(wrapper);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < steps && success; ++i)
+    {
+        for (Fluid2DSimulation *simulation : simulations)
+            success = success && simulation->update(dt);
+    }
+    clFinish(wrapper->queue());
+
+    const double separateMsPerStep = timer.nsecsElapsed() / 1e6 / steps;
+
+    for (Fluid2DSimulation *simulation : simulations)
+        delete simulation;
+
+    if (!success)
+    {
+        qDebug() << "Failed to run the separate simulations.";
+        return false;
+    }
+
+    // The same fields in one ensemble.
+    Fluid2DEnsemble ensemble(config, fields);
+    if (!ensemble.create(wrapper))
+    {
+        qDebug() << "Failed to create the benchmark ensemble.";
+        return false;
+    }
+
+    timer.start();
+
+    for (int i = 0; i < steps; ++i)
+    {
+        if (!ensemble.update())
+            return false;
+    }
+    clFinish(wrapper->queue());
+
+    const double ensembleMsPerStep = timer.nsecsElapsed() / 1e6 / steps;
+
+    qDebug() << "   separate:" << separateMsPerStep << "ms per step of every field";
+    qDebug() << "   ensemble:" << ensembleMsPerStep << "ms per step of every field";
+
+    return true;
+}
+
+bool FluidStorageBenchmark::timeSimulation(MyCLWrapper *wrapper,
+                                           const Fluid2DSimulationConfig &config,
+                                           int steps,
+                                           double *msPerStep)
+{
+    const float dt = 1 / 60.0f;
+
+    Fluid2DSimulation simulation(config);
+    if (!simulation.create(wrapper))
+    {
+        qDebug() << "Failed to create the benchmark simulation.";
+        return false;
+    }
+
+    // Warm up, so that one-time costs aren't measured.
+    for (int i = 0; i < 10; ++i)
+    {
+        if (!simulation.update(dt))
+            return false;
+    }
+    clFinish(wrapper->queue());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < steps; ++i)
+    {
+        if (!simulation.update(dt))
+            return false;
+    }
+    clFinish(wrapper->queue());
+
+    *msPerStep = timer.nsecsElapsed() / 1e6 / steps;
+    return true;
+}
+
+bool FluidStorageBenchmark::timePartitioned(MyCLWrapper *wrappers,
+                                            int count,
+                                            const Fluid2DSimulationConfig &config,
+                                            int steps,
+                                            double *msPerStep,
+                                            std::vector<cl_float2> *velocities)
+{
+    const float dt = PartitionedDt;
+    const size_t cells = config.width * config.height;
+    cl_command_queue queue = wrappers[0].queue();
+
+    Fluid2DSimulation simulation(config);
+
+    bool created = count > 0
+            ? simulation.createPartitioned(wrappers, count)
+            : simulation.create(&wrappers[0]);
+
+    if (!created)
+    {
+        qDebug() << "Failed to create the benchmark simulation.";
+        return false;
+    }
+
+    // The push crosses the seams between strips.
+    std::vector<cl_float2> forceData = stirringForces(config);
+
+    MyCLBuffer forces;
+    if (!forces.create(wrappers[0].context(), cells * sizeof(cl_float2)) ||
+        !forces.write(queue, forceData.data(), cells * sizeof(cl_float2)))
+    {
+        qDebug() << "Failed to create the benchmark forces.";
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < steps; ++i)
+    {
+        if (!simulation.update(dt, forces))
+            return false;
+    }
+    // Every strip's queue finishes before the first one gathers the result.
+    clFinish(queue);
+
+    *msPerStep = timer.nsecsElapsed() / 1e6 / steps;
+
+    velocities->resize(cells);
+    return simulation.velocityBuffer().read(queue, velocities->data(), cells * sizeof(cl_float2));
+}
+
+std::vector<cl_float2> FluidStorageBenchmark::stirringForces(const Fluid2DSimulationConfig &config)
+{
+    std::vector<cl_float2> forceData(config.width * config.height);
+    const float radius = std::min(config.width, config.height) / 4.0f;
+
+    for (size_t y = 0; y < config.height; ++y)
+    {
+        for (size_t x = 0; x < config.width; ++x)
+        {
+            float dx = x - config.width / 2.0f;
+            float dy = y - config.height / 2.0f;
+
+            forceData[y * config.width + x] = {{ 0, dx * dx + dy * dy < radius * radius ? StirringForce : 0.0f }};
+        }
+    }
+
+    return forceData;
+}
+
+float FluidStorageBenchmark::largestDifference(const std::vector<cl_float2> &a, const std::vector<cl_float2> &b)
+{
+    float largest = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        largest = std::max(largest, std::abs(a[i].s[0] - b[i].s[0]));
+        largest = std::max(largest, std::abs(a[i].s[1] - b[i].s[1]));
+    }
+
+    return largest;
+}
@@ -0,0 +1,76 @@
+#ifndef FLUIDSTORAGEBENCHMARK_H
+#define FLUIDSTORAGEBENCHMARK_H
+
+#include "fluid2dsimulationconfig.h"
+
+#include "cl_interface/myclwrapper.h"
+
+#include <vector>
+
+/// Compares the speed of the image and buffer storage backends of
+/// Fluid2DSimulation on the wrapper's device and of the CPU backend, of
+/// partitioned simulations against unpartitioned ones, and of ensembles
+/// against separate simulations.
+class FluidStorageBenchmark
+{
+public:
+    /// Times `steps` updates of a simulation of the given size with each backend
+    /// and prints the results with qDebug(). Backends the device can't run are
+    /// skipped. Blocks until done.
+    static bool run(MyCLWrapper *wrapper, size_t width, size_t height, int steps = 200);
+
+    /// Splits the first device of the given type into up to `partitions`
+    /// devices (see MyCLWrapper::createPartitioned()), and times `steps`
+    /// updates of a partitioned buffer simulation of the given size on them and
+    /// of an unpartitioned one on the whole device. Both are stirred by the same
+    /// forces, and the largest difference between their velocities is printed
+    /// too, which should be rounding error. Blocks until done.
+    static bool runPartitioned(size_t width,
+                               size_t height,
+                               int partitions = 4,
+                               int steps = 200,
+                               cl_device_type deviceType = CL_DEVICE_TYPE_CPU);
+
+    /// Times `steps` updates of a buffer simulation of the given size on the
+    /// wrapper's device and of a CPUStorage one, both stirred by the same
+    /// forces, and prints the largest difference between their velocities,
+    /// which should be rounding error. Blocks until done.
+    static bool compareWithCPU(MyCLWrapper *wrapper, size_t width, size_t height, int steps = 100);
+
+    /// Times `steps` updates of `fields` separate buffer simulations of the
+    /// given size and of a Fluid2DEnsemble of as many fields, on the wrapper's
+    /// device. Blocks until done.
+    static bool runEnsemble(MyCLWrapper *wrapper, size_t width, size_t height, int fields = 32, int steps = 100);
+
+private:
+    /// The time step of timePartitioned(), and the strength of stirringForces().
+    static constexpr float PartitionedDt = 1 / 60.0f;
+    static constexpr float StirringForce = 6.0f;
+
+    /// Runs the simulation for a few untimed steps, then times `steps` steps.
+    static bool timeSimulation(MyCLWrapper *wrapper,
+                               const Fluid2DSimulationConfig &config,
+                               int steps,
+                               double *msPerStep);
+
+    /// Like timeSimulation(), for a simulation made with createPartitioned()
+    /// and stirred every step. Reads the final velocities into
+    /// velocities. With a count of 0, the simulation is instead made with
+    /// create() on the first wrapper, so that it runs the unpartitioned
+    /// buffer pipeline.
+    static bool timePartitioned(MyCLWrapper *wrappers,
+                                int count,
+                                const Fluid2DSimulationConfig &config,
+                                int steps,
+                                double *msPerStep,
+                                std::vector<cl_float2> *velocities);
+
+    /// An upward push in a disk at the center of the config's grid, for the
+    /// comparisons.
+    static std::vector<cl_float2> stirringForces(const Fluid2DSimulationConfig &config);
+
+    /// The largest difference between the components of two vector fields.
+    static float largestDifference(const std::vector<cl_float2> &a, const std::vector<cl_float2> &b);
+};
+
+#endif // FLUIDSTORAGEBENCHMARK_H
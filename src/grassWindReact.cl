@@ -4,13 +4,22 @@ __kernel void reactToWind2(__global float2 *grassWindOffsets,           // The t
                            __global float2 *grassNormalizedPositions,   // For each grass blade, a corresponding position in the wind.
                            __read_only image2d_t windVelocityImg,       // The image containing wind velocities.
                            const unsigned int numBlades,                // Number of grass blades.
-                           const float time)                            // The current time in seconds.
+                           const float time,                            // The current time in seconds.
+                           const float2 windMin,                        // Blades outside of [windMin, windMax)
+                           const float2 windMax)                        // get no wind.
 {
     unsigned int bladeIdx = get_global_id(0);
 
+    // With TILEABLE_WIND, positions outside of [0, 1] wrap around the wind.
+#ifdef TILEABLE_WIND
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE  |
+                              CLK_ADDRESS_REPEAT          |
+                              CLK_FILTER_LINEAR;
+#else
     const sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE  |
                               CLK_ADDRESS_CLAMP           |
                               CLK_FILTER_LINEAR;
+#endif
 
     if (bladeIdx < numBlades)
     {
@@ -19,7 +28,9 @@ __kernel void reactToWind2(__global float2 *grassWindOffsets,           // The t
         const float vibrationFrequency = 10; // angular frequency in 2*pi hertz
 
         float2 normalizedCoords = grassNormalizedPositions[bladeIdx];
-        float2 windVelocity = read_imagef(windVelocityImg, sampler, normalizedCoords).xy;
+        float2 windVelocity = (float2) (0, 0);
+        if (all(normalizedCoords >= windMin) && all(normalizedCoords < windMax))
+            windVelocity = read_imagef(windVelocityImg, sampler, normalizedCoords).xy;
 
         float windStrength = fast_length(windVelocity);
         float2 windDirection = (float2) (0, 0);
@@ -23,11 +23,11 @@ GrassWindCLProgram::~GrassWindCLProgram()
     release();
 }
 
-bool GrassWindCLProgram::create(MyCLWrapper *wrapper)
+bool GrassWindCLProgram::create(MyCLWrapper *wrapper, bool tileableWind)
 {
     mCLWrapper = wrapper;
 
-    if (!mProgram.create(wrapper, ":/compute/grassWindReact.cl"))
+    if (!mProgram.create(wrapper, ":/compute/grassWindReact.cl", tileableWind ? "-D TILEABLE_WIND" : ""))
     {
         qDebug() << "Failed to create program. Program: " << mProgram.program();
         return false;
@@ -61,7 +61,9 @@ bool GrassWindCLProgram::reactToWind2(cl_mem grassWindOffsets,
                                       cl_mem grassNormalizedPositions,
                                       cl_image windVelocity,
                                       cl_uint numBlades,
-                                      cl_float time)
+                                      cl_float time,
+                                      cl_float2 windMin,
+                                      cl_float2 windMax)
 {
     Q_ASSERT( mCreated );
 
@@ -71,5 +73,7 @@ bool GrassWindCLProgram::reactToWind2(cl_mem grassWindOffsets,
                               grassNormalizedPositions,
                               windVelocity,
                               numBlades,
-                              time);
+                              time,
+                              windMin,
+                              windMax);
 }
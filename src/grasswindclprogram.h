@@ -16,7 +16,11 @@ public:
 
     /// Creates the program and its kernels. This program will
     /// use the given MyCLWrapper object but will not own it.
-    bool create(MyCLWrapper *wrapper);
+    ///
+    /// With tileableWind, the wind is repeated outside of the [0, 1] range of
+    /// normalized positions, for wind from a periodic simulation (see
+    /// Fluid2DSimulationConfig::periodicBoundary). Otherwise it is 0 there.
+    bool create(MyCLWrapper *wrapper, bool tileableWind = false);
 
     /// Lets go of all resources (except the MyCLWrapper object).
     void release();
@@ -26,12 +30,18 @@ public:
     ///
     /// Note that grassWindPositions and grassWindVelocities are modified by
     /// this operation. Returns true on success, false on failure.
+    ///
+    /// Blades whose normalized position is outside of [windMin, windMax) get no
+    /// wind. For a wind grid that scrolls over a tileable world (see
+    /// Fluid2DSimulation::scrollTo()), this is the area currently under the grid.
     bool reactToWind2(cl_mem grassWindOffsets,
                       cl_mem grassPeriodOffsets,
                       cl_mem grassNormalizedPositions,
                       cl_image windVelocity,
                       cl_uint numBlades,
-                      cl_float time);
+                      cl_float time,
+                      cl_float2 windMin,
+                      cl_float2 windMax);
 
 private:
 
@@ -40,7 +50,9 @@ private:
                                             cl_mem,
                                             cl_image,
                                             cl_uint,
-                                            cl_float>;
+                                            cl_float,
+                                            cl_float2,
+                                            cl_float2>;
 
 
     bool mCreated;
@@ -4,6 +4,8 @@
 
 #include "cl_interface/clniceties.h"
 
+#include "fluidstoragebenchmark.h"
+
 // For rand()
 #include <cstdlib>
 
@@ -13,9 +15,14 @@
 
 MainWindow::MainWindow(QWindow *parent)
     : QOpenGLWindow(NoPartialUpdate, parent),
-      mInitialized(false)
+      mInitialized(false),
+      mWindFollowsCamera(false),
+      mForcesOriginX(0),
+      mForcesOriginY(0),
+      mLastFrameStartTime(0),
+      mCurrentFrameStartTime(0)
 {
-    mApplicationStartTime = QTime::currentTime();
+    mApplicationTimer.start();
 }
 
 MainWindow::~MainWindow()
@@ -36,7 +43,8 @@ MainWindow::~MainWindow()
     delete mWindQuadBuffer;
     delete mWindQuadVAO;
 
-    delete mWindVelocities;
+    delete mWindVelocities[0];
+    delete mWindVelocities[1];
 }
 
 
@@ -91,13 +99,14 @@ void MainWindow::initializeGL()
 
     /* Create the OpenCL program for wind effects. */
     mWindProgram = new GrassWindCLProgram();
-    ERROR_IF_FALSE(mWindProgram->create(mCLWrapper), "Failed to create wind program.");
+    ERROR_IF_FALSE(mWindProgram->create(mCLWrapper, mWindFollowsCamera), "Failed to create wind program.");
 
     /* Used to create any CL buffers that share with GL buffers.
         In particular, this is used to create the mGrassBladeWindPositionBuffer. */
     createCLBuffersFromGLBuffers();
 
     /* Creates the variables needed to simulate wind. */
+    createWindTextures();
     createWindSimulation();
 
     /* Creates the variables for drawing a quad for visualizing the wind. */
@@ -112,7 +121,7 @@ void MainWindow::initializeGL()
     connect(QOpenGLContext::currentContext(), &QOpenGLContext::aboutToBeDestroyed, this, &MainWindow::releaseAllResources);
 
 
-    mCurrentFrameStartTime = QTime::currentTime();
+    mCurrentFrameStartTime = mApplicationTimer.nsecsElapsed();
     mInitialized = true;
 }
 
@@ -128,7 +137,7 @@ void MainWindow::paintGL()
     Q_ASSERT( mInitialized );
 
     mLastFrameStartTime = mCurrentFrameStartTime;
-    mCurrentFrameStartTime = QTime::currentTime();
+    mCurrentFrameStartTime = mApplicationTimer.nsecsElapsed();
 
     updateWind();
     updateGrassWindOffsets();
@@ -209,6 +218,32 @@ void MainWindow::keyReleaseEvent(QKeyEvent *evt)
         mCurForce = mNextForce;
         mNextForce = tmp;
     }
+    else if (evt->key() == Qt::Key_B)
+    {
+        /* Compare the storage backends at the wind simulation's size. */
+        FluidStorageBenchmark::run(mCLWrapper, mWindVelocities[0]->width(), mWindVelocities[0]->height());
+    }
+    else if (evt->key() == Qt::Key_P)
+    {
+        /* Compare a wind simulation split across CPU sub-devices with an unsplit one. */
+        FluidStorageBenchmark::runPartitioned(mWindVelocities[0]->width(), mWindVelocities[0]->height());
+    }
+    else if (evt->key() == Qt::Key_C)
+    {
+        /* Check the CPU backend against the device at the wind simulation's size. */
+        FluidStorageBenchmark::compareWithCPU(mCLWrapper, mWindVelocities[0]->width(), mWindVelocities[0]->height());
+    }
+    else if (evt->key() == Qt::Key_E)
+    {
+        /* Compare many small wind fields stepped separately and as an ensemble. */
+        FluidStorageBenchmark::runEnsemble(mCLWrapper, 32, 32);
+    }
+    else if (evt->key() == Qt::Key_W)
+    {
+        /* Toggle whether the wind grid follows the camera. */
+        mWindFollowsCamera = !mWindFollowsCamera;
+        recreateWindSimulation();
+    }
 }
 
 bool MainWindow::checkGLErrors()
@@ -255,6 +290,7 @@ void MainWindow::releaseCLResources()
     mWindSimulation->release();
     mForces1.destroy();
     mForces2.destroy();
+    mForcesPattern.destroy();
 
     /* To avoid accidentally trying to use an image that
         no longer exists. */
@@ -282,7 +318,8 @@ void MainWindow::releaseGLResources()
     mWindQuadVAO->destroy();
 
     /* This SHOULD happen AFTER mWindVelocitiesCL is released. */
-    mWindVelocities->destroy();
+    mWindVelocities[0]->destroy();
+    mWindVelocities[1]->destroy();
 
     doneCurrent();
 }
@@ -356,7 +393,7 @@ void MainWindow::drawWindQuad()
 
     mWindQuadProgram.setWindSpeedTextureUnit(0);
     glActiveTexture(GL_TEXTURE0);
-    mWindVelocities->bind();
+    glBindTexture(GL_TEXTURE_2D, mWindSimulation->velocityTexture()->textureId());
 
     mWindQuadVAO->bind();
     glDrawArrays(GL_TRIANGLES, 0, 6);
@@ -370,9 +407,28 @@ void MainWindow::drawWindQuad()
 
 void MainWindow::updateWind()
 {
-    float dt = mLastFrameStartTime.msecsTo(mCurrentFrameStartTime) / 1000.0;
+    float dt = (mCurrentFrameStartTime - mLastFrameStartTime) / 1e9;
+
+    if (mWindFollowsCamera)
+    {
+        /* Center the wind grid on the camera. The grass covers one grid's
+            worth of normalized positions, and the camera moves over the
+            grass's (x, z) plane. */
+        const int gridWidth = mWindSimulation->gridWidth();
+        const int gridHeight = mWindSimulation->gridHeight();
+
+        QVector2D camera = (QVector2D(mCameraOffset.x(), mCameraOffset.z()) - mGrassWorldMin) / mGrassWorldSize;
+
+        ERROR_IF_FALSE(mWindSimulation->scrollTo(qFloor(camera.x() * gridWidth) - gridWidth / 2,
+                                                 qFloor(camera.y() * gridHeight) - gridHeight / 2),
+                       "Failed to scroll the wind.");
+
+        if (mWindSimulation->originX() != mForcesOriginX || mWindSimulation->originY() != mForcesOriginY)
+            moveForces();
+    }
 
-    bool success = mWindSimulation->update(dt, *mCurForce);
+    // The simulation takes fixed steps, so a long frame can't destabilize it.
+    bool success = mWindSimulation->advance(dt, *mCurForce);
 
     ERROR_IF_FALSE(success, "Failed to update wind.");
 }
@@ -387,14 +443,27 @@ void MainWindow::updateGrassWindOffsets()
     /* Compute the time in seconds since the application started.
         The absolute time does not matter---we just need a relative
         time to animate the grass blade vibrations. */
-    cl_float time = mApplicationStartTime.msecsTo(mCurrentFrameStartTime) / 1000.0;
+    cl_float time = mCurrentFrameStartTime / 1e9;
+
+    /* The grass outside of the wind grid gets no wind. A scrolling grid
+        covers the normalized positions one grid size from its origin. */
+    cl_float2 windMin = {{ 0, 0 }};
+    if (mWindFollowsCamera)
+    {
+        windMin.s[0] = (float) mWindSimulation->originX() / mWindSimulation->gridWidth();
+        windMin.s[1] = (float) mWindSimulation->originY() / mWindSimulation->gridHeight();
+    }
+
+    cl_float2 windMax = {{ windMin.s[0] + 1, windMin.s[1] + 1 }};
 
     ERROR_IF_FALSE(mWindProgram->reactToWind2(mGrassWindPositions,
                                               mGrassPeriodOffsets,
                                               mGrassNormalizedPositions,
-                                              mWindSimulation->velocities().image(),
+                                              mWindSimulation->outputVelocities().image(),
                                               mNumBlades,
-                                              time),
+                                              time,
+                                              windMin,
+                                              windMax),
                    "Failed to run wind program");
 
     err = clEnqueueReleaseGLObjects(mCLWrapper->queue(), 1, &mGrassWindPositions, 0, NULL, NULL);
@@ -471,16 +540,19 @@ void MainWindow::createGrassInstanceData()
 
     float positionScale = 0.5;
 
+    float minX = positionScale * (-bladesX / 2 - 2);
+    float minY = positionScale * (-bladesY / 2 - 2);
+    float rangeX = positionScale * (bladesX + 4);
+    float rangeY = positionScale * (bladesY + 4);
+
+    mGrassWorldMin = QVector2D(minX, minY);
+    mGrassWorldSize = QVector2D(rangeX, rangeY);
+
     for (int index = 0; index < mNumBlades; ++index)
     {
         float xPos = positionScale * (zOrderX(index) - bladesX / 2 + (((float) rand() / RAND_MAX) - 0.5));
         float yPos = positionScale * (zOrderY(index) - bladesY / 2 + (((float) rand() / RAND_MAX) - 0.5));
 
-        float minX = positionScale * (-bladesX / 2 - 2);
-        float minY = positionScale * (-bladesY / 2 - 2);
-        float rangeX = positionScale * (bladesX + 4);
-        float rangeY = positionScale * (bladesY + 4);
-
         offsets[12*index + 0] = xPos;
         offsets[12*index + 1] = 0;
         offsets[12*index + 2] = yPos;
@@ -595,50 +667,152 @@ void MainWindow::createCLBuffersFromGLBuffers()
 }
 
 
+void MainWindow::createWindTextures()
+{
+    /* Create two empty OpenGL textures with 2 half floats per pixel. These
+        will be used to store wind velocities; the simulation writes
+        each step into the one that isn't current, so that it never
+        has to copy its result. They are not guaranteed to be
+        zero-initialized, but the Fluid2DSimulation object will
+        zero-initialize them. */
+    for (QOpenGLTexture *&texture : mWindVelocities)
+    {
+        texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        ERROR_IF_FALSE(texture->create(), "Couldn't create wind texture.");
+        texture->setFormat(QOpenGLTexture::RG16F);
+        texture->setMagnificationFilter(QOpenGLTexture::Nearest);
+        texture->setMinificationFilter(QOpenGLTexture::Nearest);
+        texture->setAutoMipMapGenerationEnabled(false);
+        texture->setSize(128, 128);
+        texture->allocateStorage();
+    }
+}
+
 void MainWindow::createWindSimulation()
 {
-    /* Create an empty OpenGL texture with 4 floats per pixel. This
-        will be used to store wind velocities. This is not guaranteed
-        to be zero-initialized, but the Fluid2DSimulation object will
-        zero-initialize it. */
-    mWindVelocities = new QOpenGLTexture(QOpenGLTexture::Target2D);
-    ERROR_IF_FALSE(mWindVelocities->create(), "Couldn't create wind texture.");
-    mWindVelocities->setFormat(QOpenGLTexture::RGBA32F);
-    mWindVelocities->setMagnificationFilter(QOpenGLTexture::Nearest);
-    mWindVelocities->setMinificationFilter(QOpenGLTexture::Nearest);
-    mWindVelocities->setAutoMipMapGenerationEnabled(false);
-    mWindVelocities->setSize(128, 128);
-    mWindVelocities->allocateStorage();
+    const int width = mWindVelocities[0]->width();
+    const int height = mWindVelocities[0]->height();
 
     /* Create the fluid simulation object.
         Parameters: width, height, density, side-length of a single grid square */
-    Fluid2DSimulationConfig config(mWindVelocities->width(), mWindVelocities->height(), 3, 0.03f);
+    Fluid2DSimulationConfig config(width, height, 3, 0.03f);
+    config.precision = Fluid2DSimulationConfig::HalfPrecision;
+    config.setLowResolution(2);
+    config.setFixedTimeStep(1 / 60.0f, 4);
+    config.periodicBoundary = mWindFollowsCamera;
     mWindSimulation = new Fluid2DSimulation(config);
-    ERROR_IF_FALSE(mWindSimulation->create(mCLWrapper, mWindVelocities), "Couldn't crate fluid simulation.");
-
-    /* Create the forces. Note that they are not guaranteed to be zero-initialized. */
-    ERROR_IF_FALSE(mForces1.create(mCLWrapper->context(), mWindVelocities->width(), mWindVelocities->height(), CL_RG), "Failed to create a CL image.");
-    ERROR_IF_FALSE(mForces2.create(mCLWrapper->context(), mWindVelocities->width(), mWindVelocities->height(), CL_RG), "Failed to create a CL image.");
+    ERROR_IF_FALSE(mWindSimulation->create(mCLWrapper, mWindVelocities[0], nullptr, mWindVelocities[1]), "Couldn't crate fluid simulation.");
 
-    /* Initialize forces. */
-    mForces1.acquire(mCLWrapper->queue());
-    mForces1.map(mCLWrapper->queue());
-    for (int x = 55; x < 73; ++x)
-        mForces1.setf(x, 5, 0, 30, 0, 0);
-    mForces1.unmap(mCLWrapper->queue());
-    mForces1.release(mCLWrapper->queue());
+    /* Create the forces. */
+    ERROR_IF_FALSE(mForces1.create(mCLWrapper->context(), width, height, CL_RG), "Failed to create a CL image.");
+    ERROR_IF_FALSE(mForces2.create(mCLWrapper->context(), width, height, CL_RG), "Failed to create a CL image.");
+    ERROR_IF_FALSE(mForcesPattern.create(mCLWrapper->context(), width, height, CL_RG), "Failed to create a CL image.");
 
-    mForces2.acquire(mCLWrapper->queue());
-    mForces2.map(mCLWrapper->queue());
-    for (int y = 20; y < 30; ++y)
-        mForces2.setf(30, y, 0, 0, 0, 0);
-    mForces2.unmap(mCLWrapper->queue());
-    mForces2.release(mCLWrapper->queue());
+    writeForces();
 
     mCurForce = &mForces2;
     mNextForce = &mForces1;
 }
 
+void MainWindow::recreateWindSimulation()
+{
+    /* The wind program reads the wind tiled and the simulation is periodic
+        only when the grid follows the camera, so both are rebuilt and the
+        wind starts over. The textures are kept. */
+    bool useFirstForce = mCurForce == &mForces1;
+
+    /* The simulation shares the wind textures with OpenGL. */
+    makeCurrent();
+
+    mWindProgram->release();
+    ERROR_IF_FALSE(mWindProgram->create(mCLWrapper, mWindFollowsCamera), "Failed to create wind program.");
+
+    mWindSimulation->release();
+    delete mWindSimulation;
+
+    mForces1.destroy();
+    mForces2.destroy();
+    mForcesPattern.destroy();
+
+    createWindSimulation();
+
+    mCurForce = useFirstForce ? &mForces1 : &mForces2;
+    mNextForce = useFirstForce ? &mForces2 : &mForces1;
+
+    doneCurrent();
+}
+
+void MainWindow::writeForces()
+{
+    /* The forces are written once, for a grid whose origin is at (0, 0), into
+        mForcesPattern and mForces2. moveForces() then places the pattern in
+        mForces1 on the device. Every texel is written, since the images
+        aren't zero-initialized. */
+    const int width = mForcesPattern.width();
+    const int height = mForcesPattern.height();
+
+    for (MyCLImage2D *forces : {&mForcesPattern, &mForces2})
+    {
+        forces->acquire(mCLWrapper->queue());
+        forces->map(mCLWrapper->queue());
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                forces->setf(x, y, 0, 0, 0, 0);
+    }
+
+    for (int x = 55; x < 73; ++x)
+        mForcesPattern.setf(x, 5, 0, 30, 0, 0);
+
+    for (MyCLImage2D *forces : {&mForcesPattern, &mForces2})
+    {
+        forces->unmap(mCLWrapper->queue());
+        forces->release(mCLWrapper->queue());
+    }
+
+    moveForces();
+}
+
+void MainWindow::moveForces()
+{
+    /* The forces are placed relative to the grid's lower corner. A grid that
+        follows the camera stores the world cell (x, y) at (x mod width,
+        y mod height), so the pattern is copied into mForces1 shifted by its
+        origin, which is counted in cells of the solver's grid. The shift
+        wraps around, so it takes up to four copies, none of which wait. */
+    const int width = mForcesPattern.width();
+    const int height = mForcesPattern.height();
+
+    mForcesOriginX = mWindFollowsCamera ? mWindSimulation->originX() : 0;
+    mForcesOriginY = mWindFollowsCamera ? mWindSimulation->originY() : 0;
+
+    const int offsetX = ((mForcesOriginX * (width / (int) mWindSimulation->gridWidth())) % width + width) % width;
+    const int offsetY = ((mForcesOriginY * (height / (int) mWindSimulation->gridHeight())) % height + height) % height;
+
+    /* The pattern's columns [0, width - offsetX) go to [offsetX, width), and
+        the rest wrap around to [0, offsetX); likewise for rows. */
+    const size_t spansX[2][3] = { { 0, (size_t) offsetX, (size_t) (width - offsetX) },
+                                  { (size_t) (width - offsetX), 0, (size_t) offsetX } };
+    const size_t spansY[2][3] = { { 0, (size_t) offsetY, (size_t) (height - offsetY) },
+                                  { (size_t) (height - offsetY), 0, (size_t) offsetY } };
+
+    for (const auto &spanY : spansY)
+    {
+        for (const auto &spanX : spansX)
+        {
+            if (spanX[2] == 0 || spanY[2] == 0)
+                continue;
+
+            const size_t srcOrigin[3] = { spanX[0], spanY[0], 0 };
+            const size_t dstOrigin[3] = { spanX[1], spanY[1], 0 };
+            const size_t region[3] = { spanX[2], spanY[2], 1 };
+
+            cl_int err = clEnqueueCopyImage(mCLWrapper->queue(), mForcesPattern.image(), mForces1.image(),
+                                            srcOrigin, dstOrigin, region, 0, NULL, NULL);
+            ERROR_IF_NOT_SUCCESS(err, "Failed to move the forces.");
+        }
+    }
+}
+
 
 void MainWindow::createWindQuadData()
 {
@@ -19,8 +19,9 @@
 
 #include <QMouseEvent>
 #include <QPoint>
+#include <QVector2D>
 
-#include <QTime>
+#include <QElapsedTimer>
 
 class MainWindow : public QOpenGLWindow, QOpenGLExtraFunctions
 {
@@ -72,7 +73,11 @@ private:
     void createGrassVAO();
 
     void createCLBuffersFromGLBuffers();
+    void createWindTextures();
     void createWindSimulation();
+    void recreateWindSimulation();
+    void writeForces();
+    void moveForces();
     void createWindQuadData();
 
 
@@ -124,15 +129,32 @@ private:
     cl_mem mGrassPeriodOffsets;         /// "velocity" of each grass blade (used for wind effect)
     cl_mem mGrassNormalizedPositions;   /// position of each grass blade, with each coordinate in (0,1)
 
+    /// The world-space (x, z) rectangle that normalized grass positions map onto.
+    QVector2D mGrassWorldMin;
+    QVector2D mGrassWorldSize;
+
 
     /* Wind simulation variables. */
     Fluid2DSimulation *mWindSimulation;
 
-    QOpenGLTexture *mWindVelocities;
+    /// The wind simulation alternates between these every step.
+    QOpenGLTexture *mWindVelocities[2];
+
+    /// Whether the wind grid scrolls to stay centered under the camera. The
+    /// simulation is then periodic and the grass reads the wind tiled.
+    /// Toggled with the W key.
+    bool mWindFollowsCamera;
+
+    /// The grid origin that mForces1 was last placed for. See moveForces().
+    int mForcesOriginX;
+    int mForcesOriginY;
 
     MyCLImage2D mForces1;
     MyCLImage2D mForces2;
 
+    /// The forces of mForces1 for a grid at the origin, written once.
+    MyCLImage2D mForcesPattern;
+
     MyCLImage2D *mCurForce;
     MyCLImage2D *mNextForce;
 
@@ -151,11 +173,12 @@ private:
     float mDragPitchStart;
     float mDragYawStart;
 
-    /// Used to keep track of time.
-    QTime mApplicationStartTime;
+    /// Used to keep track of time. The frame start times are in nanoseconds
+    /// since the application started.
+    QElapsedTimer mApplicationTimer;
 
-    QTime mLastFrameStartTime;
-    QTime mCurrentFrameStartTime;
+    qint64 mLastFrameStartTime;
+    qint64 mCurrentFrameStartTime;
 };
 
 #endif // MAINWINDOW_H